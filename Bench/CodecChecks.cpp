@@ -0,0 +1,1188 @@
+﻿#include "CodecChecks.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <csetjmp>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Corpus.h"
+#include "Decoder.h"
+#include "jpeglib.h"
+#include "png.h"
+#include "turbojpeg.h"
+
+using namespace ImageDecoder;
+
+namespace ImageBench {
+namespace {
+
+int numFailures = 0;
+
+void Report(const std::string& name, bool bPassed) {
+    printf("%-68s %s\n", name.c_str(), bPassed ? "ok" : "FAILED");
+    fflush(stdout);
+    if (!bPassed) {
+        numFailures++;
+    }
+}
+
+bool IsLittleEndian() {
+    const uint16_t probe = 1;
+    uint8_t firstByte;
+    memcpy(&firstByte, &probe, 1);
+    return firstByte == 1;
+}
+
+/**
+ * Pixels of a format CreateCompressedData takes, made from the medium entropy RGBA8 pixels. 16-bit samples get a low
+ * byte of their own, so a swapped or truncated sample shows.
+ */
+std::vector<uint8_t> MakePixels(ETextureSourceFormat format, int width, int height, uint64_t stride) {
+    const std::vector<uint8_t> rgba = GeneratePixels(width, height, EContentEntropy::Medium);
+    std::vector<uint8_t> pixels(stride * height);
+    for (int y = 0; y < height; y++) {
+        uint8_t* row = pixels.data() + y * stride;
+        for (int x = 0; x < width; x++) {
+            const uint8_t* source = rgba.data() + (uint64_t(y) * width + x) * 4;
+            switch (format) {
+                case ETextureSourceFormat::RGBA8: memcpy(row + x * 4, source, 4); break;
+                case ETextureSourceFormat::BGRA8:
+                    row[x * 4 + 0] = source[2];
+                    row[x * 4 + 1] = source[1];
+                    row[x * 4 + 2] = source[0];
+                    row[x * 4 + 3] = source[3];
+                    break;
+                case ETextureSourceFormat::G8: row[x] = source[0]; break;
+                case ETextureSourceFormat::RGBA16:
+                    for (int c = 0; c < 4; c++) {
+                        const uint16_t sample = static_cast<uint16_t>(source[c] << 8 | uint8_t(source[(c + 1) & 3] ^ x));
+                        memcpy(row + x * 8 + c * 2, &sample, 2);
+                    }
+                    break;
+                case ETextureSourceFormat::G16: {
+                    const uint16_t sample = static_cast<uint16_t>(source[0] << 8 | source[1]);
+                    memcpy(row + x * 2, &sample, 2);
+                    break;
+                }
+                default: break;
+            }
+        }
+    }
+    return pixels;
+}
+
+int GetBytesPerPixel(ETextureSourceFormat format) {
+    switch (format) {
+        case ETextureSourceFormat::G8: return 1;
+        case ETextureSourceFormat::G16: return 2;
+        case ETextureSourceFormat::RGBA16: return 8;
+        default: return 4;
+    }
+}
+
+const char* GetTextureFormatName(ETextureSourceFormat format) {
+    switch (format) {
+        case ETextureSourceFormat::RGBA8: return "RGBA8";
+        case ETextureSourceFormat::BGRA8: return "BGRA8";
+        case ETextureSourceFormat::G8: return "G8";
+        case ETextureSourceFormat::RGBA16: return "RGBA16";
+        case ETextureSourceFormat::G16: return "G16";
+        default: return "unknown";
+    }
+}
+
+/**
+ * Rewrites a row of MakePixels in the sample order a PNG stores: RGBA instead of BGRA, 16-bit samples big-endian.
+ */
+std::vector<uint8_t> ToPngRow(ETextureSourceFormat format, const uint8_t* row, int width) {
+    std::vector<uint8_t> pngRow(row, row + uint64_t(width) * GetBytesPerPixel(format));
+    if (format == ETextureSourceFormat::BGRA8) {
+        for (int x = 0; x < width; x++) {
+            std::swap(pngRow[x * 4], pngRow[x * 4 + 2]);
+        }
+    } else if ((format == ETextureSourceFormat::RGBA16 || format == ETextureSourceFormat::G16) && IsLittleEndian()) {
+        for (size_t i = 0; i < pngRow.size(); i += 2) {
+            std::swap(pngRow[i], pngRow[i + 1]);
+        }
+    }
+    return pngRow;
+}
+
+struct FPngBuffer {
+    const uint8_t* data;
+    size_t size;
+    size_t offset;
+};
+
+void ReadPngBuffer(png_structp png_ptr, png_bytep data, png_size_t length) {
+    FPngBuffer* buffer = static_cast<FPngBuffer*>(png_get_io_ptr(png_ptr));
+    if (length > buffer->size - buffer->offset) {
+        png_error(png_ptr, "Read past the end of the data");
+    }
+    memcpy(data, buffer->data + buffer->offset, length);
+    buffer->offset += length;
+}
+
+void WritePngBuffer(png_structp png_ptr, png_bytep data, png_size_t length) {
+    std::vector<uint8_t>* png = static_cast<std::vector<uint8_t>*>(png_get_io_ptr(png_ptr));
+    png->insert(png->end(), data, data + length);
+}
+
+void FlushPngBuffer(png_structp /*png_ptr*/) {}
+
+/**
+ * Decodes a PNG with libpng alone, deinterlaced, either with its rows as stored or expanded to RGBA at the file's bit
+ * depth with 16-bit samples in host byte order, which is what the library decodes PNGs to.
+ */
+bool DecodeWithLibpng(const std::vector<uint8_t>& png, bool bExpandToRgba, std::vector<uint8_t>& outRows, int& outWidth, int& outHeight, uint64_t& outRowBytes) {
+    png_structp png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+    png_infop info_ptr = png_create_info_struct(png_ptr);
+    std::vector<png_bytep> rowPointers;
+    if (setjmp(png_jmpbuf(png_ptr))) {
+        png_destroy_read_struct(&png_ptr, &info_ptr, nullptr);
+        return false;
+    }
+
+    FPngBuffer buffer = {png.data(), png.size(), 0};
+    png_set_read_fn(png_ptr, &buffer, ReadPngBuffer);
+    png_read_info(png_ptr, info_ptr);
+    const int bitDepth = png_get_bit_depth(png_ptr, info_ptr);
+    if (bExpandToRgba) {
+        png_set_expand(png_ptr);
+        png_set_gray_to_rgb(png_ptr);
+        png_set_add_alpha(png_ptr, bitDepth == 16 ? 0xffff : 0xff, PNG_FILLER_AFTER);
+        if (bitDepth == 16 && IsLittleEndian()) {
+            png_set_swap(png_ptr);
+        }
+    }
+    png_set_interlace_handling(png_ptr);
+    png_read_update_info(png_ptr, info_ptr);
+
+    outWidth = png_get_image_width(png_ptr, info_ptr);
+    outHeight = png_get_image_height(png_ptr, info_ptr);
+    outRowBytes = png_get_rowbytes(png_ptr, info_ptr);
+    outRows.resize(outRowBytes * outHeight);
+    for (int y = 0; y < outHeight; y++) {
+        rowPointers.push_back(outRows.data() + y * outRowBytes);
+    }
+    png_read_image(png_ptr, rowPointers.data());
+    png_read_end(png_ptr, nullptr);
+    png_destroy_read_struct(&png_ptr, &info_ptr, nullptr);
+    return true;
+}
+
+/**
+ * Encodes the medium entropy pixels with libpng in the given color type and bit depth, Adam7 interlaced if asked. The
+ * small compression buffer spreads the image data over many IDAT chunks.
+ */
+std::vector<uint8_t> EncodeWithLibpng(int width, int height, int colorType, int bitDepth, bool bInterlaced) {
+    const std::vector<uint8_t> rgba = GeneratePixels(width, height, EContentEntropy::Medium);
+    const int channels = colorType == PNG_COLOR_TYPE_GRAY ? 1 : (colorType == PNG_COLOR_TYPE_GRAY_ALPHA ? 2 : (colorType == PNG_COLOR_TYPE_RGB ? 3 : 4));
+    const int bytesPerSample = bitDepth / 8;
+    std::vector<uint8_t> rows(uint64_t(width) * height * channels * bytesPerSample);
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            const uint8_t* source = rgba.data() + (uint64_t(y) * width + x) * 4;
+            uint8_t* dest = rows.data() + ((uint64_t(y) * width + x) * channels) * bytesPerSample;
+            for (int c = 0; c < channels; c++) {
+                // Gray with alpha takes its alpha from the fourth source channel.
+                const uint8_t sample = source[channels == 2 && c == 1 ? 3 : c];
+                dest[c * bytesPerSample] = sample;
+                if (bytesPerSample == 2) {
+                    dest[c * bytesPerSample + 1] = static_cast<uint8_t>(x ^ y ^ c);
+                }
+            }
+        }
+    }
+
+    std::vector<uint8_t> png;
+    png_structp png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+    png_infop info_ptr = png_create_info_struct(png_ptr);
+    if (setjmp(png_jmpbuf(png_ptr))) {
+        png_destroy_write_struct(&png_ptr, &info_ptr);
+        return std::vector<uint8_t>();
+    }
+
+    png_set_write_fn(png_ptr, &png, WritePngBuffer, FlushPngBuffer);
+    png_set_compression_buffer_size(png_ptr, 8192);
+    png_set_IHDR(png_ptr, info_ptr, width, height, bitDepth, colorType, bInterlaced ? PNG_INTERLACE_ADAM7 : PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+    png_write_info(png_ptr, info_ptr);
+    // libpng picks the pixels of each pass out of the full rows, which an interlaced image passes in once per pass.
+    const int numPasses = png_set_interlace_handling(png_ptr);
+    for (int pass = 0; pass < numPasses; pass++) {
+        for (int y = 0; y < height; y++) {
+            png_write_row(png_ptr, rows.data() + uint64_t(y) * width * channels * bytesPerSample);
+        }
+    }
+    png_write_end(png_ptr, nullptr);
+    png_destroy_write_struct(&png_ptr, &info_ptr);
+    return png;
+}
+
+/**
+ * Compares decoded pixels with tightly packed reference rows.
+ */
+bool MatchesRows(const ImagePixelData& pixelData, const std::vector<uint8_t>& rows, int width, int height, uint64_t rowBytes) {
+    if (pixelData.width != width || pixelData.height != height || rows.size() < rowBytes * height) {
+        return false;
+    }
+    for (int y = 0; y < height; y++) {
+        if (memcmp(pixelData.data + uint64_t(y) * pixelData.stride, rows.data() + y * rowBytes, rowBytes) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Decodes the PNG with the library and with libpng, which have to agree.
+ */
+bool DecodesLikeLibpng(const std::vector<uint8_t>& png) {
+    std::vector<uint8_t> rows;
+    int width = 0;
+    int height = 0;
+    uint64_t rowBytes = 0;
+    if (!DecodeWithLibpng(png, true, rows, width, height, rowBytes)) {
+        return false;
+    }
+
+    ImageInfo info;
+    ImagePixelData* pixelData = nullptr;
+    if (!CreatePixelData(EImageFormat::PNG, png.data(), png.size(), info, pixelData)) {
+        return false;
+    }
+    const bool bSame = MatchesRows(*pixelData, rows, width, height, rowBytes);
+    ReleasePixelData(pixelData);
+    return bSame;
+}
+
+void CheckPngEncode() {
+    // Wide enough rows and enough of them to be encoded in parallel blocks at every pixel format, with padded rows.
+    const int width = 1531;
+    const int height = 1100;
+    const ETextureSourceFormat formats[] = {ETextureSourceFormat::RGBA8, ETextureSourceFormat::BGRA8, ETextureSourceFormat::G8, ETextureSourceFormat::RGBA16, ETextureSourceFormat::G16};
+    const EPngProfile profiles[] = {EPngProfile::Fastest, EPngProfile::Balanced, EPngProfile::Smallest};
+    for (ETextureSourceFormat format : formats) {
+        const int bytesPerPixel = GetBytesPerPixel(format);
+        const uint64_t stride = uint64_t(width) * bytesPerPixel + 16;
+        std::vector<uint8_t> pixels = MakePixels(format, width, height, stride);
+
+        ImagePixelData pixelData = {};
+        pixelData.texture_format = format;
+        pixelData.bit_depth = format == ETextureSourceFormat::RGBA16 || format == ETextureSourceFormat::G16 ? 16 : 8;
+        pixelData.data = pixels.data();
+        pixelData.width = width;
+        pixelData.height = height;
+        pixelData.stride = static_cast<int>(stride);
+
+        for (EPngProfile profile : profiles) {
+            const std::string name = std::string("png encode ") + GetTextureFormatName(format) + " " + GetPngProfileName(profile) + " " + std::to_string(width) + "x" + std::to_string(height) + " ";
+            ImageEncodeOptions options = {};
+            options.png_profile = profile;
+            std::vector<uint8_t> png(GetMaxCompressedSize(EImageFormat::PNG, width, height, options));
+            uint64_t pngSize = 0;
+            if (!CreateCompressedData(EImageFormat::PNG, pixelData, options, png.data(), png.size(), pngSize)) {
+                Report(name + "encodes", false);
+                continue;
+            }
+            png.resize(pngSize);
+
+            // libpng has to read back exactly the samples that went in.
+            std::vector<uint8_t> rows;
+            int decodedWidth = 0;
+            int decodedHeight = 0;
+            uint64_t rowBytes = 0;
+            bool bSame = DecodeWithLibpng(png, false, rows, decodedWidth, decodedHeight, rowBytes) && decodedWidth == width && decodedHeight == height && rowBytes == uint64_t(width) * bytesPerPixel;
+            for (int y = 0; bSame && y < height; y++) {
+                bSame = ToPngRow(format, pixels.data() + y * stride, width) == std::vector<uint8_t>(rows.begin() + y * rowBytes, rows.begin() + (y + 1) * rowBytes);
+            }
+            Report(name + "round-trips through libpng", bSame);
+            Report(name + "decodes like libpng", DecodesLikeLibpng(png));
+
+            // Deflating stops early once the blocks cannot fit, but the encode still has to fail. This overwrites png.
+            uint64_t shortSize = 0;
+            const bool bRejected = !CreateCompressedData(EImageFormat::PNG, pixelData, options, png.data(), pngSize - 1, shortSize);
+            Report(name + "rejects a destination one byte short", bRejected);
+        }
+    }
+}
+
+void CheckPngDecode() {
+    struct FPngLayout {
+        const char* name;
+        int colorType;
+        int bitDepth;
+    };
+    const FPngLayout layouts[] = {
+        {"gray8", PNG_COLOR_TYPE_GRAY, 8},   {"gray-alpha8", PNG_COLOR_TYPE_GRAY_ALPHA, 8},   {"rgb8", PNG_COLOR_TYPE_RGB, 8}, {"rgba8", PNG_COLOR_TYPE_RGB_ALPHA, 8},
+        {"gray16", PNG_COLOR_TYPE_GRAY, 16}, {"gray-alpha16", PNG_COLOR_TYPE_GRAY_ALPHA, 16}, {"rgb16", PNG_COLOR_TYPE_RGB, 16}, {"rgba16", PNG_COLOR_TYPE_RGB_ALPHA, 16},
+    };
+    const int sizes[][2] = {{333, 257}, {1024, 700}};
+    for (const FPngLayout& layout : layouts) {
+        for (const int* size : sizes) {
+            const std::string name = std::string("png decode ") + layout.name + " " + std::to_string(size[0]) + "x" + std::to_string(size[1]) + " from libpng";
+            const std::vector<uint8_t> png = EncodeWithLibpng(size[0], size[1], layout.colorType, layout.bitDepth, false);
+            Report(name, !png.empty() && DecodesLikeLibpng(png));
+        }
+    }
+}
+
+/**
+ * Decodes a JPEG to RGBA8 in a single tjDecompress2 call with the fast DCT the library uses, scaled by the given factor.
+ */
+bool DecodeScaledWithTurbo(const std::vector<uint8_t>& jpeg, const tjscalingfactor& scale, std::vector<uint8_t>& outPixels, int& outWidth, int& outHeight) {
+    tjhandle decompressor = tjInitDecompress();
+    int subsampling = 0;
+    int colorspace = 0;
+    bool bDecoded = tjDecompressHeader3(decompressor, jpeg.data(), static_cast<unsigned long>(jpeg.size()), &outWidth, &outHeight, &subsampling, &colorspace) == 0;
+    if (bDecoded) {
+        outWidth = TJSCALED(outWidth, scale);
+        outHeight = TJSCALED(outHeight, scale);
+        outPixels.resize(uint64_t(outWidth) * outHeight * 4);
+        bDecoded = tjDecompress2(decompressor, jpeg.data(), static_cast<unsigned long>(jpeg.size()), outPixels.data(), outWidth, 0, outHeight, TJPF_RGBA, TJFLAG_FASTDCT) == 0;
+    }
+    tjDestroy(decompressor);
+    return bDecoded;
+}
+
+bool DecodeWithTurbo(const std::vector<uint8_t>& jpeg, std::vector<uint8_t>& outPixels, int& outWidth, int& outHeight) {
+    const tjscalingfactor fullSize = {1, 1};
+    return DecodeScaledWithTurbo(jpeg, fullSize, outPixels, outWidth, outHeight);
+}
+
+/**
+ * Decodes the JPEG with the library, whole or a region of it, which has to match the same pixels of one tjDecompress2
+ * call.
+ */
+bool DecodesLikeTurbo(const std::vector<uint8_t>& jpeg, const ImageDecodeOptions& options) {
+    std::vector<uint8_t> pixels;
+    int width = 0;
+    int height = 0;
+    if (!DecodeWithTurbo(jpeg, pixels, width, height)) {
+        return false;
+    }
+
+    const uint64_t fullRowBytes = uint64_t(width) * 4;
+    int x = 0;
+    int y = 0;
+    if (options.region_width != 0 && options.region_height != 0) {
+        x = options.region_x;
+        y = options.region_y;
+        width = options.region_width;
+        height = options.region_height;
+    }
+    const uint64_t rowBytes = uint64_t(width) * 4;
+
+    ImageInfo info;
+    ImagePixelData* pixelData = nullptr;
+    if (!CreatePixelDataWithOptions(EImageFormat::JPEG, jpeg.data(), jpeg.size(), options, info, pixelData)) {
+        return false;
+    }
+    bool bSame = pixelData->width == width && pixelData->height == height;
+    for (int row = 0; bSame && row < height; row++) {
+        bSame = memcmp(pixelData->data + uint64_t(row) * pixelData->stride, pixels.data() + uint64_t(y + row) * fullRowBytes + uint64_t(x) * 4, rowBytes) == 0;
+    }
+    ReleasePixelData(pixelData);
+    return bSame;
+}
+
+void CheckJpegRestartStrips() {
+    // Above the size at which the encoder splits into strips and the decoder into restart bands.
+    const int width = 2048;
+    const int height = 1531;
+    struct FJpegLayout {
+        const char* name;
+        ETextureSourceFormat format;
+        EJpegSubsampling subsampling;
+    };
+    const FJpegLayout layouts[] = {
+        {"4:2:0", ETextureSourceFormat::RGBA8, EJpegSubsampling::YUV420},
+        {"4:2:2", ETextureSourceFormat::BGRA8, EJpegSubsampling::YUV422},
+        {"4:4:4", ETextureSourceFormat::RGBA8, EJpegSubsampling::YUV444},
+        {"gray", ETextureSourceFormat::G8, EJpegSubsampling::Gray},
+    };
+    for (const FJpegLayout& layout : layouts) {
+        const std::string name = std::string("jpeg ") + layout.name + " " + std::to_string(width) + "x" + std::to_string(height) + " ";
+        const uint64_t stride = uint64_t(width) * GetBytesPerPixel(layout.format);
+        std::vector<uint8_t> pixels = MakePixels(layout.format, width, height, stride);
+
+        ImagePixelData pixelData = {};
+        pixelData.texture_format = layout.format;
+        pixelData.bit_depth = 8;
+        pixelData.data = pixels.data();
+        pixelData.width = width;
+        pixelData.height = height;
+        pixelData.stride = static_cast<int>(stride);
+
+        // Optimized Huffman tables keep the encode serial and without restart markers, but code the same coefficients.
+        ImageEncodeOptions options = {};
+        options.quality = 90;
+        options.subsampling = layout.subsampling;
+        std::vector<uint8_t> stripJpeg(GetMaxCompressedSize(EImageFormat::JPEG, width, height, options));
+        uint64_t stripSize = 0;
+        options.optimize_huffman = true;
+        std::vector<uint8_t> serialJpeg(stripJpeg.size());
+        uint64_t serialSize = 0;
+        if (!CreateCompressedData(EImageFormat::JPEG, pixelData, options, serialJpeg.data(), serialJpeg.size(), serialSize)) {
+            Report(name + "encodes serially", false);
+            continue;
+        }
+        options.optimize_huffman = false;
+        if (!CreateCompressedData(EImageFormat::JPEG, pixelData, options, stripJpeg.data(), stripJpeg.size(), stripSize)) {
+            Report(name + "encodes in strips", false);
+            continue;
+        }
+        stripJpeg.resize(stripSize);
+        serialJpeg.resize(serialSize);
+
+        std::vector<uint8_t> stripPixels;
+        std::vector<uint8_t> serialPixels;
+        int decodedWidth = 0;
+        int decodedHeight = 0;
+        const bool bStripDecoded = DecodeWithTurbo(stripJpeg, stripPixels, decodedWidth, decodedHeight);
+        Report(name + "strip encode matches the serial one", bStripDecoded && DecodeWithTurbo(serialJpeg, serialPixels, decodedWidth, decodedHeight) && stripPixels == serialPixels);
+        Report(name + "restart band decode matches tjDecompress2", bStripDecoded && DecodesLikeTurbo(stripJpeg, ImageDecodeOptions()));
+    }
+}
+
+void CheckJpegScaling() {
+    // A JPEG TurboJPEG decodes in one call, and one large enough to be decoded in restart bands by libjpeg.
+    const int smallWidth = 1000;
+    const int smallHeight = 701;
+    const std::vector<uint8_t> small = EncodeJPEG(GeneratePixels(smallWidth, smallHeight, EContentEntropy::Medium), smallWidth, smallHeight);
+    const int largeWidth = 2048;
+    const int largeHeight = 1531;
+    std::vector<uint8_t> largePixels = GeneratePixels(largeWidth, largeHeight, EContentEntropy::Medium);
+    ImagePixelData pixelData = {};
+    pixelData.texture_format = ETextureSourceFormat::RGBA8;
+    pixelData.bit_depth = 8;
+    pixelData.data = largePixels.data();
+    pixelData.width = largeWidth;
+    pixelData.height = largeHeight;
+    pixelData.stride = largeWidth * 4;
+    ImageEncodeOptions encodeOptions = {};
+    encodeOptions.quality = 90;
+    std::vector<uint8_t> large(GetMaxCompressedSize(EImageFormat::JPEG, largeWidth, largeHeight, encodeOptions));
+    uint64_t largeSize = 0;
+    if (!CreateCompressedData(EImageFormat::JPEG, pixelData, encodeOptions, large.data(), large.size(), largeSize)) {
+        Report("jpeg scaled 2048x1531 encodes in strips", false);
+        return;
+    }
+    large.resize(largeSize);
+
+    const struct {
+        std::string name;
+        const std::vector<uint8_t>& data;
+    } jpegs[] = {{"jpeg scaled " + std::to_string(smallWidth) + "x" + std::to_string(smallHeight), small}, {"jpeg scaled " + std::to_string(largeWidth) + "x" + std::to_string(largeHeight) + " restart bands", large}};
+    const tjscalingfactor factors[] = {{7, 8}, {1, 2}, {3, 8}, {1, 8}};
+    for (const auto& jpeg : jpegs) {
+        for (const tjscalingfactor& factor : factors) {
+            const std::string name = jpeg.name + " by " + std::to_string(factor.num) + "/" + std::to_string(factor.denom) + " matches tjDecompress2";
+            std::vector<uint8_t> reference;
+            int width = 0;
+            int height = 0;
+            if (!DecodeScaledWithTurbo(jpeg.data, factor, reference, width, height)) {
+                Report(name, false);
+                continue;
+            }
+
+            ImageDecodeOptions options = {};
+            options.scale_num = factor.num;
+            options.scale_denom = factor.denom;
+            ImageInfo info;
+            ImagePixelData* scaled = nullptr;
+            if (!CreatePixelDataWithOptions(EImageFormat::JPEG, jpeg.data.data(), jpeg.data.size(), options, info, scaled)) {
+                Report(name, false);
+                continue;
+            }
+            Report(name, MatchesRows(*scaled, reference, width, height, uint64_t(width) * 4));
+            ReleasePixelData(scaled);
+        }
+    }
+}
+
+/**
+ * Decodes the JPEG with the library to YUV planes, which have to have the sizes tjPlaneWidth and tjPlaneHeight give and
+ * hold the samples of one tjDecompressToYUVPlanes call at the same scale.
+ */
+bool DecodesPlanesLikeTurbo(const std::vector<uint8_t>& jpeg, const tjscalingfactor& scale, ETextureSourceFormat yuvFormat) {
+    tjhandle decompressor = tjInitDecompress();
+    int width = 0;
+    int height = 0;
+    int subsampling = 0;
+    int colorspace = 0;
+    bool bSame = tjDecompressHeader3(decompressor, jpeg.data(), static_cast<unsigned long>(jpeg.size()), &width, &height, &subsampling, &colorspace) == 0;
+    width = TJSCALED(width, scale);
+    height = TJSCALED(height, scale);
+    std::vector<uint8_t> planes[3];
+    unsigned char* planePointers[3];
+    int strides[3];
+    for (int plane = 0; plane < 3; plane++) {
+        strides[plane] = tjPlaneWidth(plane, width, subsampling);
+        planes[plane].resize(uint64_t(strides[plane]) * tjPlaneHeight(plane, height, subsampling));
+        planePointers[plane] = planes[plane].data();
+    }
+    bSame = bSame && tjDecompressToYUVPlanes(decompressor, jpeg.data(), static_cast<unsigned long>(jpeg.size()), planePointers, width, strides, height, TJFLAG_FASTDCT) == 0;
+    tjDestroy(decompressor);
+
+    ImageDecodeOptions options = {};
+    options.scale_num = scale.num;
+    options.scale_denom = scale.denom;
+    options.yuv_planes = true;
+    ImageInfo info;
+    ImagePixelData* pixelData = nullptr;
+    if (!bSame || !CreatePixelDataWithOptions(EImageFormat::JPEG, jpeg.data(), jpeg.size(), options, info, pixelData)) {
+        return false;
+    }
+    bSame = pixelData->texture_format == yuvFormat && pixelData->num_planes == 3 && pixelData->width == width && pixelData->height == height;
+    for (int plane = 0; bSame && plane < 3; plane++) {
+        const int planeWidth = tjPlaneWidth(plane, width, subsampling);
+        const int planeHeight = tjPlaneHeight(plane, height, subsampling);
+        bSame = pixelData->plane_width[plane] == planeWidth && pixelData->plane_height[plane] == planeHeight;
+        for (int y = 0; bSame && y < planeHeight; y++) {
+            const uint8_t* row = pixelData->data + pixelData->plane_offset[plane] + uint64_t(y) * pixelData->plane_stride[plane];
+            bSame = memcmp(row, planes[plane].data() + uint64_t(y) * strides[plane], planeWidth) == 0;
+        }
+    }
+    ReleasePixelData(pixelData);
+    return bSame;
+}
+
+void CheckJpegYuvPlanes() {
+    // An odd width and height leave partial chroma samples at the right and bottom edges.
+    const int width = 1001;
+    const int height = 701;
+    std::vector<uint8_t> pixels = GeneratePixels(width, height, EContentEntropy::Medium);
+    ImagePixelData pixelData = {};
+    pixelData.texture_format = ETextureSourceFormat::RGBA8;
+    pixelData.bit_depth = 8;
+    pixelData.data = pixels.data();
+    pixelData.width = width;
+    pixelData.height = height;
+    pixelData.stride = width * 4;
+
+    const struct {
+        const char* name;
+        EJpegSubsampling subsampling;
+        ETextureSourceFormat yuvFormat;
+    } layouts[] = {
+        {"4:2:0", EJpegSubsampling::YUV420, ETextureSourceFormat::YUV420},
+        {"4:2:2", EJpegSubsampling::YUV422, ETextureSourceFormat::YUV422},
+        {"4:4:4", EJpegSubsampling::YUV444, ETextureSourceFormat::YUV444},
+    };
+    const tjscalingfactor factors[] = {{1, 1}, {1, 2}};
+    for (const auto& layout : layouts) {
+        ImageEncodeOptions options = {};
+        options.quality = 90;
+        options.subsampling = layout.subsampling;
+        std::vector<uint8_t> jpeg(GetMaxCompressedSize(EImageFormat::JPEG, width, height, options));
+        uint64_t jpegSize = 0;
+        const std::string name = std::string("jpeg yuv planes ") + layout.name + " " + std::to_string(width) + "x" + std::to_string(height);
+        if (!CreateCompressedData(EImageFormat::JPEG, pixelData, options, jpeg.data(), jpeg.size(), jpegSize)) {
+            Report(name + " encodes", false);
+            continue;
+        }
+        jpeg.resize(jpegSize);
+
+        for (const tjscalingfactor& factor : factors) {
+            const std::string scale = factor.num == factor.denom ? "" : " by " + std::to_string(factor.num) + "/" + std::to_string(factor.denom);
+            Report(name + scale + " match tjDecompressToYUVPlanes", DecodesPlanesLikeTurbo(jpeg, factor, layout.yuvFormat));
+        }
+    }
+}
+
+struct FJpegErrorJump {
+    jpeg_error_mgr pub;
+    jmp_buf buffer;
+};
+
+void JumpOnJpegError(j_common_ptr cinfo) { longjmp(reinterpret_cast<FJpegErrorJump*>(cinfo->err)->buffer, 1); }
+
+/**
+ * Decodes the first scans of a multi-scan JPEG to RGBA8 with libjpeg alone. The whole file is there, the buffered-image
+ * decode just stops taking input once the last scan wanted is complete and renders that. Block smoothing is off, like
+ * in the library's previews.
+ */
+bool DecodeScansWithLibjpeg(const std::vector<uint8_t>& jpeg, int numScans, std::vector<uint8_t>& outPixels, int& outWidth, int& outHeight) {
+    jpeg_decompress_struct cinfo;
+    FJpegErrorJump errorJump;
+    cinfo.err = jpeg_std_error(&errorJump.pub);
+    errorJump.pub.error_exit = JumpOnJpegError;
+    jpeg_create_decompress(&cinfo);
+    if (setjmp(errorJump.buffer) != 0) {
+        jpeg_destroy_decompress(&cinfo);
+        return false;
+    }
+
+    jpeg_mem_src(&cinfo, jpeg.data(), static_cast<unsigned long>(jpeg.size()));
+    jpeg_read_header(&cinfo, TRUE);
+    cinfo.out_color_space = JCS_EXT_RGBA;
+    cinfo.dct_method = JDCT_IFAST;
+    cinfo.buffered_image = TRUE;
+    cinfo.do_block_smoothing = FALSE;
+    jpeg_start_decompress(&cinfo);
+    int result;
+    do {
+        result = jpeg_consume_input(&cinfo);
+    } while (result != JPEG_REACHED_EOI && !(result == JPEG_SCAN_COMPLETED && cinfo.input_scan_number == numScans));
+
+    // With fewer scans in the file, the output scan number is clamped to the last one.
+    jpeg_start_output(&cinfo, numScans);
+    outWidth = cinfo.output_width;
+    outHeight = cinfo.output_height;
+    outPixels.resize(uint64_t(outWidth) * outHeight * 4);
+    while (cinfo.output_scanline < cinfo.output_height) {
+        JSAMPROW rowPointer = outPixels.data() + uint64_t(cinfo.output_scanline) * outWidth * 4;
+        jpeg_read_scanlines(&cinfo, &rowPointer, 1);
+    }
+    jpeg_abort_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+    return true;
+}
+
+void CheckJpegScanLimit() {
+    const int width = 1000;
+    const int height = 701;
+    std::vector<uint8_t> pixels = GeneratePixels(width, height, EContentEntropy::Medium);
+    ImagePixelData pixelData = {};
+    pixelData.texture_format = ETextureSourceFormat::RGBA8;
+    pixelData.bit_depth = 8;
+    pixelData.data = pixels.data();
+    pixelData.width = width;
+    pixelData.height = height;
+    pixelData.stride = width * 4;
+    ImageEncodeOptions encodeOptions = {};
+    encodeOptions.quality = 90;
+    encodeOptions.progressive = true;
+    std::vector<uint8_t> jpeg(GetMaxCompressedSize(EImageFormat::JPEG, width, height, encodeOptions));
+    uint64_t jpegSize = 0;
+    if (!CreateCompressedData(EImageFormat::JPEG, pixelData, encodeOptions, jpeg.data(), jpeg.size(), jpegSize)) {
+        Report("jpeg preview progressive encodes", false);
+        return;
+    }
+    jpeg.resize(jpegSize);
+
+    // The color progression has ten scans, the last count is past them and has to give the full image.
+    const int scanCounts[] = {1, 3, 6, 64};
+    for (int numScans : scanCounts) {
+        const std::string name = "jpeg preview progressive " + std::to_string(width) + "x" + std::to_string(height) + " of " + std::to_string(numScans) + " scans matches libjpeg";
+        std::vector<uint8_t> reference;
+        int referenceWidth = 0;
+        int referenceHeight = 0;
+        if (!DecodeScansWithLibjpeg(jpeg, numScans, reference, referenceWidth, referenceHeight)) {
+            Report(name, false);
+            continue;
+        }
+
+        ImageDecodeOptions options = {};
+        options.max_scans = numScans;
+        ImageInfo info;
+        ImagePixelData* preview = nullptr;
+        if (!CreatePixelDataWithOptions(EImageFormat::JPEG, jpeg.data(), jpeg.size(), options, info, preview)) {
+            Report(name, false);
+            continue;
+        }
+        Report(name, MatchesRows(*preview, reference, width, height, uint64_t(width) * 4));
+        ReleasePixelData(preview);
+    }
+}
+
+void CheckJpegMcuIndex() {
+    const int width = 2048;
+    const int height = 1536;
+    const std::vector<uint8_t> jpeg = EncodeJPEG(GeneratePixels(width, height, EContentEntropy::Medium), width, height);
+
+    uint64_t indexSize = 0;
+    CreateJpegMcuIndex(jpeg.data(), jpeg.size(), nullptr, 0, indexSize);
+    std::vector<uint8_t> index(indexSize);
+    if (indexSize == 0 || !CreateJpegMcuIndex(jpeg.data(), jpeg.size(), index.data(), index.size(), indexSize)) {
+        Report("jpeg index builds", false);
+        return;
+    }
+
+    // Regions at the top, across MCU row boundaries at odd offsets, and at the bottom right corner.
+    const int regions[][4] = {{0, 0, 300, 200}, {517, 611, 800, 333}, {0, 643, width, 64}, {width - 257, height - 129, 257, 129}};
+    for (const int* region : regions) {
+        ImageDecodeOptions options = {};
+        options.region_x = region[0];
+        options.region_y = region[1];
+        options.region_width = region[2];
+        options.region_height = region[3];
+        const std::string name = "jpeg region " + std::to_string(region[2]) + "x" + std::to_string(region[3]) + " at " + std::to_string(region[0]) + "," + std::to_string(region[1]);
+        Report(name + " matches tjDecompress2", DecodesLikeTurbo(jpeg, options));
+
+        options.jpeg_index = index.data();
+        options.jpeg_index_length = index.size();
+        Report(name + " with index matches tjDecompress2", DecodesLikeTurbo(jpeg, options));
+    }
+}
+
+/**
+ * What DecodeImageRows handed over so far: the rows copied into one image, and whether the batches came in order.
+ */
+struct FRowBatches {
+    std::vector<uint8_t> rows;
+    uint64_t rowBytes = 0;
+    int rowsPerBatch = 0;
+    int nextRow = 0;
+    bool bInOrder = true;
+};
+
+bool __cdecl OnRowsDecoded(const ImagePixelData& rows, int first_row, void* user_data) {
+    FRowBatches* batches = static_cast<FRowBatches*>(user_data);
+    const int expectedRows = std::min(batches->rowsPerBatch, static_cast<int>(batches->rows.size() / batches->rowBytes) - first_row);
+    batches->bInOrder = batches->bInOrder && first_row == batches->nextRow && rows.height == expectedRows;
+    for (int y = 0; batches->bInOrder && y < rows.height; y++) {
+        memcpy(batches->rows.data() + (uint64_t(first_row) + y) * batches->rowBytes, rows.data + uint64_t(y) * rows.stride, batches->rowBytes);
+    }
+    batches->nextRow = first_row + rows.height;
+    return batches->bInOrder;
+}
+
+/**
+ * Decodes the image with DecodeImageRows, whose batches have to come in order and add up to the pixels of a full decode.
+ */
+bool DecodesRowsLikeFullDecode(EImageFormat format, const std::vector<uint8_t>& data, int rowsPerBatch) {
+    ImageInfo info;
+    ImagePixelData* full = nullptr;
+    if (!CreatePixelData(format, data.data(), data.size(), info, full)) {
+        return false;
+    }
+    FRowBatches batches;
+    batches.rowBytes = uint64_t(full->width) * 4 * full->bit_depth / 8;
+    batches.rows.resize(batches.rowBytes * full->height);
+    batches.rowsPerBatch = rowsPerBatch;
+    ImageInfo rowsInfo;
+    const bool bDecoded = DecodeImageRows(format, data.data(), data.size(), rowsPerBatch, rowsInfo, OnRowsDecoded, &batches);
+    const bool bSame = bDecoded && batches.bInOrder && batches.nextRow == full->height && MatchesRows(*full, batches.rows, full->width, full->height, batches.rowBytes);
+    ReleasePixelData(full);
+    return bSame;
+}
+
+void CheckDecodeRows() {
+    // 37 divides neither height, so the last batch is a short one.
+    const int width = 1000;
+    const int height = 701;
+    const int rowsPerBatch = 37;
+    const std::vector<uint8_t> pixels = GeneratePixels(width, height, EContentEntropy::Medium);
+    const std::string size = std::to_string(width) + "x" + std::to_string(height) + " in batches of " + std::to_string(rowsPerBatch);
+    Report("jpeg rows 4:2:0 " + size + " match a full decode", DecodesRowsLikeFullDecode(EImageFormat::JPEG, EncodeJPEG(pixels, width, height), rowsPerBatch));
+    Report("png rows rgba8 " + size + " match a full decode", DecodesRowsLikeFullDecode(EImageFormat::PNG, EncodePNG(pixels, width, height), rowsPerBatch));
+    Report("png rows rgb16 adam7 333x257 in batches of " + std::to_string(rowsPerBatch) + " match a full decode", DecodesRowsLikeFullDecode(EImageFormat::PNG, EncodeWithLibpng(333, 257, PNG_COLOR_TYPE_RGB, 16, true), rowsPerBatch));
+}
+
+/**
+ * Transforms a JPEG with a single tjTransform call.
+ */
+bool TransformWithTurbo(const std::vector<uint8_t>& jpeg, tjtransform& transform, std::vector<uint8_t>& outJpeg) {
+    tjhandle transformer = tjInitTransform();
+    unsigned char* outBuffer = nullptr;
+    unsigned long outSize = 0;
+    const bool bTransformed = tjTransform(transformer, jpeg.data(), static_cast<unsigned long>(jpeg.size()), 1, &outBuffer, &outSize, &transform, 0) == 0;
+    if (bTransformed) {
+        outJpeg.assign(outBuffer, outBuffer + outSize);
+    }
+    tjFree(outBuffer);
+    tjDestroy(transformer);
+    return bTransformed;
+}
+
+/**
+ * Transforms the JPEG with the library, asking for the size first, which has to give the same JPEG as tjTransform.
+ */
+bool TransformsLikeTurbo(const std::vector<uint8_t>& jpeg, const JpegTransformOptions& options, tjtransform& transform) {
+    std::vector<uint8_t> reference;
+    if (!TransformWithTurbo(jpeg, transform, reference)) {
+        return false;
+    }
+
+    uint64_t transformedSize = 0;
+    if (TransformJpeg(jpeg.data(), jpeg.size(), options, nullptr, 0, transformedSize) || transformedSize != reference.size()) {
+        return false;
+    }
+    std::vector<uint8_t> transformed(transformedSize);
+    return TransformJpeg(jpeg.data(), jpeg.size(), options, transformed.data(), transformed.size(), transformedSize) && transformed == reference;
+}
+
+void CheckJpegTransform() {
+    // 4:2:2 has MCUs of 16x8 pixels, 8x16 once transposed, and neither divides the size.
+    const int width = 1000;
+    const int height = 701;
+    std::vector<uint8_t> pixels = GeneratePixels(width, height, EContentEntropy::Medium);
+    ImagePixelData pixelData = {};
+    pixelData.texture_format = ETextureSourceFormat::RGBA8;
+    pixelData.bit_depth = 8;
+    pixelData.data = pixels.data();
+    pixelData.width = width;
+    pixelData.height = height;
+    pixelData.stride = width * 4;
+    ImageEncodeOptions encodeOptions = {};
+    encodeOptions.quality = 90;
+    encodeOptions.subsampling = EJpegSubsampling::YUV422;
+    std::vector<uint8_t> jpeg(GetMaxCompressedSize(EImageFormat::JPEG, width, height, encodeOptions));
+    uint64_t jpegSize = 0;
+    if (!CreateCompressedData(EImageFormat::JPEG, pixelData, encodeOptions, jpeg.data(), jpeg.size(), jpegSize)) {
+        Report("jpeg transform 4:2:2 encodes", false);
+        return;
+    }
+    jpeg.resize(jpegSize);
+
+    const struct {
+        const char* name;
+        EJpegTransform transform;
+        int op;
+    } ops[] = {
+        {"none", EJpegTransform::None, TJXOP_NONE},
+        {"flip horizontal", EJpegTransform::FlipHorizontal, TJXOP_HFLIP},
+        {"flip vertical", EJpegTransform::FlipVertical, TJXOP_VFLIP},
+        {"transpose", EJpegTransform::Transpose, TJXOP_TRANSPOSE},
+        {"transverse", EJpegTransform::Transverse, TJXOP_TRANSVERSE},
+        {"rotate 90", EJpegTransform::Rotate90, TJXOP_ROT90},
+        {"rotate 180", EJpegTransform::Rotate180, TJXOP_ROT180},
+        {"rotate 270", EJpegTransform::Rotate270, TJXOP_ROT270},
+    };
+    const std::string name = "jpeg transform 4:2:2 ";
+    for (const auto& op : ops) {
+        JpegTransformOptions options = {};
+        options.transform = op.transform;
+        tjtransform transform = {};
+        transform.op = op.op;
+        Report(name + op.name + " matches tjTransform", TransformsLikeTurbo(jpeg, options, transform));
+    }
+
+    // Every flag at once, which tjTransform takes as its options.
+    {
+        JpegTransformOptions options = {};
+        options.transform = EJpegTransform::Transverse;
+        options.trim = true;
+        options.grayscale = true;
+        options.progressive = true;
+        options.strip_markers = true;
+        tjtransform transform = {};
+        transform.op = TJXOP_TRANSVERSE;
+        transform.options = TJXOPT_TRIM | TJXOPT_GRAY | TJXOPT_PROGRESSIVE | TJXOPT_COPYNONE;
+        Report(name + "transverse with all flags matches tjTransform", TransformsLikeTurbo(jpeg, options, transform));
+    }
+
+    // A crop off the MCU grid of the rotated image moves its corner up and left onto the 8x16 grid, growing to match.
+    {
+        JpegTransformOptions options = {};
+        options.transform = EJpegTransform::Rotate90;
+        options.crop_x = 13;
+        options.crop_y = 21;
+        options.crop_width = 300;
+        options.crop_height = 200;
+        tjtransform transform = {};
+        transform.op = TJXOP_ROT90;
+        transform.options = TJXOPT_CROP;
+        transform.r.x = 8;
+        transform.r.y = 16;
+        transform.r.w = 305;
+        transform.r.h = 205;
+        Report(name + "rotate 90 crop at 13,21 matches tjTransform", TransformsLikeTurbo(jpeg, options, transform));
+    }
+
+    // A destination one byte short fails and reports the size it needs.
+    {
+        JpegTransformOptions options = {};
+        options.transform = EJpegTransform::Rotate180;
+        uint64_t transformedSize = 0;
+        TransformJpeg(jpeg.data(), jpeg.size(), options, nullptr, 0, transformedSize);
+        std::vector<uint8_t> transformed(transformedSize);
+        uint64_t shortSize = 0;
+        const bool bRejected = transformedSize > 0 && !TransformJpeg(jpeg.data(), jpeg.size(), options, transformed.data(), transformedSize - 1, shortSize);
+        Report(name + "rejects a destination one byte short", bRejected && shortSize == transformedSize);
+    }
+}
+
+/**
+ * Splits data of the given size into chunks of a single byte to a few kilobytes, the same on every run. Every few
+ * chunks are tiny so that headers, markers and entropy-coded segments get cut at every position.
+ */
+std::vector<uint64_t> SplitIntoChunks(uint64_t size, uint32_t seed) {
+    std::mt19937 random(seed);
+    std::vector<uint64_t> chunks;
+    for (uint64_t offset = 0; offset < size;) {
+        const uint64_t maxChunk = random() % 4 == 0 ? 16 : 4096;
+        const uint64_t chunk = std::min<uint64_t>(1 + random() % maxChunk, size - offset);
+        chunks.push_back(chunk);
+        offset += chunk;
+    }
+    return chunks;
+}
+
+void CheckJpegIncremental() {
+    // Not a multiple of the MCU size in either direction, so the edge MCUs are partial.
+    const int width = 1000;
+    const int height = 701;
+    std::vector<uint8_t> pixels = GeneratePixels(width, height, EContentEntropy::Medium);
+    const std::vector<uint8_t> baseline = EncodeJPEG(pixels, width, height);
+
+    ImagePixelData pixelData = {};
+    pixelData.texture_format = ETextureSourceFormat::RGBA8;
+    pixelData.bit_depth = 8;
+    pixelData.data = pixels.data();
+    pixelData.width = width;
+    pixelData.height = height;
+    pixelData.stride = width * 4;
+    ImageEncodeOptions options = {};
+    options.quality = 90;
+    options.progressive = true;
+    std::vector<uint8_t> progressive(GetMaxCompressedSize(EImageFormat::JPEG, width, height, options));
+    uint64_t progressiveSize = 0;
+    if (!CreateCompressedData(EImageFormat::JPEG, pixelData, options, progressive.data(), progressive.size(), progressiveSize)) {
+        Report("jpeg incremental progressive encodes", false);
+        return;
+    }
+    progressive.resize(progressiveSize);
+
+    const struct {
+        const char* name;
+        const std::vector<uint8_t>& data;
+    } jpegs[] = {{"baseline", baseline}, {"progressive", progressive}};
+    for (const auto& jpeg : jpegs) {
+        const std::string name = std::string("jpeg incremental ") + jpeg.name + " " + std::to_string(width) + "x" + std::to_string(height) + " ";
+        std::vector<uint8_t> reference;
+        int referenceWidth = 0;
+        int referenceHeight = 0;
+        if (!DecodeWithTurbo(jpeg.data, reference, referenceWidth, referenceHeight)) {
+            Report(name + "decodes with tjDecompress2", false);
+            continue;
+        }
+        const uint64_t rowBytes = uint64_t(width) * 4;
+
+        IncrementalJpegDecoder* decoder = CreateIncrementalJpegDecoder();
+        bool bAppended = true;
+        bool bMonotonic = true;
+        bool bRowsFinal = true;
+        IncrementalJpegProgress progress = {};
+        int checkedRows = 0;
+        uint64_t offset = 0;
+        for (uint64_t chunk : SplitIntoChunks(jpeg.data.size(), 15)) {
+            bAppended = AppendIncrementalJpegData(decoder, jpeg.data.data() + offset, chunk);
+            offset += chunk;
+            if (!bAppended) {
+                break;
+            }
+
+            // Fetching the pixels renders the latest complete scan of the progressive JPEG, which may finish it.
+            ImagePixelData rows = {};
+            const bool bHasPixels = GetIncrementalJpegPixels(decoder, rows);
+            const IncrementalJpegProgress previous = progress;
+            ImageInfo info;
+            GetIncrementalJpegProgress(decoder, info, progress);
+            bMonotonic = bMonotonic && progress.rows_complete >= previous.rows_complete && progress.scans_complete >= previous.scans_complete;
+
+            // Rows reported complete have to hold their final pixels already.
+            for (; bHasPixels && checkedRows < progress.rows_complete; checkedRows++) {
+                bRowsFinal = bRowsFinal && memcmp(rows.data + uint64_t(checkedRows) * rows.stride, reference.data() + checkedRows * rowBytes, rowBytes) == 0;
+            }
+        }
+
+        ImagePixelData rows = {};
+        const bool bDecoded = bAppended && progress.complete && GetIncrementalJpegPixels(decoder, rows);
+        Report(name + "matches tjDecompress2", bDecoded && MatchesRows(rows, reference, width, height, rowBytes));
+        Report(name + "progress never goes back", bMonotonic && (progress.scans_complete > 1) == progress.multiple_scans);
+        Report(name + "complete rows are final", bRowsFinal && checkedRows == height);
+        ReleaseIncrementalJpegDecoder(decoder);
+    }
+}
+
+void CheckPngIncremental() {
+    const int width = 333;
+    const int height = 257;
+    struct FPngLayout {
+        const char* name;
+        int colorType;
+        int bitDepth;
+        bool bInterlaced;
+    };
+    const FPngLayout layouts[] = {
+        {"rgb8", PNG_COLOR_TYPE_RGB, 8, false},
+        {"rgb8 adam7", PNG_COLOR_TYPE_RGB, 8, true},
+        {"gray-alpha16", PNG_COLOR_TYPE_GRAY_ALPHA, 16, false},
+        {"gray-alpha16 adam7", PNG_COLOR_TYPE_GRAY_ALPHA, 16, true},
+    };
+    for (const FPngLayout& layout : layouts) {
+        const std::string name = std::string("png incremental ") + layout.name + " " + std::to_string(width) + "x" + std::to_string(height) + " ";
+        const std::vector<uint8_t> png = EncodeWithLibpng(width, height, layout.colorType, layout.bitDepth, layout.bInterlaced);
+        std::vector<uint8_t> reference;
+        int referenceWidth = 0;
+        int referenceHeight = 0;
+        uint64_t rowBytes = 0;
+        if (png.empty() || !DecodeWithLibpng(png, true, reference, referenceWidth, referenceHeight, rowBytes)) {
+            Report(name + "decodes with libpng", false);
+            continue;
+        }
+
+        IncrementalPngDecoder* decoder = CreateIncrementalPngDecoder();
+        bool bAppended = true;
+        bool bMonotonic = true;
+        bool bRowsFinal = true;
+        IncrementalPngProgress progress = {};
+        int checkedRows = 0;
+        uint64_t offset = 0;
+        for (uint64_t chunk : SplitIntoChunks(png.size(), 22)) {
+            bAppended = AppendIncrementalPngData(decoder, png.data() + offset, chunk);
+            offset += chunk;
+            if (!bAppended) {
+                break;
+            }
+
+            ImagePixelData rows = {};
+            const bool bHasPixels = GetIncrementalPngPixels(decoder, rows);
+            const IncrementalPngProgress previous = progress;
+            ImageInfo info;
+            GetIncrementalPngProgress(decoder, info, progress);
+            bMonotonic = bMonotonic && progress.rows_complete >= previous.rows_complete && progress.passes_complete >= previous.passes_complete;
+
+            // Rows reported complete have to hold their final pixels already, in an interlaced PNG only from the last pass on.
+            for (; bHasPixels && checkedRows < progress.rows_complete; checkedRows++) {
+                bRowsFinal = bRowsFinal && memcmp(rows.data + uint64_t(checkedRows) * rows.stride, reference.data() + checkedRows * rowBytes, rowBytes) == 0;
+            }
+        }
+
+        ImagePixelData rows = {};
+        const bool bDecoded = bAppended && progress.complete && GetIncrementalPngPixels(decoder, rows);
+        Report(name + "matches libpng", bDecoded && MatchesRows(rows, reference, width, height, rowBytes));
+        Report(name + "progress never goes back", bMonotonic && progress.interlaced == layout.bInterlaced && progress.passes_complete == (layout.bInterlaced ? 7 : 1));
+        Report(name + "complete rows are final", bRowsFinal && checkedRows == height);
+        ReleaseIncrementalPngDecoder(decoder);
+    }
+}
+
+/**
+ * What the callback of one asynchronous decode reported.
+ */
+struct FAsyncResult {
+    std::mutex mutex;
+    std::condition_variable cv;
+    int numCalls = 0;
+    uint64_t ticket = 0;
+    EDecodeStatus status = EDecodeStatus::DecodeError;
+    ImagePixelData* pixelData = nullptr;
+
+    // Set for the decodes that hold a pool thread in their callback until it opens.
+    bool bHoldThread = false;
+    bool bGateOpen = false;
+};
+
+void __cdecl OnAsyncDecoded(uint64_t ticket, EDecodeStatus status, const ImageInfo& /*info*/, ImagePixelData* pixel_data, void* user_data) {
+    FAsyncResult* result = static_cast<FAsyncResult*>(user_data);
+    std::unique_lock<std::mutex> lock(result->mutex);
+    result->numCalls++;
+    result->ticket = ticket;
+    result->status = status;
+    result->pixelData = pixel_data;
+    result->cv.notify_all();
+    result->cv.wait(lock, [result] { return !result->bHoldThread || result->bGateOpen; });
+}
+
+/**
+ * Waits for the callback, and a little longer to catch a second call.
+ */
+bool WaitForCallback(FAsyncResult& result) {
+    std::unique_lock<std::mutex> lock(result.mutex);
+    if (!result.cv.wait_for(lock, std::chrono::seconds(60), [&result] { return result.numCalls > 0; })) {
+        return false;
+    }
+    lock.unlock();
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    lock.lock();
+    return result.numCalls == 1;
+}
+
+/**
+ * Checks one decode that CancelDecode was called on at some point: the callback fires once with the ticket, and reports
+ * Cancelled without pixels exactly when CancelDecode succeeded.
+ */
+bool ReportedOnce(FAsyncResult& result, uint64_t ticket, bool bCancelled) {
+    if (!WaitForCallback(result) || result.ticket != ticket) {
+        return false;
+    }
+    const bool bStatusMatches = bCancelled ? result.status == EDecodeStatus::Cancelled && !result.pixelData : result.status == EDecodeStatus::Success && result.pixelData;
+    ReleasePixelData(result.pixelData);
+    return bStatusMatches;
+}
+
+void CheckAsyncCancel() {
+    const std::vector<uint8_t> small = EncodeJPEG(GeneratePixels(64, 64, EContentEntropy::Medium), 64, 64);
+    const int largeSize = 4096;
+    const std::vector<uint8_t> largePixels = GeneratePixels(largeSize, largeSize, EContentEntropy::Medium);
+    const std::vector<uint8_t> largeJpeg = EncodeJPEG(largePixels, largeSize, largeSize);
+    const std::vector<uint8_t> largePng = EncodePNG(largePixels, largeSize, largeSize);
+
+    // Before the start: the pool has one thread per core, holding each of them in a callback keeps the next decode queued.
+    {
+        const int numPoolThreads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+        std::vector<FAsyncResult> holders(numPoolThreads);
+        for (FAsyncResult& holder : holders) {
+            holder.bHoldThread = true;
+            CreatePixelDataAsync(EImageFormat::JPEG, small.data(), small.size(), OnAsyncDecoded, &holder);
+        }
+        for (FAsyncResult& holder : holders) {
+            std::unique_lock<std::mutex> lock(holder.mutex);
+            holder.cv.wait(lock, [&holder] { return holder.numCalls > 0; });
+        }
+
+        FAsyncResult queued;
+        const uint64_t ticket = CreatePixelDataAsync(EImageFormat::JPEG, largeJpeg.data(), largeJpeg.size(), OnAsyncDecoded, &queued);
+        const bool bCancelled = CancelDecode(ticket);
+        for (FAsyncResult& holder : holders) {
+            std::lock_guard<std::mutex> lock(holder.mutex);
+            holder.bGateOpen = true;
+            holder.cv.notify_all();
+        }
+        Report("async cancel before the start reports Cancelled once", bCancelled && ReportedOnce(queued, ticket, true));
+        for (FAsyncResult& holder : holders) {
+            ReleasePixelData(holder.pixelData);
+        }
+    }
+
+    // While running: the large decodes take far longer than the wait before the cancel.
+    const struct {
+        const char* name;
+        EImageFormat format;
+        const std::vector<uint8_t>& data;
+    } running[] = {{"jpeg", EImageFormat::JPEG, largeJpeg}, {"png", EImageFormat::PNG, largePng}};
+    for (const auto& image : running) {
+        FAsyncResult result;
+        const uint64_t ticket = CreatePixelDataAsync(image.format, image.data.data(), image.data.size(), OnAsyncDecoded, &result);
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        const bool bCancelled = CancelDecode(ticket);
+        Report(std::string("async cancel of a running ") + image.name + " decode reports Cancelled once", bCancelled && ReportedOnce(result, ticket, true));
+    }
+
+    // After completion: the cancel fails and the decode keeps its result.
+    {
+        FAsyncResult result;
+        const uint64_t ticket = CreatePixelDataAsync(EImageFormat::JPEG, small.data(), small.size(), OnAsyncDecoded, &result);
+        const bool bDecoded = WaitForCallback(result);
+        const bool bCancelled = CancelDecode(ticket);
+        Report("async cancel after completion fails and keeps the pixels", bDecoded && !bCancelled && ReportedOnce(result, ticket, false));
+    }
+}
+}  // namespace
+
+int RunCodecChecks() {
+    numFailures = 0;
+    CheckPngEncode();
+    CheckPngDecode();
+    CheckJpegRestartStrips();
+    CheckJpegScaling();
+    CheckJpegYuvPlanes();
+    CheckJpegScanLimit();
+    CheckJpegMcuIndex();
+    CheckJpegTransform();
+    CheckJpegIncremental();
+    CheckPngIncremental();
+    CheckDecodeRows();
+    CheckAsyncCancel();
+    return numFailures;
+}
+}  // namespace ImageBench
@@ -0,0 +1,21 @@
+﻿#pragma once
+
+namespace ImageBench {
+/**
+ * Checks the encoders and the fast decode paths against the reference libraries, printing one line per check.
+ *
+ * PNGs the library encodes must decode through libpng to the exact input, a destination one byte short must fail, and
+ * the library must decode PNGs libpng wrote like libpng does. JPEGs split into restart bands, stitched from parallel
+ * strips, scaled or decoded through an MCU row index must give the same pixels as one tjDecompress2 call at the same
+ * scale, and so must baseline and progressive JPEGs fed to the incremental decoder in random chunks, whose progress
+ * must never go back. PNGs fed the same way, interlaced or not, must decode like libpng. YUV planes must have the sizes
+ * and samples of one tjDecompressToYUVPlanes call, and previews of the first scans of a progressive JPEG the pixels
+ * libjpeg renders from those scans in buffered-image mode. Batches of rows from DecodeImageRows, JPEG or PNG, must add
+ * up to a full decode. TransformJpeg must give the JPEG tjTransform does for every operation, also for a crop off the
+ * MCU grid, and fail for a destination one byte short. Asynchronous decodes cancelled before, while and after they run
+ * must call back once with the matching status.
+ *
+ * @return The number of failed checks.
+ */
+int RunCodecChecks();
+}  // namespace ImageBench
@@ -0,0 +1,511 @@
+﻿#include "Corpus.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include "turbojpeg.h"
+#include "zlib.h"
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <dirent.h>
+#endif
+
+using namespace ImageDecoder;
+
+namespace ImageBench {
+const char* GetEntropyName(EContentEntropy entropy) {
+    switch (entropy) {
+        case EContentEntropy::Low: return "low";
+        case EContentEntropy::Medium: return "medium";
+        case EContentEntropy::High: return "high";
+        default: return "unknown";
+    }
+}
+
+const char* GetFormatName(EImageFormat format) {
+    switch (format) {
+        case EImageFormat::PNG: return "png";
+        case EImageFormat::JPEG: return "jpeg";
+        case EImageFormat::BMP: return "bmp";
+        case EImageFormat::ICO: return "ico";
+        case EImageFormat::EXR: return "exr";
+        case EImageFormat::PCX: return "pcx";
+        case EImageFormat::TGA: return "tga";
+        default: return "invalid";
+    }
+}
+
+const char* GetPngProfileName(EPngProfile profile) {
+    switch (profile) {
+        case EPngProfile::Fastest: return "fastest";
+        case EPngProfile::Balanced: return "balanced";
+        case EPngProfile::Smallest: return "smallest";
+        default: return "unknown";
+    }
+}
+
+/**
+ * xorshift64, so the corpus is identical on every platform and run.
+ */
+class FRandom {
+public:
+    FRandom(uint64_t seed) : state(seed * 0x9E3779B97F4A7C15ull + 1) {}
+
+    uint32_t Next() {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return static_cast<uint32_t>(state >> 32);
+    }
+
+private:
+    uint64_t state;
+};
+
+/**
+ * RGBA8 pixels: smooth gradients, gradients with noise, or pure noise.
+ */
+std::vector<uint8_t> GeneratePixels(int width, int height, EContentEntropy entropy) {
+    std::vector<uint8_t> pixels(uint64_t(width) * height * 4);
+    FRandom random(uint64_t(width) * 131 + uint64_t(height) * 7 + static_cast<uint64_t>(entropy));
+    for (int y = 0; y < height; y++) {
+        uint8_t* row = pixels.data() + uint64_t(y) * width * 4;
+        for (int x = 0; x < width; x++) {
+            uint8_t* pixel = row + x * 4;
+            if (entropy == EContentEntropy::High) {
+                const uint32_t value = random.Next();
+                memcpy(pixel, &value, 4);
+                continue;
+            }
+
+            int color[4] = {x * 255 / width, y * 255 / height, (x + y) * 255 / (width + height), 255 - (x ^ y) % 64};
+            if (entropy == EContentEntropy::Medium) {
+                const uint32_t noise = random.Next();
+                for (int c = 0; c < 4; c++) {
+                    color[c] += int((noise >> (c * 8)) & 15) - 8;
+                }
+            }
+            for (int c = 0; c < 4; c++) {
+                pixel[c] = static_cast<uint8_t>(color[c] < 0 ? 0 : (color[c] > 255 ? 255 : color[c]));
+            }
+        }
+    }
+    return pixels;
+}
+
+void Put16(std::vector<uint8_t>& out, uint16_t value) {
+    out.push_back(value & 0xff);
+    out.push_back(value >> 8);
+}
+
+void Put32(std::vector<uint8_t>& out, uint32_t value) {
+    Put16(out, value & 0xffff);
+    Put16(out, value >> 16);
+}
+
+void Put64(std::vector<uint8_t>& out, uint64_t value) {
+    Put32(out, value & 0xffffffff);
+    Put32(out, value >> 32);
+}
+
+void PutBigEndian32(std::vector<uint8_t>& out, uint32_t value) {
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        out.push_back((value >> shift) & 0xff);
+    }
+}
+
+void PutPngChunk(std::vector<uint8_t>& out, const char* type, const std::vector<uint8_t>& data) {
+    PutBigEndian32(out, static_cast<uint32_t>(data.size()));
+    const size_t typeOffset = out.size();
+    out.insert(out.end(), type, type + 4);
+    out.insert(out.end(), data.begin(), data.end());
+    PutBigEndian32(out, static_cast<uint32_t>(crc32(0, out.data() + typeOffset, static_cast<uInt>(out.size() - typeOffset))));
+}
+
+/**
+ * 8-bit RGBA PNG, every row with the Sub filter, deflated at zlib's default level.
+ */
+std::vector<uint8_t> EncodePNG(const std::vector<uint8_t>& pixels, int width, int height) {
+    const uint64_t rowBytes = uint64_t(width) * 4;
+    std::vector<uint8_t> filtered;
+    filtered.reserve((rowBytes + 1) * height);
+    for (int y = 0; y < height; y++) {
+        const uint8_t* row = pixels.data() + y * rowBytes;
+        filtered.push_back(1);
+        for (uint64_t i = 0; i < rowBytes; i++) {
+            filtered.push_back(static_cast<uint8_t>(row[i] - (i >= 4 ? row[i - 4] : 0)));
+        }
+    }
+
+    std::vector<uint8_t> idat(compressBound(static_cast<uLong>(filtered.size())));
+    uLongf idatSize = static_cast<uLongf>(idat.size());
+    compress2(idat.data(), &idatSize, filtered.data(), static_cast<uLong>(filtered.size()), Z_DEFAULT_COMPRESSION);
+    idat.resize(idatSize);
+
+    std::vector<uint8_t> ihdr;
+    PutBigEndian32(ihdr, width);
+    PutBigEndian32(ihdr, height);
+    const uint8_t ihdrTail[] = {8, 6, 0, 0, 0};  // 8-bit RGBA, deflate, adaptive filtering, no interlace
+    ihdr.insert(ihdr.end(), ihdrTail, ihdrTail + sizeof(ihdrTail));
+
+    const uint8_t signature[] = {0x89, 'P', 'N', 'G', 0x0D, 0x0A, 0x1A, 0x0A};
+    std::vector<uint8_t> png(signature, signature + sizeof(signature));
+    PutPngChunk(png, "IHDR", ihdr);
+    PutPngChunk(png, "IDAT", idat);
+    PutPngChunk(png, "IEND", std::vector<uint8_t>());
+    return png;
+}
+
+/**
+ * Baseline 4:2:0 JPEG at quality 90.
+ */
+std::vector<uint8_t> EncodeJPEG(const std::vector<uint8_t>& pixels, int width, int height) {
+    tjhandle compressor = tjInitCompress();
+    unsigned char* jpegBuffer = nullptr;
+    unsigned long jpegSize = 0;
+    std::vector<uint8_t> jpeg;
+    if (tjCompress2(compressor, pixels.data(), width, 0, height, TJPF_RGBA, &jpegBuffer, &jpegSize, TJSAMP_420, 90, 0) == 0) {
+        jpeg.assign(jpegBuffer, jpegBuffer + jpegSize);
+    }
+    tjFree(jpegBuffer);
+    tjDestroy(compressor);
+    return jpeg;
+}
+
+uint16_t FloatToHalf(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, 4);
+    const uint32_t sign = (bits >> 16) & 0x8000;
+    const int exponent = int((bits >> 23) & 0xff) - 127 + 15;
+    uint32_t mantissa = bits & 0x7fffff;
+    if (exponent <= 0) {
+        // Values this small only occur as 0 in the generated images.
+        return static_cast<uint16_t>(sign);
+    }
+    mantissa += 0x1000;  // round to nearest
+    if (mantissa & 0x800000) {
+        return static_cast<uint16_t>(sign | ((exponent + 1) << 10));
+    }
+    return static_cast<uint16_t>(sign | (exponent << 10) | (mantissa >> 13));
+}
+
+void PutExrAttribute(std::vector<uint8_t>& out, const char* name, const char* type, const std::vector<uint8_t>& value) {
+    out.insert(out.end(), name, name + strlen(name) + 1);
+    out.insert(out.end(), type, type + strlen(type) + 1);
+    Put32(out, static_cast<uint32_t>(value.size()));
+    out.insert(out.end(), value.begin(), value.end());
+}
+
+/**
+ * Half float RGBA scanline EXR with ZIP compression (16 rows per block), the layout RgbaOutputFile writes.
+ */
+std::vector<uint8_t> EncodeEXR(const std::vector<uint8_t>& pixels, int width, int height) {
+    const int rowsPerBlock = 16;
+    const char channelNames[4] = {'A', 'B', 'G', 'R'};  // channels are stored in alphabetical order
+    const int channelOffsets[4] = {3, 2, 1, 0};
+
+    std::vector<uint8_t> header = {0x76, 0x2f, 0x31, 0x01};
+    Put32(header, 2);
+
+    std::vector<uint8_t> value;
+    for (char channelName : channelNames) {
+        value.push_back(channelName);
+        value.push_back(0);
+        Put32(value, 1);  // HALF
+        Put32(value, 0);  // pLinear and reserved
+        Put32(value, 1);  // xSampling
+        Put32(value, 1);  // ySampling
+    }
+    value.push_back(0);
+    PutExrAttribute(header, "channels", "chlist", value);
+    PutExrAttribute(header, "compression", "compression", std::vector<uint8_t>(1, 3));  // ZIP_COMPRESSION
+    value.clear();
+    Put32(value, 0);
+    Put32(value, 0);
+    Put32(value, width - 1);
+    Put32(value, height - 1);
+    PutExrAttribute(header, "dataWindow", "box2i", value);
+    PutExrAttribute(header, "displayWindow", "box2i", value);
+    PutExrAttribute(header, "lineOrder", "lineOrder", std::vector<uint8_t>(1, 0));  // INCREASING_Y
+    const float one = 1.0f;
+    value.assign((const uint8_t*)&one, (const uint8_t*)&one + 4);
+    PutExrAttribute(header, "pixelAspectRatio", "float", value);
+    PutExrAttribute(header, "screenWindowWidth", "float", value);
+    PutExrAttribute(header, "screenWindowCenter", "v2f", std::vector<uint8_t>(8, 0));
+    header.push_back(0);
+
+    const int numBlocks = (height + rowsPerBlock - 1) / rowsPerBlock;
+    std::vector<uint8_t> blocks;
+    std::vector<uint64_t> offsets;
+    const uint64_t firstBlockOffset = header.size() + uint64_t(numBlocks) * 8;
+    for (int firstRow = 0; firstRow < height; firstRow += rowsPerBlock) {
+        const int numRows = std::min(rowsPerBlock, height - firstRow);
+
+        // Rows one after the other, each holding every channel's samples one after the other.
+        std::vector<uint8_t> raw;
+        raw.reserve(uint64_t(numRows) * width * 8);
+        for (int y = firstRow; y < firstRow + numRows; y++) {
+            for (int channel = 0; channel < 4; channel++) {
+                for (int x = 0; x < width; x++) {
+                    const uint16_t half = FloatToHalf(pixels[(uint64_t(y) * width + x) * 4 + channelOffsets[channel]] / 255.0f);
+                    Put16(raw, half);
+                }
+            }
+        }
+
+        // ZIP compression splits the bytes into even and odd halves and delta-encodes them before deflating.
+        std::vector<uint8_t> predicted(raw.size());
+        const size_t half = (raw.size() + 1) / 2;
+        for (size_t i = 0; i < raw.size(); i++) {
+            predicted[(i % 2) ? half + i / 2 : i / 2] = raw[i];
+        }
+        for (size_t i = predicted.size() - 1; i > 0; i--) {
+            predicted[i] = static_cast<uint8_t>(int(predicted[i]) - int(predicted[i - 1]) + 128);
+        }
+
+        std::vector<uint8_t> compressed(compressBound(static_cast<uLong>(predicted.size())));
+        uLongf compressedSize = static_cast<uLongf>(compressed.size());
+        compress2(compressed.data(), &compressedSize, predicted.data(), static_cast<uLong>(predicted.size()), Z_DEFAULT_COMPRESSION);
+        compressed.resize(compressedSize);
+        const std::vector<uint8_t>& blockData = compressed.size() < raw.size() ? compressed : raw;
+
+        offsets.push_back(firstBlockOffset + blocks.size());
+        Put32(blocks, firstRow);
+        Put32(blocks, static_cast<uint32_t>(blockData.size()));
+        blocks.insert(blocks.end(), blockData.begin(), blockData.end());
+    }
+
+    std::vector<uint8_t> exr = header;
+    for (uint64_t offset : offsets) {
+        Put64(exr, offset);
+    }
+    exr.insert(exr.end(), blocks.begin(), blocks.end());
+    return exr;
+}
+
+/**
+ * Bottom-up 24-bit BMP.
+ */
+std::vector<uint8_t> EncodeBMP(const std::vector<uint8_t>& pixels, int width, int height) {
+    const uint32_t rowBytes = (uint32_t(width) * 3 + 3) & ~3u;
+    const uint32_t dataOffset = 14 + 40;
+    std::vector<uint8_t> bmp = {'B', 'M'};
+    Put32(bmp, dataOffset + rowBytes * height);
+    Put32(bmp, 0);
+    Put32(bmp, dataOffset);
+    Put32(bmp, 40);
+    Put32(bmp, width);
+    Put32(bmp, height);
+    Put16(bmp, 1);
+    Put16(bmp, 24);
+    Put32(bmp, 0);  // BI_RGB
+    Put32(bmp, rowBytes * height);
+    Put32(bmp, 2835);
+    Put32(bmp, 2835);
+    Put32(bmp, 0);
+    Put32(bmp, 0);
+    for (int y = height - 1; y >= 0; y--) {
+        const uint8_t* row = pixels.data() + uint64_t(y) * width * 4;
+        for (int x = 0; x < width; x++) {
+            bmp.push_back(row[x * 4 + 2]);
+            bmp.push_back(row[x * 4 + 1]);
+            bmp.push_back(row[x * 4 + 0]);
+        }
+        bmp.resize(bmp.size() + rowBytes - uint32_t(width) * 3, 0);
+    }
+    return bmp;
+}
+
+/**
+ * Bottom-up run-length encoded 32-bit TGA.
+ */
+std::vector<uint8_t> EncodeTGA(const std::vector<uint8_t>& pixels, int width, int height) {
+    std::vector<uint8_t> tga = {0, 0, 10, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+    Put16(tga, width);
+    Put16(tga, height);
+    tga.push_back(32);
+    tga.push_back(8);  // 8 alpha bits, bottom-up
+
+    std::vector<uint32_t> row(width);
+    for (int y = height - 1; y >= 0; y--) {
+        for (int x = 0; x < width; x++) {
+            const uint8_t* pixel = pixels.data() + (uint64_t(y) * width + x) * 4;
+            row[x] = uint32_t(pixel[2]) | uint32_t(pixel[1]) << 8 | uint32_t(pixel[0]) << 16 | uint32_t(pixel[3]) << 24;
+        }
+
+        // Packets never cross rows, which keeps every decoder happy.
+        for (int x = 0; x < width;) {
+            int run = 1;
+            while (x + run < width && run < 128 && row[x + run] == row[x]) {
+                run++;
+            }
+            if (run > 1) {
+                tga.push_back(static_cast<uint8_t>(0x80 | (run - 1)));
+                Put32(tga, row[x]);
+                x += run;
+                continue;
+            }
+
+            int literals = 1;
+            while (x + literals < width && literals < 128 && (x + literals + 1 >= width || row[x + literals] != row[x + literals + 1])) {
+                literals++;
+            }
+            tga.push_back(static_cast<uint8_t>(literals - 1));
+            for (int i = 0; i < literals; i++) {
+                Put32(tga, row[x + i]);
+            }
+            x += literals;
+        }
+    }
+    return tga;
+}
+
+/**
+ * Run-length encoded 24-bit PCX with three planes.
+ */
+std::vector<uint8_t> EncodePCX(const std::vector<uint8_t>& pixels, int width, int height) {
+    std::vector<uint8_t> pcx = {10, 5, 1, 8};
+    Put16(pcx, 0);
+    Put16(pcx, 0);
+    Put16(pcx, width - 1);
+    Put16(pcx, height - 1);
+    Put16(pcx, 72);
+    Put16(pcx, 72);
+    pcx.resize(pcx.size() + 48, 0);
+    pcx.push_back(0);
+    pcx.push_back(3);
+    Put16(pcx, width);  // bytes per line, the generated sizes are all even
+    Put16(pcx, 1);
+    pcx.resize(128, 0);
+
+    for (int y = 0; y < height; y++) {
+        const uint8_t* row = pixels.data() + uint64_t(y) * width * 4;
+        for (int plane = 0; plane < 3; plane++) {
+            for (int x = 0; x < width;) {
+                const uint8_t color = row[x * 4 + plane];
+                int run = 1;
+                while (x + run < width && run < 63 && row[(x + run) * 4 + plane] == color) {
+                    run++;
+                }
+                if (run > 1 || (color & 0xc0) == 0xc0) {
+                    pcx.push_back(static_cast<uint8_t>(0xc0 | run));
+                }
+                pcx.push_back(color);
+                x += run;
+            }
+        }
+    }
+    return pcx;
+}
+
+/**
+ * Icon with a single PNG encoded entry.
+ */
+std::vector<uint8_t> EncodeICO(const std::vector<uint8_t>& pixels, int width, int height) {
+    const std::vector<uint8_t> png = EncodePNG(pixels, width, height);
+    std::vector<uint8_t> ico;
+    Put16(ico, 0);
+    Put16(ico, 1);
+    Put16(ico, 1);
+    ico.push_back(static_cast<uint8_t>(width >= 256 ? 0 : width));
+    ico.push_back(static_cast<uint8_t>(height >= 256 ? 0 : height));
+    ico.push_back(0);
+    ico.push_back(0);
+    Put16(ico, 1);
+    Put16(ico, 32);
+    Put32(ico, static_cast<uint32_t>(png.size()));
+    Put32(ico, 6 + 16);
+    ico.insert(ico.end(), png.begin(), png.end());
+    return ico;
+}
+
+std::vector<uint8_t> EncodeImage(EImageFormat format, const std::vector<uint8_t>& pixels, int width, int height) {
+    switch (format) {
+        case EImageFormat::PNG: return EncodePNG(pixels, width, height);
+        case EImageFormat::JPEG: return EncodeJPEG(pixels, width, height);
+        case EImageFormat::BMP: return EncodeBMP(pixels, width, height);
+        case EImageFormat::ICO: return EncodeICO(pixels, width, height);
+        case EImageFormat::EXR: return EncodeEXR(pixels, width, height);
+        case EImageFormat::PCX: return EncodePCX(pixels, width, height);
+        case EImageFormat::TGA: return EncodeTGA(pixels, width, height);
+        default: return std::vector<uint8_t>();
+    }
+}
+
+std::vector<FCorpusImage> GenerateCorpus(const std::vector<EImageFormat>& formats, const std::vector<int>& sizes) {
+    const EContentEntropy entropies[] = {EContentEntropy::Low, EContentEntropy::Medium, EContentEntropy::High};
+
+    std::vector<FCorpusImage> corpus;
+    for (EImageFormat format : formats) {
+        std::vector<int> formatSizes = format == EImageFormat::ICO ? std::vector<int>(1, 256) : sizes;
+        for (int size : formatSizes) {
+            for (EContentEntropy entropy : entropies) {
+                FCorpusImage image;
+                image.name = std::string(GetFormatName(format)) + "_" + std::to_string(size) + "_" + GetEntropyName(entropy);
+                image.format = format;
+                image.width = size;
+                image.height = size;
+                image.data = EncodeImage(format, GeneratePixels(size, size, entropy), size, size);
+                corpus.push_back(std::move(image));
+            }
+        }
+    }
+    return corpus;
+}
+
+std::vector<std::string> ListDirectory(const std::string& directory) {
+    std::vector<std::string> fileNames;
+#ifdef _WIN32
+    WIN32_FIND_DATAA findData;
+    HANDLE findHandle = FindFirstFileA((directory + "\\*").c_str(), &findData);
+    if (findHandle == INVALID_HANDLE_VALUE) {
+        return fileNames;
+    }
+    do {
+        fileNames.push_back(findData.cFileName);
+    } while (FindNextFileA(findHandle, &findData));
+    FindClose(findHandle);
+#else
+    DIR* dir = opendir(directory.c_str());
+    if (!dir) {
+        return fileNames;
+    }
+    while (dirent* entry = readdir(dir)) {
+        fileNames.push_back(entry->d_name);
+    }
+    closedir(dir);
+#endif
+    return fileNames;
+}
+
+bool LoadSampleImages(const std::string& directory, std::vector<FCorpusImage>& outImages) {
+    std::vector<std::string> fileNames = ListDirectory(directory);
+    if (fileNames.empty()) {
+        return false;
+    }
+
+    std::sort(fileNames.begin(), fileNames.end());
+    for (const std::string& fileName : fileNames) {
+        if (fileName.size() < 4 || fileName.compare(fileName.size() - 4, 4, ".tga") != 0) {
+            continue;
+        }
+
+        std::ifstream fileStream(directory + "/" + fileName, std::ios_base::in | std::ios::binary);
+        FCorpusImage image;
+        image.data.assign(std::istreambuf_iterator<char>(fileStream), std::istreambuf_iterator<char>());
+
+        ImageInfo info = {};
+        if (!ProbeImage(EImageFormat::TGA, image.data.data(), image.data.size(), info)) {
+            continue;
+        }
+        image.name = "sample_" + fileName.substr(0, fileName.size() - 4);
+        image.format = EImageFormat::TGA;
+        image.width = info.width;
+        image.height = info.height;
+        outImages.push_back(std::move(image));
+    }
+    return true;
+}
+}  // namespace ImageBench
@@ -0,0 +1,55 @@
+﻿#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "Decoder.h"
+
+namespace ImageBench {
+/**
+ * How much detail generated pixels have, which drives how well they compress.
+ */
+enum class EContentEntropy { Low, Medium, High };
+
+const char* GetEntropyName(EContentEntropy entropy);
+
+const char* GetFormatName(ImageDecoder::EImageFormat format);
+
+const char* GetPngProfileName(ImageDecoder::EPngProfile profile);
+
+/**
+ * One encoded image the benchmark decodes.
+ */
+struct FCorpusImage {
+    std::string name;
+    ImageDecoder::EImageFormat format;
+    int width;
+    int height;
+    std::vector<uint8_t> data;
+};
+
+/**
+ * RGBA8 pixels of the given entropy, the same on every run.
+ */
+std::vector<uint8_t> GeneratePixels(int width, int height, EContentEntropy entropy);
+
+/**
+ * 8-bit RGBA PNG of RGBA8 pixels, every row with the Sub filter, deflated at zlib's default level.
+ */
+std::vector<uint8_t> EncodePNG(const std::vector<uint8_t>& pixels, int width, int height);
+
+/**
+ * Baseline 4:2:0 JPEG at quality 90 of RGBA8 pixels, encoded by TurboJPEG.
+ */
+std::vector<uint8_t> EncodeJPEG(const std::vector<uint8_t>& pixels, int width, int height);
+
+/**
+ * Generates the same images on every run: every requested format at every size and entropy.
+ * ICO only holds images up to 256x256, so it is generated once at that size.
+ */
+std::vector<FCorpusImage> GenerateCorpus(const std::vector<ImageDecoder::EImageFormat>& formats, const std::vector<int>& sizes);
+
+/**
+ * Adds every .tga file in the directory, returns false if it cannot be listed.
+ */
+bool LoadSampleImages(const std::string& directory, std::vector<FCorpusImage>& outImages);
+}  // namespace ImageBench
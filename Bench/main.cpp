@@ -0,0 +1,397 @@
+﻿#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "CodecChecks.h"
+#include "Corpus.h"
+#include "Decoder.h"
+
+#ifdef _WIN32
+#include <Windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#ifndef IMAGE_BENCH_SAMPLE_DIR
+#define IMAGE_BENCH_SAMPLE_DIR "Sample"
+#endif
+
+using namespace ImageDecoder;
+using namespace ImageBench;
+
+struct FBenchOptions {
+    std::vector<int> threadCounts;
+    std::vector<int> sizes;
+    std::vector<EImageFormat> formats;
+    double minSeconds;
+    ImageDecodeOptions decodeOptions;
+    std::string sampleDirectory;
+    std::string jsonPath;
+    bool bPngEncode;
+    bool bVerify;
+};
+
+struct FBenchResult {
+    const FCorpusImage* image;
+    int threads;
+    bool bDecoded;
+    uint64_t decodes;
+    double seconds;
+    double megapixelsPerSecond;
+    double bytesPerSecond;
+    double p50Ms;
+    double p99Ms;
+    double peakRssMb;
+};
+
+struct FEncodeResult {
+    std::string name;
+    int width;
+    int height;
+    EPngProfile profile;
+    bool bEncoded;
+    uint64_t encodes;
+    double seconds;
+    double megabytesPerSecond;
+    double ratio;
+    double p50Ms;
+};
+
+double GetPeakRssMb() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return 0.0;
+    }
+    return counters.PeakWorkingSetSize / (1024.0 * 1024.0);
+#else
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return usage.ru_maxrss / (1024.0 * 1024.0);  // bytes
+#else
+    return usage.ru_maxrss / 1024.0;  // kilobytes
+#endif
+#endif
+}
+
+std::vector<int> ParseIntList(const char* text) {
+    std::vector<int> values;
+    for (const char* item = text; *item;) {
+        char* end = nullptr;
+        const long value = strtol(item, &end, 10);
+        if (end == item || value <= 0) {
+            return std::vector<int>();
+        }
+        values.push_back(static_cast<int>(value));
+        item = *end == ',' ? end + 1 : end;
+    }
+    return values;
+}
+
+std::vector<EImageFormat> ParseFormatList(const char* text) {
+    const EImageFormat allFormats[] = {EImageFormat::PNG, EImageFormat::JPEG, EImageFormat::EXR, EImageFormat::BMP, EImageFormat::TGA, EImageFormat::PCX, EImageFormat::ICO};
+    std::vector<EImageFormat> formats;
+    std::string list = text;
+    for (size_t begin = 0; begin <= list.size();) {
+        size_t end = list.find(',', begin);
+        if (end == std::string::npos) {
+            end = list.size();
+        }
+        const std::string name = list.substr(begin, end - begin);
+        const EImageFormat* format = std::find_if(std::begin(allFormats), std::end(allFormats), [&name](EImageFormat format) { return name == GetFormatName(format); });
+        if (format == std::end(allFormats)) {
+            return std::vector<EImageFormat>();
+        }
+        formats.push_back(*format);
+        begin = end + 1;
+    }
+    return formats;
+}
+
+void PrintUsage() {
+    printf(
+        "Usage: image_bench [options]\n"
+        "  --threads 1,2,4      decoding thread counts to sweep (default: powers of two up to the core count)\n"
+        "  --sizes 256,1024     generated image edge lengths (default: 256,1024,2048)\n"
+        "  --formats png,jpeg   generated formats out of png,jpeg,exr,bmp,tga,pcx,ico (default: all)\n"
+        "  --min-time 0.5       seconds spent on each image and thread count\n"
+        "  --max-dimension 256  decode scaled down to at most this width and height where the format allows it\n"
+        "  --yuv-planes 1       decode JPEGs to their Y, Cb and Cr planes instead of RGBA\n"
+        "  --samples DIR        directory with extra .tga files, empty to skip (default: " IMAGE_BENCH_SAMPLE_DIR ")\n"
+        "  --png-encode 0       skip encoding the generated PNG pixels with every profile (default: 1 if png is in --formats)\n"
+        "  --json FILE          also write the results as JSON\n"
+        "  --verify 1           check the encoders and the fast decode paths against libpng and TurboJPEG instead of benchmarking\n");
+}
+
+bool ParseOptions(int argc, char* argv[], FBenchOptions& options) {
+    options.sizes = {256, 1024, 2048};
+    options.formats = ParseFormatList("png,jpeg,exr,bmp,tga,pcx,ico");
+    options.minSeconds = 0.5;
+    options.decodeOptions = {};
+    options.sampleDirectory = IMAGE_BENCH_SAMPLE_DIR;
+    options.bPngEncode = true;
+    options.bVerify = false;
+
+    const int numCores = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    for (int threads = 1; threads < numCores; threads *= 2) {
+        options.threadCounts.push_back(threads);
+    }
+    options.threadCounts.push_back(numCores);
+
+    for (int i = 1; i < argc; i++) {
+        const std::string option = argv[i];
+        if (i + 1 >= argc) {
+            return false;
+        }
+        const char* value = argv[++i];
+        if (option == "--threads") {
+            options.threadCounts = ParseIntList(value);
+        } else if (option == "--sizes") {
+            options.sizes = ParseIntList(value);
+        } else if (option == "--formats") {
+            options.formats = ParseFormatList(value);
+        } else if (option == "--min-time") {
+            options.minSeconds = atof(value);
+        } else if (option == "--max-dimension") {
+            options.decodeOptions.max_dimension = atoi(value);
+        } else if (option == "--yuv-planes") {
+            options.decodeOptions.yuv_planes = atoi(value) != 0;
+        } else if (option == "--samples") {
+            options.sampleDirectory = value;
+        } else if (option == "--png-encode") {
+            options.bPngEncode = atoi(value) != 0;
+        } else if (option == "--json") {
+            options.jsonPath = value;
+        } else if (option == "--verify") {
+            options.bVerify = atoi(value) != 0;
+        } else {
+            return false;
+        }
+    }
+    return !options.threadCounts.empty() && !options.sizes.empty() && !options.formats.empty() && options.minSeconds > 0.0 && options.decodeOptions.max_dimension >= 0;
+}
+
+/**
+ * Has numThreads threads decode the image over and over for at least minSeconds.
+ * Throughput is counted in source pixels and bytes, also when decodeOptions scale the output down.
+ */
+FBenchResult RunImage(const FCorpusImage& image, int numThreads, double minSeconds, const ImageDecodeOptions& decodeOptions) {
+    typedef std::chrono::steady_clock FClock;
+
+    FBenchResult result = {};
+    result.image = &image;
+    result.threads = numThreads;
+
+    std::vector<std::vector<double>> threadLatencies(numThreads);
+    std::atomic<bool> bStart(false);
+    std::atomic<bool> bFailed(false);
+    FClock::time_point startTime;
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < numThreads; i++) {
+        threads.emplace_back([&, i]() {
+            while (!bStart) {
+                std::this_thread::yield();
+            }
+            std::vector<double>& latencies = threadLatencies[i];
+            do {
+                const FClock::time_point decodeStart = FClock::now();
+                ImageInfo info;
+                ImagePixelData* pixelData = nullptr;
+                if (!CreatePixelDataWithOptions(image.format, image.data.data(), image.data.size(), decodeOptions, info, pixelData)) {
+                    bFailed = true;
+                    return;
+                }
+                ReleasePixelData(pixelData);
+                latencies.push_back(std::chrono::duration<double, std::milli>(FClock::now() - decodeStart).count());
+            } while (std::chrono::duration<double>(FClock::now() - startTime).count() < minSeconds);
+        });
+    }
+
+    startTime = FClock::now();
+    bStart = true;
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    result.seconds = std::chrono::duration<double>(FClock::now() - startTime).count();
+    result.peakRssMb = GetPeakRssMb();
+    if (bFailed) {
+        return result;
+    }
+
+    std::vector<double> latencies;
+    for (const std::vector<double>& decodeLatencies : threadLatencies) {
+        latencies.insert(latencies.end(), decodeLatencies.begin(), decodeLatencies.end());
+    }
+    std::sort(latencies.begin(), latencies.end());
+
+    result.bDecoded = true;
+    result.decodes = latencies.size();
+    result.megapixelsPerSecond = result.decodes * double(image.width) * image.height / 1e6 / result.seconds;
+    result.bytesPerSecond = result.decodes * double(image.data.size()) / result.seconds;
+    result.p50Ms = latencies[(latencies.size() - 1) / 2];
+    result.p99Ms = latencies[(latencies.size() - 1) * 99 / 100];
+    return result;
+}
+
+/**
+ * Encodes the pixels as a PNG with the profile over and over for at least minSeconds, on the calling thread and the
+ * library's thread pool. Throughput is counted in RGBA8 bytes, the ratio is the PNG's size over theirs.
+ */
+FEncodeResult RunPngEncode(const std::string& name, const std::vector<uint8_t>& pixels, int width, int height, EPngProfile profile, double minSeconds) {
+    typedef std::chrono::steady_clock FClock;
+
+    FEncodeResult result = {};
+    result.name = name;
+    result.width = width;
+    result.height = height;
+    result.profile = profile;
+
+    ImagePixelData pixelData = {};
+    pixelData.data = const_cast<uint8_t*>(pixels.data());
+    pixelData.width = width;
+    pixelData.height = height;
+    pixelData.stride = uint64_t(width) * 4;
+    pixelData.texture_format = ETextureSourceFormat::RGBA8;
+
+    ImageEncodeOptions encodeOptions = {};
+    encodeOptions.png_profile = profile;
+    std::vector<uint8_t> buffer(GetMaxCompressedSize(EImageFormat::PNG, width, height, encodeOptions));
+
+    std::vector<double> latencies;
+    uint64_t compressedSize = 0;
+    const FClock::time_point startTime = FClock::now();
+    do {
+        const FClock::time_point encodeStart = FClock::now();
+        if (!CreateCompressedData(EImageFormat::PNG, pixelData, encodeOptions, buffer.data(), buffer.size(), compressedSize)) {
+            return result;
+        }
+        latencies.push_back(std::chrono::duration<double, std::milli>(FClock::now() - encodeStart).count());
+    } while (std::chrono::duration<double>(FClock::now() - startTime).count() < minSeconds);
+    result.seconds = std::chrono::duration<double>(FClock::now() - startTime).count();
+    std::sort(latencies.begin(), latencies.end());
+
+    result.bEncoded = true;
+    result.encodes = latencies.size();
+    result.megabytesPerSecond = result.encodes * double(pixels.size()) / 1e6 / result.seconds;
+    result.ratio = double(compressedSize) / pixels.size();
+    result.p50Ms = latencies[(latencies.size() - 1) / 2];
+    return result;
+}
+
+std::string EscapeJson(const std::string& text) {
+    std::string escaped;
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            escaped += '\\';
+            escaped += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            char code[8];
+            snprintf(code, sizeof(code), "\\u%04x", c);
+            escaped += code;
+        } else {
+            escaped += c;
+        }
+    }
+    return escaped;
+}
+
+bool WriteJson(const std::string& path, const FBenchOptions& options, const std::vector<FBenchResult>& results, const std::vector<FEncodeResult>& encodeResults) {
+    std::ofstream file(path);
+    if (!file) {
+        return false;
+    }
+
+    file << "{\n  \"version\": 1,\n  \"hardware_threads\": " << std::thread::hardware_concurrency() << ",\n  \"min_seconds\": " << options.minSeconds << ",\n  \"max_dimension\": " << options.decodeOptions.max_dimension << ",\n  \"yuv_planes\": " << (options.decodeOptions.yuv_planes ? "true" : "false") << ",\n  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const FBenchResult& result = results[i];
+        file << "    {\"name\": \"" << EscapeJson(result.image->name) << "\", \"format\": \"" << GetFormatName(result.image->format) << "\", \"width\": " << result.image->width << ", \"height\": " << result.image->height
+             << ", \"bytes\": " << result.image->data.size() << ", \"threads\": " << result.threads << ", \"ok\": " << (result.bDecoded ? "true" : "false") << ", \"decodes\": " << result.decodes << ", \"seconds\": " << result.seconds
+             << ", \"megapixels_per_second\": " << result.megapixelsPerSecond << ", \"bytes_per_second\": " << result.bytesPerSecond << ", \"p50_ms\": " << result.p50Ms << ", \"p99_ms\": " << result.p99Ms << ", \"peak_rss_mb\": " << result.peakRssMb << "}"
+             << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    file << "  ],\n  \"png_encode_results\": [\n";
+    for (size_t i = 0; i < encodeResults.size(); i++) {
+        const FEncodeResult& result = encodeResults[i];
+        file << "    {\"name\": \"" << EscapeJson(result.name) << "\", \"width\": " << result.width << ", \"height\": " << result.height << ", \"profile\": \"" << GetPngProfileName(result.profile) << "\", \"ok\": " << (result.bEncoded ? "true" : "false")
+             << ", \"encodes\": " << result.encodes << ", \"seconds\": " << result.seconds << ", \"megabytes_per_second\": " << result.megabytesPerSecond << ", \"ratio\": " << result.ratio << ", \"p50_ms\": " << result.p50Ms << "}"
+             << (i + 1 < encodeResults.size() ? ",\n" : "\n");
+    }
+    file << "  ]\n}\n";
+    return static_cast<bool>(file);
+}
+
+int main(int argc, char* argv[]) {
+    FBenchOptions options;
+    if (!ParseOptions(argc, argv, options)) {
+        PrintUsage();
+        return 1;
+    }
+
+    if (options.bVerify) {
+        return RunCodecChecks() == 0 ? 0 : 3;
+    }
+
+    std::vector<FCorpusImage> corpus = GenerateCorpus(options.formats, options.sizes);
+    if (!options.sampleDirectory.empty() && !LoadSampleImages(options.sampleDirectory, corpus)) {
+        fprintf(stderr, "Could not list sample directory %s, skipping samples.\n", options.sampleDirectory.c_str());
+    }
+
+    printf("%-28s %11s %10s %7s %10s %10s %9s %9s %9s\n", "image", "size", "bytes", "threads", "MP/s", "MB/s", "p50 ms", "p99 ms", "peak MB");
+    std::vector<FBenchResult> results;
+    for (const FCorpusImage& image : corpus) {
+        const std::string size = std::to_string(image.width) + "x" + std::to_string(image.height);
+        for (int threads : options.threadCounts) {
+            const FBenchResult result = RunImage(image, threads, options.minSeconds, options.decodeOptions);
+            results.push_back(result);
+            if (!result.bDecoded) {
+                printf("%-28s %11s %10zu %7d %10s\n", image.name.c_str(), size.c_str(), image.data.size(), threads, "FAILED");
+                break;
+            }
+            printf("%-28s %11s %10zu %7d %10.1f %10.1f %9.2f %9.2f %9.1f\n", image.name.c_str(), size.c_str(), image.data.size(), threads, result.megapixelsPerSecond, result.bytesPerSecond / 1e6, result.p50Ms, result.p99Ms, result.peakRssMb);
+            fflush(stdout);
+        }
+    }
+
+    // Encoding is measured on the pixels the PNG images were generated from, so the ratios compare with those files.
+    std::vector<FEncodeResult> encodeResults;
+    if (options.bPngEncode && std::find(options.formats.begin(), options.formats.end(), EImageFormat::PNG) != options.formats.end()) {
+        const EContentEntropy entropies[] = {EContentEntropy::Low, EContentEntropy::Medium, EContentEntropy::High};
+        const EPngProfile profiles[] = {EPngProfile::Fastest, EPngProfile::Balanced, EPngProfile::Smallest};
+        printf("\n%-28s %11s %10s %10s %9s %9s\n", "png encode", "size", "profile", "MB/s", "ratio", "p50 ms");
+        for (int size : options.sizes) {
+            for (EContentEntropy entropy : entropies) {
+                const std::string name = "png_" + std::to_string(size) + "_" + GetEntropyName(entropy);
+                const std::string sizeName = std::to_string(size) + "x" + std::to_string(size);
+                const std::vector<uint8_t> pixels = GeneratePixels(size, size, entropy);
+                for (EPngProfile profile : profiles) {
+                    const FEncodeResult result = RunPngEncode(name, pixels, size, size, profile, options.minSeconds);
+                    encodeResults.push_back(result);
+                    if (!result.bEncoded) {
+                        printf("%-28s %11s %10s %10s\n", name.c_str(), sizeName.c_str(), GetPngProfileName(profile), "FAILED");
+                        continue;
+                    }
+                    printf("%-28s %11s %10s %10.1f %9.3f %9.2f\n", name.c_str(), sizeName.c_str(), GetPngProfileName(profile), result.megabytesPerSecond, result.ratio, result.p50Ms);
+                    fflush(stdout);
+                }
+            }
+        }
+    }
+
+    if (!options.jsonPath.empty() && !WriteJson(options.jsonPath, options, results, encodeResults)) {
+        fprintf(stderr, "Could not write %s.\n", options.jsonPath.c_str());
+        return 1;
+    }
+
+    const bool bAllDecoded = std::all_of(results.begin(), results.end(), [](const FBenchResult& result) { return result.bDecoded; });
+    const bool bAllEncoded = std::all_of(encodeResults.begin(), encodeResults.end(), [](const FEncodeResult& result) { return result.bEncoded; });
+    return bAllDecoded && bAllEncoded ? 0 : 2;
+}
@@ -73,6 +73,12 @@ enum class ETextureSourceFormat {
     RGBA16F,
     RGBA8,
     RGBE8,
+    // 8-bit Y, Cb and Cr planes with the chroma subsampling in the name, see the plane fields of ImagePixelData
+    YUV444,
+    YUV422,
+    YUV420,
+    YUV440,
+    YUV411,
 };
 
 struct ImageInfo {
@@ -89,19 +95,363 @@ struct ImagePixelData {
     uint8_t* data;
     int width;
     int height;
-    int size;  // should equals to width * height * components * bit_depth / 8
+    int size;    // should equals to width * height * components * bit_depth / 8 for tightly packed rows
+    int stride;  // number of bytes between the starts of consecutive rows
+    int num_planes;       // 3 for the planar YUV formats, 1 otherwise
+    int plane_offset[3];  // bytes from data to the first row of each plane
+    int plane_stride[3];  // bytes between the starts of consecutive rows of each plane
+    int plane_width[3];   // size of each plane in pixels, for YUV padded to whole chroma samples like TurboJPEG does
+    int plane_height[3];
 };
 
+/**
+ * Outcome of one job of a batch decode or of an asynchronous decode.
+ */
+enum class EDecodeStatus : int8_t {
+    /** The image was decoded. */
+    Success = 0,
+
+    /** The file could not be opened or read. */
+    FileError,
+
+    /** The data is not a supported image of the given format, or decoding it failed. */
+    DecodeError,
+
+    /** CancelDecode stopped the decode before it finished. */
+    Cancelled,
+};
+
+struct ImageDecodeJob {
+    EImageFormat image_format;
+    const uint8_t* buffer;  // compressed image in memory, used when not null
+    uint64_t length;
+    const char* file_name;  // image file to decode when buffer is null
+};
+
+/**
+ * Optional output adjustments for CreatePixelDataWithOptions. Zero-initialize it and set only the fields you need.
+ */
+struct ImageDecodeOptions {
+    int max_dimension;           // if not 0, the decoded width and height should not exceed it
+    int scale_num;               // if scale_denom is not 0, decode at no more than scale_num / scale_denom of the full size
+    int scale_denom;
+    bool yuv_planes;             // return a color JPEG as its Y, Cb and Cr planes, skipping chroma upsampling and color conversion
+    int region_x;                // if region_width and region_height are not 0, decode only this rectangle given in full size pixels
+    int region_y;
+    int region_width;
+    int region_height;
+    int max_scans;               // if not 0, decode a progressive JPEG from at most its first max_scans scans, a blurrier but faster preview
+    uint64_t max_bytes;          // if not 0, decode a progressive JPEG only from the scans that end within its first max_bytes bytes
+    const uint8_t* jpeg_index;   // from CreateJpegMcuIndex for this file, lets a region decode skip the MCU rows above it
+    uint64_t jpeg_index_length;
+};
+
+/**
+ * Chroma subsampling of an encoded JPEG.
+ */
+enum class EJpegSubsampling : int8_t {
+    /** Chroma at half the resolution in both directions. */
+    YUV420 = 0,
+
+    /** Chroma at half the horizontal resolution. */
+    YUV422,
+
+    /** Chroma at full resolution. */
+    YUV444,
+
+    /** Luma only. */
+    Gray,
+};
+
+/**
+ * Trade between encoding speed and file size of a PNG. Every profile picks each row's filter the way libpng does.
+ */
+enum class EPngProfile : int8_t {
+    /** zlib's fastest level, run-length matches only for noisy rows, which deflate finds few other matches in. */
+    Fastest = 0,
+
+    /** zlib's default level, several times slower for noticeably smaller files, most of all of smooth content. */
+    Balanced,
+
+    /** zlib's best level, each block deflated both normally and with the strategy made for filtered data, keeping the smaller. */
+    Smallest,
+};
+
+/**
+ * Settings for CreateCompressedData. Zero-initialize it and set only the fields you need.
+ */
+struct ImageEncodeOptions {
+    int quality;                   // JPEG quality from 1 to 100, 0 for the default of 85
+    EJpegSubsampling subsampling;  // G8 pixels are always encoded as grayscale
+    bool progressive;              // progressive JPEGs always get optimized Huffman tables
+    bool optimize_huffman;         // Huffman tables made for the image instead of the standard ones, a smaller file for a slower encode
+    bool accurate_dct;             // the slower, more accurate integer DCT instead of the fast one, worth it at high quality
+    EPngProfile png_profile;       // the only setting that applies to PNG
+};
+
+/**
+ * Lossless JPEG transforms, applied to the DCT coefficients without decoding.
+ */
+enum class EJpegTransform : int8_t {
+    None = 0,
+    FlipHorizontal,
+    FlipVertical,
+
+    /** Mirror along the top left to bottom right diagonal. */
+    Transpose,
+
+    /** Mirror along the top right to bottom left diagonal. */
+    Transverse,
+
+    /** Clockwise. */
+    Rotate90,
+    Rotate180,
+    Rotate270,
+};
+
+/**
+ * Settings for TransformJpeg. Zero-initialize it and set only the fields you need.
+ */
+struct JpegTransformOptions {
+    EJpegTransform transform;
+    int crop_x;          // if crop_width and crop_height are not 0, keep only this rectangle of the transformed image,
+    int crop_y;          // its top left corner moves up and left onto the MCU grid (8 or 16 pixels), growing the size to match
+    int crop_width;
+    int crop_height;
+    bool trim;           // drop the partial MCUs at the right and bottom edges that cannot be transformed, instead of leaving them as they were
+    bool perfect;        // fail instead if there are such partial MCUs
+    bool grayscale;      // drop the chroma components
+    bool progressive;    // write a progressive JPEG
+    bool strip_markers;  // drop EXIF, ICC profile and comment markers instead of copying them
+};
+
+/**
+ * Progress of an incremental JPEG decode, see GetIncrementalJpegProgress.
+ */
+struct IncrementalJpegProgress {
+    bool header_complete;  // the size and format are known and pixels can be fetched
+    bool multiple_scans;   // the JPEG refines the whole image scan by scan, usually because it is progressive
+    bool complete;         // every row holds its final pixels
+    int rows_complete;     // number of rows from the top that hold their final pixels
+    int scans_complete;    // number of scans received completely, a multi-scan JPEG can show the latest one
+};
+
+/** Decoder state of an incremental JPEG decode */
+struct IncrementalJpegDecoder;
+
+/**
+ * Progress of an incremental PNG decode, see GetIncrementalPngProgress.
+ */
+struct IncrementalPngProgress {
+    bool header_complete;  // the size and format are known and pixels can be fetched
+    bool interlaced;       // the PNG fills in the whole image over seven Adam7 passes
+    bool complete;         // every row holds its final pixels
+    int rows_complete;     // number of rows from the top that hold their final pixels
+    int passes_complete;   // number of interlace passes received completely, a PNG that is not interlaced has one
+};
+
+/** Decoder state of an incremental PNG decode */
+struct IncrementalPngDecoder;
+
 enum class ELogLevel { Info, Warning, Error };
 
 typedef void(__cdecl* LogFunc)(ELogLevel, const char*);
 
 IMAGE_PORT void __cdecl SetLogFunction(LogFunc func);
 
+typedef void*(__cdecl* PixelAllocFunc)(uint64_t size, void* user_data);
+
+typedef void(__cdecl* PixelFreeFunc)(void* ptr, uint64_t size, void* user_data);
+
+/**
+ * Routes the memory behind ImagePixelData through the host's allocator, passing null functions restores the built-in one.
+ * Pixel data is always freed with the functions it was allocated with, so switching while images are alive is safe.
+ */
+IMAGE_PORT void __cdecl SetPixelAllocator(PixelAllocFunc alloc_func, PixelFreeFunc free_func, void* user_data);
+
+/**
+ * Lets the built-in allocator back large images with transparent huge pages where the OS supports it. Off by default.
+ */
+IMAGE_PORT void __cdecl SetPixelAllocatorHugePages(bool enable);
+
+/**
+ * Returns the memory the built-in allocator keeps cached for reuse to the OS.
+ */
+IMAGE_PORT void __cdecl TrimPixelAllocator();
+
 IMAGE_PORT bool __cdecl CreatePixelDataFromFile(EImageFormat image_format, const char* file_name, ImageInfo& info, ImagePixelData*& pixel_data);
 
 IMAGE_PORT bool __cdecl CreatePixelData(EImageFormat image_format, const uint8_t* buffer, uint64_t length, ImageInfo& info, ImagePixelData*& pixel_data);
 
+/**
+ * Same as CreatePixelData, scaling the image down while decoding where the format allows it, which is much faster than
+ * decoding at full size and shrinking afterwards. Only JPEG scales, by the nearest factor in 1/8 steps (at least 1/8)
+ * that satisfies the options. Other formats decode at full size. info keeps the full size, pixel_data has the decoded one.
+ * With yuv_planes a color JPEG comes back in one of the YUV formats and a grayscale JPEG as G8, check texture_format
+ * since other images, including JPEGs with an unusual subsampling, still decode to RGBA.
+ * A region has to lie within the image. JPEG then only decodes the MCU rows and columns covering it, other formats decode
+ * fully and copy the region out. The region of a scaled decode covers the same part of the picture, rounded outwards,
+ * and always comes back packed, even with yuv_planes.
+ * max_scans and max_bytes stop a progressive JPEG after its first scans and render those, so the input may be just a
+ * prefix of the file. The decode fails if not even the first scan is complete. Sequential JPEGs have a single scan and
+ * ignore both. Like a region, a decode with either always comes back packed.
+ * A jpeg_index that does not belong to the file is ignored with a warning.
+ */
+IMAGE_PORT bool __cdecl CreatePixelDataWithOptions(EImageFormat image_format, const uint8_t* buffer, uint64_t length, const ImageDecodeOptions& options, ImageInfo& info, ImagePixelData*& pixel_data);
+
+/**
+ * Decodes straight into caller-owned memory, e.g. a mapped upload buffer, instead of a library allocation.
+ * Rows are written dest_stride bytes apart (0 means tightly packed) and the result must not be passed to ReleasePixelData.
+ * If dest is null or dest_capacity is too small, returns false and leaves the required stride and size in pixel_data.
+ */
+IMAGE_PORT bool __cdecl CreatePixelDataInBuffer(EImageFormat image_format, const uint8_t* buffer, uint64_t length, ImageInfo& info, ImagePixelData& pixel_data, uint8_t* dest, uint64_t dest_stride, uint64_t dest_capacity);
+
+/**
+ * Receives rows from DecodeImageRows. rows describes the num_rows rows starting at first_row in its height, and its data
+ * is only valid during the call. Return false to stop decoding.
+ */
+typedef bool(__cdecl* RowsDecodedFunc)(const ImagePixelData& rows, int first_row, void* user_data);
+
+/**
+ * Decodes an image row by row and hands the rows to callback in batches of rows_per_batch (0 for 16) as soon as they are
+ * decoded, so only one batch is ever in memory instead of the whole image. The pixels have the format CreatePixelData
+ * would give them. info is filled before the first callback. Interlaced PNGs have no final rows before their last pass,
+ * they are decoded whole and then handed over the same way. Progressive JPEGs keep their coefficients, but not their
+ * pixels, in memory until the first batch. Only PNG and JPEG can be decoded by rows so far.
+ * Returns false if decoding failed or the callback stopped it.
+ */
+IMAGE_PORT bool __cdecl DecodeImageRows(EImageFormat image_format, const uint8_t* buffer, uint64_t length, int rows_per_batch, ImageInfo& info, RowsDecodedFunc callback, void* user_data);
+
+/**
+ * Decodes num_jobs images on the library's thread pool, largest inputs first so big images do not end up last.
+ * pixel_data and statuses must hold num_jobs entries, infos too unless it is null. Failed jobs get a null pixel_data.
+ * num_threads caps the threads working on this batch including the calling one, 0 uses every core.
+ * Returns true if every job succeeded. Release each pixel_data with ReleasePixelData as usual.
+ */
+IMAGE_PORT bool __cdecl CreatePixelDataBatch(const ImageDecodeJob* jobs, int num_jobs, ImageInfo* infos, ImagePixelData** pixel_data, EDecodeStatus* statuses, int num_threads);
+
+/**
+ * Receives the result of CreatePixelDataAsync on one of the library's threads.
+ * pixel_data is null unless status is Success, and then has to be released with ReleasePixelData as usual.
+ */
+typedef void(__cdecl* DecodeCompleteFunc)(uint64_t ticket, EDecodeStatus status, const ImageInfo& info, ImagePixelData* pixel_data, void* user_data);
+
+/**
+ * Starts decoding on the library's thread pool and returns its ticket right away, or 0 if callback is null.
+ * The callback runs exactly once per ticket, also for failed and cancelled decodes.
+ * buffer must stay valid until the callback has been called.
+ */
+IMAGE_PORT uint64_t __cdecl CreatePixelDataAsync(EImageFormat image_format, const uint8_t* buffer, uint64_t length, DecodeCompleteFunc callback, void* user_data);
+
+/**
+ * Stops an asynchronous decode, a running one within about a row. A JPEG that TurboJPEG decodes in one call finishes
+ * that call, or its current restart band, first. Its callback then reports Cancelled.
+ * Returns false if the callback has already been called or is being called, in which case the decode is not affected.
+ */
+IMAGE_PORT bool __cdecl CancelDecode(uint64_t ticket);
+
+/**
+ * Fills info from the image header alone, without decoding or allocating pixels.
+ * Returns false if the header is missing, malformed or describes an image CreatePixelData cannot decode.
+ */
+IMAGE_PORT bool __cdecl ProbeImage(EImageFormat image_format, const uint8_t* buffer, uint64_t length, ImageInfo& info);
+
+/**
+ * Same as ProbeImage, reading only as much of the file as the header needs.
+ */
+IMAGE_PORT bool __cdecl ProbeImageFromFile(EImageFormat image_format, const char* file_name, ImageInfo& info);
+
+/**
+ * Gets the largest size CreateCompressedData can produce for an image of this size, 0 if the format cannot be encoded
+ * or the options are invalid. For PNG this assumes RGBA16 pixels, the largest ones.
+ */
+IMAGE_PORT uint64_t __cdecl GetMaxCompressedSize(EImageFormat image_format, int width, int height, const ImageEncodeOptions& options);
+
+/**
+ * Encodes pixel_data into dest, which GetMaxCompressedSize bytes are always enough for. JPEG is encoded from RGBA8, BGRA8
+ * or G8 pixels with any stride. Large images without progressive or optimize_huffman are encoded as strips on the
+ * library's thread pool, which adds a restart marker after every MCU row.
+ * PNG is encoded from RGBA8, BGRA8, G8, RGBA16 or G16 pixels with any stride, as fast or as small as png_profile asks.
+ * Large images are deflated in blocks on the library's thread pool, which costs a few bytes per block.
+ * If dest is null or dest_capacity turns out too small, returns false and leaves the size GetMaxCompressedSize reports
+ * in compressed_size, for PNG the one for the format of the pixels.
+ */
+IMAGE_PORT bool __cdecl CreateCompressedData(EImageFormat image_format, const ImagePixelData& pixel_data, const ImageEncodeOptions& options, uint8_t* dest, uint64_t dest_capacity, uint64_t& compressed_size);
+
+/**
+ * Rotates, flips and crops a JPEG without decoding it, so there is no generation loss and it takes a fraction of the time.
+ * If dest is null or dest_capacity is too small, returns false and leaves the size of the transformed JPEG in transformed_size.
+ */
+IMAGE_PORT bool __cdecl TransformJpeg(const uint8_t* buffer, uint64_t length, const JpegTransformOptions& options, uint8_t* dest, uint64_t dest_capacity, uint64_t& transformed_size);
+
+/**
+ * Builds an index of where each MCU row of a JPEG starts, for decoding regions of a large JPEG over and over. With the
+ * index as jpeg_index in ImageDecodeOptions, a region decode skips straight to the MCU rows it needs. Building it decodes
+ * the compressed data once, storing it next to the file saves that on later runs.
+ * Works for baseline JPEGs without restart intervals, those with restart intervals need no index.
+ * If dest is null or dest_capacity is too small, returns false and leaves the size of the index in index_size.
+ */
+IMAGE_PORT bool __cdecl CreateJpegMcuIndex(const uint8_t* buffer, uint64_t length, uint8_t* dest, uint64_t dest_capacity, uint64_t& index_size);
+
+/**
+ * Starts decoding a JPEG whose data arrives in chunks, so pixels are ready long before the whole file is.
+ * Release the decoder with ReleaseIncrementalJpegDecoder.
+ */
+IMAGE_PORT IncrementalJpegDecoder* __cdecl CreateIncrementalJpegDecoder();
+
+/**
+ * Appends the next chunk of the file and decodes as far as the data received so far goes.
+ * Returns false once the data turns out not to be a JPEG that can be decoded, the decoder is then of no further use.
+ */
+IMAGE_PORT bool __cdecl AppendIncrementalJpegData(IncrementalJpegDecoder* decoder, const uint8_t* buffer, uint64_t length);
+
+/**
+ * Reports how far decoding has got. info is filled once the header is complete.
+ */
+IMAGE_PORT void __cdecl GetIncrementalJpegProgress(IncrementalJpegDecoder* decoder, ImageInfo& info, IncrementalJpegProgress& progress);
+
+/**
+ * Describes the decoder's RGBA8 pixels in pixel_data, which must not be passed to ReleasePixelData. They stay valid until
+ * the decoder is released and are updated by each append. A sequential JPEG fills its rows from the top, rows below
+ * rows_complete are still zero. A multi-scan JPEG first renders its latest complete scan, a coarse version of the whole image.
+ * Returns false until the header is complete or if decoding failed.
+ */
+IMAGE_PORT bool __cdecl GetIncrementalJpegPixels(IncrementalJpegDecoder* decoder, ImagePixelData& pixel_data);
+
+IMAGE_PORT void __cdecl ReleaseIncrementalJpegDecoder(IncrementalJpegDecoder*& decoder);
+
+/**
+ * Starts decoding a PNG whose data arrives in chunks of any size, so rows are ready long before the whole file is.
+ * Release the decoder with ReleaseIncrementalPngDecoder.
+ */
+IMAGE_PORT IncrementalPngDecoder* __cdecl CreateIncrementalPngDecoder();
+
+/**
+ * Appends the next chunk of the file and decodes as far as the data received so far goes.
+ * Returns false once the data turns out not to be a PNG that can be decoded, the decoder is then of no further use.
+ */
+IMAGE_PORT bool __cdecl AppendIncrementalPngData(IncrementalPngDecoder* decoder, const uint8_t* buffer, uint64_t length);
+
+/**
+ * Reports how far decoding has got. info is filled once the header is complete.
+ */
+IMAGE_PORT void __cdecl GetIncrementalPngProgress(IncrementalPngDecoder* decoder, ImageInfo& info, IncrementalPngProgress& progress);
+
+/**
+ * Describes the decoder's RGBA8 or RGBA16 pixels in pixel_data, which must not be passed to ReleasePixelData. They stay
+ * valid until the decoder is released and are updated by each append. Rows fill in from the top, pixels not decoded yet
+ * are zero. An interlaced PNG spreads its early passes over the whole image, every pass adding pixels in between.
+ * Returns false until the header is complete or if decoding failed.
+ */
+IMAGE_PORT bool __cdecl GetIncrementalPngPixels(IncrementalPngDecoder* decoder, ImagePixelData& pixel_data);
+
+IMAGE_PORT void __cdecl ReleaseIncrementalPngDecoder(IncrementalPngDecoder*& decoder);
+
+/**
+ * Frees pixel data the library allocated and sets pixel_data to null. Pointers that are not live pixel data, such as one
+ * released before, are ignored. The pointer is the only handle though, with no generation to tell images apart, so once
+ * the memory has gone to a newer image a stale copy of the old pointer releases that image. Keep one owner per pointer.
+ */
 IMAGE_PORT void __cdecl ReleasePixelData(ImagePixelData*& pixel_data);
 
 IMAGE_PORT EImageFormat __cdecl DetectFormat(const void* compressed_data, int64_t compressed_size);
@@ -1,31 +1,143 @@
 ﻿#include "Decoder.h"
 #include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstring>
+#include <fstream>
+#include <functional>
 #include <string>
 #include <memory>
+#include <mutex>
 #include <unordered_map>
+#include "PixelDataPool.h"
 #include "Wrapper/Formats/BmpImageWrapper.h"
 #include "Wrapper/Formats/ExrImageWrapper.h"
 #include "Wrapper/Formats/IcoImageWrapper.h"
 #include "Wrapper/Formats/JpegImageWrapper.h"
 #include "Wrapper/Formats/PngImageWrapper.h"
 #include "Wrapper/ImageWrapperBase.h"
+#include "Wrapper/JpegImageSupport.h"
+#include "Utils/MappedFile.h"
+#include "Utils/PixelAllocator.h"
+#include "Utils/ThreadPool.h"
 #include "Utils/Utils.h"
 
 namespace ImageDecoder {
 
-struct ImagePixelsMemData {
-    std::shared_ptr<ImagePixelData> pixels;
-    std::vector<uint8_t> data;
-};
+FPixelDataPool decoded_pixel_data_pool;
+
+/** Cancel flags of the asynchronous decodes whose callback has not run yet, by ticket */
+std::mutex async_decodes_mutex;
+std::unordered_map<uint64_t, std::shared_ptr<std::atomic<bool>>> async_decodes;
+std::atomic<uint64_t> next_async_ticket(1);
+
+/**
+ * Supplies the memory DecodeImage writes into once the output is known.
+ * Receives the pixel description with a tightly packed stride and size, sets data (and may widen stride and size),
+ * and returns false if it cannot provide the memory.
+ * An empty allocator probes the image: decoding stops once the output has been described.
+ */
+typedef std::function<bool(ImagePixelData& pixels)> FPixelAllocator;
+
+/**
+ * Whether another thread asked the running decode to stop, decoding loops check this once per row.
+ */
+bool IsDecodeCancelled(const std::atomic<bool>* cancelFlag) { return cancelFlag && cancelFlag->load(std::memory_order_relaxed); }
+
+int GetBytesPerPixel(ETextureSourceFormat textureFormat) {
+    switch (textureFormat) {
+        case ETextureSourceFormat::G8: return 1;
+        case ETextureSourceFormat::G16: return 2;
+        case ETextureSourceFormat::BGRA8:
+        case ETextureSourceFormat::BGRE8:
+        case ETextureSourceFormat::RGBA8:
+        case ETextureSourceFormat::RGBE8: return 4;
+        case ETextureSourceFormat::RGBA16:
+        case ETextureSourceFormat::RGBA16F: return 8;
+        default: return 0;
+    }
+}
+
+bool AllocatePixels(ImagePixelData& pixels, ETextureSourceFormat textureFormat, int bitDepth, int width, int height, const FPixelAllocator& allocator) {
+    if (width <= 0 || height <= 0) {
+        std::string error = "Image of " + std::to_string(width) + "x" + std::to_string(height) + " pixels is not supported.";
+        LogMessage(ELogLevel::Error, error.data());
+        return false;
+    }
 
-std::unordered_map<void*, std::shared_ptr<ImagePixelsMemData>> decoded_image_mmem_data_pool;
+    pixels.texture_format = textureFormat;
+    pixels.bit_depth = bitDepth;
+    pixels.data = nullptr;
+    pixels.width = width;
+    pixels.height = height;
+    pixels.size = 0;
+    pixels.stride = 0;
+    if (!allocator) {
+        return false;
+    }
+
+    const int64_t stride = int64_t(width) * GetBytesPerPixel(textureFormat);
+    const int64_t size = stride * height;
+    if (size > INT_MAX) {
+        std::string error = "Image of " + std::to_string(width) + "x" + std::to_string(height) + " pixels is not supported.";
+        LogMessage(ELogLevel::Error, error.data());
+        return false;
+    }
 
-std::shared_ptr<ImagePixelsMemData> AllocPixels() {
-    std::shared_ptr<ImagePixelsMemData> result = std::make_shared<ImagePixelsMemData>();
-    std::shared_ptr<ImagePixelData> pixels = std::make_shared<ImagePixelData>();
-    result->pixels = pixels;
-    decoded_image_mmem_data_pool.emplace(pixels.get(), result);
-    return result;
+    pixels.size = static_cast<int>(size);
+    pixels.stride = static_cast<int>(stride);
+    if (!allocator(pixels)) {
+        return false;
+    }
+
+    // Packed formats are a single plane, described after the allocator had its chance to widen the stride.
+    pixels.num_planes = 1;
+    pixels.plane_offset[0] = 0;
+    pixels.plane_stride[0] = pixels.stride;
+    pixels.plane_width[0] = width;
+    pixels.plane_height[0] = height;
+    return true;
+}
+
+/**
+ * Like AllocatePixels for the planar YUV formats, laying the three 8-bit planes out back to back with tightly packed rows.
+ */
+bool AllocatePlanarPixels(ImagePixelData& pixels, ETextureSourceFormat textureFormat, int width, int height, const int planeWidths[3], const int planeHeights[3], const FPixelAllocator& allocator) {
+    if (width <= 0 || height <= 0) {
+        std::string error = "Image of " + std::to_string(width) + "x" + std::to_string(height) + " pixels is not supported.";
+        LogMessage(ELogLevel::Error, error.data());
+        return false;
+    }
+
+    pixels.texture_format = textureFormat;
+    pixels.bit_depth = 8;
+    pixels.data = nullptr;
+    pixels.width = width;
+    pixels.height = height;
+    pixels.size = 0;
+    pixels.stride = 0;
+    if (!allocator) {
+        return false;
+    }
+
+    int64_t size = 0;
+    pixels.num_planes = 3;
+    for (int plane = 0; plane < 3; plane++) {
+        pixels.plane_offset[plane] = static_cast<int>(size);
+        pixels.plane_stride[plane] = planeWidths[plane];
+        pixels.plane_width[plane] = planeWidths[plane];
+        pixels.plane_height[plane] = planeHeights[plane];
+        size += int64_t(planeWidths[plane]) * planeHeights[plane];
+        if (size > INT_MAX) {
+            std::string error = "Image of " + std::to_string(width) + "x" + std::to_string(height) + " pixels is not supported.";
+            LogMessage(ELogLevel::Error, error.data());
+            return false;
+        }
+    }
+
+    pixels.size = static_cast<int>(size);
+    pixels.stride = pixels.plane_stride[0];
+    return allocator(pixels);
 }
 
 // .PCX file header.
@@ -51,9 +163,9 @@ public:
     uint16_t vScreenSize;     // Vertical monitor size.
     uint8_t reserved2[54];    // Must be 0.
 };
+#pragma pack(pop)
 
 #pragma pack(push, 1)
-
 struct FTGAFileHeader {
     uint8_t idFieldLength;
     uint8_t colorMapType;
@@ -68,9 +180,10 @@ struct FTGAFileHeader {
     uint8_t bitsPerPixel;
     uint8_t imageDescriptor;
 };
+#pragma pack(pop)
 
-// Output B8-G8-R8-A8
-void DecompressTGA_RLE_32bpp(const FTGAFileHeader* TGA, uint32_t* textureData) {
+// Output B8-G8-R8-A8, false if the packets run past dataEnd
+bool DecompressTGA_RLE_32bpp(const FTGAFileHeader* TGA, const uint8_t* dataEnd, uint8_t* textureData, uint64_t stride, const std::atomic<bool>* cancelFlag) {
     uint8_t* idData = (uint8_t*)TGA + sizeof(FTGAFileHeader);
     uint8_t* colorMap = idData + TGA->idFieldLength;
     uint8_t* imageData = (uint8_t*)(colorMap + (TGA->colorMapEntrySize + 4) / 8 * TGA->colorMapLength);
@@ -80,11 +193,18 @@ void DecompressTGA_RLE_32bpp(const FTGAFileHeader* TGA, uint32_t* textureData) {
 
     for (int y = TGA->height - 1; y >= 0; y--)  // Y-flipped.
     {
+        if (IsDecodeCancelled(cancelFlag)) {
+            return false;
+        }
+        uint32_t* textureRow = (uint32_t*)(textureData + y * stride);
         for (int x = 0; x < TGA->width; x++) {
             if (RLERun > 0) {
                 RLERun--;            // reuse current Pixel data.
             } else if (RAWRun == 0)  // new raw pixel or RLE-run.
             {
+                if (imageData >= dataEnd) {
+                    return false;
+                }
                 uint8_t RLEChunk = *(imageData++);
                 if (RLEChunk & 0x80) {
                     RLERun = (RLEChunk & 0x7F) + 1;
@@ -95,19 +215,23 @@ void DecompressTGA_RLE_32bpp(const FTGAFileHeader* TGA, uint32_t* textureData) {
             }
             // Retrieve new pixel data - raw run or single pixel for RLE stretch.
             if (RAWRun > 0) {
+                if (dataEnd - imageData < 4) {
+                    return false;
+                }
                 pixel = *(uint32_t*)imageData;  // RGBA 32-bit dword.
                 imageData += 4;
                 RAWRun--;
                 RLERun--;
             }
             // Store.
-            *((textureData + y * TGA->width) + x) = pixel;
+            textureRow[x] = pixel;
         }
     }
+    return true;
 }
 
-// Output B8-G8-R8-A8(255)
-void DecompressTGA_RLE_24bpp(const FTGAFileHeader* TGA, uint32_t* textureData) {
+// Output B8-G8-R8-A8(255), false if the packets run past dataEnd
+bool DecompressTGA_RLE_24bpp(const FTGAFileHeader* TGA, const uint8_t* dataEnd, uint8_t* textureData, uint64_t stride, const std::atomic<bool>* cancelFlag) {
     uint8_t* IdData = (uint8_t*)TGA + sizeof(FTGAFileHeader);
     uint8_t* colorMap = IdData + TGA->idFieldLength;
     uint8_t* imageData = (uint8_t*)(colorMap + (TGA->colorMapEntrySize + 4) / 8 * TGA->colorMapLength);
@@ -117,11 +241,18 @@ void DecompressTGA_RLE_24bpp(const FTGAFileHeader* TGA, uint32_t* textureData) {
 
     for (int y = TGA->height - 1; y >= 0; y--)  // Y-flipped.
     {
+        if (IsDecodeCancelled(cancelFlag)) {
+            return false;
+        }
+        uint32_t* textureRow = (uint32_t*)(textureData + y * stride);
         for (int x = 0; x < TGA->width; x++) {
             if (RLERun > 0)
                 RLERun--;          // reuse current Pixel data.
             else if (RAWRun == 0)  // new raw pixel or RLE-run.
             {
+                if (imageData >= dataEnd) {
+                    return false;
+                }
                 uint8_t RLEChunk = *(imageData++);
                 if (RLEChunk & 0x80) {
                     RLERun = (RLEChunk & 0x7F) + 1;
@@ -132,6 +263,9 @@ void DecompressTGA_RLE_24bpp(const FTGAFileHeader* TGA, uint32_t* textureData) {
             }
             // Retrieve new pixel data - raw run or single pixel for RLE stretch.
             if (RAWRun > 0) {
+                if (dataEnd - imageData < 3) {
+                    return false;
+                }
                 pixel[0] = *(imageData++);
                 pixel[1] = *(imageData++);
                 pixel[2] = *(imageData++);
@@ -140,13 +274,14 @@ void DecompressTGA_RLE_24bpp(const FTGAFileHeader* TGA, uint32_t* textureData) {
                 RLERun--;
             }
             // Store.
-            *((textureData + y * TGA->width) + x) = *(uint32_t*)&pixel;
+            textureRow[x] = *(uint32_t*)&pixel;
         }
     }
+    return true;
 }
 
-// Output B8-G8-R8-A8
-void DecompressTGA_RLE_16bpp(const FTGAFileHeader* TGA, uint32_t* textureData) {
+// Output B8-G8-R8-A8, false if the packets run past dataEnd
+bool DecompressTGA_RLE_16bpp(const FTGAFileHeader* TGA, const uint8_t* dataEnd, uint8_t* textureData, uint64_t stride, const std::atomic<bool>* cancelFlag) {
     uint8_t* IdData = (uint8_t*)TGA + sizeof(FTGAFileHeader);
     uint8_t* colorMap = IdData + TGA->idFieldLength;
     uint16_t* imageData = (uint16_t*)(colorMap + (TGA->colorMapEntrySize + 4) / 8 * TGA->colorMapLength);
@@ -157,11 +292,18 @@ void DecompressTGA_RLE_16bpp(const FTGAFileHeader* TGA, uint32_t* textureData) {
 
     for (int y = TGA->height - 1; y >= 0; y--)  // Y-flipped.
     {
+        if (IsDecodeCancelled(cancelFlag)) {
+            return false;
+        }
+        uint32_t* textureRow = (uint32_t*)(textureData + y * stride);
         for (int x = 0; x < TGA->width; x++) {
             if (RLERun > 0)
                 RLERun--;          // reuse current Pixel data.
             else if (RAWRun == 0)  // new raw pixel or RLE-run.
             {
+                if ((const uint8_t*)imageData >= dataEnd) {
+                    return false;
+                }
                 uint8_t RLEChunk = *((uint8_t*)imageData);
                 imageData = (uint16_t*)(((uint8_t*)imageData) + 1);
                 if (RLEChunk & 0x80) {
@@ -173,6 +315,9 @@ void DecompressTGA_RLE_16bpp(const FTGAFileHeader* TGA, uint32_t* textureData) {
             }
             // Retrieve new pixel data - raw run or single pixel for RLE stretch.
             if (RAWRun > 0) {
+                if (dataEnd - (const uint8_t*)imageData < 2) {
+                    return false;
+                }
                 filePixel = *(imageData++);
                 RAWRun--;
                 RLERun--;
@@ -183,24 +328,28 @@ void DecompressTGA_RLE_16bpp(const FTGAFileHeader* TGA, uint32_t* textureData) {
             texturePixel |= (filePixel & 0x7C00) << 9;
             texturePixel |= (filePixel & 0x8000) << 16;
             // Store.
-            *((textureData + y * TGA->width) + x) = texturePixel;
+            textureRow[x] = texturePixel;
         }
     }
+    return true;
 }
 
 // Output B8-G8-R8-A8
-void DecompressTGA_32bpp(const FTGAFileHeader* TGA, uint32_t* textureData) {
+void DecompressTGA_32bpp(const FTGAFileHeader* TGA, uint8_t* textureData, uint64_t stride, const std::atomic<bool>* cancelFlag) {
     uint8_t* IdData = (uint8_t*)TGA + sizeof(FTGAFileHeader);
     uint8_t* colorMap = IdData + TGA->idFieldLength;
     uint32_t* imageData = (uint32_t*)(colorMap + (TGA->colorMapEntrySize + 4) / 8 * TGA->colorMapLength);
 
     for (int Y = 0; Y < TGA->height; Y++) {
-        memcpy(textureData + Y * TGA->width, imageData + (TGA->height - Y - 1) * TGA->width, TGA->width * 4);
+        if (IsDecodeCancelled(cancelFlag)) {
+            return;
+        }
+        memcpy(textureData + Y * stride, imageData + (TGA->height - Y - 1) * TGA->width, TGA->width * 4);
     }
 }
 
 // Output B8-G8-R8-A8
-void DecompressTGA_16bpp(const FTGAFileHeader* TGA, uint32_t* textureData) {
+void DecompressTGA_16bpp(const FTGAFileHeader* TGA, uint8_t* textureData, uint64_t stride, const std::atomic<bool>* cancelFlag) {
     uint8_t* IdData = (uint8_t*)TGA + sizeof(FTGAFileHeader);
     uint8_t* colorMap = IdData + TGA->idFieldLength;
     uint16_t* imageData = (uint16_t*)(colorMap + (TGA->colorMapEntrySize + 4) / 8 * TGA->colorMapLength);
@@ -208,6 +357,10 @@ void DecompressTGA_16bpp(const FTGAFileHeader* TGA, uint32_t* textureData) {
     uint32_t texturePixel = 0;
 
     for (int y = TGA->height - 1; y >= 0; y--) {
+        if (IsDecodeCancelled(cancelFlag)) {
+            return;
+        }
+        uint32_t* textureRow = (uint32_t*)(textureData + y * stride);
         for (int x = 0; x < TGA->width; x++) {
             filePixel = *imageData++;
             // Convert file format A1R5G5B5 into pixel format B8G8R8A8
@@ -216,66 +369,79 @@ void DecompressTGA_16bpp(const FTGAFileHeader* TGA, uint32_t* textureData) {
             texturePixel |= (filePixel & 0x7C00) << 9;
             texturePixel |= (filePixel & 0x8000) << 16;
             // Store.
-            *((textureData + y * TGA->width) + x) = texturePixel;
+            textureRow[x] = texturePixel;
         }
     }
 }
 
 // Output B8-G8-R8-A8(255)
-void DecompressTGA_24bpp(const FTGAFileHeader* TGA, uint32_t* textureData) {
+void DecompressTGA_24bpp(const FTGAFileHeader* TGA, uint8_t* textureData, uint64_t stride, const std::atomic<bool>* cancelFlag) {
     uint8_t* IdData = (uint8_t*)TGA + sizeof(FTGAFileHeader);
     uint8_t* colorMap = IdData + TGA->idFieldLength;
     uint8_t* imageData = (uint8_t*)(colorMap + (TGA->colorMapEntrySize + 4) / 8 * TGA->colorMapLength);
     uint8_t pixel[4];
 
     for (int y = 0; y < TGA->height; y++) {
+        if (IsDecodeCancelled(cancelFlag)) {
+            return;
+        }
+        uint32_t* textureRow = (uint32_t*)(textureData + y * stride);
         for (int x = 0; x < TGA->width; x++) {
             pixel[0] = *((imageData + (TGA->height - y - 1) * TGA->width * 3) + x * 3 + 0);
             pixel[1] = *((imageData + (TGA->height - y - 1) * TGA->width * 3) + x * 3 + 1);
             pixel[2] = *((imageData + (TGA->height - y - 1) * TGA->width * 3) + x * 3 + 2);
             pixel[3] = 255;
-            *((textureData + y * TGA->width) + x) = *(uint32_t*)&pixel;
+            textureRow[x] = *(uint32_t*)&pixel;
         }
     }
 }
 
-void DecompressTGA_8bpp(const FTGAFileHeader* TGA, uint8_t* textureData) {
+void DecompressTGA_8bpp(const FTGAFileHeader* TGA, uint8_t* textureData, uint64_t stride, const std::atomic<bool>* cancelFlag) {
     const uint8_t* const IdData = (uint8_t*)TGA + sizeof(FTGAFileHeader);
     const uint8_t* const colorMap = IdData + TGA->idFieldLength;
     const uint8_t* const imageData = (uint8_t*)(colorMap + (TGA->colorMapEntrySize + 4) / 8 * TGA->colorMapLength);
 
     int RevY = 0;
     for (int y = TGA->height - 1; y >= 0; --y) {
+        if (IsDecodeCancelled(cancelFlag)) {
+            return;
+        }
         const uint8_t* ImageCol = imageData + (y * TGA->width);
-        uint8_t* TextureCol = textureData + (RevY++ * TGA->width);
+        uint8_t* TextureCol = textureData + (RevY++ * stride);
         memcpy(TextureCol, ImageCol, TGA->width);
     }
 }
 
-bool DecompressTGA_helper(const FTGAFileHeader* TGA, uint32_t*& textureData, const int textureDataSize) {
+bool DecompressTGA_helper(const FTGAFileHeader* TGA, const uint8_t* dataEnd, uint8_t* textureData, uint64_t stride, const std::atomic<bool>* cancelFlag) {
     if (TGA->imageTypeCode == 10)  // 10 = RLE compressed
     {
         // RLE compression: CHUNKS: 1 -byte header, high bit 0 = raw, 1 = compressed
         // bits 0-6 are a 7-bit count; count+1 = number of raw pixels following, or rle pixels to be expanded.
+        // Every pixel takes one step of a run, so writes stay within the image; reads are checked against dataEnd.
+        bool bComplete = false;
         if (TGA->bitsPerPixel == 32) {
-            DecompressTGA_RLE_32bpp(TGA, textureData);
+            bComplete = DecompressTGA_RLE_32bpp(TGA, dataEnd, textureData, stride, cancelFlag);
         } else if (TGA->bitsPerPixel == 24) {
-            DecompressTGA_RLE_24bpp(TGA, textureData);
+            bComplete = DecompressTGA_RLE_24bpp(TGA, dataEnd, textureData, stride, cancelFlag);
         } else if (TGA->bitsPerPixel == 16) {
-            DecompressTGA_RLE_16bpp(TGA, textureData);
+            bComplete = DecompressTGA_RLE_16bpp(TGA, dataEnd, textureData, stride, cancelFlag);
         } else {
             std::string error = "TGA uses an unsupported rle-compressed bit-depth: " + std::to_string(TGA->bitsPerPixel);
             LogMessage(ELogLevel::Error, error.data());
             return false;
         }
+        if (!bComplete && !IsDecodeCancelled(cancelFlag)) {
+            LogMessage(ELogLevel::Error, "TGA rle-compressed data is truncated.");
+            return false;
+        }
     } else if (TGA->imageTypeCode == 2)  // 2 = Uncompressed RGB
     {
         if (TGA->bitsPerPixel == 32) {
-            DecompressTGA_32bpp(TGA, textureData);
+            DecompressTGA_32bpp(TGA, textureData, stride, cancelFlag);
         } else if (TGA->bitsPerPixel == 16) {
-            DecompressTGA_16bpp(TGA, textureData);
+            DecompressTGA_16bpp(TGA, textureData, stride, cancelFlag);
         } else if (TGA->bitsPerPixel == 24) {
-            DecompressTGA_24bpp(TGA, textureData);
+            DecompressTGA_24bpp(TGA, textureData, stride, cancelFlag);
         } else {
             std::string error = "TGA uses an unsupported bit-depth: " + std::to_string(TGA->bitsPerPixel);
             LogMessage(ELogLevel::Error, error.data());
@@ -284,68 +450,62 @@ bool DecompressTGA_helper(const FTGAFileHeader* TGA, uint32_t*& textureData, con
     }
     // Support for alpha stored as pseudo-color 8-bit TGA
     else if (TGA->colorMapType == 1 && TGA->imageTypeCode == 1 && TGA->bitsPerPixel == 8) {
-        DecompressTGA_8bpp(TGA, (uint8_t*)textureData);
+        DecompressTGA_8bpp(TGA, textureData, stride, cancelFlag);
     }
     // standard grayscale
     else if (TGA->colorMapType == 0 && TGA->imageTypeCode == 3 && TGA->bitsPerPixel == 8) {
-        DecompressTGA_8bpp(TGA, (uint8_t*)textureData);
+        DecompressTGA_8bpp(TGA, textureData, stride, cancelFlag);
     } else {
         std::string error = "TGA is an unsupported type: " + std::to_string(TGA->imageTypeCode);
         LogMessage(ELogLevel::Error, error.data());
         return false;
     }
 
+    if (IsDecodeCancelled(cancelFlag)) {
+        return false;
+    }
+
     // Flip the image data if the flip bits are set in the TGA header.
     bool flipX = (TGA->imageDescriptor & 0x10) ? 1 : 0;
     bool flipY = (TGA->imageDescriptor & 0x20) ? 1 : 0;
     if (flipY || flipX) {
-        std::vector<uint8_t> FlippedData;
-        FlippedData.resize(textureDataSize);
-
+        // Flipped in place, one row at a time, so that rows outside the image (stride padding) are never touched.
         int numBlocksX = TGA->width;
         int numBlocksY = TGA->height;
         int blockBytes = TGA->bitsPerPixel == 8 ? 1 : 4;
 
-        uint8_t* mipData = (uint8_t*)textureData;
+        if (flipX) {
+            for (int Y = 0; Y < numBlocksY; Y++) {
+                uint8_t* row = textureData + Y * stride;
+                for (int X = 0; X < numBlocksX / 2; X++) {
+                    std::swap_ranges(row + X * blockBytes, row + (X + 1) * blockBytes, row + (numBlocksX - X - 1) * blockBytes);
+                }
+            }
+        }
 
-        for (int Y = 0; Y < numBlocksY; Y++) {
-            for (int X = 0; X < numBlocksX; X++) {
-                int DestX = flipX ? (numBlocksX - X - 1) : X;
-                int DestY = flipY ? (numBlocksY - Y - 1) : Y;
-                memcpy(&FlippedData[(DestX + DestY * numBlocksX) * blockBytes], &mipData[(X + Y * numBlocksX) * blockBytes], blockBytes);
+        if (flipY) {
+            for (int Y = 0; Y < numBlocksY / 2; Y++) {
+                uint8_t* row = textureData + Y * stride;
+                std::swap_ranges(row, row + numBlocksX * blockBytes, textureData + (numBlocksY - Y - 1) * stride);
             }
         }
-        memcpy(mipData, FlippedData.data(), FlippedData.size());
     }
 
     return true;
 }
 
-bool DecompressTGA(const FTGAFileHeader* TGA, std::shared_ptr<ImagePixelsMemData>& PixelsMemData) {
+bool DecompressTGA(const FTGAFileHeader* TGA, uint64_t length, ImageInfo& info, ImagePixelData& pixels, const FPixelAllocator& allocator, const std::atomic<bool>* cancelFlag) {
+    ETextureSourceFormat textureFormat = ETextureSourceFormat::Invalid;
     if (TGA->colorMapType == 1 && TGA->imageTypeCode == 1 && TGA->bitsPerPixel == 8) {
-        PixelsMemData = AllocPixels();
         // Notes: The Scaleform GFx exporter (dll) strips all font glyphs into a single 8-bit texture.
         // The targa format uses this for a palette index; GFx uses a palette of (i,i,i,i) so the index
         // is also the alpha value.
         //
         // We store the image as PF_G8, where it will be used as alpha in the Glyph shader.
-        PixelsMemData->pixels->width = TGA->width;
-        PixelsMemData->pixels->height = TGA->height;
-        PixelsMemData->pixels->texture_format = ETextureSourceFormat::G8;
-        PixelsMemData->pixels->bit_depth = 8;
-        PixelsMemData->pixels->bit_depth = 8;
-        PixelsMemData->data.resize(TGA->width * TGA->height * 1);
-        PixelsMemData->pixels->data = PixelsMemData->data.data();
-        PixelsMemData->pixels->size = PixelsMemData->data.size();
+        textureFormat = ETextureSourceFormat::G8;
     } else if (TGA->colorMapType == 0 && TGA->imageTypeCode == 3 && TGA->bitsPerPixel == 8) {
         // standard grayscale images
-        PixelsMemData->pixels->width = TGA->width;
-        PixelsMemData->pixels->height = TGA->height;
-        PixelsMemData->pixels->texture_format = ETextureSourceFormat::G8;
-        PixelsMemData->pixels->bit_depth = 8;
-        PixelsMemData->data.resize(TGA->width * TGA->height * 1);
-        PixelsMemData->pixels->data = PixelsMemData->data.data();
-        PixelsMemData->pixels->size = PixelsMemData->data.size();
+        textureFormat = ETextureSourceFormat::G8;
     } else {
         if (TGA->imageTypeCode == 10)  // 10 = RLE compressed
         {
@@ -361,29 +521,78 @@ bool DecompressTGA(const FTGAFileHeader* TGA, std::shared_ptr<ImagePixelsMemData
                 return false;
             }
         }
+        textureFormat = ETextureSourceFormat::BGRA8;
+    }
+
+    // The data may be a mapping of the file, where reading past its end faults instead of reading garbage.
+    const uint64_t imageDataOffset = sizeof(FTGAFileHeader) + TGA->idFieldLength + uint64_t(TGA->colorMapEntrySize + 4) / 8 * TGA->colorMapLength;
+    const uint64_t imageDataSize = uint64_t(TGA->width) * TGA->height * (TGA->bitsPerPixel / 8);
+    if (imageDataOffset > length || (TGA->imageTypeCode != 10 && length - imageDataOffset < imageDataSize)) {
+        LogMessage(ELogLevel::Error, "TGA image data is truncated.");
+        return false;
+    }
+
+    info.type = EImageFormat::TGA;
+    info.rgb_format = textureFormat == ETextureSourceFormat::BGRA8 ? ERGBFormat::BGRA : ERGBFormat::Gray;
+    info.bit_depth = 8;
+    info.width = TGA->width;
+    info.height = TGA->height;
+
+    if (!AllocatePixels(pixels, textureFormat, 8, TGA->width, TGA->height, allocator)) {
+        return false;
+    }
+
+    return DecompressTGA_helper(TGA, (const uint8_t*)TGA + length, pixels.data, pixels.stride, cancelFlag);
+}
 
-        PixelsMemData->pixels->width = TGA->width;
-        PixelsMemData->pixels->height = TGA->height;
-        PixelsMemData->pixels->texture_format = ETextureSourceFormat::BGRA8;
-        PixelsMemData->pixels->bit_depth = 8;
-        PixelsMemData->data.resize(TGA->width * TGA->height * 4);
-        PixelsMemData->pixels->data = PixelsMemData->data.data();
-        PixelsMemData->pixels->size = PixelsMemData->data.size();
+bool HasRegion(const ImageDecodeOptions& options) { return options.region_width != 0 && options.region_height != 0; }
+
+bool DecodeImage(EImageFormat imageFormat, const uint8_t* buffer, uint64_t length, ImageInfo& info, ImagePixelData& pixels, const FPixelAllocator& allocator, const std::atomic<bool>* cancelFlag = nullptr, const ImageDecodeOptions* options = nullptr);
+
+/**
+ * Decodes the whole image into a temporary buffer and copies the region in options to the allocator's memory.
+ * For formats whose decoders cannot skip to a rectangle of the image.
+ */
+bool DecodeImageRegion(EImageFormat imageFormat, const uint8_t* buffer, uint64_t length, ImageInfo& info, ImagePixelData& pixels, const FPixelAllocator& allocator, const std::atomic<bool>* cancelFlag, const ImageDecodeOptions& options) {
+    std::vector<uint8_t> fullData;
+    ImagePixelData fullPixels = {};
+    const bool bDecoded = DecodeImage(imageFormat, buffer, length, info, fullPixels, [&fullData](ImagePixelData& pixels) {
+        fullData.resize(pixels.size);
+        pixels.data = fullData.data();
+        return true;
+    }, cancelFlag);
+    if (!bDecoded) {
+        return false;
     }
 
-    size_t TextureDataSize = PixelsMemData->data.size();
-    uint32_t* TextureData = (uint32_t*)PixelsMemData->pixels->data;
+    if (options.region_x < 0 || options.region_y < 0 || options.region_width <= 0 || options.region_height <= 0 || int64_t(options.region_x) + options.region_width > fullPixels.width || int64_t(options.region_y) + options.region_height > fullPixels.height) {
+        LogMessage(ELogLevel::Error, "Decode region does not lie within the image.");
+        return false;
+    }
+    if (!AllocatePixels(pixels, fullPixels.texture_format, fullPixels.bit_depth, options.region_width, options.region_height, allocator)) {
+        return false;
+    }
 
-    return DecompressTGA_helper(TGA, TextureData, static_cast<int>(TextureDataSize));
+    const uint64_t bytesPerPixel = GetBytesPerPixel(fullPixels.texture_format);
+    const uint8_t* source = fullPixels.data + options.region_y * uint64_t(fullPixels.stride) + options.region_x * bytesPerPixel;
+    for (int row = 0; row < options.region_height; row++) {
+        memcpy(pixels.data + row * uint64_t(pixels.stride), source + row * uint64_t(fullPixels.stride), options.region_width * bytesPerPixel);
+    }
+    return true;
 }
 
-bool DecodeImage(EImageFormat imageFormat, const uint8_t* buffer, uint32_t length, ImageInfo& info, std::shared_ptr<ImagePixelsMemData>& PixelsMemData) {
+bool DecodeImage(EImageFormat imageFormat, const uint8_t* buffer, uint64_t length, ImageInfo& info, ImagePixelData& pixels, const FPixelAllocator& allocator, const std::atomic<bool>* cancelFlag, const ImageDecodeOptions* options) {
+    // Only JPEG can decode part of an image, the other formats are cropped after a full decode. Probing skips the decode.
+    if (options && HasRegion(*options) && imageFormat != EImageFormat::JPEG && allocator) {
+        return DecodeImageRegion(imageFormat, buffer, length, info, pixels, allocator, cancelFlag, *options);
+    }
+
     //
     // PNG
     //
     if (imageFormat == EImageFormat::PNG) {
         std::shared_ptr<IImageWrapper> pngImageWrapper = std::make_shared<FPngImageWrapper>();
-        if (pngImageWrapper && pngImageWrapper->SetCompressed(buffer, length)) {
+        if (pngImageWrapper && pngImageWrapper->SetCompressedView(buffer, length)) {
             // Select the texture's source format
             ETextureSourceFormat textureFormat = ETextureSourceFormat::Invalid;
             int bitDepth = pngImageWrapper->GetBitDepth();
@@ -419,20 +628,19 @@ bool DecodeImage(EImageFormat imageFormat, const uint8_t* buffer, uint32_t lengt
                 return false;
             }
 
-            PixelsMemData = AllocPixels();
-            info.width = PixelsMemData->pixels->width = pngImageWrapper->GetWidth();
-            info.height = PixelsMemData->pixels->height = pngImageWrapper->GetHeight();
-            PixelsMemData->pixels->texture_format = textureFormat;
-            PixelsMemData->pixels->bit_depth = bitDepth;
+            info.width = pngImageWrapper->GetWidth();
+            info.height = pngImageWrapper->GetHeight();
+            if (!AllocatePixels(pixels, textureFormat, bitDepth, info.width, info.height, allocator)) {
+                return false;
+            }
 
-            if (!pngImageWrapper->GetRaw(format, bitDepth, PixelsMemData->data)) {
-                decoded_image_mmem_data_pool.erase(PixelsMemData->pixels.get());
-                PixelsMemData = nullptr;
-                LogMessage(ELogLevel::Error, "Failed to decode PNG.");
+            pngImageWrapper->SetCancelFlag(cancelFlag);
+            if (!pngImageWrapper->GetRaw(format, bitDepth, pixels.data, pixels.stride, pixels.size)) {
+                if (!IsDecodeCancelled(cancelFlag)) {
+                    LogMessage(ELogLevel::Error, "Failed to decode PNG.");
+                }
                 return false;
             }
-            PixelsMemData->pixels->data = PixelsMemData->data.data();
-            PixelsMemData->pixels->size = PixelsMemData->data.size();
             return true;
         }
     }
@@ -441,8 +649,8 @@ bool DecodeImage(EImageFormat imageFormat, const uint8_t* buffer, uint32_t lengt
     // JPEG
     //
     if (imageFormat == EImageFormat::JPEG) {
-        std::shared_ptr<IImageWrapper> jpegImageWrapper = std::make_shared<FJpegImageWrapper>();
-        if (jpegImageWrapper && jpegImageWrapper->SetCompressed(buffer, length)) {
+        std::shared_ptr<FJpegImageWrapper> jpegImageWrapper = std::make_shared<FJpegImageWrapper>();
+        if (jpegImageWrapper && jpegImageWrapper->SetCompressedView(buffer, length)) {
             // Select the texture's source format
             ETextureSourceFormat textureFormat = ETextureSourceFormat::Invalid;
             int bitDepth = jpegImageWrapper->GetBitDepth();
@@ -478,20 +686,70 @@ bool DecodeImage(EImageFormat imageFormat, const uint8_t* buffer, uint32_t lengt
                 return false;
             }
 
-            PixelsMemData = AllocPixels();
-            info.width = PixelsMemData->pixels->width = jpegImageWrapper->GetWidth();
-            info.height = PixelsMemData->pixels->height = jpegImageWrapper->GetHeight();
-            PixelsMemData->pixels->texture_format = textureFormat;
-            PixelsMemData->pixels->bit_depth = bitDepth;
+            info.width = jpegImageWrapper->GetWidth();
+            info.height = jpegImageWrapper->GetHeight();
+            const bool bRegion = options && HasRegion(*options);
+            if (options) {
+                jpegImageWrapper->SelectScale(options->max_dimension, options->scale_num, options->scale_denom);
+                jpegImageWrapper->SetScanLimit(options->max_scans, options->max_bytes);
+            }
+            const bool bScanLimited = options && (options->max_scans != 0 || options->max_bytes != 0);
+            if (bRegion && !jpegImageWrapper->SetRegion(options->region_x, options->region_y, options->region_width, options->region_height)) {
+                LogMessage(ELogLevel::Error, "Decode region does not lie within the image.");
+                return false;
+            }
+
+            // The wrapper reads the index while decoding below.
+            FJpegMcuIndex mcuIndex;
+            if (bRegion && options->jpeg_index) {
+                if (mcuIndex.Deserialize(options->jpeg_index, options->jpeg_index_length, buffer, length)) {
+                    jpegImageWrapper->SetMcuIndex(&mcuIndex);
+                } else {
+                    LogMessage(ELogLevel::Warning, "JPEG index does not belong to this file, the region is decoded without it.");
+                }
+            }
+
+            // Planar output hands the renderer the decoder's own planes, grayscale images already are just the Y plane.
+            const ETextureSourceFormat yuvFormat = jpegImageWrapper->GetYUVFormat();
+            if (options && options->yuv_planes && !bRegion && !bScanLimited && yuvFormat != ETextureSourceFormat::Invalid) {
+                int planeWidths[3];
+                int planeHeights[3];
+                for (int plane = 0; plane < 3; plane++) {
+                    planeWidths[plane] = jpegImageWrapper->GetPlaneWidth(plane);
+                    planeHeights[plane] = jpegImageWrapper->GetPlaneHeight(plane);
+                }
+                if (!AllocatePlanarPixels(pixels, yuvFormat, jpegImageWrapper->GetScaledWidth(), jpegImageWrapper->GetScaledHeight(), planeWidths, planeHeights, allocator)) {
+                    return false;
+                }
+
+                uint8_t* planes[3];
+                for (int plane = 0; plane < 3; plane++) {
+                    planes[plane] = pixels.data + pixels.plane_offset[plane];
+                }
+                jpegImageWrapper->SetCancelFlag(cancelFlag);
+                if (!jpegImageWrapper->GetYUVPlanes(planes, pixels.plane_stride)) {
+                    if (!IsDecodeCancelled(cancelFlag)) {
+                        LogMessage(ELogLevel::Error, "Failed to decode JPEG.");
+                    }
+                    return false;
+                }
+                return true;
+            } else if (options && options->yuv_planes && jpegImageWrapper->GetFormat() == ERGBFormat::Gray) {
+                textureFormat = ETextureSourceFormat::G8;
+                format = ERGBFormat::Gray;
+            }
+
+            if (!AllocatePixels(pixels, textureFormat, bitDepth, jpegImageWrapper->GetOutputWidth(), jpegImageWrapper->GetOutputHeight(), allocator)) {
+                return false;
+            }
 
-            if (!jpegImageWrapper->GetRaw(format, bitDepth, PixelsMemData->data)) {
-                decoded_image_mmem_data_pool.erase(PixelsMemData->pixels.get());
-                PixelsMemData = nullptr;
-                LogMessage(ELogLevel::Error, "Failed to decode JPEG.");
+            jpegImageWrapper->SetCancelFlag(cancelFlag);
+            if (!jpegImageWrapper->GetRaw(format, bitDepth, pixels.data, pixels.stride, pixels.size)) {
+                if (!IsDecodeCancelled(cancelFlag)) {
+                    LogMessage(ELogLevel::Error, "Failed to decode JPEG.");
+                }
                 return false;
             }
-            PixelsMemData->pixels->data = PixelsMemData->data.data();
-            PixelsMemData->pixels->size = PixelsMemData->data.size();
             return true;
         }
     }
@@ -501,7 +759,7 @@ bool DecodeImage(EImageFormat imageFormat, const uint8_t* buffer, uint32_t lengt
     //
     if (imageFormat == EImageFormat::EXR) {
         std::shared_ptr<IImageWrapper> exrImageWrapper = std::make_shared<FExrImageWrapper>();
-        if (exrImageWrapper && exrImageWrapper->SetCompressed(buffer, length)) {
+        if (exrImageWrapper && exrImageWrapper->SetCompressedView(buffer, length)) {
             int width = exrImageWrapper->GetWidth();
             int height = exrImageWrapper->GetHeight();
 
@@ -523,20 +781,19 @@ bool DecodeImage(EImageFormat imageFormat, const uint8_t* buffer, uint32_t lengt
                 return false;
             }
 
-            PixelsMemData = AllocPixels();
-            info.width = PixelsMemData->pixels->width = width;
-            info.height = PixelsMemData->pixels->height = height;
-            PixelsMemData->pixels->texture_format = textureFormat;
-            PixelsMemData->pixels->bit_depth = bitDepth;
+            info.width = width;
+            info.height = height;
+            if (!AllocatePixels(pixels, textureFormat, bitDepth, width, height, allocator)) {
+                return false;
+            }
 
-            if (!exrImageWrapper->GetRaw(format, bitDepth, PixelsMemData->data)) {
-                decoded_image_mmem_data_pool.erase(PixelsMemData->pixels.get());
-                PixelsMemData = nullptr;
-                LogMessage(ELogLevel::Error, "Failed to decode EXR.");
+            exrImageWrapper->SetCancelFlag(cancelFlag);
+            if (!exrImageWrapper->GetRaw(format, bitDepth, pixels.data, pixels.stride, pixels.size)) {
+                if (!IsDecodeCancelled(cancelFlag)) {
+                    LogMessage(ELogLevel::Error, "Failed to decode EXR.");
+                }
                 return false;
             }
-            PixelsMemData->pixels->data = PixelsMemData->data.data();
-            PixelsMemData->pixels->size = PixelsMemData->data.size();
             return true;
         }
     }
@@ -546,27 +803,77 @@ bool DecodeImage(EImageFormat imageFormat, const uint8_t* buffer, uint32_t lengt
     //
     if (imageFormat == EImageFormat::BMP) {
         std::shared_ptr<IImageWrapper> bmpImageWrapper = std::make_shared<FBmpImageWrapper>();
-        if (bmpImageWrapper && bmpImageWrapper->SetCompressed(buffer, length)) {
+        if (bmpImageWrapper && bmpImageWrapper->SetCompressedView(buffer, length)) {
             int bitDepth = bmpImageWrapper->GetBitDepth();
             ERGBFormat format = bmpImageWrapper->GetFormat();
             info.type = EImageFormat::BMP;
             info.rgb_format = format;
             info.bit_depth = bitDepth;
 
-            PixelsMemData = AllocPixels();
-            info.width = PixelsMemData->pixels->width = bmpImageWrapper->GetWidth();
-            info.height = PixelsMemData->pixels->height = bmpImageWrapper->GetHeight();
-            PixelsMemData->pixels->texture_format = ETextureSourceFormat::BGRA8;
-            PixelsMemData->pixels->bit_depth = bmpImageWrapper->GetBitDepth();
-            std::vector<uint8_t> decoded;
-            if (!bmpImageWrapper->GetRaw(bmpImageWrapper->GetFormat(), bmpImageWrapper->GetBitDepth(), PixelsMemData->data)) {
-                decoded_image_mmem_data_pool.erase(PixelsMemData->pixels.get());
-                PixelsMemData = nullptr;
-                LogMessage(ELogLevel::Error, "Failed to decode BMP.");
+            info.width = bmpImageWrapper->GetWidth();
+            info.height = bmpImageWrapper->GetHeight();
+            if (!AllocatePixels(pixels, ETextureSourceFormat::BGRA8, bitDepth, info.width, info.height, allocator)) {
+                return false;
+            }
+
+            bmpImageWrapper->SetCancelFlag(cancelFlag);
+            if (!bmpImageWrapper->GetRaw(format, bitDepth, pixels.data, pixels.stride, pixels.size)) {
+                if (!IsDecodeCancelled(cancelFlag)) {
+                    LogMessage(ELogLevel::Error, "Failed to decode BMP.");
+                }
+                return false;
+            }
+            return true;
+        }
+    }
+
+    //
+    // ICO
+    //
+    if (imageFormat == EImageFormat::ICO) {
+        std::shared_ptr<IImageWrapper> icoImageWrapper = std::make_shared<FIcoImageWrapper>();
+        if (icoImageWrapper && icoImageWrapper->SetCompressedView(buffer, length)) {
+            // The largest entry is either a PNG or a BMP, decode it the way those formats are decoded on their own
+            ETextureSourceFormat textureFormat = ETextureSourceFormat::Invalid;
+            int bitDepth = icoImageWrapper->GetBitDepth();
+            ERGBFormat format = icoImageWrapper->GetFormat();
+            info.type = EImageFormat::ICO;
+            info.rgb_format = format;
+            info.bit_depth = bitDepth;
+
+            if (format == ERGBFormat::BGRA) {
+                textureFormat = ETextureSourceFormat::BGRA8;
+                bitDepth = 8;
+            } else if (format == ERGBFormat::Gray || format == ERGBFormat::RGBA) {
+                if (bitDepth <= 8) {
+                    textureFormat = ETextureSourceFormat::RGBA8;
+                    format = ERGBFormat::RGBA;
+                    bitDepth = 8;
+                } else if (bitDepth == 16) {
+                    textureFormat = ETextureSourceFormat::RGBA16;
+                    format = ERGBFormat::RGBA;
+                    bitDepth = 16;
+                }
+            }
+
+            if (textureFormat == ETextureSourceFormat::Invalid) {
+                LogMessage(ELogLevel::Error, "ICO file contains data in an unsupported format.");
+                return false;
+            }
+
+            info.width = icoImageWrapper->GetWidth();
+            info.height = icoImageWrapper->GetHeight();
+            if (!AllocatePixels(pixels, textureFormat, bitDepth, info.width, info.height, allocator)) {
+                return false;
+            }
+
+            icoImageWrapper->SetCancelFlag(cancelFlag);
+            if (!icoImageWrapper->GetRaw(format, bitDepth, pixels.data, pixels.stride, pixels.size)) {
+                if (!IsDecodeCancelled(cancelFlag)) {
+                    LogMessage(ELogLevel::Error, "Failed to decode ICO.");
+                }
                 return false;
             }
-            PixelsMemData->pixels->data = PixelsMemData->data.data();
-            PixelsMemData->pixels->size = PixelsMemData->data.size();
             return true;
         }
     }
@@ -585,23 +892,28 @@ bool DecodeImage(EImageFormat imageFormat, const uint8_t* buffer, uint32_t lengt
         };
         const FPCXFileHeader* PCX = (FPCXFileHeader*)buffer;
         if (length >= sizeof(FPCXFileHeader) && PCX->manufacturer == 10) {
+            // The data may be a mapping of the file, where reading past its end faults instead of reading garbage.
+            const uint8_t* dataEnd = buffer + length;
             int NewU = PCX->xMax + 1 - PCX->xMin;
             int NewV = PCX->yMax + 1 - PCX->yMin;
 
             if (PCX->numPlanes == 1 && PCX->bitsPerPixel == 8) {
+                if (length < sizeof(FPCXFileHeader) + 256 * 3) {
+                    LogMessage(ELogLevel::Error, "PCX is too short to hold its palette.");
+                    return false;
+                }
+                // The palette takes the last 768 bytes, the image data ends before it.
+                dataEnd -= 256 * 3;
+
                 info.type = EImageFormat::PCX;
                 info.rgb_format = ERGBFormat::BGRA;
                 info.bit_depth = 8;
+                info.width = NewU;
+                info.height = NewV;
                 // Set texture properties.
-                PixelsMemData = AllocPixels();
-                info.width = PixelsMemData->pixels->width = NewU;
-                info.height = PixelsMemData->pixels->height = NewV;
-                PixelsMemData->pixels->texture_format = ETextureSourceFormat::BGRA8;
-                PixelsMemData->pixels->bit_depth = 8;
-                PixelsMemData->data.resize(NewU * NewV * 4);
-                PixelsMemData->pixels->data = PixelsMemData->data.data();
-                PixelsMemData->pixels->size = PixelsMemData->data.size();
-                FColor* DestPtr = (FColor*)PixelsMemData->pixels->data;
+                if (!AllocatePixels(pixels, ETextureSourceFormat::BGRA8, 8, NewU, NewV, allocator)) {
+                    return false;
+                }
 
                 // Import the palette.
                 uint8_t* PCXPalette = (uint8_t*)(buffer + length - 256 * 3);
@@ -615,50 +927,79 @@ bool DecodeImage(EImageFormat imageFormat, const uint8_t* buffer, uint32_t lengt
                     Palette.push_back(color);
                 }
 
-                // Import it.
-                FColor* DestEnd = DestPtr + NewU * NewV;
+                // Import it, carrying runs over from one row into the next.
                 buffer += 128;
-                while (DestPtr < DestEnd) {
-                    uint8_t Color = *buffer++;
-                    if ((Color & 0xc0) == 0xc0) {
-                        uint32_t RunLength = Color & 0x3f;
-                        Color = *buffer++;
-
-                        for (uint32_t Index = 0; Index < RunLength; Index++) {
-                            *DestPtr++ = Palette[Color];
+                uint32_t RunLength = 0;
+                uint8_t Color = 0;
+                for (int i = 0; i < NewV; i++) {
+                    if (IsDecodeCancelled(cancelFlag)) {
+                        return false;
+                    }
+                    FColor* DestPtr = (FColor*)(pixels.data + i * pixels.stride);
+                    for (int j = 0; j < NewU; j++) {
+                        while (RunLength == 0) {
+                            if (buffer >= dataEnd) {
+                                LogMessage(ELogLevel::Error, "PCX image data is truncated.");
+                                return false;
+                            }
+                            Color = *buffer++;
+                            if ((Color & 0xc0) == 0xc0) {
+                                if (buffer >= dataEnd) {
+                                    LogMessage(ELogLevel::Error, "PCX image data is truncated.");
+                                    return false;
+                                }
+                                RunLength = Color & 0x3f;
+                                Color = *buffer++;
+                            } else
+                                RunLength = 1;
                         }
-                    } else
                         *DestPtr++ = Palette[Color];
+                        RunLength--;
+                    }
                 }
             } else if (PCX->numPlanes == 3 && PCX->bitsPerPixel == 8) {
                 info.type = EImageFormat::PCX;
                 info.rgb_format = ERGBFormat::BGRA;
                 info.bit_depth = 8;
+                info.width = NewU;
+                info.height = NewV;
                 // Set texture properties.
-                PixelsMemData = AllocPixels();
-                info.width = PixelsMemData->pixels->width = NewU;
-                info.height = PixelsMemData->pixels->height = NewV;
-                PixelsMemData->pixels->texture_format = ETextureSourceFormat::BGRA8;
-                PixelsMemData->pixels->bit_depth = 8;
-                // Doing a memset to make sure the alpha channel is set to 0xff since we only have 3 color planes.
-                PixelsMemData->data.resize(NewU * NewV * 4, 0xff);
-                PixelsMemData->pixels->data = PixelsMemData->data.data();
-                PixelsMemData->pixels->size = PixelsMemData->data.size();
-
-                uint8_t* Dest = PixelsMemData->pixels->data;
+                if (!AllocatePixels(pixels, ETextureSourceFormat::BGRA8, 8, NewU, NewV, allocator)) {
+                    return false;
+                }
+
+                uint8_t* Dest = pixels.data;
 
                 // Copy upside-down scanlines.
                 buffer += 128;
                 int CountU = std::min<int>(PCX->bytesPerLine, NewU);
                 for (int i = 0; i < NewV; i++) {
+                    if (IsDecodeCancelled(cancelFlag)) {
+                        return false;
+                    }
+                    uint8_t* DestRow = Dest + i * pixels.stride;
+
+                    // Set the alpha channel to 0xff since we only have 3 color planes.
+                    for (int k = 0; k < NewU; k++) {
+                        DestRow[k * 4 + 3] = 0xff;
+                    }
+
                     // We need to decode image one line per time building RGB image color plane by color plane.
                     int RunLength, Overflow = 0;
                     uint8_t Color = 0;
                     for (int32_t ColorPlane = 2; ColorPlane >= 0; ColorPlane--) {
                         for (int32_t j = 0; j < CountU; j++) {
                             if (!Overflow) {
+                                if (buffer >= dataEnd) {
+                                    LogMessage(ELogLevel::Error, "PCX image data is truncated.");
+                                    return false;
+                                }
                                 Color = *buffer++;
                                 if ((Color & 0xc0) == 0xc0) {
+                                    if (buffer >= dataEnd) {
+                                        LogMessage(ELogLevel::Error, "PCX image data is truncated.");
+                                        return false;
+                                    }
                                     RunLength = std::min<int>((Color & 0x3f), CountU - j);
                                     Overflow = (Color & 0x3f) - RunLength;
                                     Color = *buffer++;
@@ -672,7 +1013,7 @@ bool DecodeImage(EImageFormat imageFormat, const uint8_t* buffer, uint32_t lengt
                             // checkf(((i*NewU + RunLength) * 4 + ColorPlane) < (Texture->Source.CalcMipSize(0)),
                             //	TEXT("RLE going off the end of buffer"));
                             for (int32_t k = j; k < j + RunLength; k++) {
-                                Dest[(i * NewU + k) * 4 + ColorPlane] = Color;
+                                DestRow[k * 4 + ColorPlane] = Color;
                             }
                             j += RunLength - 1;
                         }
@@ -697,18 +1038,7 @@ bool DecodeImage(EImageFormat imageFormat, const uint8_t* buffer, uint32_t lengt
         if (length >= sizeof(FTGAFileHeader) && ((TGA->colorMapType == 0 && TGA->imageTypeCode == 2) ||
                                                  // ImageTypeCode 3 is greyscale
                                                  (TGA->colorMapType == 0 && TGA->imageTypeCode == 3) || (TGA->colorMapType == 0 && TGA->imageTypeCode == 10) || (TGA->colorMapType == 1 && TGA->imageTypeCode == 1 && TGA->bitsPerPixel == 8))) {
-            const bool bResult = DecompressTGA(TGA, PixelsMemData);
-            if (!bResult) {
-                decoded_image_mmem_data_pool.erase(PixelsMemData->pixels.get());
-                PixelsMemData = nullptr;
-            } else {
-                info.type = EImageFormat::TGA;
-                info.rgb_format = PixelsMemData->pixels->texture_format == ETextureSourceFormat::BGRA8 ? ERGBFormat::BGRA : ERGBFormat::Gray;
-                info.bit_depth = PixelsMemData->pixels->bit_depth;
-                info.width = PixelsMemData->pixels->width;
-                info.height = PixelsMemData->pixels->height;
-            }
-            return bResult;
+            return DecompressTGA(TGA, length, info, pixels, allocator, cancelFlag);
         }
     }
     return false;
@@ -716,42 +1046,622 @@ bool DecodeImage(EImageFormat imageFormat, const uint8_t* buffer, uint32_t lengt
 
 void __cdecl SetLogFunction(LogFunc func) { SetLogMessageFunc(func); }
 
+void __cdecl SetPixelAllocator(PixelAllocFunc alloc_func, PixelFreeFunc free_func, void* user_data) { SetPixelMemoryHooks(alloc_func, free_func, user_data); }
+
+void __cdecl SetPixelAllocatorHugePages(bool enable) { SetPixelMemoryHugePages(enable); }
+
+void __cdecl TrimPixelAllocator() { TrimPixelMemory(); }
+
+/**
+ * Gets the contents of a file for decoding, mapped when possible and read into fileData otherwise.
+ * The returned pointer stays valid as long as both mappedFile and fileData do.
+ */
+bool LoadFile(const char* fileName, FMappedFile& mappedFile, std::vector<uint8_t>& fileData, const uint8_t*& outData, uint64_t& outSize) {
+    // Decode straight from the page cache when the file can be mapped.
+    if (mappedFile.Open(fileName, true)) {
+        outData = mappedFile.GetData();
+        outSize = mappedFile.GetSize();
+        return true;
+    }
+
+    std::ifstream fileStream(fileName, std::ios_base::in | std::ios::binary);
+    if (!fileStream) {
+        return false;
+    }
+
+    fileStream.unsetf(std::ios::skipws);
+    fileStream.seekg(0, std::ios::end);
+    fileData.resize(static_cast<size_t>(fileStream.tellg()));
+    fileStream.seekg(0, std::ios::beg);
+    fileStream.read(reinterpret_cast<char*>(fileData.data()), fileData.size());
+    fileData.resize(static_cast<size_t>(fileStream.gcount()));
+    outData = fileData.data();
+    outSize = fileData.size();
+    return true;
+}
+
+EDecodeStatus DecodeJob(const ImageDecodeJob& job, ImageInfo& info, ImagePixelData*& pixelData) {
+    pixelData = nullptr;
+
+    // Workers must not let exceptions escape, they would terminate the process.
+    try {
+        if (job.buffer) {
+            return CreatePixelData(job.image_format, job.buffer, job.length, info, pixelData) ? EDecodeStatus::Success : EDecodeStatus::DecodeError;
+        }
+
+        FMappedFile mappedFile;
+        std::vector<uint8_t> fileData;
+        const uint8_t* data = nullptr;
+        uint64_t size = 0;
+        if (!job.file_name || !LoadFile(job.file_name, mappedFile, fileData, data, size)) {
+            std::string error = "Failed to read " + std::string(job.file_name ? job.file_name : "(null)") + ".";
+            LogMessage(ELogLevel::Error, error.data());
+            return EDecodeStatus::FileError;
+        }
+
+        return CreatePixelData(job.image_format, data, size, info, pixelData) ? EDecodeStatus::Success : EDecodeStatus::DecodeError;
+    } catch (const std::exception& e) {
+        LogMessage(ELogLevel::Error, e.what());
+        return EDecodeStatus::DecodeError;
+    }
+}
+
 bool __cdecl CreatePixelDataFromFile(EImageFormat image_format, const char* file_name, ImageInfo& info, ImagePixelData*& pixel_data) {
-    std::vector<uint8_t> dataBinary;
-    std::ifstream fileStream(file_name, std::ios_base::in | std::ios::binary);
-    if (fileStream) {
-        fileStream.unsetf(std::ios::skipws);
-        fileStream.seekg(0, std::ios::end);
-        dataBinary.resize(static_cast<size_t>(fileStream.tellg()));
-        fileStream.seekg(0, std::ios::beg);
-        fileStream.read(reinterpret_cast<char*>(dataBinary.data()), dataBinary.size());
-        dataBinary.resize(static_cast<size_t>(fileStream.gcount()));
-        return CreatePixelData(image_format, dataBinary.data(), dataBinary.size(), info, pixel_data);
-    } else {
+    FMappedFile mappedFile;
+    std::vector<uint8_t> fileData;
+    const uint8_t* data = nullptr;
+    uint64_t size = 0;
+    if (!LoadFile(file_name, mappedFile, fileData, data, size)) {
+        return false;
+    }
+
+    return CreatePixelData(image_format, data, size, info, pixel_data);
+}
+
+bool __cdecl CreatePixelDataBatch(const ImageDecodeJob* jobs, int num_jobs, ImageInfo* infos, ImagePixelData** pixel_data, EDecodeStatus* statuses, int num_threads) {
+    if (num_jobs <= 0) {
+        return num_jobs == 0;
+    }
+    if (!jobs || !pixel_data || !statuses) {
+        LogMessage(ELogLevel::Error, "CreatePixelDataBatch needs jobs, pixel_data and statuses arrays.");
         return false;
     }
+
+    // Input size stands in for decode cost. Starting the largest images first keeps one big image from running
+    // alone at the end while every other thread is idle.
+    std::vector<std::pair<uint64_t, int>> jobOrder(num_jobs);
+    for (int i = 0; i < num_jobs; i++) {
+        const uint64_t jobSize = jobs[i].buffer ? jobs[i].length : (jobs[i].file_name ? FMappedFile::GetFileSize(jobs[i].file_name) : 0);
+        jobOrder[i] = std::make_pair(jobSize, i);
+    }
+    std::stable_sort(jobOrder.begin(), jobOrder.end(), [](const std::pair<uint64_t, int>& a, const std::pair<uint64_t, int>& b) { return a.first > b.first; });
+
+    std::atomic<bool> bAllSucceeded(true);
+    auto runJob = [&](int orderIndex) {
+        const int jobIndex = jobOrder[orderIndex].second;
+        ImageInfo info = {};
+        statuses[jobIndex] = DecodeJob(jobs[jobIndex], info, pixel_data[jobIndex]);
+        if (infos) {
+            infos[jobIndex] = info;
+        }
+        if (statuses[jobIndex] != EDecodeStatus::Success) {
+            bAllSucceeded = false;
+        }
+    };
+
+    // The calling thread runs jobs too, the pool provides the remaining runners.
+    FThreadPool& threadPool = FThreadPool::Get();
+    threadPool.ParallelFor(num_jobs, num_threads > 0 ? num_threads : threadPool.GetNumThreads() + 1, runJob);
+
+    return bAllSucceeded;
 }
 
-bool __cdecl CreatePixelData(EImageFormat imageFormat, const uint8_t* buffer, uint64_t length, ImageInfo& info, ImagePixelData*& pixel_data) {
-    std::shared_ptr<ImagePixelsMemData> PixelsMemData;
-    bool result = DecodeImage(imageFormat, buffer, length, info, PixelsMemData);
-    if (result && PixelsMemData) {
-        pixel_data = PixelsMemData->pixels.get();
+/**
+ * Decodes into memory from the pixel data pool, stopping early once cancelFlag is set.
+ */
+bool DecodePooledImage(EImageFormat imageFormat, const uint8_t* buffer, uint64_t length, ImageInfo& info, ImagePixelData*& pixel_data, const std::atomic<bool>* cancelFlag, const ImageDecodeOptions* options = nullptr) {
+    ImagePixelData* pooledPixels = nullptr;
+    ImagePixelData pixels = {};
+    bool result = DecodeImage(imageFormat, buffer, length, info, pixels, [&pooledPixels](ImagePixelData& pixels) {
+        pooledPixels = decoded_pixel_data_pool.Allocate(pixels.size);
+        if (!pooledPixels) {
+            LogMessage(ELogLevel::Error, "Failed to allocate pixel data.");
+            return false;
+        }
+        pixels.data = pooledPixels->data;
+        return true;
+    }, cancelFlag, options);
+    if (result && pooledPixels) {
+        *pooledPixels = pixels;
+        decoded_pixel_data_pool.Register(pooledPixels);
+        pixel_data = pooledPixels;
         return true;
-    } else if (PixelsMemData) {
-        decoded_image_mmem_data_pool.erase(PixelsMemData->pixels.get());
-        PixelsMemData = nullptr;
+    } else if (pooledPixels) {
+        decoded_pixel_data_pool.Free(pooledPixels);
     }
     pixel_data = nullptr;
     return false;
 }
 
+bool __cdecl CreatePixelData(EImageFormat imageFormat, const uint8_t* buffer, uint64_t length, ImageInfo& info, ImagePixelData*& pixel_data) { return DecodePooledImage(imageFormat, buffer, length, info, pixel_data, nullptr); }
+
+bool __cdecl CreatePixelDataWithOptions(EImageFormat image_format, const uint8_t* buffer, uint64_t length, const ImageDecodeOptions& options, ImageInfo& info, ImagePixelData*& pixel_data) {
+    if (options.max_dimension < 0 || (options.scale_denom != 0 && (options.scale_num <= 0 || options.scale_denom < 0))) {
+        LogMessage(ELogLevel::Error, "ImageDecodeOptions has a negative max_dimension or a scale that is not positive.");
+        pixel_data = nullptr;
+        return false;
+    }
+    if ((options.region_width != 0 || options.region_height != 0) && (options.region_width <= 0 || options.region_height <= 0)) {
+        LogMessage(ELogLevel::Error, "ImageDecodeOptions has a region that is not positive in both dimensions.");
+        pixel_data = nullptr;
+        return false;
+    }
+    if (options.max_scans < 0) {
+        LogMessage(ELogLevel::Error, "ImageDecodeOptions has a negative max_scans.");
+        pixel_data = nullptr;
+        return false;
+    }
+    return DecodePooledImage(image_format, buffer, length, info, pixel_data, nullptr, &options);
+}
+
+uint64_t __cdecl CreatePixelDataAsync(EImageFormat image_format, const uint8_t* buffer, uint64_t length, DecodeCompleteFunc callback, void* user_data) {
+    if (!callback) {
+        LogMessage(ELogLevel::Error, "CreatePixelDataAsync needs a callback.");
+        return 0;
+    }
+
+    const uint64_t ticket = next_async_ticket++;
+    std::shared_ptr<std::atomic<bool>> cancelFlag = std::make_shared<std::atomic<bool>>(false);
+    {
+        std::lock_guard<std::mutex> lock(async_decodes_mutex);
+        async_decodes.emplace(ticket, cancelFlag);
+    }
+
+    FThreadPool::Get().Submit([=]() {
+        ImageInfo info = {};
+        ImagePixelData* pixelData = nullptr;
+        EDecodeStatus status = EDecodeStatus::Cancelled;
+
+        // Decodes cancelled while still queued are never started.
+        if (!*cancelFlag) {
+            // Workers must not let exceptions escape, they would terminate the process.
+            try {
+                status = DecodePooledImage(image_format, buffer, length, info, pixelData, cancelFlag.get()) ? EDecodeStatus::Success : EDecodeStatus::DecodeError;
+            } catch (const std::exception& e) {
+                LogMessage(ELogLevel::Error, e.what());
+                status = EDecodeStatus::DecodeError;
+            }
+        }
+
+        // CancelDecode only succeeds while the ticket is registered, so a successful cancel always ends up as Cancelled,
+        // even when it came in after the last row had been decoded.
+        {
+            std::lock_guard<std::mutex> lock(async_decodes_mutex);
+            async_decodes.erase(ticket);
+            if (*cancelFlag) {
+                status = EDecodeStatus::Cancelled;
+            }
+        }
+        if (status == EDecodeStatus::Cancelled) {
+            ReleasePixelData(pixelData);
+        }
+
+        callback(ticket, status, info, pixelData, user_data);
+    });
+
+    return ticket;
+}
+
+bool __cdecl CancelDecode(uint64_t ticket) {
+    std::lock_guard<std::mutex> lock(async_decodes_mutex);
+    auto it = async_decodes.find(ticket);
+    if (it == async_decodes.end()) {
+        return false;
+    }
+    *it->second = true;
+    return true;
+}
+
+bool __cdecl CreatePixelDataInBuffer(EImageFormat imageFormat, const uint8_t* buffer, uint64_t length, ImageInfo& info, ImagePixelData& pixel_data, uint8_t* dest, uint64_t dest_stride, uint64_t dest_capacity) {
+    return DecodeImage(imageFormat, buffer, length, info, pixel_data, [dest, dest_stride, dest_capacity](ImagePixelData& pixels) {
+        const uint64_t rowBytes = pixels.stride;
+        const uint64_t stride = dest_stride ? dest_stride : rowBytes;
+        const uint64_t requiredSize = stride * (pixels.height - 1) + rowBytes;
+        if (stride < rowBytes || requiredSize > INT_MAX) {
+            LogMessage(ELogLevel::Error, "Destination stride is not valid for this image.");
+            return false;
+        }
+
+        pixels.stride = static_cast<int>(stride);
+        pixels.size = static_cast<int>(requiredSize);
+        if (!dest || dest_capacity < requiredSize) {
+            return false;
+        }
+        pixels.data = dest;
+        return true;
+    });
+}
+
+bool __cdecl DecodeImageRows(EImageFormat image_format, const uint8_t* buffer, uint64_t length, int rows_per_batch, ImageInfo& info, RowsDecodedFunc callback, void* user_data) {
+    if (image_format != EImageFormat::PNG && image_format != EImageFormat::JPEG) {
+        LogMessage(ELogLevel::Error, "DecodeImageRows only supports PNG and JPEG.");
+        return false;
+    }
+    if (!callback || rows_per_batch < 0) {
+        LogMessage(ELogLevel::Error, "DecodeImageRows needs a callback and a batch size that is not negative.");
+        return false;
+    }
+
+    // Probing picks the output format a full decode would, the pixels are only ever a batch.
+    ImagePixelData pixels = {};
+    DecodeImage(image_format, buffer, length, info, pixels, nullptr);
+    if (pixels.texture_format == ETextureSourceFormat::Invalid) {
+        return false;
+    }
+
+    bool bStopped = false;
+    auto handOver = [&](int firstRow, int numRows, const uint8_t* rows, uint64_t rowStride) {
+        ImagePixelData batch = pixels;
+        batch.data = const_cast<uint8_t*>(rows);
+        batch.height = numRows;
+        batch.stride = static_cast<int>(rowStride);
+        batch.size = static_cast<int>(rowStride * numRows);
+        batch.num_planes = 1;
+        batch.plane_stride[0] = batch.stride;
+        batch.plane_width[0] = batch.width;
+        batch.plane_height[0] = numRows;
+        bStopped = !callback(batch, firstRow, user_data);
+        return !bStopped;
+    };
+
+    const int rowsPerBatch = rows_per_batch ? rows_per_batch : 16;
+    if (image_format == EImageFormat::JPEG) {
+        FJpegImageWrapper jpegImageWrapper;
+        jpegImageWrapper.SetCompressedView(buffer, length);
+        const bool bDecoded = jpegImageWrapper.UncompressRows(ERGBFormat::RGBA, rowsPerBatch, handOver);
+        if (!bDecoded && !bStopped) {
+            LogMessage(ELogLevel::Error, "Failed to decode JPEG.");
+        }
+        return bDecoded;
+    }
+
+    FPngImageWrapper pngImageWrapper;
+    pngImageWrapper.SetCompressedView(buffer, length);
+    const bool bDecoded = pngImageWrapper.UncompressRows(ERGBFormat::RGBA, pixels.bit_depth, rowsPerBatch, handOver);
+    if (!bDecoded && !bStopped) {
+        LogMessage(ELogLevel::Error, "Failed to decode PNG.");
+    }
+    return bDecoded;
+}
+
+bool __cdecl ProbeImage(EImageFormat image_format, const uint8_t* buffer, uint64_t length, ImageInfo& info) {
+    // Without an allocator DecodeImage stops right after describing the output, which it only reaches for a supported header.
+    ImagePixelData pixels = {};
+    DecodeImage(image_format, buffer, length, info, pixels, nullptr);
+    return pixels.texture_format != ETextureSourceFormat::Invalid;
+}
+
+bool __cdecl ProbeImageFromFile(EImageFormat image_format, const char* file_name, ImageInfo& info) {
+    // Probing a mapping of the whole file only faults in the pages the header parsing touches.
+    FMappedFile mappedFile;
+    if (mappedFile.Open(file_name, false)) {
+        return ProbeImage(image_format, mappedFile.GetData(), mappedFile.GetSize(), info);
+    }
+
+    std::ifstream fileStream(file_name, std::ios_base::in | std::ios::binary);
+    if (!fileStream) {
+        return false;
+    }
+
+    fileStream.unsetf(std::ios::skipws);
+    fileStream.seekg(0, std::ios::end);
+    const uint64_t fileSize = static_cast<uint64_t>(fileStream.tellg());
+    fileStream.seekg(0, std::ios::beg);
+
+    // Headers usually fit in the first few KB, but metadata such as EXIF or ICC profiles can push them further back,
+    // so the prefix grows until the probe succeeds or the whole file has been read.
+    std::vector<uint8_t> dataBinary;
+    for (uint64_t prefixSize = 16 * 1024;; prefixSize *= 8) {
+        const uint64_t readSize = std::min(prefixSize, fileSize);
+        const uint64_t readOffset = dataBinary.size();
+        dataBinary.resize(static_cast<size_t>(readSize));
+        fileStream.read(reinterpret_cast<char*>(dataBinary.data() + readOffset), readSize - readOffset);
+        if (static_cast<uint64_t>(fileStream.gcount()) != readSize - readOffset) {
+            return false;
+        }
+
+        if (readSize == fileSize) {
+            return ProbeImage(image_format, dataBinary.data(), dataBinary.size(), info);
+        }
+
+        // A truncated header is expected to fail here, only the final attempt reports errors.
+        FScopedLogSuppression logSuppression;
+        if (ProbeImage(image_format, dataBinary.data(), dataBinary.size(), info)) {
+            return true;
+        }
+    }
+}
+
+uint64_t __cdecl GetMaxCompressedSize(EImageFormat image_format, int width, int height, const ImageEncodeOptions& options) {
+    if (width <= 0 || height <= 0) {
+        return 0;
+    }
+    if (image_format == EImageFormat::PNG) {
+        // The pixel format is not known here, RGBA16 is the largest one.
+        return FPngImageWrapper::GetMaxCompressedSize(width, height, ERGBFormat::RGBA, 16);
+    }
+    if (image_format != EImageFormat::JPEG) {
+        return 0;
+    }
+    if (options.subsampling < EJpegSubsampling::YUV420 || options.subsampling > EJpegSubsampling::Gray) {
+        LogMessage(ELogLevel::Error, "ImageEncodeOptions has an unknown JPEG subsampling.");
+        return 0;
+    }
+    return FJpegImageWrapper::GetMaxCompressedSize(width, height, options.subsampling);
+}
+
+/**
+ * Encodes pixel data CreateCompressedData has checked as a PNG, which keeps 16-bit pixels at 16 bits.
+ */
+static bool CreateCompressedPng(const ImagePixelData& pixel_data, EPngProfile profile, uint8_t* dest, uint64_t dest_capacity, uint64_t& compressed_size) {
+    ERGBFormat format = ERGBFormat::Invalid;
+    int bitDepth = 8;
+    switch (pixel_data.texture_format) {
+        case ETextureSourceFormat::RGBA8: format = ERGBFormat::RGBA; break;
+        case ETextureSourceFormat::BGRA8: format = ERGBFormat::BGRA; break;
+        case ETextureSourceFormat::G8: format = ERGBFormat::Gray; break;
+        case ETextureSourceFormat::RGBA16:
+            format = ERGBFormat::RGBA;
+            bitDepth = 16;
+            break;
+        case ETextureSourceFormat::G16:
+            format = ERGBFormat::Gray;
+            bitDepth = 16;
+            break;
+        default: LogMessage(ELogLevel::Error, "PNG can only be encoded from RGBA8, BGRA8, G8, RGBA16 or G16 pixels."); return false;
+    }
+
+    // Unlike JPEG the worst case depends on the pixel format, so it is the one reported for a missing buffer.
+    const uint64_t maxSize = FPngImageWrapper::GetMaxCompressedSize(pixel_data.width, pixel_data.height, format, bitDepth);
+    if (!dest) {
+        compressed_size = maxSize;
+        return false;
+    }
+
+    FPngImageWrapper pngImageWrapper;
+    if (!pngImageWrapper.CompressToBuffer(pixel_data.data, pixel_data.width, pixel_data.height, pixel_data.stride, format, bitDepth, profile, dest, dest_capacity, compressed_size)) {
+        if (dest_capacity < maxSize) {
+            compressed_size = maxSize;
+        } else {
+            LogMessage(ELogLevel::Error, "Failed to encode PNG.");
+        }
+        return false;
+    }
+    return true;
+}
+
+bool __cdecl CreateCompressedData(EImageFormat image_format, const ImagePixelData& pixel_data, const ImageEncodeOptions& options, uint8_t* dest, uint64_t dest_capacity, uint64_t& compressed_size) {
+    compressed_size = 0;
+    if (image_format != EImageFormat::JPEG && image_format != EImageFormat::PNG) {
+        LogMessage(ELogLevel::Error, "CreateCompressedData only supports JPEG and PNG.");
+        return false;
+    }
+    if (!pixel_data.data || pixel_data.width <= 0 || pixel_data.height <= 0 || pixel_data.stride < pixel_data.width * GetBytesPerPixel(pixel_data.texture_format)) {
+        LogMessage(ELogLevel::Error, "Pixel data to encode has no data or an invalid size or stride.");
+        return false;
+    }
+    if (image_format == EImageFormat::PNG) {
+        if (options.png_profile < EPngProfile::Fastest || options.png_profile > EPngProfile::Smallest) {
+            LogMessage(ELogLevel::Error, "ImageEncodeOptions has an unknown PNG profile.");
+            return false;
+        }
+        return CreateCompressedPng(pixel_data, options.png_profile, dest, dest_capacity, compressed_size);
+    }
+
+    ERGBFormat format = ERGBFormat::Invalid;
+    switch (pixel_data.texture_format) {
+        case ETextureSourceFormat::RGBA8: format = ERGBFormat::RGBA; break;
+        case ETextureSourceFormat::BGRA8: format = ERGBFormat::BGRA; break;
+        case ETextureSourceFormat::G8: format = ERGBFormat::Gray; break;
+        default: LogMessage(ELogLevel::Error, "JPEG can only be encoded from RGBA8, BGRA8 or G8 pixels."); return false;
+    }
+    if (options.quality < 0 || options.quality > 100) {
+        LogMessage(ELogLevel::Error, "ImageEncodeOptions has a quality outside of 0 to 100.");
+        return false;
+    }
+    if (options.subsampling < EJpegSubsampling::YUV420 || options.subsampling > EJpegSubsampling::Gray) {
+        LogMessage(ELogLevel::Error, "ImageEncodeOptions has an unknown JPEG subsampling.");
+        return false;
+    }
+
+    const uint64_t maxSize = GetMaxCompressedSize(image_format, pixel_data.width, pixel_data.height, options);
+    if (!dest) {
+        compressed_size = maxSize;
+        return false;
+    }
+
+    FJpegImageWrapper jpegImageWrapper;
+    if (!jpegImageWrapper.CompressToBuffer(pixel_data.data, pixel_data.width, pixel_data.height, pixel_data.stride, format, options, dest, dest_capacity, compressed_size)) {
+        // A buffer below the worst case size is allowed, running out of it is reported like a missing one.
+        if (dest_capacity < maxSize) {
+            compressed_size = maxSize;
+        } else {
+            LogMessage(ELogLevel::Error, "Failed to encode JPEG.");
+        }
+        return false;
+    }
+    return true;
+}
+
+bool __cdecl TransformJpeg(const uint8_t* buffer, uint64_t length, const JpegTransformOptions& options, uint8_t* dest, uint64_t dest_capacity, uint64_t& transformed_size) {
+    transformed_size = 0;
+    if ((options.crop_width != 0 || options.crop_height != 0) && (options.crop_width <= 0 || options.crop_height <= 0)) {
+        LogMessage(ELogLevel::Error, "JpegTransformOptions has a crop that is not positive in both dimensions.");
+        return false;
+    }
+
+    FJpegImageWrapper jpegImageWrapper;
+    if (!jpegImageWrapper.SetCompressedView(buffer, length)) {
+        LogMessage(ELogLevel::Error, "Data to transform is not a JPEG.");
+        return false;
+    }
+
+    // The wrapper logs its own errors, a destination that is too small is left to the caller.
+    return jpegImageWrapper.TransformTurbo(options, dest, dest_capacity, transformed_size);
+}
+
+bool __cdecl CreateJpegMcuIndex(const uint8_t* buffer, uint64_t length, uint8_t* dest, uint64_t dest_capacity, uint64_t& index_size) {
+    index_size = buffer ? FJpegMcuIndex::GetSerializedSize(buffer, length) : 0;
+    if (index_size == 0) {
+        LogMessage(ELogLevel::Error, "An MCU index can only be built for baseline JPEGs without restart intervals.");
+        return false;
+    }
+
+    // The size comes from the headers, so asking for it does not decode the image.
+    if (!dest || dest_capacity < index_size) {
+        return false;
+    }
+
+    FJpegMcuIndex mcuIndex;
+    if (!mcuIndex.Build(buffer, length)) {
+        LogMessage(ELogLevel::Error, "Failed to decode JPEG.");
+        return false;
+    }
+    std::vector<uint8_t> index;
+    mcuIndex.Serialize(index);
+    Assert(index.size() == index_size);
+    memcpy(dest, index.data(), index.size());
+    return true;
+}
+
+struct IncrementalJpegDecoder {
+    FJpegIncrementalDecoder jpeg;
+};
+
+IncrementalJpegDecoder* __cdecl CreateIncrementalJpegDecoder() { return new IncrementalJpegDecoder(); }
+
+bool __cdecl AppendIncrementalJpegData(IncrementalJpegDecoder* decoder, const uint8_t* buffer, uint64_t length) {
+    if (!decoder || (!buffer && length)) {
+        LogMessage(ELogLevel::Error, "AppendIncrementalJpegData needs a decoder and data.");
+        return false;
+    }
+
+    // The error is only reported by the append that hit it.
+    const bool bFailedBefore = !decoder->jpeg.GetError().empty();
+    if (!decoder->jpeg.Append(buffer, length)) {
+        if (!bFailedBefore) {
+            LogMessage(ELogLevel::Error, decoder->jpeg.GetError().data());
+        }
+        return false;
+    }
+    return true;
+}
+
+void __cdecl GetIncrementalJpegProgress(IncrementalJpegDecoder* decoder, ImageInfo& info, IncrementalJpegProgress& progress) {
+    progress = {};
+    // The size is only known once decoding has started, which follows right after the header.
+    if (!decoder || !decoder->jpeg.GetRows()) {
+        return;
+    }
+
+    info.type = EImageFormat::JPEG;
+    info.rgb_format = decoder->jpeg.GetFormat();
+    info.bit_depth = 8;
+    info.width = decoder->jpeg.GetWidth();
+    info.height = decoder->jpeg.GetHeight();
+    progress.header_complete = true;
+    progress.multiple_scans = decoder->jpeg.HasMultipleScans();
+    progress.complete = decoder->jpeg.IsComplete();
+    progress.rows_complete = decoder->jpeg.GetNumRowsComplete();
+    progress.scans_complete = decoder->jpeg.GetNumScansComplete();
+}
+
+bool __cdecl GetIncrementalJpegPixels(IncrementalJpegDecoder* decoder, ImagePixelData& pixel_data) {
+    if (!decoder || !decoder->jpeg.GetRows()) {
+        return false;
+    }
+    if (!decoder->jpeg.RenderLatestScan()) {
+        return false;
+    }
+
+    // The rows are the decoder's own, already allocated.
+    uint8_t* rows = decoder->jpeg.GetRows();
+    return AllocatePixels(pixel_data, ETextureSourceFormat::RGBA8, 8, decoder->jpeg.GetWidth(), decoder->jpeg.GetHeight(), [rows](ImagePixelData& pixels) {
+        pixels.data = rows;
+        return true;
+    });
+}
+
+void __cdecl ReleaseIncrementalJpegDecoder(IncrementalJpegDecoder*& decoder) {
+    delete decoder;
+    decoder = nullptr;
+}
+
+struct IncrementalPngDecoder {
+    FPngIncrementalDecoder png;
+};
+
+IncrementalPngDecoder* __cdecl CreateIncrementalPngDecoder() { return new IncrementalPngDecoder(); }
+
+bool __cdecl AppendIncrementalPngData(IncrementalPngDecoder* decoder, const uint8_t* buffer, uint64_t length) {
+    if (!decoder || (!buffer && length)) {
+        LogMessage(ELogLevel::Error, "AppendIncrementalPngData needs a decoder and data.");
+        return false;
+    }
+
+    // The error is only reported by the append that hit it.
+    const bool bFailedBefore = !decoder->png.GetError().empty();
+    if (!decoder->png.Append(buffer, length)) {
+        if (!bFailedBefore) {
+            LogMessage(ELogLevel::Error, decoder->png.GetError().data());
+        }
+        return false;
+    }
+    return true;
+}
+
+void __cdecl GetIncrementalPngProgress(IncrementalPngDecoder* decoder, ImageInfo& info, IncrementalPngProgress& progress) {
+    progress = {};
+    if (!decoder || !decoder->png.HasHeader()) {
+        return;
+    }
+
+    info.type = EImageFormat::PNG;
+    info.rgb_format = decoder->png.GetFormat();
+    info.bit_depth = decoder->png.GetBitDepth();
+    info.width = decoder->png.GetWidth();
+    info.height = decoder->png.GetHeight();
+    progress.header_complete = true;
+    progress.interlaced = decoder->png.IsInterlaced();
+    progress.complete = decoder->png.IsComplete();
+    progress.rows_complete = decoder->png.GetNumRowsComplete();
+    progress.passes_complete = decoder->png.GetNumPassesComplete();
+}
+
+bool __cdecl GetIncrementalPngPixels(IncrementalPngDecoder* decoder, ImagePixelData& pixel_data) {
+    if (!decoder || !decoder->png.GetRows() || !decoder->png.GetError().empty()) {
+        return false;
+    }
+
+    // The rows are the decoder's own, already allocated.
+    uint8_t* rows = decoder->png.GetRows();
+    const int bitDepth = decoder->png.GetBitDepth() == 16 ? 16 : 8;
+    return AllocatePixels(pixel_data, bitDepth == 16 ? ETextureSourceFormat::RGBA16 : ETextureSourceFormat::RGBA8, bitDepth, decoder->png.GetWidth(), decoder->png.GetHeight(), [rows](ImagePixelData& pixels) {
+        pixels.data = rows;
+        return true;
+    });
+}
+
+void __cdecl ReleaseIncrementalPngDecoder(IncrementalPngDecoder*& decoder) {
+    delete decoder;
+    decoder = nullptr;
+}
+
 void __cdecl ReleasePixelData(ImagePixelData*& pixel_data) {
     if (!pixel_data) {
         return;
     }
-    if (decoded_image_mmem_data_pool.find(pixel_data) != decoded_image_mmem_data_pool.end()) {
-        decoded_image_mmem_data_pool.erase(pixel_data);
+    if (decoded_pixel_data_pool.Release(pixel_data)) {
         pixel_data = nullptr;
     }
 }
@@ -0,0 +1,64 @@
+﻿#include "PixelDataPool.h"
+#include <new>
+#include "Utils/PixelAllocator.h"
+#include "Utils/Utils.h"
+
+namespace ImageDecoder {
+
+namespace {
+// Pixels start on a cache line so row copies and SIMD conversions see aligned data.
+const uint64_t pixelAlignment = 64;
+
+/** Layout at the start of each block, the public handle points at pixels. */
+struct FPixelBlock {
+    ImagePixelData pixels;
+    FPixelMemory memory;
+};
+
+const uint64_t blockHeaderSize = Align(sizeof(FPixelBlock), pixelAlignment);
+}  // namespace
+
+ImagePixelData* FPixelDataPool::Allocate(uint64_t size) {
+    FPixelMemory memory;
+    if (!AllocatePixelMemory(blockHeaderSize + size, memory)) {
+        return nullptr;
+    }
+
+    FPixelBlock* block = new (memory.data) FPixelBlock();
+    block->memory = memory;
+    block->pixels.data = memory.data + blockHeaderSize;
+    block->pixels.size = static_cast<int>(size);
+    return &block->pixels;
+}
+
+void FPixelDataPool::Register(ImagePixelData* pixels) {
+    FShard& shard = GetShard(pixels);
+    std::lock_guard<std::mutex> shardLock(shard.mutex);
+    shard.handles.insert(pixels);
+}
+
+bool FPixelDataPool::Release(ImagePixelData* pixels) {
+    {
+        FShard& shard = GetShard(pixels);
+        std::lock_guard<std::mutex> shardLock(shard.mutex);
+        if (shard.handles.erase(pixels) == 0) {
+            return false;
+        }
+    }
+
+    Free(pixels);
+    return true;
+}
+
+void FPixelDataPool::Free(ImagePixelData* pixels) {
+    // The description lives inside the block that is being freed.
+    const FPixelMemory memory = reinterpret_cast<FPixelBlock*>(pixels)->memory;
+    FreePixelMemory(memory);
+}
+
+FPixelDataPool::FShard& FPixelDataPool::GetShard(const ImagePixelData* pixels) {
+    // Blocks are at least 64 byte aligned, mix the higher bits so neighbouring allocations spread over the shards.
+    const uint64_t key = (reinterpret_cast<uintptr_t>(pixels) >> 6) * 0x9E3779B97F4A7C15ull;
+    return shards[(key >> 32) % numShards];
+}
+}  // namespace ImageDecoder
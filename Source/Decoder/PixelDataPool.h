@@ -0,0 +1,49 @@
+﻿#pragma once
+#include <cstdint>
+#include <mutex>
+#include <unordered_set>
+#include "Decoder.h"
+
+namespace ImageDecoder {
+
+/**
+ * Owns the ImagePixelData handles returned to library users.
+ *
+ * Each handle is a single block from the pixel allocator holding the ImagePixelData header followed by its pixels. Live handles are tracked
+ * in shards selected by pointer hash, so threads creating and releasing different images rarely share a lock.
+ */
+class FPixelDataPool {
+public:
+    /**
+     * Allocates a block with room for size bytes of pixels, pointed to by the returned header's data.
+     * The block is not yet a live handle; pass it to Register once filled or to Free on failure.
+     */
+    ImagePixelData* Allocate(uint64_t size);
+
+    /** Makes a block returned by Allocate a live handle that Release accepts. */
+    void Register(ImagePixelData* pixels);
+
+    /**
+     * Frees a live handle. Handles are the block addresses and carry no generation, so a stale handle whose address a
+     * later Allocate reused frees the newer block.
+     *
+     * @return false if pixels is not a live handle of this pool, in which case nothing is freed.
+     */
+    bool Release(ImagePixelData* pixels);
+
+    /** Frees a block returned by Allocate that was never registered. */
+    void Free(ImagePixelData* pixels);
+
+private:
+    static const int numShards = 64;
+
+    struct alignas(64) FShard {
+        std::mutex mutex;
+        std::unordered_set<ImagePixelData*> handles;
+    };
+
+    FShard& GetShard(const ImagePixelData* pixels);
+
+    FShard shards[numShards];
+};
+}  // namespace ImageDecoder
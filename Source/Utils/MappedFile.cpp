@@ -0,0 +1,115 @@
+﻿#include "MappedFile.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace ImageDecoder {
+
+#ifdef _WIN32
+FMappedFile::FMappedFile() : data(nullptr), size(0), fileHandle(INVALID_HANDLE_VALUE), mappingHandle(nullptr) {}
+#else
+FMappedFile::FMappedFile() : data(nullptr), size(0) {}
+#endif
+
+FMappedFile::~FMappedFile() { Close(); }
+
+bool FMappedFile::Open(const char* fileName, bool bSequentialAccess) {
+    Close();
+
+#ifdef _WIN32
+    fileHandle = CreateFileA(fileName, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | (bSequentialAccess ? FILE_FLAG_SEQUENTIAL_SCAN : 0), nullptr);
+    if (fileHandle == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(fileHandle, &fileSize) || fileSize.QuadPart <= 0) {
+        Close();
+        return false;
+    }
+
+    mappingHandle = CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!mappingHandle) {
+        Close();
+        return false;
+    }
+
+    data = static_cast<const uint8_t*>(MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0));
+    if (!data) {
+        Close();
+        return false;
+    }
+    size = static_cast<uint64_t>(fileSize.QuadPart);
+#else
+    const int fileDescriptor = open(fileName, O_RDONLY);
+    if (fileDescriptor < 0) {
+        return false;
+    }
+
+    struct stat fileStat;
+    if (fstat(fileDescriptor, &fileStat) != 0 || !S_ISREG(fileStat.st_mode) || fileStat.st_size <= 0) {
+        close(fileDescriptor);
+        return false;
+    }
+
+    // The mapping keeps its own reference to the file, the descriptor is not needed past this point.
+    void* mapping = mmap(nullptr, static_cast<size_t>(fileStat.st_size), PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+    close(fileDescriptor);
+    if (mapping == MAP_FAILED) {
+        return false;
+    }
+
+    data = static_cast<const uint8_t*>(mapping);
+    size = static_cast<uint64_t>(fileStat.st_size);
+    if (bSequentialAccess) {
+        madvise(mapping, static_cast<size_t>(size), MADV_SEQUENTIAL);
+    }
+#endif
+
+    return true;
+}
+
+uint64_t FMappedFile::GetFileSize(const char* fileName) {
+#ifdef _WIN32
+    WIN32_FILE_ATTRIBUTE_DATA fileAttributes;
+    if (!GetFileAttributesExA(fileName, GetFileExInfoStandard, &fileAttributes)) {
+        return 0;
+    }
+    return (uint64_t(fileAttributes.nFileSizeHigh) << 32) | fileAttributes.nFileSizeLow;
+#else
+    struct stat fileStat;
+    if (stat(fileName, &fileStat) != 0) {
+        return 0;
+    }
+    return static_cast<uint64_t>(fileStat.st_size);
+#endif
+}
+
+void FMappedFile::Close() {
+#ifdef _WIN32
+    if (data) {
+        UnmapViewOfFile(data);
+    }
+    if (mappingHandle) {
+        CloseHandle(mappingHandle);
+    }
+    if (fileHandle != INVALID_HANDLE_VALUE) {
+        CloseHandle(fileHandle);
+    }
+    mappingHandle = nullptr;
+    fileHandle = INVALID_HANDLE_VALUE;
+#else
+    if (data) {
+        munmap(const_cast<uint8_t*>(data), static_cast<size_t>(size));
+    }
+#endif
+    data = nullptr;
+    size = 0;
+}
+}  // namespace ImageDecoder
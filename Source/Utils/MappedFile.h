@@ -0,0 +1,48 @@
+﻿#pragma once
+#include <cstdint>
+
+namespace ImageDecoder {
+
+/**
+ * Read-only memory mapping of a whole file, unmapped on destruction.
+ */
+class FMappedFile {
+public:
+    FMappedFile();
+    ~FMappedFile();
+
+    FMappedFile(const FMappedFile&) = delete;
+    FMappedFile& operator=(const FMappedFile&) = delete;
+
+    /**
+     * Maps the file.
+     *
+     * @param fileName Path of the file to map.
+     * @param bSequentialAccess Hints the OS that the whole file will be read front to back, leave it off when only a header is read.
+     * @return false if the file could not be opened or mapped (e.g. it is empty or not a regular file).
+     */
+    bool Open(const char* fileName, bool bSequentialAccess);
+
+    /**
+     * Gets the size of a file without opening it.
+     *
+     * @return The size in bytes, 0 if the file does not exist.
+     */
+    static uint64_t GetFileSize(const char* fileName);
+
+    const uint8_t* GetData() const { return data; }
+
+    uint64_t GetSize() const { return size; }
+
+private:
+    void Close();
+
+    const uint8_t* data;
+    uint64_t size;
+
+#ifdef _WIN32
+    void* fileHandle;
+    void* mappingHandle;
+#endif
+};
+}  // namespace ImageDecoder
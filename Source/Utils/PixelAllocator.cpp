@@ -0,0 +1,298 @@
+﻿#include "PixelAllocator.h"
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "Utils.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+namespace ImageDecoder {
+
+namespace {
+
+// Size classes step by a quarter of a power of two, so a block wastes at most 25% of its size.
+const uint64_t minClassSize = 4096;
+const int minClassShift = 12;
+const int maxClassShift = 26;
+const int numSizeClasses = 1 + (maxClassShift - minClassShift) * 4;
+
+// Blocks up to this size are kept per thread, larger ones only in the shared lists.
+const uint64_t maxThreadCachedSize = 16 * 1024 * 1024;
+const int maxThreadCachedBlocks = 2;
+
+// Upper bound for memory parked in one thread's cache, further blocks go to the shared lists.
+const uint64_t maxThreadCachedBytes = 32 * 1024 * 1024;
+
+// Upper bound for memory parked in the shared lists, anything beyond it goes back to the OS.
+const uint64_t maxGlobalCachedBytes = 256 * 1024 * 1024;
+
+const uint64_t hugePageSize = 2 * 1024 * 1024;
+const uint64_t dataAlignment = 64;
+
+int GetSizeClass(uint64_t size) {
+    if (size <= minClassSize) {
+        return 0;
+    }
+
+    int shift = minClassShift;
+    while ((uint64_t(1) << (shift + 1)) < size) {
+        shift++;
+    }
+    const uint64_t base = uint64_t(1) << shift;
+    const uint64_t step = base / 4;
+    return (shift - minClassShift) * 4 + int((size - base + step - 1) / step);
+}
+
+uint64_t GetClassSize(int sizeClass) {
+    if (sizeClass == 0) {
+        return minClassSize;
+    }
+
+    const uint64_t base = uint64_t(1) << (minClassShift + (sizeClass - 1) / 4);
+    return base + ((sizeClass - 1) % 4 + 1) * (base / 4);
+}
+
+std::atomic<bool> bUseHugePages(false);
+
+void* AllocateSystemMemory(uint64_t size) {
+#ifdef _WIN32
+    // Large pages need the SeLockMemoryPrivilege on Windows, so the huge page option only applies elsewhere.
+    return VirtualAlloc(nullptr, static_cast<SIZE_T>(size), MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+#else
+#ifdef MADV_HUGEPAGE
+    if (bUseHugePages.load(std::memory_order_relaxed) && size >= hugePageSize) {
+        // Map with enough slack to cut out a huge page aligned range, so the kernel can back it with huge pages.
+        uint8_t* mapping = static_cast<uint8_t*>(mmap(nullptr, static_cast<size_t>(size + hugePageSize), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+        if (mapping == MAP_FAILED) {
+            return nullptr;
+        }
+
+        uint8_t* aligned = Align(mapping, hugePageSize);
+        if (aligned != mapping) {
+            munmap(mapping, static_cast<size_t>(aligned - mapping));
+        }
+        munmap(aligned + size, static_cast<size_t>(mapping + hugePageSize - aligned));
+        madvise(aligned, static_cast<size_t>(size), MADV_HUGEPAGE);
+        return aligned;
+    }
+#endif
+    void* mapping = mmap(nullptr, static_cast<size_t>(size), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return mapping == MAP_FAILED ? nullptr : mapping;
+#endif
+}
+
+void FreeSystemMemory(void* memory, uint64_t size) {
+#ifdef _WIN32
+    VirtualFree(memory, 0, MEM_RELEASE);
+#else
+    munmap(memory, static_cast<size_t>(size));
+#endif
+}
+
+struct FGlobalSizeClass {
+    std::mutex mutex;
+    std::vector<void*> blocks;
+};
+
+FGlobalSizeClass globalSizeClasses[numSizeClasses];
+std::atomic<uint64_t> globalCachedBytes(0);
+
+bool PopGlobalBlock(int sizeClass, void*& outBlock) {
+    FGlobalSizeClass& globalClass = globalSizeClasses[sizeClass];
+    std::lock_guard<std::mutex> classLock(globalClass.mutex);
+    if (globalClass.blocks.empty()) {
+        return false;
+    }
+
+    outBlock = globalClass.blocks.back();
+    globalClass.blocks.pop_back();
+    globalCachedBytes -= GetClassSize(sizeClass);
+    return true;
+}
+
+void PushGlobalBlock(int sizeClass, void* block) {
+    const uint64_t classSize = GetClassSize(sizeClass);
+    if (globalCachedBytes.fetch_add(classSize) + classSize > maxGlobalCachedBytes) {
+        globalCachedBytes -= classSize;
+        FreeSystemMemory(block, classSize);
+        return;
+    }
+
+    FGlobalSizeClass& globalClass = globalSizeClasses[sizeClass];
+    std::lock_guard<std::mutex> classLock(globalClass.mutex);
+    globalClass.blocks.push_back(block);
+}
+
+struct FThreadCache;
+
+// Every live thread cache, so TrimPixelMemory can also empty the caches of threads that are idle.
+std::mutex threadCachesMutex;
+std::vector<FThreadCache*> threadCaches;
+
+struct FThreadCache {
+    // Only contended while TrimPixelMemory flushes the cache from another thread.
+    std::mutex mutex;
+    uint64_t cachedBytes = 0;
+    int numBlocks[numSizeClasses] = {};
+    void* blocks[numSizeClasses][maxThreadCachedBlocks] = {};
+
+    FThreadCache() {
+        std::lock_guard<std::mutex> cachesLock(threadCachesMutex);
+        threadCaches.push_back(this);
+    }
+
+    ~FThreadCache() {
+        {
+            std::lock_guard<std::mutex> cachesLock(threadCachesMutex);
+            threadCaches.erase(std::find(threadCaches.begin(), threadCaches.end(), this));
+        }
+        Flush();
+    }
+
+    bool Pop(int sizeClass, void*& outBlock) {
+        std::lock_guard<std::mutex> cacheLock(mutex);
+        if (numBlocks[sizeClass] == 0) {
+            return false;
+        }
+
+        outBlock = blocks[sizeClass][--numBlocks[sizeClass]];
+        cachedBytes -= GetClassSize(sizeClass);
+        return true;
+    }
+
+    bool Push(int sizeClass, void* block) {
+        const uint64_t classSize = GetClassSize(sizeClass);
+        std::lock_guard<std::mutex> cacheLock(mutex);
+        if (classSize > maxThreadCachedSize || numBlocks[sizeClass] == maxThreadCachedBlocks || cachedBytes + classSize > maxThreadCachedBytes) {
+            return false;
+        }
+
+        blocks[sizeClass][numBlocks[sizeClass]++] = block;
+        cachedBytes += classSize;
+        return true;
+    }
+
+    void Flush() {
+        std::lock_guard<std::mutex> cacheLock(mutex);
+        for (int sizeClass = 0; sizeClass < numSizeClasses; sizeClass++) {
+            while (numBlocks[sizeClass] > 0) {
+                PushGlobalBlock(sizeClass, blocks[sizeClass][--numBlocks[sizeClass]]);
+            }
+        }
+        cachedBytes = 0;
+    }
+};
+
+thread_local FThreadCache threadCache;
+
+struct FAllocatorHooks {
+    PixelAllocFunc allocFunc;
+    PixelFreeFunc freeFunc;
+    void* userData;
+};
+
+// Swapped atomically, an allocation running concurrently with SetPixelMemoryHooks keeps the hooks it loaded alive.
+std::shared_ptr<const FAllocatorHooks> allocatorHooks;
+}  // namespace
+
+bool AllocatePixelMemory(uint64_t size, FPixelMemory& outMemory) {
+    const std::shared_ptr<const FAllocatorHooks> hooks = std::atomic_load(&allocatorHooks);
+    if (hooks) {
+        // Host memory carries no alignment guarantee, over-allocate to align the data ourselves.
+        const uint64_t baseSize = size + dataAlignment;
+        void* base = hooks->allocFunc(baseSize, hooks->userData);
+        if (!base) {
+            return false;
+        }
+
+        outMemory.data = Align(static_cast<uint8_t*>(base), dataAlignment);
+        outMemory.base = base;
+        outMemory.baseSize = baseSize;
+        outMemory.freeFunc = hooks->freeFunc;
+        outMemory.userData = hooks->userData;
+        return true;
+    }
+
+    const int sizeClass = GetSizeClass(size);
+    void* block = nullptr;
+    uint64_t blockSize = 0;
+    if (sizeClass < numSizeClasses) {
+        blockSize = GetClassSize(sizeClass);
+        if (!threadCache.Pop(sizeClass, block) && !PopGlobalBlock(sizeClass, block)) {
+            block = AllocateSystemMemory(blockSize);
+        }
+    } else {
+        blockSize = Align(size, minClassSize);
+        block = AllocateSystemMemory(blockSize);
+    }
+
+    if (!block) {
+        return false;
+    }
+
+    // System memory is page aligned, which covers the data alignment.
+    outMemory.data = static_cast<uint8_t*>(block);
+    outMemory.base = block;
+    outMemory.baseSize = blockSize;
+    outMemory.freeFunc = nullptr;
+    outMemory.userData = nullptr;
+    return true;
+}
+
+void FreePixelMemory(const FPixelMemory& memory) {
+    if (memory.freeFunc) {
+        memory.freeFunc(memory.base, memory.baseSize, memory.userData);
+        return;
+    }
+
+    const int sizeClass = GetSizeClass(memory.baseSize);
+    if (sizeClass >= numSizeClasses) {
+        FreeSystemMemory(memory.base, memory.baseSize);
+    } else if (!threadCache.Push(sizeClass, memory.base)) {
+        PushGlobalBlock(sizeClass, memory.base);
+    }
+}
+
+void SetPixelMemoryHooks(PixelAllocFunc allocFunc, PixelFreeFunc freeFunc, void* userData) {
+    std::shared_ptr<const FAllocatorHooks> hooks;
+    if (allocFunc && freeFunc) {
+        hooks = std::make_shared<const FAllocatorHooks>(FAllocatorHooks{allocFunc, freeFunc, userData});
+    } else if (allocFunc || freeFunc) {
+        LogMessage(ELogLevel::Error, "Pixel allocator needs both an allocation and a free function, keeping the current allocator.");
+        return;
+    }
+    std::atomic_store(&allocatorHooks, hooks);
+}
+
+void SetPixelMemoryHugePages(bool bEnable) { bUseHugePages.store(bEnable, std::memory_order_relaxed); }
+
+void TrimPixelMemory() {
+    {
+        std::lock_guard<std::mutex> cachesLock(threadCachesMutex);
+        for (FThreadCache* cache : threadCaches) {
+            cache->Flush();
+        }
+    }
+
+    for (int sizeClass = 0; sizeClass < numSizeClasses; sizeClass++) {
+        std::vector<void*> blocks;
+        {
+            FGlobalSizeClass& globalClass = globalSizeClasses[sizeClass];
+            std::lock_guard<std::mutex> classLock(globalClass.mutex);
+            blocks.swap(globalClass.blocks);
+        }
+
+        const uint64_t classSize = GetClassSize(sizeClass);
+        for (void* block : blocks) {
+            globalCachedBytes -= classSize;
+            FreeSystemMemory(block, classSize);
+        }
+    }
+}
+}  // namespace ImageDecoder
@@ -0,0 +1,41 @@
+﻿#pragma once
+#include <cstdint>
+#include "Decoder.h"
+
+namespace ImageDecoder {
+
+/**
+ * Memory returned by AllocatePixelMemory. Remembers the allocator it came from so it can be freed
+ * correctly even if the host switches allocators in the meantime.
+ */
+struct FPixelMemory {
+    /** 64-byte aligned start of the usable memory. */
+    uint8_t* data;
+    /** Pointer and size the allocator handed out, data may be offset into it. */
+    void* base;
+    uint64_t baseSize;
+    /** Host free function, null for the built-in allocator. */
+    PixelFreeFunc freeFunc;
+    void* userData;
+};
+
+/**
+ * Allocates at least size bytes of uninitialized memory for pixels.
+ *
+ * Uses the host allocator if one was set with SetPixelAllocator, otherwise rounds the size up to a size class and
+ * reuses a cached block of that class when possible.
+ *
+ * @return false if the memory could not be allocated.
+ */
+bool AllocatePixelMemory(uint64_t size, FPixelMemory& outMemory);
+
+/** Returns memory from AllocatePixelMemory, caching built-in blocks for reuse. */
+void FreePixelMemory(const FPixelMemory& memory);
+
+void SetPixelMemoryHooks(PixelAllocFunc allocFunc, PixelFreeFunc freeFunc, void* userData);
+
+void SetPixelMemoryHugePages(bool bEnable);
+
+/** Releases the blocks cached by the built-in allocator, including those in the caches of other threads, back to the OS. */
+void TrimPixelMemory();
+}  // namespace ImageDecoder
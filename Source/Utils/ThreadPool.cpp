@@ -0,0 +1,144 @@
+﻿#include "ThreadPool.h"
+#include <algorithm>
+
+namespace ImageDecoder {
+
+namespace {
+// Index of the calling thread's queue in the pool it works for, -1 on threads outside any pool.
+thread_local const FThreadPool* currentPool = nullptr;
+thread_local int currentWorkerIndex = -1;
+}  // namespace
+
+FThreadPool& FThreadPool::Get() {
+    // Never destroyed: joining workers during static destruction (or DLL unload on Windows) can deadlock.
+    static FThreadPool* threadPool = new FThreadPool(std::max(1, static_cast<int>(std::thread::hardware_concurrency())));
+    return *threadPool;
+}
+
+FThreadPool::FThreadPool(int numThreads) : numQueuedTasks(0), nextQueue(0), bStopping(false) {
+    for (int i = 0; i < numThreads; i++) {
+        queues.emplace_back(new FWorkerQueue());
+    }
+    for (int i = 0; i < numThreads; i++) {
+        workers.emplace_back(&FThreadPool::WorkerLoop, this, i);
+    }
+}
+
+FThreadPool::~FThreadPool() {
+    {
+        std::lock_guard<std::mutex> wakeLock(wakeMutex);
+        bStopping = true;
+    }
+    wakeCondition.notify_all();
+
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+}
+
+void FThreadPool::Submit(std::function<void()> task) {
+    const int queueIndex = currentPool == this ? currentWorkerIndex : static_cast<int>(nextQueue++ % queues.size());
+    {
+        std::lock_guard<std::mutex> queueLock(queues[queueIndex]->mutex);
+        queues[queueIndex]->tasks.push_back(std::move(task));
+    }
+
+    // Taking the wake mutex orders the increment against a worker that is about to sleep.
+    {
+        std::lock_guard<std::mutex> wakeLock(wakeMutex);
+        numQueuedTasks++;
+    }
+    wakeCondition.notify_one();
+}
+
+void FThreadPool::ParallelFor(int numItems, int maxRunners, const std::function<void(int)>& func) {
+    // Runner tasks can start after the call returned, so what they touch lives as long as the last of them. func is
+    // only called for claimed items, which the call waits for.
+    struct FParallelItems {
+        std::atomic<int> nextItem;
+        int numItems;
+        int numFinished;
+        const std::function<void(int)>* func;
+        std::mutex mutex;
+        std::condition_variable condition;
+    };
+    std::shared_ptr<FParallelItems> items = std::make_shared<FParallelItems>();
+    items->nextItem = 0;
+    items->numItems = numItems;
+    items->numFinished = 0;
+    items->func = &func;
+
+    auto runItems = [](FParallelItems& items) {
+        for (int item = items.nextItem++; item < items.numItems; item = items.nextItem++) {
+            (*items.func)(item);
+
+            std::lock_guard<std::mutex> lock(items.mutex);
+            if (++items.numFinished == items.numItems) {
+                items.condition.notify_all();
+            }
+        }
+    };
+
+    const int numRunners = std::min({numItems, maxRunners, GetNumThreads() + 1});
+    for (int i = 1; i < numRunners; i++) {
+        Submit([items, runItems]() { runItems(*items); });
+    }
+    runItems(*items);
+
+    // Whatever is left is running on other threads.
+    std::unique_lock<std::mutex> lock(items->mutex);
+    items->condition.wait(lock, [&items] { return items->numFinished == items->numItems; });
+}
+
+void FThreadPool::WorkerLoop(int workerIndex) {
+    currentPool = this;
+    currentWorkerIndex = workerIndex;
+
+    while (true) {
+        std::function<void()> task;
+        if (PopTask(workerIndex, task)) {
+            task();
+            continue;
+        }
+
+        std::unique_lock<std::mutex> wakeLock(wakeMutex);
+        wakeCondition.wait(wakeLock, [this] { return bStopping || numQueuedTasks > 0; });
+        if (bStopping && numQueuedTasks == 0) {
+            return;
+        }
+    }
+}
+
+bool FThreadPool::PopTask(int workerIndex, std::function<void()>& outTask) {
+    if (numQueuedTasks == 0) {
+        return false;
+    }
+
+    // Own queue from the back, the most recently queued task is the most likely to still be in cache.
+    {
+        FWorkerQueue& queue = *queues[workerIndex];
+        std::lock_guard<std::mutex> queueLock(queue.mutex);
+        if (!queue.tasks.empty()) {
+            outTask = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+            numQueuedTasks--;
+            return true;
+        }
+    }
+
+    // Steal from the front of the other queues.
+    const int numQueues = static_cast<int>(queues.size());
+    for (int offset = 1; offset < numQueues; offset++) {
+        FWorkerQueue& queue = *queues[(workerIndex + offset) % numQueues];
+        std::lock_guard<std::mutex> queueLock(queue.mutex);
+        if (!queue.tasks.empty()) {
+            outTask = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+            numQueuedTasks--;
+            return true;
+        }
+    }
+
+    return false;
+}
+}  // namespace ImageDecoder
@@ -0,0 +1,65 @@
+﻿#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ImageDecoder {
+
+/**
+ * Fixed set of worker threads, each with its own task queue.
+ *
+ * Workers run their own queue newest first and steal the oldest tasks of other workers once it is empty, so
+ * a worker that gets stuck on a large image does not hold up the tasks queued behind it.
+ */
+class FThreadPool {
+public:
+    /** The shared pool, sized to the number of hardware threads. */
+    static FThreadPool& Get();
+
+    explicit FThreadPool(int numThreads);
+    ~FThreadPool();
+
+    FThreadPool(const FThreadPool&) = delete;
+    FThreadPool& operator=(const FThreadPool&) = delete;
+
+    int GetNumThreads() const { return static_cast<int>(workers.size()); }
+
+    /**
+     * Queues a task. Tasks submitted from a worker go to that worker's queue, others are spread round-robin.
+     */
+    void Submit(std::function<void()> task);
+
+    /**
+     * Calls func for every index below numItems on up to maxRunners threads, the calling thread being one of them, and
+     * returns once every call is finished.
+     *
+     * The calling thread only runs items of this call, never unrelated queued tasks. Items are claimed when a thread
+     * gets to them, so the call cannot wait on a task that is still queued behind a worker that is waiting itself.
+     */
+    void ParallelFor(int numItems, int maxRunners, const std::function<void(int)>& func);
+
+private:
+    struct alignas(64) FWorkerQueue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    void WorkerLoop(int workerIndex);
+
+    bool PopTask(int workerIndex, std::function<void()>& outTask);
+
+    std::vector<std::unique_ptr<FWorkerQueue>> queues;
+    std::vector<std::thread> workers;
+
+    std::mutex wakeMutex;
+    std::condition_variable wakeCondition;
+    std::atomic<int> numQueuedTasks;
+    std::atomic<uint32_t> nextQueue;
+    bool bStopping;
+};
+}  // namespace ImageDecoder
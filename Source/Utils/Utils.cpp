@@ -46,7 +46,16 @@ unsigned CountLeadingZeros(uint32_t x) {
 
 LogFunc global_log_func = nullptr;
 
+thread_local int log_suppression_depth = 0;
+
+FScopedLogSuppression::FScopedLogSuppression() { ++log_suppression_depth; }
+
+FScopedLogSuppression::~FScopedLogSuppression() { --log_suppression_depth; }
+
 void LogMessage(ELogLevel level, const char* msg) {
+    if (log_suppression_depth > 0) {
+        return;
+    }
     if (global_log_func) {
         global_log_func(level, msg);
     } else {
@@ -28,6 +28,15 @@ void LogMessage(ELogLevel, const char*);
 
 void SetLogMessageFunc(LogFunc func);
 
+/**
+ * Drops messages logged on the calling thread while in scope, for attempts that are expected to fail and be retried.
+ */
+class FScopedLogSuppression {
+public:
+    FScopedLogSuppression();
+    ~FScopedLogSuppression();
+};
+
 #define Assert(expr)                                             \
     if (!(expr)) {                                               \
         std::string err = #expr;                                 \
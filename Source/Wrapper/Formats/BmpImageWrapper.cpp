@@ -14,15 +14,15 @@ FBmpImageWrapper::FBmpImageWrapper(bool bInHasHeader, bool bInHalfHeight) : FIma
 void FBmpImageWrapper::Compress(int quality) { LogMessage(ELogLevel::Error, "BMP compression not supported。"); }
 
 void FBmpImageWrapper::Uncompress(const ERGBFormat inFormat, const int inBitDepth) {
-    const uint8_t* buffer = compressedData.data();
+    const uint8_t* buffer = compressedBuffer;
 
-    if (!bHasHeader || ((compressedData.size() >= sizeof(FBitmapFileHeader) + sizeof(FBitmapInfoHeader)) && buffer[0] == 'B' && buffer[1] == 'M')) {
+    if (!bHasHeader || ((uint64_t(compressedSize) >= sizeof(FBitmapFileHeader) + sizeof(FBitmapInfoHeader)) && buffer[0] == 'B' && buffer[1] == 'M')) {
         UncompressBMPData(inFormat, inBitDepth);
     }
 }
 
 void FBmpImageWrapper::UncompressBMPData(const ERGBFormat inFormat, const int inBitDepth) {
-    const uint8_t* Buffer = compressedData.data();
+    const uint8_t* Buffer = compressedBuffer;
     const FBitmapInfoHeader* bmhdr = nullptr;
     const uint8_t* bits = nullptr;
     EBitmapHeaderVersion headerVersion = EBitmapHeaderVersion::BHV_BITMAPINFOHEADER;
@@ -47,16 +47,19 @@ void FBmpImageWrapper::UncompressBMPData(const ERGBFormat inFormat, const int in
 
     if (bmhdr->biPlanes == 1 && bmhdr->biBitCount == 8) {
         // Do palette.
-        const uint8_t* bmpal = (uint8_t*)compressedData.data() + sizeof(FBitmapFileHeader) + sizeof(FBitmapInfoHeader);
+        const uint8_t* bmpal = (uint8_t*)compressedBuffer + sizeof(FBitmapFileHeader) + sizeof(FBitmapInfoHeader);
 
         // Set texture properties.
         width = bmhdr->biWidth;
         const bool bNegativeHeight = (bmhdr->biHeight < 0);
         height = abs(bHalfHeight ? bmhdr->biHeight / 2 : bmhdr->biHeight);
         format = ERGBFormat::BGRA;
-        rawData.resize(height * width * 4);
 
-        FColor* imageData = (FColor*)rawData.data();
+        uint64_t dstStride = 0;
+        uint8_t* dstRows = AllocateRawRows(uint64_t(width) * 4, height, dstStride);
+        if (!dstRows) {
+            return;
+        }
 
         // If the number for color palette entries is 0, we need to default to 2^biBitCount entries.  In this case 2^8 = 256
         int clrPaletteCount = bmhdr->biClrUsed ? bmhdr->biClrUsed : 256;
@@ -86,6 +89,10 @@ void FBmpImageWrapper::UncompressBMPData(const ERGBFormat inFormat, const int in
         const uint8_t* srcPtr = bits + (bNegativeHeight ? 0 : height - 1) * srcStride;
 
         for (int y = 0; y < height; y++) {
+            if (IsCancelled()) {
+                return;
+            }
+            FColor* imageData = (FColor*)(dstRows + y * dstStride);
             for (int x = 0; x < width; x++) {
                 *imageData++ = palette[srcPtr[x]];
             }
@@ -98,9 +105,12 @@ void FBmpImageWrapper::UncompressBMPData(const ERGBFormat inFormat, const int in
         const bool bNegativeHeight = (bmhdr->biHeight < 0);
         height = abs(bHalfHeight ? bmhdr->biHeight / 2 : bmhdr->biHeight);
         format = ERGBFormat::BGRA;
-        rawData.resize(height * width * 4);
 
-        uint8_t* imageData = rawData.data();
+        uint64_t dstStride = 0;
+        uint8_t* dstRows = AllocateRawRows(uint64_t(width) * 4, height, dstStride);
+        if (!dstRows) {
+            return;
+        }
 
         // Copy scanlines, accounting for scanline direction according to the Height field.
         const int srcStride = Align(width * 3, 4);
@@ -108,6 +118,10 @@ void FBmpImageWrapper::UncompressBMPData(const ERGBFormat inFormat, const int in
         const uint8_t* srcPtr = bits + (bNegativeHeight ? 0 : height - 1) * srcStride;
 
         for (int y = 0; y < height; y++) {
+            if (IsCancelled()) {
+                return;
+            }
+            uint8_t* imageData = dstRows + y * dstStride;
             const uint8_t* srcRowPtr = srcPtr;
             for (int x = 0; x < width; x++) {
                 *imageData++ = *srcRowPtr++;
@@ -124,9 +138,12 @@ void FBmpImageWrapper::UncompressBMPData(const ERGBFormat inFormat, const int in
         const bool bNegativeHeight = (bmhdr->biHeight < 0);
         height = abs(bHalfHeight ? bmhdr->biHeight / 2 : bmhdr->biHeight);
         format = ERGBFormat::BGRA;
-        rawData.resize(height * width * 4);
 
-        uint8_t* imageData = rawData.data();
+        uint64_t dstStride = 0;
+        uint8_t* dstRows = AllocateRawRows(uint64_t(width) * 4, height, dstStride);
+        if (!dstRows) {
+            return;
+        }
 
         // Copy scanlines, accounting for scanline direction according to the Height field.
         const int srcStride = width * 4;
@@ -134,12 +151,16 @@ void FBmpImageWrapper::UncompressBMPData(const ERGBFormat inFormat, const int in
         const uint8_t* srcPtr = bits + (bNegativeHeight ? 0 : height - 1) * srcStride;
 
         // Getting the bmiColors member from the BITMAPINFO, which is used as a mask on BitFields compression.
-        const FBmiColorsMask* colorMask = (FBmiColorsMask*)(compressedData.data() + sizeof(FBitmapFileHeader) + sizeof(FBitmapInfoHeader));
+        const FBmiColorsMask* colorMask = (FBmiColorsMask*)(compressedBuffer + sizeof(FBitmapFileHeader) + sizeof(FBitmapInfoHeader));
         // Header version 4 introduced the option to declare custom color space, so we can't just assume sRGB past that version.
         const bool bAssumeRGBCompression = bmhdr->biCompression == BCBI_RGB || (bmhdr->biCompression == BCBI_BITFIELDS && colorMask->IsMaskRGB8() && headerVersion < EBitmapHeaderVersion::BHV_BITMAPV4HEADER);
 
         if (bAssumeRGBCompression) {
             for (int y = 0; y < height; y++) {
+                if (IsCancelled()) {
+                    return;
+                }
+                uint8_t* imageData = dstRows + y * dstStride;
                 const uint8_t* srcRowPtr = srcPtr;
                 for (int x = 0; x < width; x++) {
                     *imageData++ = *srcRowPtr++;
@@ -174,6 +195,10 @@ void FBmpImageWrapper::UncompressBMPData(const ERGBFormat inFormat, const int in
             const bool bHasAlphaChannel = colorMask->RGBAMask[3] != 0 && headerVersion >= EBitmapHeaderVersion::BHV_BITMAPV4HEADER;
 
             for (int y = 0; y < height; y++) {
+                if (IsCancelled()) {
+                    return;
+                }
+                uint8_t* imageData = dstRows + y * dstStride;
                 const uint32_t* srcPixel = (uint32_t*)srcPtr;
                 for (int x = 0; x < width; x++) {
                     // Set the color values in BGRA order.
@@ -207,9 +232,9 @@ bool FBmpImageWrapper::SetCompressed(const void* inCompressedData, int64_t inCom
 }
 
 bool FBmpImageWrapper::LoadBMPHeader() {
-    const FBitmapInfoHeader* bmhdr = (FBitmapInfoHeader*)(compressedData.data() + sizeof(FBitmapFileHeader));
-    const FBitmapFileHeader* bmf = (FBitmapFileHeader*)(compressedData.data() + 0);
-    if ((compressedData.size() >= sizeof(FBitmapFileHeader) + sizeof(FBitmapInfoHeader)) && compressedData.data()[0] == 'B' && compressedData.data()[1] == 'M') {
+    const FBitmapInfoHeader* bmhdr = (FBitmapInfoHeader*)(compressedBuffer + sizeof(FBitmapFileHeader));
+    const FBitmapFileHeader* bmf = (FBitmapFileHeader*)(compressedBuffer + 0);
+    if ((uint64_t(compressedSize) >= sizeof(FBitmapFileHeader) + sizeof(FBitmapInfoHeader)) && compressedBuffer[0] == 'B' && compressedBuffer[1] == 'M') {
         if (bmhdr->biCompression != BCBI_RGB && bmhdr->biCompression != BCBI_BITFIELDS) {
             LogMessage(ELogLevel::Error, "RLE compression of BMP images not supported.");
             return false;
@@ -237,7 +262,7 @@ bool FBmpImageWrapper::LoadBMPHeader() {
 }
 
 bool FBmpImageWrapper::LoadBMPInfoHeader() {
-    const FBitmapInfoHeader* bmhdr = (FBitmapInfoHeader*)compressedData.data();
+    const FBitmapInfoHeader* bmhdr = (FBitmapInfoHeader*)compressedBuffer;
 
     if (bmhdr->biCompression != BCBI_RGB && bmhdr->biCompression != BCBI_BITFIELDS) {
         LogMessage(ELogLevel::Error, "RLE compression of BMP images not supported.");
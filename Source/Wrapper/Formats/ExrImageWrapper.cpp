@@ -1,6 +1,7 @@
 ﻿#include "ExrImageWrapper.h"
 #include "Utils/Utils.h"
 #include <stdio.h>
+#include <cstring>
 #include <algorithm>
 #include <cmath>
 
@@ -13,7 +14,7 @@ template <typename sourcetype>
 class FSourceImageRaw {
 public:
     FSourceImageRaw(const std::vector<uint8_t>& inSourceImageBitmap, uint64_t inChannels, uint64_t inWidth, uint64_t inHeight) : sourceImageBitmap(inSourceImageBitmap), width(inWidth), height(inHeight), channels(inChannels) {
-        check(sourceImageBitmap.size() == channels * width * height * sizeof(sourcetype));
+        Assert(sourceImageBitmap.size() == channels * width * height * sizeof(sourcetype));
     }
 
     uint64_t GetXStride() const { return sizeof(sourcetype) * channels; }
@@ -45,9 +46,7 @@ public:
             data.resize(data.size() + std::max((uint64_t)data.size() * 2, destPost) - data.size());
         }
 
-        for (uint64_t i = 0; i < srcN; ++i) {
-            data[pos + i] = c[i];
-        }
+        memcpy(data.data() + pos, c, srcN);
         pos += srcN;
     }
 
@@ -65,7 +64,7 @@ public:
     // After calling seekp(i), tellp() returns i.
     //-------------------------------------------
 
-    virtual void seekp(uint64_t pos) { pos = pos; }
+    virtual void seekp(uint64_t inPos) { pos = inPos; }
 
     uint64_t pos;
     std::vector<uint8_t> data;
@@ -95,15 +94,13 @@ public:
         uint64_t srcN = (uint64_t)inN;
 
         if (pos + srcN > size) {
-            return false;
+            throw std::runtime_error("Unexpected end of EXR data.");
         }
 
-        for (uint64_t i = 0; i < srcN; ++i) {
-            c[i] = data[pos];
-            ++pos;
-        }
+        memcpy(c, data + pos, srcN);
+        pos += srcN;
 
-        return pos >= size;
+        return pos < size;
     }
 
     //--------------------------------------------------------
@@ -119,7 +116,7 @@ public:
     // After calling seekg(i), tellg() returns i.
     //-------------------------------------------
 
-    virtual void seekg(uint64_t pos) { pos = pos; }
+    virtual void seekg(uint64_t inPos) { pos = inPos; }
 
 private:
     const char* data;
@@ -181,6 +178,24 @@ int GetNumChannelsFromFormat(ERGBFormat format) {
     Assert(false);
     return 1;
 }
+
+/////////////////////////////////////////
+// Scanlines compressed together, as in OpenEXR's line buffers. A read that cuts a block decompresses all of it.
+int GetLinesPerBlock(Imf::Compression compression) {
+    switch (compression) {
+        case Imf::NO_COMPRESSION:
+        case Imf::RLE_COMPRESSION:
+        case Imf::ZIPS_COMPRESSION: return 1;
+        case Imf::ZIP_COMPRESSION:
+        case Imf::PXR24_COMPRESSION: return 16;
+        case Imf::PIZ_COMPRESSION:
+        case Imf::B44_COMPRESSION:
+        case Imf::B44A_COMPRESSION:
+        case Imf::DWAA_COMPRESSION: return 32;
+        case Imf::DWAB_COMPRESSION: return 256;
+        default: return 256;  // compressions newer than this list, none of which uses larger blocks
+    }
+}
 }  // namespace
 
 const char* FExrImageWrapper::GetRawChannelName(int channelIndex) const {
@@ -272,9 +287,7 @@ void FExrImageWrapper::CompressRaw(const sourcetype* srcData, bool bIgnoreAlpha)
         fileLength = memFile.tellp();
     }
 
-    for (int64_t i = 0; i < fileLength; i++) {
-        compressedData.push_back(memFile.data[i]);
-    }
+    compressedData.insert(compressedData.end(), memFile.data.begin(), memFile.data.begin() + fileLength);
 
     // const double DeltaTime = FPlatformTime::Seconds() - StartTime;
     // UE_LOG(LogImageWrapper, Verbose, TEXT("Compressed image in %.3f seconds"), DeltaTime);
@@ -300,11 +313,11 @@ void FExrImageWrapper::Compress(int quality) {
 
 void FExrImageWrapper::Uncompress(const ERGBFormat inFormat, const int inBitDepth) {
     // Ensure we haven't already uncompressed the file.
-    if (rawData.size() != 0) {
+    if (!rawDest && rawData.size() != 0) {
         return;
     }
 
-    FMemFileIn memFile(compressedData.data(), compressedData.size());
+    FMemFileIn memFile(compressedBuffer, compressedSize);
 
     Imf::RgbaInputFile imfFile(memFile);
 
@@ -316,13 +329,37 @@ void FExrImageWrapper::Uncompress(const ERGBFormat inFormat, const int inBitDept
 
     uint32_t channels = 4;
 
-    rawData.resize(int64_t(width) * int64_t(height) * int64_t(channels) * int64_t(bitDepth / 8));
+    uint64_t rowStride = 0;
+    uint8_t* rows = AllocateRawRows(uint64_t(width) * uint64_t(channels) * uint64_t(bitDepth / 8), height, rowStride);
+    if (!rows) {
+        return;
+    }
+
+    // The frame buffer is addressed in whole pixels, so the row stride has to be too.
+    if (rowStride % sizeof(Imf::Rgba) != 0) {
+        SetError("EXR destination stride must be a multiple of the pixel size.");
+        return;
+    }
+    const int64_t pixelStride = int64_t(rowStride / sizeof(Imf::Rgba));
 
     int dx = win.min.x;
     int dy = win.min.y;
 
-    imfFile.setFrameBuffer((Imf::Rgba*)(rawData.data()) - int64_t(dx) - int64_t(dy) * int64_t(width), 1, width);
-    imfFile.readPixels(win.min.y, win.max.y);
+    imfFile.setFrameBuffer((Imf::Rgba*)(rows) - int64_t(dx) - int64_t(dy) * pixelStride, 1, pixelStride);
+    if (!cancelFlag) {
+        imfFile.readPixels(win.min.y, win.max.y);
+        return;
+    }
+
+    // Read in strips so a cancelled decode stops early. A strip cut through a compressed block decompresses it once for
+    // every strip it touches, so strips are at least 64 rows and always a whole number of the file's blocks.
+    const int stripHeight = std::max(64, GetLinesPerBlock(imfFile.header().compression()));
+    for (int y = win.min.y; y <= win.max.y; y += stripHeight) {
+        if (IsCancelled()) {
+            return;
+        }
+        imfFile.readPixels(y, std::min(y + stripHeight - 1, win.max.y));
+    }
 }
 
 // from http://www.openexr.com/ReadingAndWritingImageFiles.pdf
@@ -342,13 +379,28 @@ bool FExrImageWrapper::SetCompressed(const void* inCompressedData, int64_t inCom
 
     FMemFileIn MemFile(inCompressedData, inCompressedSize);
 
-    if (!IsThisAnOpenExrFile(MemFile)) {
+    // Only the header is parsed here, the pixels are read on Uncompress.
+    Imf::Header header;
+    try {
+        if (!IsThisAnOpenExrFile(MemFile)) {
+            return false;
+        }
+
+        // Skip the magic number, the version field follows it.
+        char versionField[4];
+        MemFile.seekg(4);
+        MemFile.read(versionField, sizeof(versionField));
+        int version = uint8_t(versionField[0]) | (uint8_t(versionField[1]) << 8) | (uint8_t(versionField[2]) << 16) | (uint8_t(versionField[3]) << 24);
+
+        header.readFrom(MemFile, version);
+    } catch (const std::exception& e) {
+        SetError(e.what());
+        std::string error = "EXR Error: " + std::string(e.what());
+        LogMessage(ELogLevel::Error, error.data());
         return false;
     }
 
-    Imf::RgbaInputFile imfFile(MemFile);
-
-    Imath::Box2i win = imfFile.dataWindow();
+    Imath::Box2i win = header.dataWindow();
 
     Imath::V2i dim(win.max.x - win.min.x + 1, win.max.y - win.min.y + 1);
 
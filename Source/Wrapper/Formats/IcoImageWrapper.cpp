@@ -49,7 +49,7 @@ struct FIconImage {
 /* FJpegImageWrapper structors
  *****************************************************************************/
 
-FIcoImageWrapper::FIcoImageWrapper() : FImageWrapperBase() {}
+FIcoImageWrapper::FIcoImageWrapper() : FImageWrapperBase(), imageOffset(0), imageSize(0), bIsPng(false) {}
 
 /* FImageWrapper interface
  *****************************************************************************/
@@ -57,9 +57,8 @@ FIcoImageWrapper::FIcoImageWrapper() : FImageWrapperBase() {}
 void FIcoImageWrapper::Compress(int quality) { LogMessage(ELogLevel::Error, "ICO compression not supported."); }
 
 void FIcoImageWrapper::Uncompress(const ERGBFormat inFormat, const int inBitDepth) {
-    const uint8_t* buffer = compressedData.data();
-
     if (imageOffset != 0 && imageSize != 0) {
+        subImageWrapper->SetCancelFlag(cancelFlag);
         subImageWrapper->Uncompress(inFormat, inBitDepth);
     }
 }
@@ -81,40 +80,59 @@ bool FIcoImageWrapper::GetRaw(const ERGBFormat inFormat, int inBitDepth, std::ve
     return lastError.empty();
 }
 
+bool FIcoImageWrapper::GetRaw(const ERGBFormat inFormat, int inBitDepth, uint8_t* outRawData, uint64_t outStride, uint64_t outCapacity) {
+    lastError.clear();
+
+    if (imageOffset == 0 || imageSize == 0) {
+        return false;
+    }
+
+    subImageWrapper->SetCancelFlag(cancelFlag);
+    return subImageWrapper->GetRaw(inFormat, inBitDepth, outRawData, outStride, outCapacity);
+}
+
 /* FImageWrapper implementation
  *****************************************************************************/
 
 bool FIcoImageWrapper::LoadICOHeader() {
-    const uint8_t* buffer = compressedData.data();
+    const uint8_t* buffer = compressedBuffer;
 
     std::shared_ptr<FPngImageWrapper> pngWrapper = std::make_shared<FPngImageWrapper>();
     std::shared_ptr<FBmpImageWrapper> bmpWrapper = std::make_shared<FBmpImageWrapper>(false, true);
 
     bool bFoundImage = false;
     const FIconDir* iconHeader = (FIconDir*)(buffer);
+    const uint64_t iconDirSize = sizeof(FIconDir) - sizeof(FIconDirEntry);
 
-    if (iconHeader->idReserved == 0 && iconHeader->idType == 1) {
+    if (uint64_t(compressedSize) >= iconDirSize && iconHeader->idReserved == 0 && iconHeader->idType == 1 && iconDirSize + iconHeader->idCount * sizeof(FIconDirEntry) <= uint64_t(compressedSize)) {
         // use the largest-width 32-bit dir entry we find
         uint32_t largestWidth = 0;
         const FIconDirEntry* iconDirEntry = iconHeader->idEntries;
 
         for (int entry = 0; entry < (int)iconHeader->idCount; entry++, iconDirEntry++) {
             const uint32_t realWidth = iconDirEntry->bWidth == 0 ? 256 : iconDirEntry->bWidth;
+            if (uint64_t(iconDirEntry->dwImageOffset) + iconDirEntry->dwBytesInRes > uint64_t(compressedSize)) {
+                continue;
+            }
+
+            // The sub-images only view this wrapper's compressed data, which outlives them.
             if (iconDirEntry->wBitCount == 32 && realWidth > largestWidth) {
-                if (pngWrapper->SetCompressed(buffer + iconDirEntry->dwImageOffset, (int)iconDirEntry->dwBytesInRes)) {
+                if (pngWrapper->SetCompressedView(buffer + iconDirEntry->dwImageOffset, (int)iconDirEntry->dwBytesInRes)) {
                     width = pngWrapper->GetWidth();
                     height = pngWrapper->GetHeight();
                     format = pngWrapper->GetFormat();
+                    bitDepth = pngWrapper->GetBitDepth();
                     largestWidth = realWidth;
                     bFoundImage = true;
                     bIsPng = true;
                     imageOffset = iconDirEntry->dwImageOffset;
                     imageSize = iconDirEntry->dwBytesInRes;
-                } else if (bmpWrapper->SetCompressed(buffer + iconDirEntry->dwImageOffset, (int)iconDirEntry->dwBytesInRes)) {
+                } else if (bmpWrapper->SetCompressedView(buffer + iconDirEntry->dwImageOffset, (int)iconDirEntry->dwBytesInRes)) {
                     // otherwise this should be a BMP icon
                     width = bmpWrapper->GetWidth();
                     height = bmpWrapper->GetHeight() / 2;  // ICO file spec says to divide by 2 here as height refers to combined image & mask height
                     format = bmpWrapper->GetFormat();
+                    bitDepth = bmpWrapper->GetBitDepth();
                     largestWidth = realWidth;
                     bFoundImage = true;
                     bIsPng = false;
@@ -1,4 +1,5 @@
 ﻿#pragma once
+#include <memory>
 #include "Wrapper/ImageWrapperBase.h"
 
 namespace ImageDecoder {
@@ -17,6 +18,7 @@ public:
     virtual void Uncompress(const ERGBFormat inFormat, int inBitDepth) override;
     virtual bool SetCompressed(const void* inCompressedData, int64_t inCompressedSize) override;
     virtual bool GetRaw(const ERGBFormat inFormat, int inBitDepth, std::vector<uint8_t>& outRawData) override;
+    virtual bool GetRaw(const ERGBFormat inFormat, int inBitDepth, uint8_t* outRawData, uint64_t outStride, uint64_t outCapacity) override;
 
 protected:
     /**
@@ -1,9 +1,14 @@
 ﻿// Copyright Epic Games, Inc. All Rights Reserved.
 
 #include "JpegImageWrapper.h"
+#include "Utils/ThreadPool.h"
 #include "Utils/Utils.h"
+#include "Wrapper/JpegImageSupport.h"
 #include <algorithm>
-#include <mutex>
+#include <atomic>
+#include <csetjmp>
+#include <cstdio>
+#include <cstring>
 
 namespace ImageDecoder {
 #ifdef __clang__
@@ -18,6 +23,8 @@ namespace ImageDecoder {
 #pragma push_macro("DLLEXPORT")
 #undef DLLEXPORT  // libjpeg-turbo defines DLLEXPORT as well
 #include "turbojpeg.h"
+#include "jpeglib.h"
+#include "jerror.h"
 #pragma pop_macro("DLLEXPORT")
 
 #ifdef __clang__
@@ -42,25 +49,153 @@ int ConvertTJpegPixelFormat(ERGBFormat InFormat) {
     }
 }
 
-// Only allow one thread to use JPEG decoder at a time (it's not thread safe)
-std::mutex GJPEGSection;
+J_COLOR_SPACE ConvertLibJpegColorSpace(ERGBFormat InFormat) {
+    switch (InFormat) {
+        case ERGBFormat::BGRA: return JCS_EXT_BGRA;
+        case ERGBFormat::Gray: return JCS_GRAYSCALE;
+        case ERGBFormat::RGBA: return JCS_EXT_RGBA;
+        default: return JCS_EXT_RGBA;
+    }
+}
 
-/* FJpegImageWrapper structors
- *****************************************************************************/
+/**
+ * libjpeg error manager that jumps back to the decode call instead of exiting the process.
+ */
+struct FJpegErrorManager {
+    jpeg_error_mgr pub;
+    jmp_buf setjmpBuffer;
+    char message[JMSG_LENGTH_MAX];
+
+    static void ErrorExit(j_common_ptr cinfo) {
+        FJpegErrorManager* errorManager = (FJpegErrorManager*)cinfo->err;
+        (*cinfo->err->format_message)(cinfo, errorManager->message);
+        longjmp(errorManager->setjmpBuffer, 1);
+    }
+
+    static void OutputMessage(j_common_ptr /*cinfo*/) {}
+};
+
+/**
+ * libjpeg compressor writing into a fixed buffer, which fails the encode once it is full instead of growing it.
+ * Set next_output_byte and free_in_buffer of destination before each encode, and call ResetDefaults.
+ */
+struct FJpegCompressor {
+    jpeg_compress_struct cinfo;
+    FJpegErrorManager errorManager;
+    jpeg_destination_mgr destination;
+
+    /** Standard Huffman tables for luma and chroma */
+    JHUFF_TBL standardDcTables[2];
+    JHUFF_TBL standardAcTables[2];
+
+    FJpegCompressor() {
+        cinfo.err = jpeg_std_error(&errorManager.pub);
+        errorManager.pub.error_exit = FJpegErrorManager::ErrorExit;
+        errorManager.pub.output_message = FJpegErrorManager::OutputMessage;
+        jpeg_create_compress(&cinfo);
+        destination.init_destination = InitDestination;
+        destination.empty_output_buffer = EmptyOutputBuffer;
+        destination.term_destination = TermDestination;
+        cinfo.dest = &destination;
+
+        cinfo.in_color_space = JCS_RGB;
+        cinfo.input_components = 3;
+        jpeg_set_defaults(&cinfo);
+        for (int table = 0; table < 2; table++) {
+            standardDcTables[table] = *cinfo.dc_huff_tbl_ptrs[table];
+            standardAcTables[table] = *cinfo.ac_huff_tbl_ptrs[table];
+        }
+    }
+
+    /**
+     * Same as jpeg_set_defaults on a new compressor. libjpeg-turbo leaves existing Huffman tables alone there, which
+     * would keep the tables optimized for the previous image.
+     */
+    void ResetDefaults() {
+        jpeg_set_defaults(&cinfo);
+        for (int table = 0; table < 2; table++) {
+            *cinfo.dc_huff_tbl_ptrs[table] = standardDcTables[table];
+            *cinfo.ac_huff_tbl_ptrs[table] = standardAcTables[table];
+        }
+    }
+
+    ~FJpegCompressor() { jpeg_destroy_compress(&cinfo); }
+
+    static void InitDestination(j_compress_ptr /*cinfo*/) {}
 
-FJpegImageWrapper::FJpegImageWrapper(int inNumComponents) : FImageWrapperBase(), numComponents(inNumComponents), compressor(tjInitCompress()), decompressor(tjInitDecompress()) {}
+    static boolean EmptyOutputBuffer(j_compress_ptr cinfo) {
+        cinfo->err->msg_code = JERR_BUFFER_SIZE;
+        (*cinfo->err->error_exit)(reinterpret_cast<j_common_ptr>(cinfo));
+        return FALSE;
+    }
+
+    static void TermDestination(j_compress_ptr /*cinfo*/) {}
+};
+
+/**
+ * Codec handles of one thread, created on first use and destroyed when the thread exits.
+ * A handle must never be used by two threads at once, giving each thread its own lets wrappers on different threads run in parallel.
+ * Encoding goes through libjpeg itself, TurboJPEG 2.x cannot optimize Huffman tables per image.
+ */
+struct FTurboJpegHandles {
+    FJpegCompressor* compressor = nullptr;
+    tjhandle decompressor = nullptr;
+    tjhandle transformer = nullptr;
+
+    ~FTurboJpegHandles() {
+        delete compressor;
+        if (decompressor) {
+            tjDestroy(decompressor);
+        }
+        if (transformer) {
+            tjDestroy(transformer);
+        }
+    }
+};
 
-FJpegImageWrapper::~FJpegImageWrapper() {
-    std::lock_guard<std::mutex> JPEGLock(GJPEGSection);
+thread_local FTurboJpegHandles thread_jpeg_handles;
 
-    if (compressor) {
-        tjDestroy(compressor);
+FJpegCompressor& GetThreadCompressor() {
+    if (!thread_jpeg_handles.compressor) {
+        thread_jpeg_handles.compressor = new FJpegCompressor();
     }
-    if (decompressor) {
-        tjDestroy(decompressor);
+    return *thread_jpeg_handles.compressor;
+}
+
+tjhandle GetThreadDecompressor() {
+    if (!thread_jpeg_handles.decompressor) {
+        thread_jpeg_handles.decompressor = tjInitDecompress();
     }
+    return thread_jpeg_handles.decompressor;
 }
 
+tjhandle GetThreadTransformer() {
+    if (!thread_jpeg_handles.transformer) {
+        thread_jpeg_handles.transformer = tjInitTransform();
+    }
+    return thread_jpeg_handles.transformer;
+}
+
+int ConvertTJpegTransformOp(EJpegTransform transform) {
+    switch (transform) {
+        case EJpegTransform::FlipHorizontal: return TJXOP_HFLIP;
+        case EJpegTransform::FlipVertical: return TJXOP_VFLIP;
+        case EJpegTransform::Transpose: return TJXOP_TRANSPOSE;
+        case EJpegTransform::Transverse: return TJXOP_TRANSVERSE;
+        case EJpegTransform::Rotate90: return TJXOP_ROT90;
+        case EJpegTransform::Rotate180: return TJXOP_ROT180;
+        case EJpegTransform::Rotate270: return TJXOP_ROT270;
+        default: return TJXOP_NONE;
+    }
+}
+
+/* FJpegImageWrapper structors
+ *****************************************************************************/
+
+FJpegImageWrapper::FJpegImageWrapper(int inNumComponents) : FImageWrapperBase(), numComponents(inNumComponents), subsampling(TJSAMP_GRAY), scaleNum(1), scaleDenom(1), regionX(0), regionY(0), regionWidth(0), regionHeight(0), maxScans(0), maxScanBytes(0), mcuIndex(nullptr) {}
+
+FJpegImageWrapper::~FJpegImageWrapper() {}
+
 /* FImageWrapperBase interface
  *****************************************************************************/
 
@@ -79,8 +214,7 @@ void FJpegImageWrapper::Compress(int quality) { CompressTurbo(quality); }
 void FJpegImageWrapper::Uncompress(const ERGBFormat inFormat, int inBitDepth) { UncompressTurbo(inFormat, inBitDepth); }
 
 bool FJpegImageWrapper::SetCompressedTurbo(const void* inCompressedData, int64_t inCompressedSize) {
-    std::lock_guard<std::mutex> JPEGLock(GJPEGSection);
-
+    tjhandle decompressor = GetThreadDecompressor();
     Assert(decompressor);
 
     int imageWidth;
@@ -98,43 +232,204 @@ bool FJpegImageWrapper::SetCompressedTurbo(const void* inCompressedData, int64_t
     height = imageHeight;
     bitDepth = 8;  // We don't support 16 bit jpegs
     format = subSampling == TJSAMP_GRAY ? ERGBFormat::Gray : ERGBFormat::RGBA;
+    subsampling = subSampling;
+    scaleNum = 1;
+    scaleDenom = 1;
+    regionX = 0;
+    regionY = 0;
+    regionWidth = 0;
+    regionHeight = 0;
+    maxScans = 0;
+    maxScanBytes = 0;
+    mcuIndex = nullptr;
 
     return bResult;
 }
 
-void FJpegImageWrapper::CompressTurbo(int quality) {
-    if (compressedData.size() == 0) {
-        std::lock_guard<std::mutex> JPEGLock(GJPEGSection);
+void FJpegImageWrapper::SelectScale(int maxDimension, int inScaleNum, int inScaleDenom) {
+    scaleNum = 1;
+    scaleDenom = 1;
+
+    int numScalingFactors = 0;
+    const tjscalingfactor* scalingFactors = tjGetScalingFactors(&numScalingFactors);
+    if (!scalingFactors) {
+        return;
+    }
+
+    auto isSmaller = [](const tjscalingfactor& a, const tjscalingfactor& b) { return int64_t(a.num) * b.denom < int64_t(b.num) * a.denom; };
+    auto scaled = [](int dimension, const tjscalingfactor& factor) { return (int64_t(dimension) * factor.num + factor.denom - 1) / factor.denom; };
 
-        Assert(compressor);
+    // Without a factor that fits, the smallest one is still the closest.
+    tjscalingfactor best = {0, 1};
+    tjscalingfactor smallest = {1, 1};
+    for (int i = 0; i < numScalingFactors; i++) {
+        const tjscalingfactor& factor = scalingFactors[i];
+        if (factor.num > factor.denom) {
+            continue;  // Upscaling is left to the GPU
+        }
+        if (isSmaller(factor, smallest)) {
+            smallest = factor;
+        }
 
-        if (quality == 0) {
-            quality = 85;
+        const bool bFitsScale = inScaleDenom <= 0 || int64_t(factor.num) * inScaleDenom <= int64_t(inScaleNum) * factor.denom;
+        const bool bFitsDimension = maxDimension <= 0 || (scaled(width, factor) <= maxDimension && scaled(height, factor) <= maxDimension);
+        if (bFitsScale && bFitsDimension && isSmaller(best, factor)) {
+            best = factor;
         }
-        Assert(quality >= 1 && quality <= 100);
-        quality = std::min(std::max(quality, 1), 100);
+    }
+
+    const tjscalingfactor& selected = best.num > 0 ? best : smallest;
+    scaleNum = selected.num;
+    scaleDenom = selected.denom;
+}
+
+bool FJpegImageWrapper::SetRegion(int inX, int inY, int inWidth, int inHeight) {
+    if (inX < 0 || inY < 0 || inWidth <= 0 || inHeight <= 0 || int64_t(inX) + inWidth > width || int64_t(inY) + inHeight > height) {
+        return false;
+    }
+
+    // The scaled rectangle has to cover every scaled pixel the full size one touches.
+    const int left = static_cast<int>(int64_t(inX) * scaleNum / scaleDenom);
+    const int top = static_cast<int>(int64_t(inY) * scaleNum / scaleDenom);
+    const int right = std::min(ScaleDimension(inX + inWidth), GetScaledWidth());
+    const int bottom = std::min(ScaleDimension(inY + inHeight), GetScaledHeight());
+    regionX = left;
+    regionY = top;
+    regionWidth = std::max(right - left, 1);
+    regionHeight = std::max(bottom - top, 1);
+    return true;
+}
+
+ETextureSourceFormat FJpegImageWrapper::GetYUVFormat() const {
+    switch (subsampling) {
+        case TJSAMP_444: return ETextureSourceFormat::YUV444;
+        case TJSAMP_422: return ETextureSourceFormat::YUV422;
+        case TJSAMP_420: return ETextureSourceFormat::YUV420;
+        case TJSAMP_440: return ETextureSourceFormat::YUV440;
+        case TJSAMP_411: return ETextureSourceFormat::YUV411;
+        default: return ETextureSourceFormat::Invalid;
+    }
+}
+
+int FJpegImageWrapper::GetPlaneWidth(int plane) const { return tjPlaneWidth(plane, GetScaledWidth(), subsampling); }
+
+int FJpegImageWrapper::GetPlaneHeight(int plane) const { return tjPlaneHeight(plane, GetScaledHeight(), subsampling); }
+
+bool FJpegImageWrapper::GetYUVPlanes(uint8_t* const outPlanes[3], const int outStrides[3]) {
+    lastError.clear();
+    if (GetYUVFormat() == ETextureSourceFormat::Invalid) {
+        SetError("JPEG has no planar YUV layout.");
+        return false;
+    }
+
+    // TurboJPEG decodes the planes in one call, so a cancel flag is only honored before and after it.
+    if (IsCancelled()) {
+        return false;
+    }
+
+    tjhandle decompressor = GetThreadDecompressor();
+    Assert(decompressor);
+    Assert(compressedSize);
+
+    unsigned char* planes[3] = {outPlanes[0], outPlanes[1], outPlanes[2]};
+    int strides[3] = {outStrides[0], outStrides[1], outStrides[2]};
+    if (tjDecompressToYUVPlanes(decompressor, compressedBuffer, static_cast<unsigned long>(compressedSize), planes, GetScaledWidth(), strides, GetScaledHeight(), TJFLAG_FASTDCT) != 0) {
+        SetError(tjGetErrorStr2(decompressor));
+        return false;
+    }
+    return !IsCancelled();
+}
+
+void FJpegImageWrapper::CompressTurbo(int quality) {
+    if (compressedData.size() == 0) {
+        Assert(quality >= 0 && quality <= 100);
 
         Assert(rawData.size());
         Assert(width > 0);
         Assert(height > 0);
 
-        compressedData.resize(rawData.size());
+        ImageEncodeOptions options = {};
+        options.quality = quality;
+        options.subsampling = EJpegSubsampling::YUV420;
 
-        const int pixelFormat = ConvertTJpegPixelFormat(rawFormat);
-        unsigned char* outBuffer = compressedData.data();
-        unsigned long outBufferSize = static_cast<unsigned long>(compressedData.size());
-        const int flags = TJFLAG_NOREALLOC | TJFLAG_FASTDCT;
+        // Sized for the worst case, raw data can be smaller than the JPEG of incompressible content.
+        compressedData.resize(GetMaxCompressedSize(width, height, options.subsampling));
 
-        const bool bSuccess = tjCompress2(compressor, rawData.data(), width, 0, height, pixelFormat, &outBuffer, &outBufferSize, TJSAMP_420, quality, flags) == 0;
+        const uint64_t rawStride = uint64_t(width) * (rawFormat == ERGBFormat::Gray ? 1 : 4);
+        uint64_t outSize = 0;
+        const bool bSuccess = CompressToBuffer(rawData.data(), width, height, rawStride, rawFormat, options, compressedData.data(), compressedData.size(), outSize);
         Assert(bSuccess);
 
-        compressedData.resize((int64_t)outBufferSize);
+        compressedData.resize(outSize);
     }
 }
 
+bool FJpegImageWrapper::TransformTurbo(const JpegTransformOptions& options, uint8_t* dest, uint64_t destCapacity, uint64_t& outSize) {
+    lastError.clear();
+    outSize = 0;
+
+    tjhandle transformer = GetThreadTransformer();
+    Assert(transformer);
+    Assert(compressedSize);
+
+    tjtransform transform = {};
+    transform.op = ConvertTJpegTransformOp(options.transform);
+    transform.options = (options.trim ? TJXOPT_TRIM : 0) | (options.perfect ? TJXOPT_PERFECT : 0) | (options.grayscale ? TJXOPT_GRAY : 0) | (options.progressive ? TJXOPT_PROGRESSIVE : 0) | (options.strip_markers ? TJXOPT_COPYNONE : 0);
+
+    if (options.crop_width && options.crop_height) {
+        // The crop applies to the transformed image, whose size and MCUs are the other way round after transposing.
+        const bool bTransposed = transform.op == TJXOP_TRANSPOSE || transform.op == TJXOP_TRANSVERSE || transform.op == TJXOP_ROT90 || transform.op == TJXOP_ROT270;
+        const int transformedWidth = bTransposed ? height : width;
+        const int transformedHeight = bTransposed ? width : height;
+        if (options.crop_x < 0 || options.crop_y < 0 || options.crop_width <= 0 || options.crop_height <= 0 || int64_t(options.crop_x) + options.crop_width > transformedWidth || int64_t(options.crop_y) + options.crop_height > transformedHeight) {
+            SetError("Crop rectangle does not lie within the transformed image.");
+            LogMessage(ELogLevel::Error, lastError.data());
+            return false;
+        }
+
+        const int mcuWidth = bTransposed ? tjMCUHeight[subsampling] : tjMCUWidth[subsampling];
+        const int mcuHeight = bTransposed ? tjMCUWidth[subsampling] : tjMCUHeight[subsampling];
+        transform.r.x = options.crop_x / mcuWidth * mcuWidth;
+        transform.r.y = options.crop_y / mcuHeight * mcuHeight;
+        transform.r.w = options.crop_x + options.crop_width - transform.r.x;
+        transform.r.h = options.crop_y + options.crop_height - transform.r.y;
+        transform.options |= TJXOPT_CROP;
+    }
+
+    // Copied markers can make the result larger than tjBufSize, so TurboJPEG allocates it and it is copied over afterwards.
+    unsigned char* outBuffer = nullptr;
+    unsigned long outBufferSize = 0;
+    if (tjTransform(transformer, compressedBuffer, static_cast<unsigned long>(compressedSize), 1, &outBuffer, &outBufferSize, &transform, 0) != 0) {
+        SetError(tjGetErrorStr2(transformer));
+        LogMessage(ELogLevel::Error, lastError.data());
+        tjFree(outBuffer);
+        return false;
+    }
+
+    outSize = outBufferSize;
+    const bool bFits = dest && destCapacity >= outSize;
+    if (bFits) {
+        memcpy(dest, outBuffer, outSize);
+    }
+    tjFree(outBuffer);
+    return bFits;
+}
+
+uint64_t FJpegImageWrapper::GetMaxCompressedSize(int inWidth, int inHeight, EJpegSubsampling inSubsampling) {
+    int jpegSubsamp = TJSAMP_420;
+    switch (inSubsampling) {
+        case EJpegSubsampling::YUV420: jpegSubsamp = TJSAMP_420; break;
+        case EJpegSubsampling::YUV422: jpegSubsamp = TJSAMP_422; break;
+        case EJpegSubsampling::YUV444: jpegSubsamp = TJSAMP_444; break;
+        case EJpegSubsampling::Gray: jpegSubsamp = TJSAMP_GRAY; break;
+    }
+    const unsigned long size = tjBufSize(inWidth, inHeight, jpegSubsamp);
+    return size == static_cast<unsigned long>(-1) ? 0 : size;
+}
+
 void FJpegImageWrapper::UncompressTurbo(const ERGBFormat inFormat, int inBitDepth) {
     // Ensure we haven't already uncompressed the file.
-    if (rawData.size() != 0) {
+    if (!rawDest && rawData.size() != 0) {
         return;
     }
 
@@ -148,17 +443,725 @@ void FJpegImageWrapper::UncompressTurbo(const ERGBFormat inFormat, int inBitDept
         Assert(false);
     }
 
-    std::lock_guard<std::mutex> jpegLock(GJPEGSection);
+    // tjDecompress2 can neither crop nor stop after a scan, such decodes read the scanlines themselves.
+    if (regionWidth || maxScans || maxScanBytes) {
+        UncompressScanlines(inFormat, channels);
+        return;
+    }
+
+    // Nor can it be stopped partway, the cancel flag is checked between restart bands or around the whole call.
+    if (IsCancelled()) {
+        return;
+    }
 
+    tjhandle decompressor = GetThreadDecompressor();
     Assert(decompressor);
-    Assert(compressedData.size());
+    Assert(compressedSize);
+
+    // TurboJPEG picks the scaling factor that produces exactly the scaled size.
+    const int scaledWidth = GetScaledWidth();
+    const int scaledHeight = GetScaledHeight();
+    uint64_t rowStride = 0;
+    uint8_t* rows = AllocateRawRows(uint64_t(scaledWidth) * channels, scaledHeight, rowStride);
+    if (!rows) {
+        return;
+    }
+    if (UncompressRestartBands(inFormat, rows, rowStride)) {
+        return;
+    }
 
-    rawData.resize(width * height * channels);
     const int pixelFormat = ConvertTJpegPixelFormat(inFormat);
     const int flags = TJFLAG_NOREALLOC | TJFLAG_FASTDCT;
 
-    if (tjDecompress2(decompressor, compressedData.data(), static_cast<unsigned long>(compressedData.size()), rawData.data(), width, 0, height, pixelFormat, flags) != 0) {
+    if (tjDecompress2(decompressor, compressedBuffer, static_cast<unsigned long>(compressedSize), rows, scaledWidth, static_cast<int>(rowStride), scaledHeight, pixelFormat, flags) != 0) {
+        SetError(tjGetErrorStr2(decompressor));
+        return;
+    }
+
+    // A cancel that came during the call still fails the decode, IsCancelled sets the error that reports it.
+    if (IsCancelled()) {
+        return;
+    }
+}
+
+bool FJpegImageWrapper::BuildIndexedBand(std::vector<uint8_t>& outBandJpeg, int& outSkipRows) const {
+    // MCU rows are whole multiples of 8 pixels, so they scale to whole rows.
+    const FJpegMcuIndex& index = *mcuIndex;
+    const int scaledMcuHeight = index.mcuHeight * scaleNum / scaleDenom;
+    int firstRow = regionY / scaledMcuHeight;
+    int endRow = std::min((regionY + regionHeight + scaledMcuHeight - 1) / scaledMcuHeight, index.mcuRows);
+
+    // Vertical chroma upsampling blends in the neighboring MCU rows, so those are decoded along with the region's.
+    if (index.bVerticalUpsampling) {
+        firstRow = std::max(firstRow - 1, 0);
+        endRow = std::min(endRow + 1, index.mcuRows);
+    }
+
+    int primingRows = 0;
+    if (!index.BuildBand(compressedBuffer, firstRow, endRow, outBandJpeg, primingRows)) {
+        return false;
+    }
+    outSkipRows = primingRows * scaleNum / scaleDenom + regionY - firstRow * scaledMcuHeight;
+    return true;
+}
+
+static bool DecodeRestartBand(const std::vector<uint8_t>& bandJpeg, J_COLOR_SPACE colorSpace, int scaleNum, int scaleDenom, int skipRows, int numRows, uint8_t* rows, uint64_t rowStride);
+
+/** Images below this many pixels encode and decode faster in one go than split into bands */
+static const int64_t MIN_RESTART_BAND_PIXELS = 1024 * 1024;
+
+bool FJpegImageWrapper::UncompressRestartBands(const ERGBFormat inFormat, uint8_t* rows, uint64_t rowStride) {
+    if (int64_t(width) * height < MIN_RESTART_BAND_PIXELS) {
+        return false;
+    }
+
+    FJpegRestartIndex restartIndex;
+    if (!restartIndex.Parse(compressedBuffer, compressedSize)) {
+        return false;
+    }
+
+    // One band per runner, like batches the calling thread runs one too. Bands start at the first MCU row at or below
+    // an even split that begins a restart interval.
+    FThreadPool& threadPool = FThreadPool::Get();
+    const int numRunners = threadPool.GetNumThreads() + 1;
+    std::vector<int> bandRows(1, 0);
+    for (int band = 1; band < numRunners; band++) {
+        int row = static_cast<int>(int64_t(restartIndex.mcuRows) * band / numRunners);
+        while (row < restartIndex.mcuRows && restartIndex.GetRowSegment(row) < 0) {
+            row++;
+        }
+        if (row > bandRows.back() && row < restartIndex.mcuRows) {
+            bandRows.push_back(row);
+        }
+    }
+    bandRows.push_back(restartIndex.mcuRows);
+    const int numBands = static_cast<int>(bandRows.size()) - 1;
+    if (numBands < 2) {
+        return false;
+    }
+
+    // MCU rows are whole multiples of 8 pixels, so they scale to whole rows.
+    auto getScaledRow = [&](int mcuRow) { return static_cast<int>(std::min<int64_t>(int64_t(mcuRow) * restartIndex.mcuHeight * scaleNum / scaleDenom, GetScaledHeight())); };
+    const J_COLOR_SPACE colorSpace = ConvertLibJpegColorSpace(inFormat);
+
+    std::atomic<bool> bFailed(false);
+    auto decodeBand = [&](int band) {
+        const int firstRow = bandRows[band];
+        const int endRow = bandRows[band + 1];
+
+        // Vertical chroma upsampling blends in the neighboring MCU rows, so those are decoded along with the band
+        // starting from the closest restart interval above it. Below the band, decoding simply stops.
+        int decodeFirstRow = firstRow;
+        int decodeEndRow = endRow;
+        if (restartIndex.bVerticalUpsampling) {
+            if (decodeFirstRow > 0) {
+                decodeFirstRow--;
+                while (restartIndex.GetRowSegment(decodeFirstRow) < 0) {
+                    decodeFirstRow--;
+                }
+            }
+            if (decodeEndRow < restartIndex.mcuRows) {
+                decodeEndRow++;
+                while (restartIndex.GetRowSegment(decodeEndRow) < 0) {
+                    decodeEndRow++;
+                }
+            }
+        }
+
+        if (bFailed || (cancelFlag && cancelFlag->load(std::memory_order_relaxed))) {
+            bFailed = true;
+            return;
+        }
+
+        // Workers must not let exceptions escape, they would terminate the process.
+        try {
+            std::vector<uint8_t> bandJpeg;
+            restartIndex.BuildBand(compressedBuffer, decodeFirstRow, decodeEndRow, bandJpeg);
+            const int skipRows = getScaledRow(firstRow) - getScaledRow(decodeFirstRow);
+            const int numRows = getScaledRow(endRow) - getScaledRow(firstRow);
+            if (!DecodeRestartBand(bandJpeg, colorSpace, scaleNum, scaleDenom, skipRows, numRows, rows + getScaledRow(firstRow) * rowStride, rowStride)) {
+                bFailed = true;
+            }
+        } catch (const std::exception&) {
+            bFailed = true;
+        }
+    };
+
+    threadPool.ParallelFor(numBands, numBands, decodeBand);
+
+    // A cancelled decode is done, the serial one must not start over.
+    return IsCancelled() || !bFailed;
+}
+
+static bool EncodeJpeg(const uint8_t* pixels, int width, int height, uint64_t stride, ERGBFormat format, const ImageEncodeOptions& options, int restartRows, uint8_t* dest, uint64_t destCapacity, uint64_t& outSize, std::string& outError);
+
+bool FJpegImageWrapper::CompressRestartStrips(const uint8_t* inPixels, int inWidth, int inHeight, uint64_t inStride, ERGBFormat inFormat, const ImageEncodeOptions& options, uint8_t* dest, uint64_t destCapacity, uint64_t& outSize) {
+    // Progressive scans and optimized Huffman tables need the whole image at once.
+    if (options.progressive || options.optimize_huffman || int64_t(inWidth) * inHeight < MIN_RESTART_BAND_PIXELS) {
+        return false;
+    }
+
+    // Strips are whole MCU rows, so chroma downsampling never looks across a strip boundary.
+    const EJpegSubsampling stripSubsampling = inFormat == ERGBFormat::Gray ? EJpegSubsampling::Gray : options.subsampling;
+    const int mcuHeight = stripSubsampling == EJpegSubsampling::YUV420 ? 16 : 8;
+    const int mcuRows = (inHeight + mcuHeight - 1) / mcuHeight;
+    FThreadPool& threadPool = FThreadPool::Get();
+    const int numStrips = std::min(threadPool.GetNumThreads() + 1, mcuRows);
+    if (numStrips < 2) {
+        return false;
+    }
+
+    // Each strip is a JPEG of its own with a restart marker after every MCU row, encoded by the compressor of the
+    // thread it runs on. The restart index then finds the intervals to stitch.
+    std::vector<std::vector<uint8_t>> stripJpegs(numStrips);
+    std::vector<FJpegRestartIndex> stripIndices(numStrips);
+    std::atomic<bool> bFailed(false);
+    auto encodeStrip = [&](int strip) {
+        const int firstRow = static_cast<int>(int64_t(mcuRows) * strip / numStrips) * mcuHeight;
+        const int endRow = std::min(static_cast<int>(int64_t(mcuRows) * (strip + 1) / numStrips) * mcuHeight, inHeight);
+
+        // Workers must not let exceptions escape, they would terminate the process.
+        try {
+            std::vector<uint8_t>& stripJpeg = stripJpegs[strip];
+            stripJpeg.resize(GetMaxCompressedSize(inWidth, endRow - firstRow, stripSubsampling) + 2 * uint64_t(mcuRows));
+            uint64_t stripSize = 0;
+            std::string error;
+            if (!EncodeJpeg(inPixels + firstRow * inStride, inWidth, endRow - firstRow, inStride, inFormat, options, 1, stripJpeg.data(), stripJpeg.size(), stripSize, error)) {
+                bFailed = true;
+                return;
+            }
+            stripJpeg.resize(stripSize);
+            if (!stripIndices[strip].Parse(stripJpeg.data(), stripJpeg.size())) {
+                bFailed = true;
+            }
+        } catch (const std::exception&) {
+            bFailed = true;
+        }
+    };
+
+    threadPool.ParallelFor(numStrips, numStrips, encodeStrip);
+    if (bFailed) {
+        return false;
+    }
+
+    // The first strip's headers with the full height, followed by the scan data of every strip. The marker that ends
+    // a strip becomes the restart marker before the next one, so each strip keeps its size.
+    const FJpegRestartIndex& firstIndex = stripIndices[0];
+    uint64_t size = firstIndex.scanDataOffset;
+    for (const FJpegRestartIndex& stripIndex : stripIndices) {
+        size += stripIndex.segmentOffsets.back() - stripIndex.scanDataOffset;
+    }
+    if (!dest || destCapacity < size) {
+        SetError("Buffer passed to JPEG library is too small");
+        return false;
+    }
+
+    memcpy(dest, stripJpegs[0].data(), firstIndex.scanDataOffset);
+    dest[firstIndex.heightOffset] = static_cast<uint8_t>(inHeight >> 8);
+    dest[firstIndex.heightOffset + 1] = static_cast<uint8_t>(inHeight & 0xFF);
+
+    uint64_t position = firstIndex.scanDataOffset;
+    int numIntervals = 0;
+    for (int strip = 0; strip < numStrips; strip++) {
+        const FJpegRestartIndex& stripIndex = stripIndices[strip];
+        const uint64_t stripDataSize = stripIndex.segmentOffsets.back() - stripIndex.scanDataOffset;
+        memcpy(dest + position, stripJpegs[strip].data() + stripIndex.scanDataOffset, stripDataSize);
+
+        // Restart markers count up from RST0 across the whole scan.
+        for (int segment = 1; segment <= stripIndex.GetNumSegments(); segment++) {
+            const uint64_t markerOffset = position + (stripIndex.segmentOffsets[segment] - 2 - stripIndex.scanDataOffset);
+            const bool bLast = strip == numStrips - 1 && segment == stripIndex.GetNumSegments();
+            dest[markerOffset + 1] = bLast ? 0xD9 : static_cast<uint8_t>(0xD0 + numIntervals++ % 8);
+        }
+        position += stripDataSize;
+    }
+
+    outSize = size;
+    return true;
+}
+
+// Disable warning "interaction between '_setjmp' and C++ object destruction is non-portable"
+#ifdef _MSC_VER
+#pragma warning(push)
+#pragma warning(disable : 4611)
+#endif
+
+void FJpegImageWrapper::UncompressScanlines(const ERGBFormat inFormat, int channels) {
+    Assert(compressedSize);
+
+    const int outputWidth = GetOutputWidth();
+    const int outputHeight = GetOutputHeight();
+    uint64_t rowStride = 0;
+    uint8_t* rows = AllocateRawRows(uint64_t(outputWidth) * channels, outputHeight, rowStride);
+    if (!rows) {
+        return;
+    }
+
+    // Cropped scanlines start at an iMCU boundary left of the region, so they go through a row buffer first.
+    std::vector<uint8_t> rowBuffer;
+
+    // With an MCU index, only the MCU rows covering the region are decoded, from a JPEG of their own.
+    std::vector<uint8_t> bandJpeg;
+    int skipRows = regionY;
+    if (!(regionWidth && mcuIndex && BuildIndexedBand(bandJpeg, skipRows))) {
+        bandJpeg.clear();
+        skipRows = regionY;
+    }
+    const uint8_t* source = bandJpeg.empty() ? compressedBuffer : bandJpeg.data();
+    const uint64_t sourceSize = bandJpeg.empty() ? compressedSize : bandJpeg.size();
+
+    jpeg_decompress_struct cinfo;
+    FJpegErrorManager errorManager;
+    cinfo.err = jpeg_std_error(&errorManager.pub);
+    errorManager.pub.error_exit = FJpegErrorManager::ErrorExit;
+    errorManager.pub.output_message = FJpegErrorManager::OutputMessage;
+    jpeg_create_decompress(&cinfo);
+
+    if (setjmp(errorManager.setjmpBuffer) != 0) {
+        SetError(errorManager.message);
+        jpeg_destroy_decompress(&cinfo);
         return;
     }
+
+    jpeg_mem_src(&cinfo, source, static_cast<unsigned long>(sourceSize));
+    jpeg_read_header(&cinfo, TRUE);
+    cinfo.out_color_space = ConvertLibJpegColorSpace(inFormat);
+    cinfo.dct_method = JDCT_IFAST;  // Same as TJFLAG_FASTDCT
+    cinfo.scale_num = scaleNum;
+    cinfo.scale_denom = scaleDenom;
+
+    // A preview collects the coefficients of the first scans in buffered-image mode and renders them as they are.
+    // Block smoothing is off since it would read ahead into the next scan to smooth the current one.
+    const bool bScanLimited = (maxScans > 0 || maxScanBytes > 0) && jpeg_has_multiple_scans(&cinfo);
+    int numScans = 0;
+    if (bScanLimited) {
+        const uint64_t scanDataOffset = cinfo.src->next_input_byte - source;
+        const uint64_t budget = maxScanBytes > 0 ? std::min<uint64_t>(sourceSize, maxScanBytes) : sourceSize;
+        const uint64_t scansEnd = FindJpegScansEnd(source, budget, scanDataOffset, maxScans, numScans);
+        if (numScans == 0) {
+            SetError("JPEG data ends before its first scan is complete.");
+            jpeg_destroy_decompress(&cinfo);
+            return;
+        }
+
+        // The memory source ends the data right after the last scan wanted, as if the file were cut off there.
+        cinfo.src->bytes_in_buffer = scansEnd - scanDataOffset;
+        cinfo.buffered_image = TRUE;
+        cinfo.do_block_smoothing = FALSE;
+    }
+    jpeg_start_decompress(&cinfo);
+
+    if (bScanLimited) {
+        while (jpeg_consume_input(&cinfo) != JPEG_REACHED_EOI) {
+            if (IsCancelled()) {
+                jpeg_abort_decompress(&cinfo);
+                jpeg_destroy_decompress(&cinfo);
+                return;
+            }
+        }
+        jpeg_start_output(&cinfo, numScans);
+    }
+
+    uint64_t cropSkipBytes = 0;
+    if (regionWidth) {
+        // Only the iMCU columns covering the region are decoded, and the rows above it are skipped without an IDCT.
+        // Chroma upsampling replicates the samples at the edges of the crop, so it reaches one pixel past the region on
+        // either side to keep the region's border pixels identical to a full decode.
+        JDIMENSION cropX = std::max(regionX - 1, 0);
+        JDIMENSION cropWidth = std::min(regionX + regionWidth + 1, GetScaledWidth()) - cropX;
+        jpeg_crop_scanline(&cinfo, &cropX, &cropWidth);
+        cropSkipBytes = uint64_t(regionX - cropX) * channels;
+        rowBuffer.resize(uint64_t(cinfo.output_width) * channels);
+        if (skipRows > 0) {
+            jpeg_skip_scanlines(&cinfo, skipRows);
+        }
+    }
+
+    // Checked once per scanline, so a cancelled decode stops within one row.
+    bool bCancelled = false;
+    for (int row = 0; row < outputHeight; row++) {
+        if (IsCancelled()) {
+            bCancelled = true;
+            break;
+        }
+        uint8_t* outRow = rows + row * rowStride;
+        JSAMPROW rowPointer = regionWidth ? rowBuffer.data() : outRow;
+        jpeg_read_scanlines(&cinfo, &rowPointer, 1);
+        if (regionWidth) {
+            memcpy(outRow, rowBuffer.data() + cropSkipBytes, uint64_t(outputWidth) * channels);
+        }
+    }
+
+    // Rows below the region are never read, which jpeg_finish_decompress would complain about. A preview leaves the
+    // scans after it unread.
+    if (bCancelled || bScanLimited || cinfo.output_scanline < cinfo.output_height) {
+        jpeg_abort_decompress(&cinfo);
+    } else {
+        jpeg_finish_decompress(&cinfo);
+    }
+    jpeg_destroy_decompress(&cinfo);
+}
+
+bool FJpegImageWrapper::UncompressRows(const ERGBFormat inFormat, int rowsPerBatch, const FJpegRowCallback& callback) {
+    Assert(compressedSize);
+    Assert(inFormat == ERGBFormat::BGRA || inFormat == ERGBFormat::RGBA || inFormat == ERGBFormat::Gray);
+    Assert(rowsPerBatch > 0);
+
+    lastError.clear();
+    rowsPerBatch = std::min(rowsPerBatch, height);
+
+    // The batch is all the memory the rows need, it is filled again for every batch.
+    const uint64_t bytesPerRow = uint64_t(width) * (inFormat == ERGBFormat::Gray ? 1 : 4);
+    std::vector<uint8_t> batch(bytesPerRow * rowsPerBatch);
+    bool bStopped = false;
+
+    jpeg_decompress_struct cinfo;
+    FJpegErrorManager errorManager;
+    cinfo.err = jpeg_std_error(&errorManager.pub);
+    errorManager.pub.error_exit = FJpegErrorManager::ErrorExit;
+    errorManager.pub.output_message = FJpegErrorManager::OutputMessage;
+    jpeg_create_decompress(&cinfo);
+
+    if (setjmp(errorManager.setjmpBuffer) != 0) {
+        SetError(errorManager.message);
+        jpeg_destroy_decompress(&cinfo);
+        return false;
+    }
+
+    jpeg_mem_src(&cinfo, compressedBuffer, static_cast<unsigned long>(compressedSize));
+    jpeg_read_header(&cinfo, TRUE);
+    cinfo.out_color_space = ConvertLibJpegColorSpace(inFormat);
+    cinfo.dct_method = JDCT_IFAST;  // Same as TJFLAG_FASTDCT
+    jpeg_start_decompress(&cinfo);
+
+    // The header was read before, but the rows are only as wide as the batch if this data still agrees with it.
+    if (cinfo.output_width != static_cast<JDIMENSION>(width) || cinfo.output_height != static_cast<JDIMENSION>(height) || uint64_t(cinfo.output_width) * cinfo.output_components != bytesPerRow) {
+        SetError("JPEG header changed between reads.");
+        jpeg_destroy_decompress(&cinfo);
+        return false;
+    }
+
+    for (int firstRow = 0; firstRow < height; firstRow += rowsPerBatch) {
+        const int numRows = std::min(rowsPerBatch, height - firstRow);
+        for (int row = 0; row < numRows; row++) {
+            JSAMPROW rowPointer = batch.data() + row * bytesPerRow;
+            jpeg_read_scanlines(&cinfo, &rowPointer, 1);
+        }
+        if (IsCancelled() || !callback(firstRow, numRows, batch.data(), bytesPerRow)) {
+            bStopped = true;
+            break;
+        }
+    }
+
+    if (bStopped) {
+        jpeg_abort_decompress(&cinfo);
+    } else {
+        jpeg_finish_decompress(&cinfo);
+    }
+    jpeg_destroy_decompress(&cinfo);
+    return !bStopped;
+}
+
+/**
+ * Decodes a band built by FJpegRestartIndex::BuildBand, throwing away the first skipRows scanlines and writing the next numRows.
+ * Any libjpeg warning fails the band, so corrupt data ends up in the serial decoder, which reports it.
+ */
+static bool DecodeRestartBand(const std::vector<uint8_t>& bandJpeg, J_COLOR_SPACE colorSpace, int scaleNum, int scaleDenom, int skipRows, int numRows, uint8_t* rows, uint64_t rowStride) {
+    std::vector<uint8_t> skipBuffer;
+
+    jpeg_decompress_struct cinfo;
+    FJpegErrorManager errorManager;
+    cinfo.err = jpeg_std_error(&errorManager.pub);
+    errorManager.pub.error_exit = FJpegErrorManager::ErrorExit;
+    errorManager.pub.output_message = FJpegErrorManager::OutputMessage;
+    jpeg_create_decompress(&cinfo);
+
+    if (setjmp(errorManager.setjmpBuffer) != 0) {
+        jpeg_destroy_decompress(&cinfo);
+        return false;
+    }
+
+    jpeg_mem_src(&cinfo, bandJpeg.data(), static_cast<unsigned long>(bandJpeg.size()));
+    jpeg_read_header(&cinfo, TRUE);
+    cinfo.out_color_space = colorSpace;
+    cinfo.dct_method = JDCT_IFAST;  // Same as TJFLAG_FASTDCT
+    cinfo.scale_num = scaleNum;
+    cinfo.scale_denom = scaleDenom;
+    jpeg_start_decompress(&cinfo);
+
+    // The rows above the band only provide the chroma context of its first row.
+    skipBuffer.resize(uint64_t(cinfo.output_width) * cinfo.output_components);
+    for (int row = 0; row < skipRows + numRows && cinfo.output_scanline < cinfo.output_height; row++) {
+        JSAMPROW rowPointer = row < skipRows ? skipBuffer.data() : rows + (row - skipRows) * rowStride;
+        jpeg_read_scanlines(&cinfo, &rowPointer, 1);
+    }
+
+    const bool bSuccess = cinfo.output_scanline >= static_cast<JDIMENSION>(skipRows + numRows) && cinfo.err->num_warnings == 0;
+    jpeg_abort_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+    return bSuccess;
+}
+
+/**
+ * libjpeg state of an incremental decode. The source suspends whenever it runs out of data, libjpeg then backs up to
+ * the last point it can resume from and leaves next_input_byte there.
+ */
+struct FJpegIncrementalDecoder::FState {
+    jpeg_decompress_struct cinfo;
+    FJpegErrorManager errorManager;
+    jpeg_source_mgr source;
+
+    /** Received bytes from the position libjpeg resumes at */
+    std::vector<uint8_t> pending;
+
+    /** Bytes libjpeg asked to skip that have not arrived yet */
+    uint64_t bytesToSkip = 0;
+
+    /** Whether jpeg_finish_output suspended while looking for the next scan, it has to be repeated before the next output pass */
+    bool bOutputPending = false;
+
+    static void InitSource(j_decompress_ptr /*cinfo*/) {}
+
+    static boolean FillInputBuffer(j_decompress_ptr /*cinfo*/) { return FALSE; }
+
+    static void SkipInputData(j_decompress_ptr cinfo, long numBytes) {
+        if (numBytes <= 0) {
+            return;
+        }
+        FState* state = static_cast<FState*>(cinfo->client_data);
+        if (uint64_t(numBytes) > cinfo->src->bytes_in_buffer) {
+            state->bytesToSkip += uint64_t(numBytes) - cinfo->src->bytes_in_buffer;
+            numBytes = static_cast<long>(cinfo->src->bytes_in_buffer);
+        }
+        cinfo->src->next_input_byte += numBytes;
+        cinfo->src->bytes_in_buffer -= numBytes;
+    }
+
+    static void TermSource(j_decompress_ptr /*cinfo*/) {}
+};
+
+FJpegIncrementalDecoder::FJpegIncrementalDecoder() : state(new FState()), bHeader(false), bStarted(false), bMultipleScans(false), bInputComplete(false), format(ERGBFormat::Invalid), width(0), height(0), numRowsComplete(0), numScansComplete(0), renderedScan(0) {
+    jpeg_decompress_struct& cinfo = state->cinfo;
+    cinfo.err = jpeg_std_error(&state->errorManager.pub);
+    state->errorManager.pub.error_exit = FJpegErrorManager::ErrorExit;
+    state->errorManager.pub.output_message = FJpegErrorManager::OutputMessage;
+    jpeg_create_decompress(&cinfo);
+    cinfo.client_data = state.get();
+
+    jpeg_source_mgr& source = state->source;
+    source.next_input_byte = nullptr;
+    source.bytes_in_buffer = 0;
+    source.init_source = FState::InitSource;
+    source.fill_input_buffer = FState::FillInputBuffer;
+    source.skip_input_data = FState::SkipInputData;
+    source.resync_to_restart = jpeg_resync_to_restart;
+    source.term_source = FState::TermSource;
+    cinfo.src = &source;
+}
+
+FJpegIncrementalDecoder::~FJpegIncrementalDecoder() { jpeg_destroy_decompress(&state->cinfo); }
+
+bool FJpegIncrementalDecoder::Append(const uint8_t* data, uint64_t size) {
+    if (!lastError.empty()) {
+        return false;
+    }
+    if (IsComplete()) {
+        return true;
+    }
+
+    // Drop what libjpeg has consumed, then continue the skip it asked for before adding the new bytes.
+    jpeg_source_mgr& source = state->source;
+    std::vector<uint8_t>& pending = state->pending;
+    pending.erase(pending.begin(), pending.end() - source.bytes_in_buffer);
+    const uint64_t skipSize = std::min(state->bytesToSkip, size);
+    state->bytesToSkip -= skipSize;
+    pending.insert(pending.end(), data + skipSize, data + size);
+    source.next_input_byte = pending.data();
+    source.bytes_in_buffer = pending.size();
+
+    if (!Decode()) {
+        return false;
+    }
+
+    // Once the last scan is in, it is rendered right away so the image ends up complete without another call.
+    if (bInputComplete) {
+        return RenderLatestScan();
+    }
+    return true;
+}
+
+bool FJpegIncrementalDecoder::Decode() {
+    jpeg_decompress_struct& cinfo = state->cinfo;
+    if (setjmp(state->errorManager.setjmpBuffer) != 0) {
+        lastError = state->errorManager.message;
+        return false;
+    }
+
+    if (!bHeader) {
+        if (jpeg_read_header(&cinfo, TRUE) == JPEG_SUSPENDED) {
+            return true;
+        }
+        format = cinfo.num_components == 1 ? ERGBFormat::Gray : ERGBFormat::RGBA;
+        bMultipleScans = jpeg_has_multiple_scans(&cinfo);
+
+        // Multi-scan images are decoded in buffered image mode, where input and output run independently.
+        // Block smoothing would make an output pass wait for rows of the next scan.
+        cinfo.out_color_space = JCS_EXT_RGBA;
+        cinfo.dct_method = JDCT_IFAST;  // Same as TJFLAG_FASTDCT
+        cinfo.buffered_image = bMultipleScans;
+        cinfo.do_block_smoothing = FALSE;
+        bHeader = true;
+    }
+
+    if (!bStarted) {
+        if (!jpeg_start_decompress(&cinfo)) {
+            return true;
+        }
+        width = cinfo.output_width;
+        height = cinfo.output_height;
+        rows.resize(GetRowStride() * height);
+        bStarted = true;
+    }
+
+    if (!bMultipleScans) {
+        while (cinfo.output_scanline < cinfo.output_height) {
+            JSAMPROW rowPointer = rows.data() + cinfo.output_scanline * GetRowStride();
+            if (jpeg_read_scanlines(&cinfo, &rowPointer, 1) == 0) {
+                break;
+            }
+            numRowsComplete = cinfo.output_scanline;
+        }
+        return true;
+    }
+
+    for (;;) {
+        const int result = jpeg_consume_input(&cinfo);
+        if (result == JPEG_SUSPENDED) {
+            break;
+        } else if (result == JPEG_SCAN_COMPLETED) {
+            numScansComplete = cinfo.input_scan_number;
+        } else if (result == JPEG_REACHED_EOI) {
+            numScansComplete = cinfo.input_scan_number;
+            bInputComplete = true;
+            break;
+        }
+    }
+    return true;
+}
+
+bool FJpegIncrementalDecoder::RenderLatestScan() {
+    if (!lastError.empty()) {
+        return false;
+    }
+    if (!bMultipleScans || numScansComplete <= renderedScan) {
+        return true;
+    }
+
+    jpeg_decompress_struct& cinfo = state->cinfo;
+    if (setjmp(state->errorManager.setjmpBuffer) != 0) {
+        lastError = state->errorManager.message;
+        return false;
+    }
+
+    // Input has moved past the previous output scan since a later one is complete, so this no longer suspends.
+    if (state->bOutputPending && !jpeg_finish_output(&cinfo)) {
+        return true;
+    }
+
+    jpeg_start_output(&cinfo, numScansComplete);
+    while (cinfo.output_scanline < cinfo.output_height) {
+        JSAMPROW rowPointer = rows.data() + cinfo.output_scanline * GetRowStride();
+        if (jpeg_read_scanlines(&cinfo, &rowPointer, 1) == 0) {
+            break;
+        }
+    }
+    renderedScan = numScansComplete;
+    if (bInputComplete && cinfo.output_scanline == cinfo.output_height) {
+        numRowsComplete = height;
+    }
+
+    // Finishing the pass reads ahead to the next scan's header, which may not have arrived yet.
+    state->bOutputPending = !jpeg_finish_output(&cinfo);
+    return true;
+}
+
+/**
+ * Encodes with the calling thread's compressor.
+ *
+ * @param restartRows Number of MCU rows per restart interval, 0 for none.
+ * @param outError Will contain libjpeg's message if encoding failed.
+ */
+static bool EncodeJpeg(const uint8_t* pixels, int width, int height, uint64_t stride, ERGBFormat format, const ImageEncodeOptions& options, int restartRows, uint8_t* dest, uint64_t destCapacity, uint64_t& outSize, std::string& outError) {
+    outSize = 0;
+
+    FJpegCompressor& compressor = GetThreadCompressor();
+    jpeg_compress_struct& cinfo = compressor.cinfo;
+    if (setjmp(compressor.errorManager.setjmpBuffer) != 0) {
+        outError = compressor.errorManager.message;
+        jpeg_abort_compress(&cinfo);
+        return false;
+    }
+
+    compressor.destination.next_output_byte = dest;
+    compressor.destination.free_in_buffer = static_cast<size_t>(destCapacity);
+    cinfo.image_width = width;
+    cinfo.image_height = height;
+    cinfo.input_components = format == ERGBFormat::Gray ? 1 : 4;
+    cinfo.in_color_space = ConvertLibJpegColorSpace(format);
+    compressor.ResetDefaults();
+
+    // Chroma sampling factors are relative to luma's, the two chroma components keep the default of 1x1.
+    if (format == ERGBFormat::Gray || options.subsampling == EJpegSubsampling::Gray) {
+        jpeg_set_colorspace(&cinfo, JCS_GRAYSCALE);
+    } else {
+        cinfo.comp_info[0].h_samp_factor = options.subsampling == EJpegSubsampling::YUV444 ? 1 : 2;
+        cinfo.comp_info[0].v_samp_factor = options.subsampling == EJpegSubsampling::YUV420 ? 2 : 1;
+    }
+
+    // Same as tjCompress2, which forces baseline quantization tables.
+    jpeg_set_quality(&cinfo, options.quality > 0 ? std::min(options.quality, 100) : 85, TRUE);
+    cinfo.dct_method = options.accurate_dct ? JDCT_ISLOW : JDCT_IFAST;
+    cinfo.optimize_coding = options.optimize_huffman ? TRUE : FALSE;
+    cinfo.restart_in_rows = restartRows;
+    if (options.progressive) {
+        jpeg_simple_progression(&cinfo);
+    }
+
+    // Rows are handed over up to an iMCU row at a time, which saves calls into libjpeg.
+    jpeg_start_compress(&cinfo, TRUE);
+    JSAMPROW rowPointers[MAX_SAMP_FACTOR * DCTSIZE];
+    while (cinfo.next_scanline < cinfo.image_height) {
+        const int numRows = std::min<int>(MAX_SAMP_FACTOR * DCTSIZE, cinfo.image_height - cinfo.next_scanline);
+        for (int row = 0; row < numRows; row++) {
+            rowPointers[row] = const_cast<uint8_t*>(pixels + (cinfo.next_scanline + row) * stride);
+        }
+        jpeg_write_scanlines(&cinfo, rowPointers, numRows);
+    }
+    jpeg_finish_compress(&cinfo);
+
+    outSize = destCapacity - compressor.destination.free_in_buffer;
+    return true;
 }
+
+bool FJpegImageWrapper::CompressToBuffer(const uint8_t* inPixels, int inWidth, int inHeight, uint64_t inStride, ERGBFormat inFormat, const ImageEncodeOptions& options, uint8_t* dest, uint64_t destCapacity, uint64_t& outSize) {
+    Assert(inFormat == ERGBFormat::RGBA || inFormat == ERGBFormat::BGRA || inFormat == ERGBFormat::Gray);
+    lastError.clear();
+    outSize = 0;
+
+    if (CompressRestartStrips(inPixels, inWidth, inHeight, inStride, inFormat, options, dest, destCapacity, outSize)) {
+        return true;
+    }
+
+    std::string error;
+    if (!EncodeJpeg(inPixels, inWidth, inHeight, inStride, inFormat, options, 0, dest, destCapacity, outSize, error)) {
+        SetError(error.data());
+        return false;
+    }
+    return true;
+}
+
+// Renable warning "interaction between '_setjmp' and C++ object destruction is non-portable"
+#ifdef _MSC_VER
+#pragma warning(pop)
+#endif
 }  // namespace ImageDecoder
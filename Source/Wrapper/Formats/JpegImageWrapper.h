@@ -1,8 +1,13 @@
 ﻿#pragma once
+#include <functional>
+#include <memory>
 #include "Wrapper/ImageWrapperBase.h"
 
 namespace ImageDecoder {
-using tjhandle = void*;
+struct FJpegMcuIndex;
+
+/** Receives a batch of decoded rows, which are only valid during the call. Returning false stops the decode. */
+typedef std::function<bool(int firstRow, int numRows, const uint8_t* rows, uint64_t rowStride)> FJpegRowCallback;
 
 /**
  * Uncompresses JPEG data to raw 24bit RGB image that can be used by Unreal textures.
@@ -26,12 +31,248 @@ public:
 
     bool SetCompressedTurbo(const void* inCompressedData, int64_t inCompressedSize);
     void CompressTurbo(int quality);
+
+    /**
+     * Encodes pixels from memory the caller owns into a buffer the caller owns, without copying either.
+     *
+     * @param inPixels The first row of the pixels.
+     * @param inStride The number of bytes between the starts of consecutive rows.
+     * @param inFormat RGBA, BGRA or Gray, the latter always encoded as grayscale.
+     * @param outSize Will contain the size of the JPEG written to dest.
+     * @return false if encoding failed or dest is too small, which never happens at GetMaxCompressedSize bytes.
+     */
+    bool CompressToBuffer(const uint8_t* inPixels, int inWidth, int inHeight, uint64_t inStride, ERGBFormat inFormat, const ImageEncodeOptions& options, uint8_t* dest, uint64_t destCapacity, uint64_t& outSize);
+
+    /**
+     * Encodes a large baseline JPEG as horizontal strips on the thread pool, restart intervals of one MCU row each that are
+     * stitched into one scan.
+     *
+     * @return false if the image is too small to be worth splitting, progressive or has optimized Huffman tables, which
+     * need the whole image, or if a strip failed. The serial encode then has to produce the JPEG.
+     */
+    bool CompressRestartStrips(const uint8_t* inPixels, int inWidth, int inHeight, uint64_t inStride, ERGBFormat inFormat, const ImageEncodeOptions& options, uint8_t* dest, uint64_t destCapacity, uint64_t& outSize);
+
+    /**
+     * Applies a lossless transform to the compressed data with tjTransform, working on the DCT coefficients.
+     *
+     * @param outSize Will contain the size of the transformed JPEG, also when dest is too small for it.
+     * @return false if the transform failed or dest is null or too small.
+     */
+    bool TransformTurbo(const JpegTransformOptions& options, uint8_t* dest, uint64_t destCapacity, uint64_t& outSize);
+
+    /** Gets the worst case size of a JPEG of this size and subsampling, as TurboJPEG's tjBufSize computes it */
+    static uint64_t GetMaxCompressedSize(int inWidth, int inHeight, EJpegSubsampling inSubsampling);
     void UncompressTurbo(const ERGBFormat inFormat, int inBitDepth);
 
+    /**
+     * Decodes a large JPEG with restart markers as horizontal bands on the thread pool, each band starting at a restart interval.
+     *
+     * Bands not yet started are skipped once the cancel flag is set.
+     *
+     * @return false, possibly after writing some rows, if the image has no usable restart intervals, is too small to be
+     * worth splitting or a band failed. The serial decode then has to produce the image. true with the error set if the
+     * decode was cancelled.
+     */
+    bool UncompressRestartBands(const ERGBFormat inFormat, uint8_t* rows, uint64_t rowStride);
+
+    /**
+     * Decodes through libjpeg one scanline at a time, stopping early once the cancel flag is set and skipping what lies outside
+     * the region. A scan limit makes a multi-scan JPEG render the last complete scan within it instead of the final image.
+     */
+    void UncompressScanlines(const ERGBFormat inFormat, int channels);
+
+    /**
+     * Decodes the whole image at full size through libjpeg in batches of scanlines and hands each batch to the callback as
+     * soon as it is complete, so only one batch is ever in memory. A JPEG with several scans is read whole before the
+     * first row can be rendered, which takes its coefficients but not its pixels.
+     *
+     * @param rowsPerBatch Number of rows per batch, the last batch may be shorter.
+     * @return false if decoding failed, was cancelled or the callback stopped it.
+     */
+    bool UncompressRows(const ERGBFormat inFormat, int rowsPerBatch, const FJpegRowCallback& callback);
+
+    /**
+     * Picks the largest of TurboJPEG's scaling factors up to 1 that keeps the decoded size within the limits, or the smallest
+     * if none does. The IDCT then produces the smaller image directly. Call after SetCompressed, which resets the scale to 1.
+     *
+     * @param maxDimension Limit for the decoded width and height, 0 for none.
+     * @param inScaleNum Numerator of the largest scale wanted.
+     * @param inScaleDenom Denominator of the largest scale wanted, 0 for no limit.
+     */
+    void SelectScale(int maxDimension, int inScaleNum, int inScaleDenom);
+
+    /** Gets the width of the image Uncompress produces at the selected scale */
+    int GetScaledWidth() const { return ScaleDimension(width); }
+
+    /** Gets the height of the image Uncompress produces at the selected scale */
+    int GetScaledHeight() const { return ScaleDimension(height); }
+
+    /**
+     * Limits Uncompress to a rectangle of the image. Only the MCU rows and columns covering it are entropy decoded and
+     * transformed. Call after SelectScale, the rectangle is given in full size pixels and rounded outwards when scaled.
+     *
+     * @return false if the rectangle is empty or does not lie within the image.
+     */
+    bool SetRegion(int inX, int inY, int inWidth, int inHeight);
+
+    /**
+     * Makes Uncompress stop a JPEG with several scans, usually a progressive one, after the first scans and render those.
+     * Call after SetCompressed, which removes the limit. Sequential JPEGs ignore it.
+     *
+     * @param inMaxScans Number of scans to decode at most, 0 for no limit.
+     * @param inMaxBytes Only scans that end within this many bytes of the data are decoded, 0 for no limit.
+     */
+    void SetScanLimit(int inMaxScans, uint64_t inMaxBytes) {
+        maxScans = inMaxScans;
+        maxScanBytes = inMaxBytes;
+    }
+
+    /**
+     * Lets a region decode start at the MCU rows covering the region instead of entropy decoding every row above it.
+     * Call after SetCompressed, which removes the index. It has to stay alive until Uncompress returns.
+     */
+    void SetMcuIndex(const FJpegMcuIndex* inMcuIndex) { mcuIndex = inMcuIndex; }
+
+    /** Gets the width of the image Uncompress produces, the region's if one is set */
+    int GetOutputWidth() const { return regionWidth ? regionWidth : GetScaledWidth(); }
+
+    /** Gets the height of the image Uncompress produces, the region's if one is set */
+    int GetOutputHeight() const { return regionHeight ? regionHeight : GetScaledHeight(); }
+
+    /** Gets the planar format GetYUVPlanes produces, Invalid for grayscale images and subsamplings without one */
+    ETextureSourceFormat GetYUVFormat() const;
+
+    /** Gets the width of one of the planes GetYUVPlanes writes at the selected scale */
+    int GetPlaneWidth(int plane) const;
+
+    /** Gets the height of one of the planes GetYUVPlanes writes at the selected scale */
+    int GetPlaneHeight(int plane) const;
+
+    /**
+     * Decodes the Y, Cb and Cr planes at the selected scale, without chroma upsampling or color conversion.
+     *
+     * @param outPlanes The first row of each of the three planes.
+     * @param outStrides The number of bytes between the starts of consecutive rows of each plane.
+     * @return true on success, false otherwise.
+     */
+    bool GetYUVPlanes(uint8_t* const outPlanes[3], const int outStrides[3]);
+
 private:
+    /** Rounds up like TurboJPEG's TJSCALED and libjpeg's output dimensions do */
+    int ScaleDimension(int dimension) const { return static_cast<int>((int64_t(dimension) * scaleNum + scaleDenom - 1) / scaleDenom); }
+
+    /**
+     * Builds a JPEG of the MCU rows covering the region with the MCU index.
+     *
+     * @param outSkipRows Will contain the number of scaled rows of the band above the region.
+     * @return false if the index cannot produce the band, the region is then decoded from the whole file.
+     */
+    bool BuildIndexedBand(std::vector<uint8_t>& outBandJpeg, int& outSkipRows) const;
+
     int numComponents;
 
-    tjhandle compressor;
-    tjhandle decompressor;
+    /** Chroma subsampling of the image as a TJSAMP value */
+    int subsampling;
+
+    /** Scaling factor applied while decoding */
+    int scaleNum;
+    int scaleDenom;
+
+    /** Rectangle of the scaled image to decode, regionWidth is 0 for the whole image */
+    int regionX;
+    int regionY;
+    int regionWidth;
+    int regionHeight;
+
+    /** Scan limit of a preview decode, 0 for none */
+    int maxScans;
+    uint64_t maxScanBytes;
+
+    /** Row starts of the scan for region decodes, nullptr for none */
+    const FJpegMcuIndex* mcuIndex;
+};
+
+/**
+ * Decodes a JPEG while its data is still arriving, as far as the bytes received so far go.
+ *
+ * Sequential JPEGs are decoded row by row straight into the final image. JPEGs with several scans, usually progressive
+ * ones, collect their coefficients instead and render the latest complete scan on request, the final one as soon as
+ * all data is in. Rows are always RGBA.
+ */
+class FJpegIncrementalDecoder {
+public:
+    FJpegIncrementalDecoder();
+
+    ~FJpegIncrementalDecoder();
+
+    /**
+     * Appends the next chunk of the file and decodes what it completes. Bytes after the end of the image are ignored.
+     *
+     * @return false if the data is not a JPEG that can be decoded. The error is then in GetError and every later call fails too.
+     */
+    bool Append(const uint8_t* data, uint64_t size);
+
+    /**
+     * Renders the latest complete scan of a multi-scan JPEG into the rows, unless it is already there.
+     *
+     * @return false on a decode error.
+     */
+    bool RenderLatestScan();
+
+    /** Whether the header has been read, which the size, format and rows need */
+    bool HasHeader() const { return bHeader; }
+
+    /** Whether the image has more than one scan and therefore refines all of its rows scan by scan */
+    bool HasMultipleScans() const { return bMultipleScans; }
+
+    /** Whether every row holds its final pixels */
+    bool IsComplete() const { return numRowsComplete > 0 && numRowsComplete == height; }
+
+    int GetWidth() const { return width; }
+
+    int GetHeight() const { return height; }
+
+    /** Gets the format of the image, the rows are RGBA regardless */
+    ERGBFormat GetFormat() const { return format; }
+
+    /** Gets the number of rows from the top that hold their final pixels */
+    int GetNumRowsComplete() const { return numRowsComplete; }
+
+    /** Gets the number of scans received completely */
+    int GetNumScansComplete() const { return numScansComplete; }
+
+    /** Gets the first row, nullptr until the header has been read */
+    uint8_t* GetRows() { return rows.empty() ? nullptr : rows.data(); }
+
+    uint64_t GetRowStride() const { return uint64_t(width) * 4; }
+
+    const std::string& GetError() const { return lastError; }
+
+private:
+    /** Feeds the buffered data to libjpeg until it runs out */
+    bool Decode();
+
+    /** libjpeg state, kept out of this header like the rest of libjpeg */
+    struct FState;
+    std::unique_ptr<FState> state;
+
+    std::vector<uint8_t> rows;
+
+    bool bHeader;
+    bool bStarted;
+    bool bMultipleScans;
+    bool bInputComplete;
+
+    ERGBFormat format;
+    int width;
+    int height;
+
+    int numRowsComplete;
+    int numScansComplete;
+
+    /** Scan the rows show, 0 for none */
+    int renderedScan;
+
+    std::string lastError;
 };
 }  // namespace ImageDecoder
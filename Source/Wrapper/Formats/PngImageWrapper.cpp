@@ -1,6 +1,11 @@
 ﻿#include "PngImageWrapper.h"
+#include "Utils/ThreadPool.h"
 #include "Utils/Utils.h"
-#include <mutex>
+#include "Wrapper/PngImageSupport.h"
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstring>
 
 namespace ImageDecoder {
 
@@ -19,9 +24,6 @@ bool IsLitleEndian() {
     }
 }
 
-/** Only allow one thread to use libpng at a time (it's not thread safe) */
-std::mutex GPNGSection;
-
 /* Local helper classes
  *****************************************************************************/
 
@@ -78,26 +80,124 @@ private:
     png_bytep* pngRowPointers;
 };
 
+/**
+ * Sets up the libpng transforms that turn the stored pixels into the requested format. Call after png_read_info, some
+ * transforms depend on the header.
+ *
+ * @param colorType The color type as defined in the header.
+ * @param bitDepth The bit depth as defined in the header.
+ */
+static void SetReadTransforms(png_structp png_ptr, int colorType, int bitDepth, const ERGBFormat inFormat, const int inBitDepth) {
+    if (colorType == PNG_COLOR_TYPE_PALETTE) {
+        png_set_palette_to_rgb(png_ptr);
+    }
+
+    if ((colorType & PNG_COLOR_MASK_COLOR) == 0 && bitDepth < 8) {
+        png_set_expand_gray_1_2_4_to_8(png_ptr);
+    }
+
+    // Insert alpha channel with full opacity for RGB images without alpha
+    if ((colorType & PNG_COLOR_MASK_ALPHA) == 0 && (inFormat == ERGBFormat::BGRA || inFormat == ERGBFormat::RGBA)) {
+        // png images don't set PNG_COLOR_MASK_ALPHA if they have alpha from a tRNS chunk, but png_set_add_alpha seems to be safe regardless
+        if ((colorType & PNG_COLOR_MASK_COLOR) == 0) {
+            png_set_tRNS_to_alpha(png_ptr);
+        } else if (colorType == PNG_COLOR_TYPE_PALETTE) {
+            png_set_tRNS_to_alpha(png_ptr);
+        }
+        if (inBitDepth == 8) {
+            png_set_add_alpha(png_ptr, 0xff, PNG_FILLER_AFTER);
+        } else if (inBitDepth == 16) {
+            png_set_add_alpha(png_ptr, 0xffff, PNG_FILLER_AFTER);
+        }
+    }
+
+    if (inFormat == ERGBFormat::BGRA) {
+        png_set_bgr(png_ptr);
+    }
+
+    // PNG files store 16-bit pixels in network byte order (big-endian, ie. most significant bits first).
+    if (IsLitleEndian()) {
+        // We're little endian so we need to swap
+        if (bitDepth == 16) {
+            png_set_swap(png_ptr);
+        }
+    }
+
+    // Convert grayscale png to RGB if requested
+    if ((colorType & PNG_COLOR_MASK_COLOR) == 0 && (inFormat == ERGBFormat::RGBA || inFormat == ERGBFormat::BGRA)) {
+        png_set_gray_to_rgb(png_ptr);
+    }
+
+    // Convert RGB png to grayscale if requested
+    if ((colorType & PNG_COLOR_MASK_COLOR) != 0 && inFormat == ERGBFormat::Gray) {
+        png_set_rgb_to_gray_fixed(png_ptr, 2 /* warn if image is in color */, -1, -1);
+    }
+
+    // Strip alpha channel if requested output is grayscale
+    if (inFormat == ERGBFormat::Gray) {
+        // this is not necessarily the best option, instead perhaps:
+        // png_color background = {0,0,0};
+        // png_set_background(png_ptr, &background, PNG_BACKGROUND_GAMMA_SCREEN, 0, 1.0);
+        png_set_strip_alpha(png_ptr);
+    }
+
+    // Reduce 16-bit to 8-bit if requested
+    if (bitDepth == 16 && inBitDepth == 8) {
+#if PNG_LIBPNG_VER >= 10504
+        Assert(0);  // Needs testing
+        png_set_scale_16(png_ptr);
+#else
+        png_set_strip_16(png_ptr);
+#endif
+    }
+
+    // Increase 8-bit to 16-bit if requested
+    if (bitDepth <= 8 && inBitDepth == 16) {
+#if PNG_LIBPNG_VER >= 10504
+        Assert(0);  // Needs testing
+        png_set_expand_16(png_ptr);
+#else
+        // Expanding 8-bit images to 16-bit via transform needs a libpng update
+        Assert(0);
+#endif
+    }
+}
+
 /* FPngImageWrapper structors
  *****************************************************************************/
 
-FPngImageWrapper::FPngImageWrapper() : FImageWrapperBase(), readOffset(0), colorType(0), channels(0) {}
+FPngImageWrapper::FPngImageWrapper() : FImageWrapperBase(), readOffset(0), colorType(0), channels(0), bInterlaced(false) {}
 
 /* FImageWrapper interface
  *****************************************************************************/
 
+/** Images below this are encoded faster in one go than split into blocks for the thread pool */
+static const int64_t MIN_PARALLEL_PNG_PIXELS = 1024 * 1024;
+
+/** Amount of filtered rows deflated as one block, large enough that priming each with the previous window costs little */
+static const uint64_t PNG_BLOCK_SIZE = 512 * 1024;
+
+/** Gets the number of rows per block, at least one however long the rows are */
+static int GetPngBlockRows(int inHeight, uint64_t filteredRowBytes) { return static_cast<int>(std::max<uint64_t>(1, std::min<uint64_t>(inHeight, PNG_BLOCK_SIZE / filteredRowBytes))); }
+
 void FPngImageWrapper::Compress(int quality) {
     if (!compressedData.size()) {
-        // Preserve old single thread code on some platform in relation to a type incompatibility at compile time.
-#if PLATFORM_ANDROID || PLATFORM_LUMIN || PLATFORM_LUMINGL4
-        // thread safety
-        std::lock_guard<std::mutex> pngLock(GPNGSection);
-#endif
-
         Assert(rawData.size());
         Assert(width > 0);
         Assert(height > 0);
 
+        // Sized for the worst case once and written in place, libpng is only left for when that fails.
+        const uint64_t maxSize = GetMaxCompressedSize(width, height, rawFormat, rawBitDepth);
+        const uint64_t rawStride = uint64_t(width) * ((rawFormat == ERGBFormat::Gray) ? 1 : 4) * rawBitDepth / 8;
+        compressedData.resize(maxSize);
+        uint64_t size = 0;
+        if (CompressToBuffer(rawData.data(), width, height, rawStride, rawFormat, rawBitDepth, EPngProfile::Fastest, compressedData.data(), compressedData.size(), size)) {
+            compressedData.resize(size);
+            return;
+        }
+        compressedData.clear();
+        lastError.clear();
+
         // Reset to the beginning of file so we can use png_read_png(), which expects to start at the beginning.
         readOffset = 0;
 
@@ -130,6 +230,7 @@ void FPngImageWrapper::Compress(int quality) {
             png_set_compression_level(png_ptr, Z_BEST_SPEED);
             png_set_IHDR(png_ptr, info_ptr, width, height, rawBitDepth, (rawFormat == ERGBFormat::Gray) ? PNG_COLOR_TYPE_GRAY : PNG_COLOR_TYPE_RGBA, PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
             png_set_write_fn(png_ptr, this, FPngImageWrapper::user_write_compressed, FPngImageWrapper::user_flush_data);
+            compressedData.reserve(maxSize);
 
             const uint64_t pixelChannels = (rawFormat == ERGBFormat::Gray) ? 1 : 4;
             const uint64_t bytesPerPixel = (rawBitDepth * pixelChannels) / 8;
@@ -155,12 +256,214 @@ void FPngImageWrapper::Compress(int quality) {
     }
 }
 
+uint64_t FPngImageWrapper::GetMaxCompressedSize(int inWidth, int inHeight, ERGBFormat inFormat, int inBitDepth) {
+    const uint64_t filteredRowBytes = uint64_t(inWidth) * (inFormat == ERGBFormat::Gray ? 1 : 4) * inBitDepth / 8 + 1;
+    const int blockRows = GetPngBlockRows(inHeight, filteredRowBytes);
+
+    // Signature, IHDR, the zlib header and checksum and IEND around an IDAT chunk per block.
+    uint64_t size = 8 + 25 + 2 + 4 + 12;
+    for (int firstRow = 0; firstRow < inHeight; firstRow += blockRows) {
+        size += 12 + GetMaxDeflateSize(std::min(blockRows, inHeight - firstRow) * filteredRowBytes);
+    }
+    return size;
+}
+
+bool FPngImageWrapper::CompressToBuffer(const uint8_t* inPixels, int inWidth, int inHeight, uint64_t inStride, ERGBFormat inFormat, int inBitDepth, EPngProfile profile, uint8_t* dest, uint64_t destCapacity, uint64_t& outSize) {
+    outSize = 0;
+    const int bytesPerPixel = (inFormat == ERGBFormat::Gray ? 1 : 4) * inBitDepth / 8;
+    const uint64_t rowBytes = uint64_t(inWidth) * bytesPerPixel;
+    const uint64_t filteredRowBytes = rowBytes + 1;
+    const int blockRows = GetPngBlockRows(inHeight, filteredRowBytes);
+    const int numBlocks = (inHeight + blockRows - 1) / blockRows;
+
+    // PNG stores RGB order and big endian 16-bit channels, other rows are reordered before filtering.
+    const bool bSwapRedBlue = inFormat == ERGBFormat::BGRA;
+    const bool bSwapBytes = inBitDepth == 16 && IsLitleEndian();
+    const int bytesPerChannel = inBitDepth / 8;
+    auto getRow = [&](int y, uint8_t* buffer) -> const uint8_t* {
+        const uint8_t* source = inPixels + y * inStride;
+        if (!bSwapRedBlue && !bSwapBytes) {
+            return source;
+        }
+        memcpy(buffer, source, rowBytes);
+        if (bSwapRedBlue) {
+            for (uint64_t x = 0; x < rowBytes; x += bytesPerPixel) {
+                for (int i = 0; i < bytesPerChannel; i++) {
+                    std::swap(buffer[x + i], buffer[x + 2 * bytesPerChannel + i]);
+                }
+            }
+        }
+        if (bSwapBytes) {
+            for (uint64_t i = 0; i < rowBytes; i += 2) {
+                std::swap(buffer[i], buffer[i + 1]);
+            }
+        }
+        return buffer;
+    };
+
+    const FPngDeflateSettings settings = GetPngDeflateSettings(profile);
+
+    // Signature, IHDR, the zlib header and checksum, IEND and the header and CRC of an IDAT per block are known up front.
+    // The deflated blocks are counted as they finish, so a destination that is too small fails as soon as that is
+    // certain instead of after the whole image has been deflated.
+    const uint64_t fixedSize = 8 + 25 + 2 + 4 + 12 + 12 * uint64_t(numBlocks);
+    if (!dest || destCapacity < fixedSize) {
+        SetError("Buffer passed to PNG encoder is too small");
+        return false;
+    }
+    std::atomic<uint64_t> deflatedSize(0);
+    std::atomic<bool> bTooSmall(false);
+
+    // Every block is a raw deflate stream primed with the window before it, ending in a sync flush so the blocks join
+    // into one zlib stream. Only the last one finishes the stream.
+    struct FDeflatedBlock {
+        std::vector<uint8_t> data;
+        uint64_t filteredSize = 0;
+        uint32_t adler = 0;
+    };
+    std::vector<FDeflatedBlock> blocks(numBlocks);
+    std::atomic<bool> bFailed(false);
+    auto encodeBlock = [&](int block) {
+        if (bFailed || bTooSmall) {
+            return;
+        }
+        const int firstRow = block * blockRows;
+        const int endRow = std::min(firstRow + blockRows, inHeight);
+        int windowFirstRow = firstRow;
+        while (windowFirstRow > 0 && uint64_t(firstRow - windowFirstRow) * filteredRowBytes < PNG_DEFLATE_WINDOW_SIZE) {
+            windowFirstRow--;
+        }
+
+        // Workers must not let exceptions escape, they would terminate the process.
+        try {
+            // The rows before the block are filtered again here, so no block has to wait for the one before it. Reordered
+            // rows alternate between two buffers after the row of zeros above the image.
+            std::vector<uint8_t> rowBuffers(3 * rowBytes);
+            std::vector<uint8_t> scratch(4 * filteredRowBytes);
+            std::vector<uint8_t> filtered(uint64_t(endRow - windowFirstRow) * filteredRowBytes);
+            const uint8_t* prevRow = windowFirstRow > 0 ? getRow(windowFirstRow - 1, rowBuffers.data() + (1 + ((windowFirstRow - 1) & 1)) * rowBytes) : rowBuffers.data();
+            uint64_t cost = 0;
+            for (int y = windowFirstRow; y < endRow; y++) {
+                const uint8_t* row = getRow(y, rowBuffers.data() + (1 + (y & 1)) * rowBytes);
+                const uint64_t rowCost = FilterPngRow(row, prevRow, rowBytes, std::max(bytesPerPixel, 1), filtered.data() + uint64_t(y - windowFirstRow) * filteredRowBytes, scratch.data());
+                cost += y >= firstRow ? rowCost : 0;
+                prevRow = row;
+            }
+
+            const uint64_t windowSize = uint64_t(firstRow - windowFirstRow) * filteredRowBytes;
+            const uint8_t* blockData = filtered.data() + windowSize;
+            const uint64_t blockSize = filtered.size() - windowSize;
+            FDeflatedBlock& deflatedBlock = blocks[block];
+            deflatedBlock.filteredSize = blockSize;
+            deflatedBlock.adler = static_cast<uint32_t>(adler32(adler32(0, Z_NULL, 0), blockData, static_cast<uInt>(blockSize)));
+
+            const bool bLastBlock = block == numBlocks - 1;
+            auto deflateBlock = [&](int strategy, std::vector<uint8_t>& outData) -> bool {
+                outData.resize(GetMaxDeflateSize(blockSize));
+                z_stream stream = {};
+                if (deflateInit2(&stream, settings.level, Z_DEFLATED, -MAX_WBITS, 8, strategy) != Z_OK) {
+                    return false;
+                }
+                if (windowSize) {
+                    const uint64_t dictionarySize = std::min(windowSize, PNG_DEFLATE_WINDOW_SIZE);
+                    deflateSetDictionary(&stream, blockData - dictionarySize, static_cast<uInt>(dictionarySize));
+                }
+
+                // Blocks are at most a row over PNG_BLOCK_SIZE, and rows are far below the 4GB zlib takes at once.
+                stream.next_in = const_cast<Bytef*>(blockData);
+                stream.avail_in = static_cast<uInt>(blockSize);
+                stream.next_out = outData.data();
+                stream.avail_out = static_cast<uInt>(outData.size());
+                const int result = deflate(&stream, bLastBlock ? Z_FINISH : Z_SYNC_FLUSH);
+                const bool bDeflated = bLastBlock ? result == Z_STREAM_END : (result == Z_OK && stream.avail_in == 0 && stream.avail_out != 0);
+                outData.resize(outData.size() - stream.avail_out);
+                deflateEnd(&stream);
+                return bDeflated;
+            };
+
+            const bool bNoisy = cost >= PNG_NOISY_FILTER_COST * blockSize;
+            if (!deflateBlock(bNoisy ? settings.noisyStrategy : settings.strategy, deflatedBlock.data)) {
+                bFailed = true;
+                return;
+            }
+            if (settings.bTryBothStrategies) {
+                std::vector<uint8_t> otherData;
+                if (!deflateBlock(bNoisy ? settings.strategy : settings.noisyStrategy, otherData)) {
+                    bFailed = true;
+                    return;
+                }
+                if (otherData.size() < deflatedBlock.data.size()) {
+                    deflatedBlock.data.swap(otherData);
+                }
+            }
+            if (fixedSize + (deflatedSize += deflatedBlock.data.size()) > destCapacity) {
+                bTooSmall = true;
+            }
+        } catch (const std::exception&) {
+            bFailed = true;
+        }
+    };
+
+    // Small images are deflated on the calling thread alone.
+    const int numRunners = int64_t(inWidth) * inHeight < MIN_PARALLEL_PNG_PIXELS ? 1 : numBlocks;
+    FThreadPool::Get().ParallelFor(numBlocks, numRunners, encodeBlock);
+    if (bFailed) {
+        SetError("Failed to deflate PNG rows");
+        return false;
+    }
+    if (bTooSmall) {
+        SetError("Buffer passed to PNG encoder is too small");
+        return false;
+    }
+
+    uint64_t size = 8 + 25 + 2 + 4 + 12;
+    uint32_t adler = blocks[0].adler;
+    for (int block = 0; block < numBlocks; block++) {
+        size += 12 + blocks[block].data.size();
+        if (block > 0) {
+            adler = static_cast<uint32_t>(adler32_combine(adler, blocks[block].adler, static_cast<z_off_t>(blocks[block].filteredSize)));
+        }
+    }
+    if (!dest || destCapacity < size) {
+        SetError("Buffer passed to PNG encoder is too small");
+        return false;
+    }
+
+    static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    memcpy(dest, signature, sizeof(signature));
+    uint64_t position = sizeof(signature);
+
+    const uint8_t header[13] = {
+        static_cast<uint8_t>(inWidth >> 24), static_cast<uint8_t>(inWidth >> 16), static_cast<uint8_t>(inWidth >> 8), static_cast<uint8_t>(inWidth),
+        static_cast<uint8_t>(inHeight >> 24), static_cast<uint8_t>(inHeight >> 16), static_cast<uint8_t>(inHeight >> 8), static_cast<uint8_t>(inHeight),
+        static_cast<uint8_t>(inBitDepth), static_cast<uint8_t>(inFormat == ERGBFormat::Gray ? PNG_COLOR_TYPE_GRAY : PNG_COLOR_TYPE_RGBA), PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT, PNG_INTERLACE_NONE,
+    };
+    position += WritePngChunk(dest + position, "IHDR", header, sizeof(header));
+
+    // One IDAT per block, the first starting with the zlib header and the last ending with the checksum of all blocks.
+    const uint16_t zlibHeader = GetZlibHeader(settings.level);
+    const uint8_t zlibHeaderBytes[2] = {static_cast<uint8_t>(zlibHeader >> 8), static_cast<uint8_t>(zlibHeader)};
+    const uint8_t adlerBytes[4] = {static_cast<uint8_t>(adler >> 24), static_cast<uint8_t>(adler >> 16), static_cast<uint8_t>(adler >> 8), static_cast<uint8_t>(adler)};
+    for (int block = 0; block < numBlocks; block++) {
+        const bool bFirst = block == 0;
+        const bool bLast = block == numBlocks - 1;
+        const std::vector<uint8_t>& data = blocks[block].data;
+        position += WritePngChunk(dest + position, "IDAT", zlibHeaderBytes, bFirst ? 2 : 0, data.data(), data.size(), adlerBytes, bLast ? 4 : 0);
+    }
+    position += WritePngChunk(dest + position, "IEND", nullptr, 0);
+
+    Assert(position == size);
+    outSize = size;
+    return true;
+}
+
 void FPngImageWrapper::Reset() {
     FImageWrapperBase::Reset();
 
     readOffset = 0;
     colorType = 0;
     channels = 0;
+    bInterlaced = false;
 }
 
 bool FPngImageWrapper::SetCompressed(const void* inCompressedData, int64_t inCompressedSize) {
@@ -170,20 +473,14 @@ bool FPngImageWrapper::SetCompressed(const void* inCompressedData, int64_t inCom
 }
 
 void FPngImageWrapper::Uncompress(const ERGBFormat inFormat, const int inBitDepth) {
-    if (!rawData.size() || inFormat != rawFormat || inBitDepth != rawBitDepth) {
-        Assert(compressedData.size());
+    if (rawDest || !rawData.size() || inFormat != rawFormat || inBitDepth != rawBitDepth) {
+        Assert(compressedSize);
         UncompressPNGData(inFormat, inBitDepth);
     }
 }
 
 void FPngImageWrapper::UncompressPNGData(const ERGBFormat inFormat, const int inBitDepth) {
-    // Preserve old single thread code on some platform in relation to a type incompatibility at compile time.
-#if PLATFORM_ANDROID || PLATFORM_LUMIN || PLATFORM_LUMINGL4
-    // thread safety
-    std::lock_guard<std::mutex> pngLock(GPNGSection);
-#endif
-
-    Assert(compressedData.size());
+    Assert(compressedSize);
     Assert(width > 0);
     Assert(height > 0);
 
@@ -191,6 +488,12 @@ void FPngImageWrapper::UncompressPNGData(const ERGBFormat inFormat, const int in
     Assert(inFormat == ERGBFormat::BGRA || inFormat == ERGBFormat::RGBA || inFormat == ERGBFormat::Gray);  // Other formats unsupported at present
     Assert(inBitDepth == 8 || inBitDepth == 16);                                                           // Other formats unsupported at present
 
+    if (UncompressWholeBuffer(inFormat, inBitDepth)) {
+        rawFormat = inFormat;
+        rawBitDepth = inBitDepth;
+        return;
+    }
+
     // Reset to the beginning of file so we can use png_read_png(), which expects to start at the beginning.
     readOffset = 0;
 
@@ -219,116 +522,304 @@ void FPngImageWrapper::UncompressPNGData(const ERGBFormat inFormat, const int in
         // ---------------------------------------------------------------------------------------------------------
         // Anything allocated on the stack after this point will not be destructed correctly in the case of an error
         {
-            if (colorType == PNG_COLOR_TYPE_PALETTE) {
-                png_set_palette_to_rgb(png_ptr);
-            }
-
-            if ((colorType & PNG_COLOR_MASK_COLOR) == 0 && bitDepth < 8) {
-                png_set_expand_gray_1_2_4_to_8(png_ptr);
-            }
-
-            // Insert alpha channel with full opacity for RGB images without alpha
-            if ((colorType & PNG_COLOR_MASK_ALPHA) == 0 && (inFormat == ERGBFormat::BGRA || inFormat == ERGBFormat::RGBA)) {
-                // png images don't set PNG_COLOR_MASK_ALPHA if they have alpha from a tRNS chunk, but png_set_add_alpha seems to be safe regardless
-                if ((colorType & PNG_COLOR_MASK_COLOR) == 0) {
-                    png_set_tRNS_to_alpha(png_ptr);
-                } else if (colorType == PNG_COLOR_TYPE_PALETTE) {
-                    png_set_tRNS_to_alpha(png_ptr);
-                }
-                if (inBitDepth == 8) {
-                    png_set_add_alpha(png_ptr, 0xff, PNG_FILLER_AFTER);
-                } else if (inBitDepth == 16) {
-                    png_set_add_alpha(png_ptr, 0xffff, PNG_FILLER_AFTER);
-                }
-            }
-
             // Calculate Pixel Depth
             const uint64_t pixelChannels = (inFormat == ERGBFormat::Gray) ? 1 : 4;
             const uint64_t bytesPerPixel = (inBitDepth * pixelChannels) / 8;
             const uint64_t bytesPerRow = bytesPerPixel * width;
-            rawData.resize(height * bytesPerRow);
+            uint64_t rowStride = 0;
+            uint8_t* rows = AllocateRawRows(bytesPerRow, height, rowStride);
+            if (!rows) {
+                return;
+            }
 
             png_set_read_fn(png_ptr, this, FPngImageWrapper::user_read_compressed);
+            if (cancelFlag) {
+                png_set_read_status_fn(png_ptr, FPngImageWrapper::user_read_status);
+            }
 
             for (int64_t i = 0; i < height; i++) {
-                row_pointers[i] = &rawData[i * bytesPerRow];
+                row_pointers[i] = rows + i * rowStride;
             }
-            png_set_rows(png_ptr, info_ptr, row_pointers);
 
-            uint32_t transform = (inFormat == ERGBFormat::BGRA) ? PNG_TRANSFORM_BGR : PNG_TRANSFORM_IDENTITY;
+            // The same steps as png_read_png, but with the transforms UncompressRows shares, which need the header read first.
+            png_read_info(png_ptr, info_ptr);
+            SetReadTransforms(png_ptr, colorType, bitDepth, inFormat, inBitDepth);
+            png_set_interlace_handling(png_ptr);
+            png_read_update_info(png_ptr, info_ptr);
+            png_read_image(png_ptr, row_pointers);
+            png_read_end(png_ptr, info_ptr);
+        }
+    } catch (const FPNGImageCRCError& e) {
+        /**
+         *	libPNG has a known issue in version 1.5.2 causing
+         *	an unhandled exception upon a CRC error. This code
+         *	catches our custom exception thrown in user_error_fn.
+         */
+        LogMessage(ELogLevel::Error, e.errorText.data());
+    }
 
-            // PNG files store 16-bit pixels in network byte order (big-endian, ie. most significant bits first).
-            if (IsLitleEndian()) {
-                // We're little endian so we need to swap
-                if (bitDepth == 16) {
-                    transform |= PNG_TRANSFORM_SWAP_ENDIAN;
-                }
-            }
+    rawFormat = inFormat;
+    rawBitDepth = inBitDepth;
+}
 
-            // Convert grayscale png to RGB if requested
-            if ((colorType & PNG_COLOR_MASK_COLOR) == 0 && (inFormat == ERGBFormat::RGBA || inFormat == ERGBFormat::BGRA)) {
-                transform |= PNG_TRANSFORM_GRAY_TO_RGB;
-            }
+static uint32_t ReadBigEndian32(const uint8_t* data) { return (uint32_t(data[0]) << 24) | (uint32_t(data[1]) << 16) | (uint32_t(data[2]) << 8) | uint32_t(data[3]); }
+
+/** Reads a sample of an unfiltered row, 16-bit ones are big endian in the file and come out in the byte order of the machine */
+static uint8_t ReadPngSample(const uint8_t* data, uint8_t) { return data[0]; }
+static uint16_t ReadPngSample(const uint8_t* data, uint16_t) { return static_cast<uint16_t>((data[0] << 8) | data[1]); }
+
+/**
+ * Converts an unfiltered row to the output format the way SetReadTransforms has libpng do it: gray is repeated into red,
+ * green and blue, missing alpha is opaque and gray output drops alpha.
+ */
+template <typename T>
+static void ConvertPngRow(const uint8_t* source, int sourceChannels, int inWidth, ERGBFormat inFormat, uint8_t* dest) {
+    const int sampleBytes = sizeof(T);
+    const int destChannels = inFormat == ERGBFormat::Gray ? 1 : 4;
+    if (sourceChannels == destChannels && inFormat != ERGBFormat::BGRA && sampleBytes == 1) {
+        memcpy(dest, source, uint64_t(inWidth) * destChannels);
+        return;
+    }
+
+    const bool bColor = sourceChannels >= 3;
+    const bool bAlpha = sourceChannels == 2 || sourceChannels == 4;
+    const int redIndex = inFormat == ERGBFormat::BGRA ? 2 : 0;
+    T* destSamples = reinterpret_cast<T*>(dest);
+    for (int x = 0; x < inWidth; x++, source += sourceChannels * sampleBytes, destSamples += destChannels) {
+        const T first = ReadPngSample(source, T());
+        if (destChannels == 1) {
+            destSamples[0] = first;
+            continue;
+        }
+        destSamples[redIndex] = first;
+        destSamples[1] = bColor ? ReadPngSample(source + sampleBytes, T()) : first;
+        destSamples[2 - redIndex] = bColor ? ReadPngSample(source + 2 * sampleBytes, T()) : first;
+        destSamples[3] = bAlpha ? ReadPngSample(source + (sourceChannels - 1) * sampleBytes, T()) : static_cast<T>(~T(0));
+    }
+}
+
+bool FPngImageWrapper::UncompressWholeBuffer(const ERGBFormat inFormat, const int inBitDepth) {
+    const bool bColor = (colorType & PNG_COLOR_MASK_COLOR) != 0;
+    if (bInterlaced || colorType == PNG_COLOR_TYPE_PALETTE || int(bitDepth) != inBitDepth || (bColor && inFormat == ERGBFormat::Gray)) {
+        return false;
+    }
+
+    // Find the IDAT chunks and check every chunk the way libpng would. Anything it may treat differently is left to it.
+    std::vector<std::pair<const uint8_t*, uint32_t>> dataChunks;
+    uint64_t dataSize = 0;
+    bool bDataEnded = false;
+    bool bEnd = false;
+    for (int64_t offset = 8; !bEnd;) {
+        if (compressedSize - offset < 12) {
+            return false;
+        }
+        const uint8_t* chunk = compressedBuffer + offset;
+        const uint32_t length = ReadBigEndian32(chunk);
+        if (length > 0x7FFFFFFF || uint64_t(compressedSize - offset - 12) < length) {
+            return false;
+        }
+        if (ReadBigEndian32(chunk + 8 + length) != static_cast<uint32_t>(crc32(crc32(0, Z_NULL, 0), chunk + 4, length + 4))) {
+            return false;
+        }
 
-            // Convert RGB png to grayscale if requested
-            if ((colorType & PNG_COLOR_MASK_COLOR) != 0 && inFormat == ERGBFormat::Gray) {
-                png_set_rgb_to_gray_fixed(png_ptr, 2 /* warn if image is in color */, -1, -1);
+        const bool bData = !memcmp(chunk + 4, "IDAT", 4);
+        const bool bCritical = (chunk[4] & 0x20) == 0;
+        bEnd = !memcmp(chunk + 4, "IEND", 4);
+        if (bData) {
+            if (bDataEnded) {
+                return false;
             }
+            dataChunks.emplace_back(chunk + 8, length);
+            dataSize += length;
+        } else {
+            bDataEnded = !dataChunks.empty();
+        }
+        if (!memcmp(chunk + 4, "tRNS", 4) || (bCritical && !bData && !bEnd && memcmp(chunk + 4, "IHDR", 4) && memcmp(chunk + 4, "PLTE", 4))) {
+            return false;
+        }
+        offset += 12 + length;
+    }
+
+    const int sourceChannels = (bColor ? 3 : 1) + ((colorType & PNG_COLOR_MASK_ALPHA) ? 1 : 0);
+    const int bytesPerPixel = sourceChannels * inBitDepth / 8;
+    const uint64_t rowBytes = uint64_t(width) * bytesPerPixel;
+    const uint64_t filteredRowBytes = rowBytes + 1;
+    std::vector<uint8_t> filtered(filteredRowBytes * height);
+
+    // Given all of the data and all of the room at once, zlib inflates in a single call without keeping a copy of its
+    // window. A lone IDAT is inflated where it is, several are joined first.
+    std::vector<uint8_t> joinedData;
+    const uint8_t* deflated = dataChunks.empty() ? nullptr : dataChunks[0].first;
+    uint64_t deflatedSize = dataChunks.empty() ? 0 : dataChunks[0].second;
+    if (dataChunks.size() > 1) {
+        joinedData.reserve(dataSize);
+        for (const std::pair<const uint8_t*, uint32_t>& dataChunk : dataChunks) {
+            joinedData.insert(joinedData.end(), dataChunk.first, dataChunk.first + dataChunk.second);
+        }
+        deflated = joinedData.data();
+        deflatedSize = joinedData.size();
+    }
+
+    z_stream stream = {};
+    if (inflateInit(&stream) != Z_OK) {
+        return false;
+    }
 
-            // Strip alpha channel if requested output is grayscale
-            if (inFormat == ERGBFormat::Gray) {
-                // this is not necessarily the best option, instead perhaps:
-                // png_color background = {0,0,0};
-                // png_set_background(png_ptr, &background, PNG_BACKGROUND_GAMMA_SCREEN, 0, 1.0);
-                transform |= PNG_TRANSFORM_STRIP_ALPHA;
+    // zlib only takes 4GB at a time, larger images take more calls.
+    int result = Z_OK;
+    bool bProgress = true;
+    uint64_t inflatedSize = 0;
+    uint64_t consumedSize = 0;
+    while (result == Z_OK || (result == Z_BUF_ERROR && bProgress)) {
+        const uInt availIn = static_cast<uInt>(std::min<uint64_t>(deflatedSize - consumedSize, UINT_MAX));
+        const uInt availOut = static_cast<uInt>(std::min<uint64_t>(filtered.size() - inflatedSize, UINT_MAX));
+        stream.next_in = const_cast<Bytef*>(deflated + consumedSize);
+        stream.avail_in = availIn;
+        stream.next_out = filtered.data() + inflatedSize;
+        stream.avail_out = availOut;
+        result = inflate(&stream, Z_FINISH);
+        consumedSize += availIn - stream.avail_in;
+        inflatedSize += availOut - stream.avail_out;
+        bProgress = stream.avail_in != availIn || stream.avail_out != availOut;
+    }
+    inflateEnd(&stream);
+    if (result != Z_STREAM_END || inflatedSize != filtered.size()) {
+        return false;
+    }
+    if (IsCancelled()) {
+        return true;
+    }
+
+    const uint64_t bytesPerRow = uint64_t(width) * (inFormat == ERGBFormat::Gray ? 1 : 4) * inBitDepth / 8;
+    uint64_t rowStride = 0;
+    uint8_t* rows = AllocateRawRows(bytesPerRow, height, rowStride);
+    if (!rows) {
+        return true;
+    }
+
+    const std::vector<uint8_t> zeros(rowBytes);
+    const uint8_t* prevRow = zeros.data();
+    for (int y = 0; y < height; y++) {
+        uint8_t* row = filtered.data() + y * filteredRowBytes;
+        if (!UnfilterPngRow(row + 1, prevRow, rowBytes, bytesPerPixel, row[0])) {
+            return false;
+        }
+        if (inBitDepth == 16) {
+            ConvertPngRow<uint16_t>(row + 1, sourceChannels, width, inFormat, rows + y * rowStride);
+        } else {
+            ConvertPngRow<uint8_t>(row + 1, sourceChannels, width, inFormat, rows + y * rowStride);
+        }
+        prevRow = row + 1;
+        if ((y & 255) == 255 && IsCancelled()) {
+            return true;
+        }
+    }
+    return true;
+}
+
+bool FPngImageWrapper::UncompressRows(const ERGBFormat inFormat, const int inBitDepth, int rowsPerBatch, const FPngRowCallback& callback) {
+    Assert(compressedSize);
+    Assert(width > 0);
+    Assert(height > 0);
+    Assert(inFormat == ERGBFormat::BGRA || inFormat == ERGBFormat::RGBA || inFormat == ERGBFormat::Gray);
+    Assert(inBitDepth == 8 || inBitDepth == 16);
+    Assert(rowsPerBatch > 0);
+
+    lastError.clear();
+    rowsPerBatch = std::min(rowsPerBatch, height);
+
+    const uint64_t pixelChannels = (inFormat == ERGBFormat::Gray) ? 1 : 4;
+    const uint64_t bytesPerRow = (inBitDepth * pixelChannels) / 8 * width;
+
+    // Rows of an interlaced image are only complete after the last pass, so there is nothing to hand over before that.
+    if (bInterlaced) {
+        std::vector<uint8_t> rows;
+        if (!GetRaw(inFormat, inBitDepth, rows)) {
+            return false;
+        }
+        for (int firstRow = 0; firstRow < height; firstRow += rowsPerBatch) {
+            if (IsCancelled() || !callback(firstRow, std::min(rowsPerBatch, height - firstRow), rows.data() + firstRow * bytesPerRow, bytesPerRow)) {
+                return false;
             }
+        }
+        return true;
+    }
 
-            // Reduce 16-bit to 8-bit if requested
-            if (bitDepth == 16 && inBitDepth == 8) {
-#if PNG_LIBPNG_VER >= 10504
-                Assert(0);  // Needs testing
-                transform |= PNG_TRANSFORM_SCALE_16;
+    // The batch is all the memory the rows need, it is filled again for every batch.
+    std::vector<uint8_t> batch(bytesPerRow * rowsPerBatch);
+    std::vector<png_bytep> batchRows(rowsPerBatch);
+    for (int i = 0; i < rowsPerBatch; i++) {
+        batchRows[i] = batch.data() + i * bytesPerRow;
+    }
+
+    readOffset = 0;
+
+    png_structp png_ptr = png_create_read_struct_2(PNG_LIBPNG_VER_STRING, this, FPngImageWrapper::user_error_fn, FPngImageWrapper::user_warning_fn, NULL, FPngImageWrapper::user_malloc, FPngImageWrapper::user_free);
+    Assert(png_ptr);
+
+    png_infop info_ptr = png_create_info_struct(png_ptr);
+    Assert(info_ptr);
+    try {
+        PNGReadGuard pngGuard(&png_ptr, &info_ptr);
+
+        // Store the current stack pointer in the jump buffer. setjmp will return non-zero in the case of a read error.
+#if PLATFORM_ANDROID || PLATFORM_LUMIN || PLATFORM_LUMINGL4
+        // Preserve old single thread code on some platform in relation to a type incompatibility at compile time.
+        if (setjmp(setjmpBuffer) != 0)
 #else
-                Transform |= PNG_TRANSFORM_STRIP_16;
+        // Use libPNG jump buffer solution to allow concurrent compression\decompression on concurrent threads.
+        if (setjmp(png_jmpbuf(png_ptr)) != 0)
 #endif
+        {
+            return false;
+        }
+
+        // ---------------------------------------------------------------------------------------------------------
+        // Anything allocated on the stack after this point will not be destructed correctly in the case of an error
+        {
+            png_set_read_fn(png_ptr, this, FPngImageWrapper::user_read_compressed);
+            if (cancelFlag) {
+                png_set_read_status_fn(png_ptr, FPngImageWrapper::user_read_status);
             }
 
-            // Increase 8-bit to 16-bit if requested
-            if (bitDepth <= 8 && inBitDepth == 16) {
-#if PNG_LIBPNG_VER >= 10504
-                Assert(0);  // Needs testing
-                transform |= PNG_TRANSFORM_EXPAND_16;
-#else
-                // Expanding 8-bit images to 16-bit via transform needs a libpng update
-                Assert(0);
-#endif
+            png_read_info(png_ptr, info_ptr);
+            SetReadTransforms(png_ptr, colorType, bitDepth, inFormat, inBitDepth);
+            png_read_update_info(png_ptr, info_ptr);
+
+            // The header was read before, but the rows are only as wide as the batch if this data still agrees with it.
+            if (png_get_rowbytes(png_ptr, info_ptr) != bytesPerRow || png_get_image_height(png_ptr, info_ptr) != static_cast<png_uint_32>(height)) {
+                png_error(png_ptr, "Image header changed between reads");
+            }
+
+            for (int firstRow = 0; firstRow < height; firstRow += rowsPerBatch) {
+                const int numRows = std::min(rowsPerBatch, height - firstRow);
+                png_read_rows(png_ptr, batchRows.data(), NULL, numRows);
+                if (!callback(firstRow, numRows, batch.data(), bytesPerRow)) {
+                    return false;
+                }
             }
 
-            png_read_png(png_ptr, info_ptr, transform, NULL);
+            // Checks the CRC of the last chunks, the pixels have all been handed over by now.
+            png_read_end(png_ptr, info_ptr);
         }
     } catch (const FPNGImageCRCError& e) {
-        /**
-         *	libPNG has a known issue in version 1.5.2 causing
-         *	an unhandled exception upon a CRC error. This code
-         *	catches our custom exception thrown in user_error_fn.
-         */
         LogMessage(ELogLevel::Error, e.errorText.data());
+        return false;
     }
 
-    rawFormat = inFormat;
-    rawBitDepth = inBitDepth;
+    return true;
 }
 
 /* FPngImageWrapper implementation
  *****************************************************************************/
 
 bool FPngImageWrapper::IsPNG() const {
-    Assert(compressedData.size());
+    Assert(compressedSize);
 
     const int pngSigSize = sizeof(png_size_t);
 
-    if (compressedData.size() > pngSigSize) {
-        png_size_t pngSignature = *reinterpret_cast<const png_size_t*>(compressedData.data());
+    if (compressedSize > pngSigSize) {
+        png_size_t pngSignature = *reinterpret_cast<const png_size_t*>(compressedBuffer);
         return (0 == png_sig_cmp(reinterpret_cast<png_bytep>(&pngSignature), 0, pngSigSize));
     }
 
@@ -336,21 +827,33 @@ bool FPngImageWrapper::IsPNG() const {
 }
 
 bool FPngImageWrapper::LoadPNGHeader() {
-    Assert(compressedData.size());
+    Assert(compressedSize);
 
     // Test whether the data this PNGLoader is pointing at is a PNG or not.
     if (IsPNG()) {
-        // thread safety
-        std::lock_guard<std::mutex> pngLock(GPNGSection);
-
+        // Every call creates its own png_struct and the error jump buffer lives in it (or in this wrapper),
+        // so no libpng state is shared between threads and no lock is needed.
         png_structp png_ptr = png_create_read_struct_2(PNG_LIBPNG_VER_STRING, this, FPngImageWrapper::user_error_fn, FPngImageWrapper::user_warning_fn, NULL, FPngImageWrapper::user_malloc, FPngImageWrapper::user_free);
         Assert(png_ptr);
 
         png_infop info_ptr = png_create_info_struct(png_ptr);
         Assert(info_ptr);
 
-        PNGReadGuard pngGuard(&png_ptr, &info_ptr);
-        {
+        try {
+            PNGReadGuard pngGuard(&png_ptr, &info_ptr);
+
+            // Store the current stack pointer in the jump buffer. setjmp will return non-zero in the case of a read error.
+#if PLATFORM_ANDROID || PLATFORM_LUMIN || PLATFORM_LUMINGL4
+            // Preserve old single thread code on some platform in relation to a type incompatibility at compile time.
+            if (setjmp(setjmpBuffer) != 0)
+#else
+            // Use libPNG jump buffer solution to allow concurrent compression\decompression on concurrent threads.
+            if (setjmp(png_jmpbuf(png_ptr)) != 0)
+#endif
+            {
+                return false;
+            }
+
             png_set_read_fn(png_ptr, this, FPngImageWrapper::user_read_compressed);
 
             png_read_info(png_ptr, info_ptr);
@@ -360,7 +863,10 @@ bool FPngImageWrapper::LoadPNGHeader() {
             colorType = info_ptr->color_type;
             bitDepth = info_ptr->bit_depth;
             channels = info_ptr->channels;
+            bInterlaced = info_ptr->interlace_type != PNG_INTERLACE_NONE;
             format = (colorType & PNG_COLOR_MASK_COLOR) ? ERGBFormat::RGBA : ERGBFormat::Gray;
+        } catch (const FPNGImageCRCError&) {
+            return false;
         }
 
         return true;
@@ -374,23 +880,30 @@ bool FPngImageWrapper::LoadPNGHeader() {
 
 void FPngImageWrapper::user_read_compressed(png_structp png_ptr, png_bytep data, png_size_t length) {
     FPngImageWrapper* ctx = (FPngImageWrapper*)png_get_io_ptr(png_ptr);
-    if (static_cast<uint64_t>(ctx->readOffset) + static_cast<uint64_t>(length) <= ctx->compressedData.size()) {
-        memcpy(data, &ctx->compressedData[ctx->readOffset], length);
+    if (static_cast<uint64_t>(ctx->readOffset) + static_cast<uint64_t>(length) <= static_cast<uint64_t>(ctx->compressedSize)) {
+        memcpy(data, ctx->compressedBuffer + ctx->readOffset, length);
         ctx->readOffset += length;
     } else {
-        ctx->SetError("Invalid read position for CompressedData.");
+        // Does not return; the header or data ends early, e.g. when only a prefix of the file was supplied.
+        png_error(png_ptr, "Invalid read position for CompressedData");
     }
 }
 
 void FPngImageWrapper::user_write_compressed(png_structp png_ptr, png_bytep data, png_size_t length) {
     FPngImageWrapper* ctx = (FPngImageWrapper*)png_get_io_ptr(png_ptr);
-    for (int i = 0; i < length; i++) {
-        ctx->compressedData.push_back(data[i]);
-    }
+    ctx->compressedData.insert(ctx->compressedData.end(), data, data + length);
 }
 
 void FPngImageWrapper::user_flush_data(png_structp png_ptr) {}
 
+void FPngImageWrapper::user_read_status(png_structp png_ptr, png_uint_32 /*row*/, int /*pass*/) {
+    FPngImageWrapper* ctx = (FPngImageWrapper*)png_get_io_ptr(png_ptr);
+    if (ctx->IsCancelled()) {
+        // Does not return, unwinds png_read_png like any other read error.
+        png_error(png_ptr, "Decode cancelled");
+    }
+}
+
 void FPngImageWrapper::user_error_fn(png_structp png_ptr, png_const_charp error_msg) {
     FPngImageWrapper* ctx = (FPngImageWrapper*)png_get_error_ptr(png_ptr);
 
@@ -398,8 +911,11 @@ void FPngImageWrapper::user_error_fn(png_structp png_ptr, png_const_charp error_
         std::string errorMsg = error_msg;
         ctx->SetError(errorMsg.c_str());
 
-        std::string error = "PNG Error: " + errorMsg + ".";
-        LogMessage(ELogLevel::Error, error.data());
+        // A cancelled decode is expected, not worth reporting.
+        if (!ctx->IsCancelled()) {
+            std::string error = "PNG Error: " + errorMsg + ".";
+            LogMessage(ELogLevel::Error, error.data());
+        }
 
         /**
          *	libPNG has a known issue in version 1.5.2 causing
@@ -436,6 +952,125 @@ void FPngImageWrapper::user_free(png_structp /*png_ptr*/, png_voidp struct_ptr)
     free(struct_ptr);
 }
 
+/* FPngIncrementalDecoder implementation
+ *****************************************************************************/
+
+/**
+ * libpng state of an incremental decode. png_process_data holds on to the part of a chunk it cannot use yet and calls
+ * back with the header, with each row it inflates and at the end of the image.
+ */
+struct FPngIncrementalDecoder::FState {
+    FPngIncrementalDecoder* decoder = nullptr;
+    png_structp png_ptr = nullptr;
+    png_infop info_ptr = nullptr;
+
+#if PLATFORM_ANDROID || PLATFORM_LUMIN || PLATFORM_LUMINGL4
+    /** setjmp buffer for error recovery. */
+    jmp_buf setjmpBuffer;
+#endif
+
+    /** The error libpng stopped with */
+    std::string message;
+
+    static void ErrorFn(png_structp png_ptr, png_const_charp error_msg) {
+        FState* state = static_cast<FState*>(png_get_error_ptr(png_ptr));
+        state->message = "PNG Error: " + std::string(error_msg) + ".";
+
+#if PLATFORM_ANDROID || PLATFORM_LUMIN || PLATFORM_LUMINGL4
+        longjmp(state->setjmpBuffer, 1);
+#endif
+    }
+
+    static void WarningFn(png_structp /*png_ptr*/, png_const_charp warning_msg) {
+        std::string warning = "PNG Warning: " + std::string(warning_msg) + ".";
+        LogMessage(ELogLevel::Warning, warning.data());
+    }
+
+    static void InfoFn(png_structp png_ptr, png_infop info_ptr) {
+        FPngIncrementalDecoder& decoder = *static_cast<FState*>(png_get_progressive_ptr(png_ptr))->decoder;
+        const int colorType = png_get_color_type(png_ptr, info_ptr);
+        decoder.bitDepth = png_get_bit_depth(png_ptr, info_ptr);
+        decoder.width = png_get_image_width(png_ptr, info_ptr);
+        decoder.height = png_get_image_height(png_ptr, info_ptr);
+        decoder.format = (colorType & PNG_COLOR_MASK_COLOR) ? ERGBFormat::RGBA : ERGBFormat::Gray;
+
+        SetReadTransforms(png_ptr, colorType, decoder.bitDepth, ERGBFormat::RGBA, decoder.bitDepth == 16 ? 16 : 8);
+        decoder.numPasses = png_set_interlace_handling(png_ptr);
+        png_read_update_info(png_ptr, info_ptr);
+
+        const uint64_t rowStride = decoder.GetRowStride();
+        if (png_get_rowbytes(png_ptr, info_ptr) != rowStride || rowStride * decoder.height > INT_MAX) {
+            png_error(png_ptr, "Image size is not supported");
+        }
+        decoder.rows.resize(rowStride * decoder.height);
+        decoder.bHeader = true;
+    }
+
+    static void RowFn(png_structp png_ptr, png_bytep new_row, png_uint_32 row_num, int pass) {
+        // Rows without pixels in this pass come without data.
+        if (!new_row) {
+            return;
+        }
+
+        // Only fills in the pixels of this pass, those of earlier passes stay.
+        FPngIncrementalDecoder& decoder = *static_cast<FState*>(png_get_progressive_ptr(png_ptr))->decoder;
+        png_progressive_combine_row(png_ptr, decoder.rows.data() + row_num * decoder.GetRowStride(), new_row);
+
+        // The passes arrive in order, so every pass before this one is complete. Rows are final in the last pass, which
+        // covers the odd rows, the even ones are done by then.
+        decoder.numPassesComplete = std::max(decoder.numPassesComplete, pass);
+        if (pass == decoder.numPasses - 1) {
+            decoder.numRowsComplete = static_cast<int>(row_num) + 1;
+        }
+    }
+
+    static void EndFn(png_structp png_ptr, png_infop /*info_ptr*/) {
+        FPngIncrementalDecoder& decoder = *static_cast<FState*>(png_get_progressive_ptr(png_ptr))->decoder;
+        decoder.numRowsComplete = decoder.height;
+        decoder.numPassesComplete = decoder.numPasses;
+        decoder.bComplete = true;
+    }
+};
+
+FPngIncrementalDecoder::FPngIncrementalDecoder() : state(new FState()), bHeader(false), bComplete(false), format(ERGBFormat::Invalid), bitDepth(0), width(0), height(0), numPasses(1), numRowsComplete(0), numPassesComplete(0) {
+    state->decoder = this;
+    state->png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, state.get(), FState::ErrorFn, FState::WarningFn);
+    Assert(state->png_ptr);
+
+    state->info_ptr = png_create_info_struct(state->png_ptr);
+    Assert(state->info_ptr);
+
+    png_set_progressive_read_fn(state->png_ptr, state.get(), FState::InfoFn, FState::RowFn, FState::EndFn);
+}
+
+FPngIncrementalDecoder::~FPngIncrementalDecoder() { png_destroy_read_struct(&state->png_ptr, &state->info_ptr, NULL); }
+
+bool FPngIncrementalDecoder::Append(const uint8_t* data, uint64_t size) {
+    if (!lastError.empty()) {
+        return false;
+    }
+    if (bComplete) {
+        return true;
+    }
+
+    // Store the current stack pointer in the jump buffer. setjmp will return non-zero in the case of a read error.
+#if PLATFORM_ANDROID || PLATFORM_LUMIN || PLATFORM_LUMINGL4
+    // Preserve old single thread code on some platform in relation to a type incompatibility at compile time.
+    if (setjmp(state->setjmpBuffer) != 0)
+#else
+    // Use libPNG jump buffer solution to allow concurrent compression\decompression on concurrent threads.
+    if (setjmp(png_jmpbuf(state->png_ptr)) != 0)
+#endif
+    {
+        lastError = state->message;
+        return false;
+    }
+
+    // libpng buffers partial chunks itself, any split of the file works. Whatever follows IEND is dropped.
+    png_process_data(state->png_ptr, state->info_ptr, const_cast<png_bytep>(data), static_cast<png_size_t>(size));
+    return true;
+}
+
 // Renable warning "interaction between '_setjmp' and C++ object destruction is non-portable"
 #ifdef _MSC_VER
 #pragma warning(pop)
@@ -1,5 +1,9 @@
 ﻿#pragma once
 #include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
 #include "Wrapper/ImageWrapperBase.h"
 #include "zlib.h"
 // make sure no other versions of libpng headers are picked up
@@ -10,6 +14,9 @@
 #include <setjmp.h>
 
 namespace ImageDecoder {
+/** Receives a batch of decoded rows, which are only valid during the call. Returning false stops the decode. */
+typedef std::function<bool(int firstRow, int numRows, const uint8_t* rows, uint64_t rowStride)> FPngRowCallback;
+
 /**
  * PNG implementation of the helper class.
  *
@@ -47,14 +54,51 @@ public:
      */
     bool LoadPNGHeader();
 
+    /**
+     * Encodes pixels from memory the caller owns into a buffer the caller owns, without libpng. Rows are filtered like
+     * libpng does by default and deflated in blocks, on the thread pool for large images. Each block is primed with the
+     * 32KB before it as its dictionary and ends in a sync flush, so together they form a single zlib stream.
+     *
+     * @param inStride The number of bytes between the starts of consecutive rows.
+     * @param inFormat RGBA, BGRA or Gray.
+     * @param inBitDepth 8 or 16, 16-bit channels in the byte order of the machine.
+     * @param profile Sets the zlib level and the strategy each block is deflated with, by how noisy its filtered rows are.
+     * @param outSize Will contain the size of the PNG written to dest.
+     * @return false if encoding failed or dest is too small, which never happens at GetMaxCompressedSize bytes.
+     */
+    bool CompressToBuffer(const uint8_t* inPixels, int inWidth, int inHeight, uint64_t inStride, ERGBFormat inFormat, int inBitDepth, EPngProfile profile, uint8_t* dest, uint64_t destCapacity, uint64_t& outSize);
+
+    /** Gets the worst case size of a PNG CompressToBuffer writes for an image of this size and format */
+    static uint64_t GetMaxCompressedSize(int inWidth, int inHeight, ERGBFormat inFormat, int inBitDepth);
+
     /** Helper function used to uncompress PNG data from a buffer */
     void UncompressPNGData(const ERGBFormat InFormat, const int InBitDepth);
 
+    /**
+     * Decodes the file without libpng, which the whole of it being in memory allows: the IDAT chunks are inflated in one
+     * go into a single buffer and the rows unfiltered there and converted into the destination.
+     *
+     * @return false, without an error, if libpng has to decode the image: interlaced, palette, tRNS or fewer than 8 bits,
+     * a conversion to another bit depth or from color to gray, unknown critical chunks or any damage, which libpng then
+     * reports. true with the error set if cancelled.
+     */
+    bool UncompressWholeBuffer(const ERGBFormat inFormat, const int inBitDepth);
+
+    /**
+     * Decodes the image in batches of rows and hands each batch to the callback as soon as it is complete, so only one
+     * batch is ever in memory. Interlaced images have no complete rows before their last pass and are decoded whole first.
+     *
+     * @param rowsPerBatch Number of rows per batch, the last batch may be shorter.
+     * @return false if decoding failed, was cancelled or the callback stopped it.
+     */
+    bool UncompressRows(const ERGBFormat inFormat, const int inBitDepth, int rowsPerBatch, const FPngRowCallback& callback);
+
 protected:
     // Callbacks for the pnglibs
     static void user_read_compressed(png_structp png_ptr, png_bytep data, png_size_t length);
     static void user_write_compressed(png_structp png_ptr, png_bytep data, png_size_t length);
     static void user_flush_data(png_structp png_ptr);
+    static void user_read_status(png_structp png_ptr, png_uint_32 row, int pass);
     static void user_error_fn(png_structp png_ptr, png_const_charp error_msg);
     static void user_warning_fn(png_structp png_ptr, png_const_charp warning_msg);
     static void* user_malloc(png_structp png_ptr, png_size_t size);
@@ -70,10 +114,88 @@ private:
     /** The number of channels. */
     uint8_t channels;
 
+    /** Whether the rows are stored in Adam7 passes. */
+    bool bInterlaced;
+
 #if PLATFORM_ANDROID || PLATFORM_LUMIN || PLATFORM_LUMINGL4
     // Other platforms rely on libPNG internal mechanism to achieve concurrent compression\decompression on multiple threads
     /** setjmp buffer for error recovery. */
     jmp_buf setjmpBuffer;
 #endif
 };
+
+/**
+ * Decodes a PNG while its data is still arriving, with libpng's progressive reader, as far as the bytes received so far go.
+ *
+ * Rows are written into the final image as soon as libpng has inflated them. An interlaced PNG fills in the whole image
+ * pass by pass, pixels of the passes still to come stay zero. Rows are always RGBA, 16 bits per channel for 16-bit PNGs.
+ */
+class FPngIncrementalDecoder {
+public:
+    FPngIncrementalDecoder();
+
+    ~FPngIncrementalDecoder();
+
+    /**
+     * Appends the next chunk of the file, of any size, and decodes what it completes. Bytes after the end of the image are ignored.
+     *
+     * @return false if the data is not a PNG that can be decoded. The error is then in GetError and every later call fails too.
+     */
+    bool Append(const uint8_t* data, uint64_t size);
+
+    /** Whether the header has been read, which the size, format and rows need */
+    bool HasHeader() const { return bHeader; }
+
+    /** Whether the rows are stored in Adam7 passes */
+    bool IsInterlaced() const { return numPasses > 1; }
+
+    /** Whether every row holds its final pixels */
+    bool IsComplete() const { return bComplete; }
+
+    int GetWidth() const { return width; }
+
+    int GetHeight() const { return height; }
+
+    /** Gets the format of the image, the rows are RGBA regardless */
+    ERGBFormat GetFormat() const { return format; }
+
+    /** Gets the bit depth of the image as stored, the rows have 16 bits per channel if it is 16 and 8 otherwise */
+    int GetBitDepth() const { return bitDepth; }
+
+    /** Gets the number of rows from the top that hold their final pixels */
+    int GetNumRowsComplete() const { return numRowsComplete; }
+
+    /** Gets the number of interlace passes received completely, the only pass of a PNG that is not interlaced included */
+    int GetNumPassesComplete() const { return numPassesComplete; }
+
+    /** Gets the first row, nullptr until the header has been read */
+    uint8_t* GetRows() { return rows.empty() ? nullptr : rows.data(); }
+
+    uint64_t GetRowStride() const { return uint64_t(width) * (bitDepth == 16 ? 8 : 4); }
+
+    const std::string& GetError() const { return lastError; }
+
+private:
+    /** libpng state, along with the callbacks of the progressive reader */
+    struct FState;
+    std::unique_ptr<FState> state;
+
+    std::vector<uint8_t> rows;
+
+    bool bHeader;
+    bool bComplete;
+
+    ERGBFormat format;
+    int bitDepth;
+    int width;
+    int height;
+
+    /** Number of passes the rows are stored in, 7 for Adam7 and 1 otherwise */
+    int numPasses;
+
+    int numRowsComplete;
+    int numPassesComplete;
+
+    std::string lastError;
+};
 }  // namespace ImageDecoder
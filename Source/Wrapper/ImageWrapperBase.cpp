@@ -21,7 +21,7 @@ bool IImageWrapper::GetRaw(const ERGBFormat inFormat, int inBitDepth, std::vecto
 /* FImageWrapperBase structors
  *****************************************************************************/
 
-FImageWrapperBase::FImageWrapperBase() : rawFormat(ERGBFormat::Invalid), rawBitDepth(0), format(ERGBFormat::Invalid), bitDepth(0), width(0), height(0), numFrames(1), framerate(0) {}
+FImageWrapperBase::FImageWrapperBase() : compressedBuffer(nullptr), compressedSize(0), bBorrowCompressed(false), rawFormat(ERGBFormat::Invalid), rawBitDepth(0), rawDest(nullptr), rawDestStride(0), rawDestCapacity(0), cancelFlag(nullptr), format(ERGBFormat::Invalid), bitDepth(0), width(0), height(0), numFrames(1), framerate(0) {}
 
 /* FImageWrapperBase interface
  *****************************************************************************/
@@ -41,6 +41,31 @@ void FImageWrapperBase::Reset() {
 
 void FImageWrapperBase::SetError(const char* ErrorMessage) { lastError = ErrorMessage; }
 
+bool FImageWrapperBase::IsCancelled() {
+    if (cancelFlag && cancelFlag->load(std::memory_order_relaxed)) {
+        SetError("Decode cancelled.");
+        return true;
+    }
+    return false;
+}
+
+uint8_t* FImageWrapperBase::AllocateRawRows(uint64_t bytesPerRow, uint64_t numRows, uint64_t& outStride) {
+    if (!rawDest) {
+        rawData.resize(bytesPerRow * numRows);
+        outStride = bytesPerRow;
+        return rawData.data();
+    }
+
+    outStride = rawDestStride ? rawDestStride : bytesPerRow;
+    const uint64_t requiredSize = numRows ? outStride * (numRows - 1) + bytesPerRow : 0;
+    if (outStride < bytesPerRow || rawDestCapacity < requiredSize) {
+        std::string error = "Destination of " + std::to_string(rawDestCapacity) + " bytes with stride " + std::to_string(outStride) + " is too small for " + std::to_string(numRows) + " rows of " + std::to_string(bytesPerRow) + " bytes.";
+        SetError(error.data());
+        return nullptr;
+    }
+    return rawDest;
+}
+
 /* IImageWrapper structors
  *****************************************************************************/
 
@@ -62,15 +87,39 @@ bool FImageWrapperBase::GetRaw(const ERGBFormat inFormat, int inBitDepth, std::v
     return lastError.empty();
 }
 
+bool FImageWrapperBase::GetRaw(const ERGBFormat inFormat, int inBitDepth, uint8_t* outRawData, uint64_t outStride, uint64_t outCapacity) {
+    if (!outRawData) {
+        return false;
+    }
+
+    lastError.clear();
+    rawDest = outRawData;
+    rawDestStride = outStride;
+    rawDestCapacity = outCapacity;
+
+    Uncompress(inFormat, inBitDepth);
+
+    rawDest = nullptr;
+    rawDestStride = 0;
+    rawDestCapacity = 0;
+
+    return lastError.empty();
+}
+
 bool FImageWrapperBase::SetCompressed(const void* inCompressedData, int64_t inCompressedSize) {
     if (inCompressedSize > 0 && inCompressedData != nullptr) {
         Reset();
         rawData.clear();  // Invalidates the raw data too
 
-        compressedData.resize(inCompressedSize);
-        for (int i = 0; i < inCompressedSize; i++) {
-            compressedData[i] = static_cast<const uint8_t*>(inCompressedData)[i];
+        const uint8_t* inCompressedBytes = static_cast<const uint8_t*>(inCompressedData);
+        if (bBorrowCompressed) {
+            compressedData.clear();
+            compressedBuffer = inCompressedBytes;
+        } else {
+            compressedData.assign(inCompressedBytes, inCompressedBytes + inCompressedSize);
+            compressedBuffer = compressedData.data();
         }
+        compressedSize = inCompressedSize;
 
         return true;
     }
@@ -78,6 +127,15 @@ bool FImageWrapperBase::SetCompressed(const void* inCompressedData, int64_t inCo
     return false;
 }
 
+bool FImageWrapperBase::SetCompressedView(const void* inCompressedData, int64_t inCompressedSize) {
+    // Goes through the format's SetCompressed so its header parsing runs as usual, only the copy is skipped.
+    bBorrowCompressed = true;
+    const bool bResult = SetCompressed(inCompressedData, inCompressedSize);
+    bBorrowCompressed = false;
+
+    return bResult;
+}
+
 bool FImageWrapperBase::SetRaw(const void* inRawData, int64_t inRawSize, const int inWidth, const int inHeight, const ERGBFormat inFormat, const int inBitDepth) {
     Assert(inRawData != NULL);
     Assert(inRawSize > 0);
@@ -86,11 +144,10 @@ bool FImageWrapperBase::SetRaw(const void* inRawData, int64_t inRawSize, const i
 
     Reset();
     compressedData.clear();  // Invalidates the compressed data too
+    compressedBuffer = nullptr;
+    compressedSize = 0;
 
-    rawData.resize(inRawSize);
-    for (int i = 0; i < inRawSize; i++) {
-        rawData[i] = static_cast<const uint8_t*>(inRawData)[i];
-    }
+    rawData.assign(static_cast<const uint8_t*>(inRawData), static_cast<const uint8_t*>(inRawData) + inRawSize);
 
     rawFormat = inFormat;
     rawBitDepth = inBitDepth;
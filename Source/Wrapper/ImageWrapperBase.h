@@ -1,5 +1,6 @@
 ﻿#pragma once
 
+#include <atomic>
 #include <iostream>
 #include <string>
 #include <vector>
@@ -21,6 +22,16 @@ public:
      */
     virtual bool SetCompressed(const void* inCompressedData, int64_t inCompressedSize) = 0;
 
+    /**
+     * Sets the compressed data without copying it.
+     * The memory must stay valid and unchanged for as long as the wrapper decodes from it.
+     *
+     * @param inCompressedData The memory address of the start of the compressed data.
+     * @param inCompressedSize The size of the compressed data parsed.
+     * @return true if data was the expected format.
+     */
+    virtual bool SetCompressedView(const void* inCompressedData, int64_t inCompressedSize) = 0;
+
     /**
      * Sets the compressed data.
      *
@@ -60,6 +71,25 @@ public:
      */
     virtual bool GetRaw(const ERGBFormat inFormat, int inBitDepth, std::vector<uint8_t>& outRawData);
 
+    /**
+     * Gets the raw data written straight into caller-owned memory, skipping the internal array.
+     *
+     * @param inFormat How we want to manipulate the RGB data.
+     * @param inBitDepth The output bit-depth per channel, normally 8.
+     * @param outRawData The memory address of the first row of the destination.
+     * @param outStride The number of bytes between the starts of consecutive rows, 0 for tightly packed rows.
+     * @param outCapacity The size of the destination in bytes.
+     * @return true on success, false otherwise (including a destination that is too small).
+     */
+    virtual bool GetRaw(const ERGBFormat inFormat, int inBitDepth, uint8_t* outRawData, uint64_t outStride, uint64_t outCapacity) = 0;
+
+    /**
+     * Lets another thread abort GetRaw. Decoding checks the flag between rows and fails once it is set.
+     *
+     * @param inCancelFlag The flag to watch, nullptr to always decode to the end.
+     */
+    virtual void SetCancelFlag(const std::atomic<bool>* inCancelFlag) = 0;
+
     /**
      * Gets the width of the image.
      *
@@ -169,6 +199,8 @@ public:
 
     virtual bool GetRaw(const ERGBFormat inFormat, int inBitDepth, std::vector<uint8_t>& outRawData) override;
 
+    virtual bool GetRaw(const ERGBFormat inFormat, int inBitDepth, uint8_t* outRawData, uint64_t outStride, uint64_t outCapacity) override;
+
     virtual int GetWidth() const override { return width; }
 
     virtual int GetNumFrames() const override { return numFrames; }
@@ -176,18 +208,54 @@ public:
     virtual int GetFramerate() const override { return framerate; }
 
     virtual bool SetCompressed(const void* inCompressedData, int64_t inCompressedSize) override;
+    virtual bool SetCompressedView(const void* inCompressedData, int64_t inCompressedSize) override;
     virtual bool SetRaw(const void* inRawData, int64_t inRawSize, const int inWidth, const int inHeight, const ERGBFormat inFormat, const int inBitDepth) override;
     virtual bool SetAnimationInfo(int inNumFrames, int inFramerate) override;
+    virtual void SetCancelFlag(const std::atomic<bool>* inCancelFlag) override { cancelFlag = inCancelFlag; }
+
+protected:
+    /**
+     * Gets the memory Uncompress should write its rows into.
+     * This is the caller's buffer while a GetRaw into external memory is running, otherwise the resized raw data array.
+     *
+     * @param bytesPerRow The number of bytes in one decoded row.
+     * @param numRows The number of rows to decode.
+     * @param outStride Will contain the number of bytes between the starts of consecutive rows.
+     * @return The address of the first row, or nullptr (with the error set) if the destination is too small.
+     */
+    uint8_t* AllocateRawRows(uint64_t bytesPerRow, uint64_t numRows, uint64_t& outStride);
+
+    /**
+     * Checks whether the running decode should stop, setting the error if so.
+     *
+     * @return true if the cancel flag is set.
+     */
+    bool IsCancelled();
 
 protected:
     /** Arrays of compressed/raw data */
     std::vector<uint8_t> rawData;
     std::vector<uint8_t> compressedData;
 
+    /** The compressed data decoding reads from, either compressedData or memory borrowed through SetCompressedView */
+    const uint8_t* compressedBuffer;
+    int64_t compressedSize;
+
+    /** Whether SetCompressed should borrow the memory instead of copying it */
+    bool bBorrowCompressed;
+
     /** Format of the raw data */
     ERGBFormat rawFormat;
     uint8_t rawBitDepth;
 
+    /** Caller-owned destination of the running GetRaw, nullptr when decoding into rawData */
+    uint8_t* rawDest;
+    uint64_t rawDestStride;
+    uint64_t rawDestCapacity;
+
+    /** Flag another thread sets to abort decoding, nullptr if decoding cannot be cancelled */
+    const std::atomic<bool>* cancelFlag;
+
     /** Format of the image */
     ERGBFormat format;
 
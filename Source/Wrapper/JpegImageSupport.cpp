@@ -0,0 +1,819 @@
+﻿#include "JpegImageSupport.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+namespace ImageDecoder {
+static const uint8_t JPEG_SOI = 0xD8;
+static const uint8_t JPEG_EOI = 0xD9;
+static const uint8_t JPEG_SOS = 0xDA;
+static const uint8_t JPEG_DRI = 0xDD;
+static const uint8_t JPEG_RST0 = 0xD0;
+static const uint8_t JPEG_RST7 = 0xD7;
+static const uint8_t JPEG_TEM = 0x01;
+static const uint8_t JPEG_DHT = 0xC4;
+
+static uint16_t ReadBigEndian16(const uint8_t* data) { return static_cast<uint16_t>((data[0] << 8) | data[1]); }
+
+static bool IsRestartMarker(uint8_t marker) { return marker >= JPEG_RST0 && marker <= JPEG_RST7; }
+
+static bool IsStartOfFrame(uint8_t marker) { return marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC; }
+
+bool FJpegRestartIndex::Parse(const uint8_t* data, uint64_t size) {
+    *this = FJpegRestartIndex();
+    if (size < 4 || data[0] != 0xFF || data[1] != JPEG_SOI) {
+        return false;
+    }
+
+    int numComponents = 0;
+    int maxHorizontalSampling = 1;
+    int maxVerticalSampling = 1;
+    uint64_t offset = 2;
+    while (scanDataOffset == 0) {
+        // Markers may be preceded by any number of 0xFF fill bytes.
+        if (offset + 2 > size || data[offset] != 0xFF) {
+            return false;
+        }
+        while (offset + 2 <= size && data[offset + 1] == 0xFF) {
+            offset++;
+        }
+        if (offset + 4 > size) {
+            return false;
+        }
+
+        const uint8_t marker = data[offset + 1];
+        if (marker == JPEG_TEM || IsRestartMarker(marker)) {
+            offset += 2;
+            continue;
+        }
+        if (marker == JPEG_SOI || marker == JPEG_EOI) {
+            return false;
+        }
+
+        const uint64_t segment = offset + 2;
+        const uint64_t segmentLength = ReadBigEndian16(data + segment);
+        if (segmentLength < 2 || segment + segmentLength > size) {
+            return false;
+        }
+
+        if (IsStartOfFrame(marker)) {
+            // Only baseline and extended sequential Huffman frames have one scan whose intervals can be cut apart.
+            if ((marker != 0xC0 && marker != 0xC1) || segmentLength < 8 || data[segment + 2] != 8) {
+                return false;
+            }
+            heightOffset = segment + 3;
+            height = ReadBigEndian16(data + segment + 3);
+            width = ReadBigEndian16(data + segment + 5);
+            numComponents = data[segment + 7];
+            if (height == 0 || width == 0 || numComponents == 0 || segmentLength < 8 + 3 * uint64_t(numComponents)) {
+                return false;
+            }
+
+            int minVerticalSampling = 4;
+            for (int component = 0; component < numComponents; component++) {
+                const uint8_t sampling = data[segment + 8 + component * 3 + 1];
+                maxHorizontalSampling = std::max(maxHorizontalSampling, sampling >> 4);
+                maxVerticalSampling = std::max(maxVerticalSampling, sampling & 15);
+                minVerticalSampling = std::min(minVerticalSampling, sampling & 15);
+            }
+            bVerticalUpsampling = numComponents > 1 && minVerticalSampling < maxVerticalSampling;
+        } else if (marker == JPEG_DRI) {
+            if (segmentLength < 4) {
+                return false;
+            }
+            restartInterval = ReadBigEndian16(data + segment + 2);
+        } else if (marker == JPEG_SOS) {
+            // A scan with fewer components than the frame is one of several, which cannot be split into bands.
+            if (numComponents == 0 || segmentLength < 3 || data[segment + 2] != numComponents) {
+                return false;
+            }
+            scanDataOffset = segment + segmentLength;
+        }
+        offset = segment + segmentLength;
+    }
+
+    if (restartInterval == 0) {
+        return false;
+    }
+
+    // A single-component scan codes one block per MCU whatever its sampling factors say.
+    mcuWidth = numComponents == 1 ? 8 : 8 * maxHorizontalSampling;
+    mcuHeight = numComponents == 1 ? 8 : 8 * maxVerticalSampling;
+    mcusPerRow = (width + mcuWidth - 1) / mcuWidth;
+    mcuRows = (height + mcuHeight - 1) / mcuHeight;
+    const int64_t numMcus = int64_t(mcusPerRow) * mcuRows;
+    const int64_t expectedSegments = (numMcus + restartInterval - 1) / restartInterval;
+
+    // Walk the entropy-coded data for markers, 0xFF followed by 0x00 is a stuffed data byte.
+    segmentOffsets.push_back(scanDataOffset);
+    for (uint64_t position = scanDataOffset;;) {
+        const uint8_t* next = static_cast<const uint8_t*>(memchr(data + position, 0xFF, size - position));
+        if (!next || uint64_t(next - data) + 1 >= size) {
+            return false;  // Truncated, the serial decoder deals with that
+        }
+        position = next - data;
+
+        const uint8_t marker = data[position + 1];
+        if (marker == 0x00) {
+            position += 2;
+        } else if (marker == 0xFF) {
+            position += 1;
+        } else if (IsRestartMarker(marker)) {
+            if (marker != JPEG_RST0 + (GetNumSegments() % 8)) {
+                return false;
+            }
+            position += 2;
+            segmentOffsets.push_back(position);
+        } else {
+            if (marker != JPEG_EOI) {
+                return false;
+            }
+            segmentOffsets.push_back(position + 2);
+            break;
+        }
+    }
+
+    return GetNumSegments() == expectedSegments;
+}
+
+int FJpegRestartIndex::GetRowSegment(int row) const {
+    if (row >= mcuRows) {
+        return GetNumSegments();
+    }
+    const int64_t firstMcu = int64_t(row) * mcusPerRow;
+    return firstMcu % restartInterval == 0 ? static_cast<int>(firstMcu / restartInterval) : -1;
+}
+
+void FJpegRestartIndex::BuildBand(const uint8_t* data, int firstRow, int endRow, std::vector<uint8_t>& outJpeg) const {
+    const int firstSegment = GetRowSegment(firstRow);
+    const int endSegment = GetRowSegment(endRow);
+    const uint64_t entropyBegin = segmentOffsets[firstSegment];
+    const uint64_t entropyEnd = segmentOffsets[endSegment] - 2;
+
+    outJpeg.resize(scanDataOffset + (entropyEnd - entropyBegin) + 2);
+    memcpy(outJpeg.data(), data, scanDataOffset);
+    memcpy(outJpeg.data() + scanDataOffset, data + entropyBegin, entropyEnd - entropyBegin);
+
+    const int bandHeight = std::min(endRow * mcuHeight, height) - firstRow * mcuHeight;
+    outJpeg[heightOffset] = static_cast<uint8_t>(bandHeight >> 8);
+    outJpeg[heightOffset + 1] = static_cast<uint8_t>(bandHeight & 0xFF);
+
+    for (int segment = firstSegment + 1; segment < endSegment; segment++) {
+        const uint64_t markerOffset = scanDataOffset + (segmentOffsets[segment] - 2 - entropyBegin);
+        outJpeg[markerOffset + 1] = static_cast<uint8_t>(JPEG_RST0 + (segment - firstSegment - 1) % 8);
+    }
+
+    outJpeg[outJpeg.size() - 2] = 0xFF;
+    outJpeg[outJpeg.size() - 1] = JPEG_EOI;
+}
+
+uint64_t FindJpegScansEnd(const uint8_t* data, uint64_t size, uint64_t scanDataOffset, int maxScans, int& outNumScans) {
+    outNumScans = 0;
+    uint64_t scansEnd = 0;
+    for (uint64_t position = scanDataOffset; position < size;) {
+        // The scan's data ends at the first marker other than a restart marker, 0xFF followed by 0x00 is a stuffed data byte.
+        const uint8_t* next = static_cast<const uint8_t*>(memchr(data + position, 0xFF, size - position));
+        if (!next || uint64_t(next - data) + 1 >= size) {
+            break;
+        }
+        position = next - data;
+
+        const uint8_t marker = data[position + 1];
+        if (marker == 0x00 || IsRestartMarker(marker)) {
+            position += 2;
+            continue;
+        }
+        if (marker == 0xFF) {
+            position += 1;
+            continue;
+        }
+
+        outNumScans++;
+        scansEnd = position;
+        if (outNumScans == maxScans) {
+            break;
+        }
+
+        // Tables may come between the scans, the next scan's data starts after its header.
+        uint64_t scanData = 0;
+        while (scanData == 0) {
+            while (position + 2 <= size && data[position + 1] == 0xFF) {
+                position++;
+            }
+            if (position + 4 > size || data[position] != 0xFF) {
+                return scansEnd;
+            }
+
+            const uint8_t segmentMarker = data[position + 1];
+            if (segmentMarker == JPEG_EOI) {
+                return scansEnd;
+            }
+            if (segmentMarker == JPEG_TEM || IsRestartMarker(segmentMarker)) {
+                position += 2;
+                continue;
+            }
+
+            const uint64_t segment = position + 2;
+            const uint64_t segmentLength = ReadBigEndian16(data + segment);
+            if (segmentLength < 2 || segment + segmentLength > size) {
+                return scansEnd;
+            }
+            position = segment + segmentLength;
+            if (segmentMarker == JPEG_SOS) {
+                scanData = position;
+            }
+        }
+    }
+    return scansEnd;
+}
+
+/** A Huffman table as a DHT segment defines it, set up for decoding and encoding */
+struct FJpegHuffmanTable {
+    bool bDefined = false;
+
+    /** Symbols in order of their codes */
+    uint8_t symbols[256] = {};
+
+    /** Largest code of each length, -1 if there is none */
+    int32_t maxCode[17] = {};
+
+    /** Index in symbols of the first code of each length, minus that code */
+    int32_t valueOffset[17] = {};
+
+    /** Length and symbol of the codes of up to 8 bits, indexed by the next 8 bits of the data. Length 0 for longer codes. */
+    uint8_t lookupLength[256] = {};
+    uint8_t lookupSymbol[256] = {};
+
+    /** Code and code length of each symbol, length 0 for symbols the table has no code for */
+    uint16_t codes[256] = {};
+    uint8_t codeLengths[256] = {};
+
+    /** Reads the table from a DHT segment and generates the canonical codes */
+    bool Define(const uint8_t* counts, const uint8_t* inSymbols) {
+        *this = FJpegHuffmanTable();
+        int numSymbols = 0;
+        for (int length = 1; length <= 16; length++) {
+            numSymbols += counts[length - 1];
+        }
+        if (numSymbols > 256) {
+            return false;
+        }
+        memcpy(symbols, inSymbols, numSymbols);
+
+        int32_t code = 0;
+        int index = 0;
+        for (int length = 1; length <= 16; length++) {
+            valueOffset[length] = index - code;
+            for (int i = 0; i < counts[length - 1]; i++, index++, code++) {
+                const uint8_t symbol = symbols[index];
+                codes[symbol] = static_cast<uint16_t>(code);
+                codeLengths[symbol] = static_cast<uint8_t>(length);
+                if (length <= 8) {
+                    const int first = code << (8 - length);
+                    for (int entry = first; entry < first + (1 << (8 - length)); entry++) {
+                        lookupLength[entry] = static_cast<uint8_t>(length);
+                        lookupSymbol[entry] = symbol;
+                    }
+                }
+            }
+            maxCode[length] = counts[length - 1] ? code - 1 : -1;
+            if (code > (1 << length)) {
+                return false;  // More codes than fit in this many bits
+            }
+            code <<= 1;
+        }
+        bDefined = true;
+        return true;
+    }
+};
+
+/** Headers of a sequential Huffman JPEG whose only scan holds every component */
+struct FJpegScanLayout {
+    int width = 0;
+    int height = 0;
+    int mcuWidth = 0;
+    int mcuHeight = 0;
+    int mcusPerRow = 0;
+    int mcuRows = 0;
+    bool bVerticalUpsampling = false;
+    uint64_t heightOffset = 0;
+    uint64_t scanDataOffset = 0;
+
+    /** The components in scan order */
+    int numComponents = 0;
+    struct FComponent {
+        int blocksPerMcu = 0;
+        int dcTable = 0;
+        int acTable = 0;
+    } components[4];
+
+    FJpegHuffmanTable dcTables[4];
+    FJpegHuffmanTable acTables[4];
+};
+
+static bool ParseScanLayout(const uint8_t* data, uint64_t size, FJpegScanLayout& layout) {
+    layout = FJpegScanLayout();
+    if (size < 4 || data[0] != 0xFF || data[1] != JPEG_SOI) {
+        return false;
+    }
+
+    // Component identifiers and sampling factors of the frame
+    int numFrameComponents = 0;
+    uint8_t frameIds[4] = {};
+    uint8_t frameSampling[4] = {};
+
+    uint64_t offset = 2;
+    while (layout.scanDataOffset == 0) {
+        if (offset + 2 > size || data[offset] != 0xFF) {
+            return false;
+        }
+        while (offset + 2 <= size && data[offset + 1] == 0xFF) {
+            offset++;
+        }
+        if (offset + 4 > size) {
+            return false;
+        }
+
+        const uint8_t marker = data[offset + 1];
+        if (marker == JPEG_TEM || IsRestartMarker(marker)) {
+            offset += 2;
+            continue;
+        }
+        if (marker == JPEG_SOI || marker == JPEG_EOI) {
+            return false;
+        }
+
+        const uint64_t segment = offset + 2;
+        const uint64_t segmentLength = ReadBigEndian16(data + segment);
+        if (segmentLength < 2 || segment + segmentLength > size) {
+            return false;
+        }
+        const uint64_t segmentEnd = segment + segmentLength;
+
+        if (IsStartOfFrame(marker)) {
+            if ((marker != 0xC0 && marker != 0xC1) || segmentLength < 8 || data[segment + 2] != 8) {
+                return false;
+            }
+            layout.heightOffset = segment + 3;
+            layout.height = ReadBigEndian16(data + segment + 3);
+            layout.width = ReadBigEndian16(data + segment + 5);
+            numFrameComponents = data[segment + 7];
+            if (layout.height == 0 || layout.width == 0 || numFrameComponents == 0 || numFrameComponents > 4 || segmentLength < 8 + 3 * uint64_t(numFrameComponents)) {
+                return false;
+            }
+            for (int component = 0; component < numFrameComponents; component++) {
+                frameIds[component] = data[segment + 8 + component * 3];
+                frameSampling[component] = data[segment + 8 + component * 3 + 1];
+                if ((frameSampling[component] >> 4) < 1 || (frameSampling[component] >> 4) > 4 || (frameSampling[component] & 15) < 1 || (frameSampling[component] & 15) > 4) {
+                    return false;
+                }
+            }
+        } else if (marker == JPEG_DHT) {
+            for (uint64_t table = segment + 2; table < segmentEnd;) {
+                if (table + 17 > segmentEnd) {
+                    return false;
+                }
+                const int tableClass = data[table] >> 4;
+                const int tableId = data[table] & 15;
+                int numSymbols = 0;
+                for (int length = 0; length < 16; length++) {
+                    numSymbols += data[table + 1 + length];
+                }
+                if (tableClass > 1 || tableId > 3 || table + 17 + numSymbols > segmentEnd) {
+                    return false;
+                }
+                FJpegHuffmanTable& huffmanTable = tableClass == 0 ? layout.dcTables[tableId] : layout.acTables[tableId];
+                if (!huffmanTable.Define(data + table + 1, data + table + 17)) {
+                    return false;
+                }
+                table += 17 + numSymbols;
+            }
+        } else if (marker == JPEG_DRI) {
+            if (segmentLength < 4 || ReadBigEndian16(data + segment + 2) != 0) {
+                return false;
+            }
+        } else if (marker == JPEG_SOS) {
+            layout.numComponents = segmentLength >= 3 ? data[segment + 2] : 0;
+            if (numFrameComponents == 0 || layout.numComponents != numFrameComponents || segmentLength < 6 + 2 * uint64_t(layout.numComponents)) {
+                return false;
+            }
+
+            // Spectral selection and successive approximation have to cover the whole of every block in one go.
+            const uint64_t spectral = segment + 3 + 2 * uint64_t(layout.numComponents);
+            if (data[spectral] != 0 || data[spectral + 1] != 63 || data[spectral + 2] != 0) {
+                return false;
+            }
+
+            int maxHorizontalSampling = 1;
+            int maxVerticalSampling = 1;
+            int minVerticalSampling = 4;
+            for (int component = 0; component < layout.numComponents; component++) {
+                const uint8_t id = data[segment + 3 + component * 2];
+                const uint8_t tables = data[segment + 3 + component * 2 + 1];
+                const int frameComponent = static_cast<int>(std::find(frameIds, frameIds + numFrameComponents, id) - frameIds);
+                if (frameComponent == numFrameComponents || (tables >> 4) > 3 || (tables & 15) > 3 || !layout.dcTables[tables >> 4].bDefined || !layout.acTables[tables & 15].bDefined) {
+                    return false;
+                }
+                const int horizontalSampling = frameSampling[frameComponent] >> 4;
+                const int verticalSampling = frameSampling[frameComponent] & 15;
+                maxHorizontalSampling = std::max(maxHorizontalSampling, horizontalSampling);
+                maxVerticalSampling = std::max(maxVerticalSampling, verticalSampling);
+                minVerticalSampling = std::min(minVerticalSampling, verticalSampling);
+
+                FJpegScanLayout::FComponent& scanComponent = layout.components[component];
+                scanComponent.blocksPerMcu = layout.numComponents == 1 ? 1 : horizontalSampling * verticalSampling;
+                scanComponent.dcTable = tables >> 4;
+                scanComponent.acTable = tables & 15;
+            }
+            layout.bVerticalUpsampling = layout.numComponents > 1 && minVerticalSampling < maxVerticalSampling;
+
+            // A single-component scan codes one block per MCU whatever its sampling factors say.
+            layout.mcuWidth = layout.numComponents == 1 ? 8 : 8 * maxHorizontalSampling;
+            layout.mcuHeight = layout.numComponents == 1 ? 8 : 8 * maxVerticalSampling;
+            layout.mcusPerRow = (layout.width + layout.mcuWidth - 1) / layout.mcuWidth;
+            layout.mcuRows = (layout.height + layout.mcuHeight - 1) / layout.mcuHeight;
+            layout.scanDataOffset = segmentEnd;
+        }
+        offset = segmentEnd;
+    }
+    return true;
+}
+
+/** Reads entropy-coded data bit by bit, dropping stuffed bytes and returning zeros once it reaches a marker */
+class FJpegBitReader {
+public:
+    FJpegBitReader(const uint8_t* inData, uint64_t inSize, uint64_t offset) : data(inData), size(inSize), position(offset) {}
+
+    /** Gets the next Huffman coded symbol, -1 if the bits are no code of the table */
+    int Decode(const FJpegHuffmanTable& table) {
+        Fill();
+        const int lookahead = static_cast<int>(buffer >> 56);
+        if (table.lookupLength[lookahead]) {
+            Consume(table.lookupLength[lookahead]);
+            return table.lookupSymbol[lookahead];
+        }
+        for (int length = 9; length <= 16; length++) {
+            const int32_t code = static_cast<int32_t>(buffer >> (64 - length));
+            if (code <= table.maxCode[length]) {
+                Consume(length);
+                return table.symbols[(table.valueOffset[length] + code) & 255];
+            }
+        }
+        return -1;
+    }
+
+    int GetBits(int numBits) {
+        Fill();
+        const int bits = static_cast<int>(buffer >> (64 - numBits));
+        Consume(numBits);
+        return bits;
+    }
+
+    /** Gets the file offset of the byte holding the next bit and the bit's position in it, counted from the top */
+    void Tell(uint64_t& outOffset, int& outBit) const {
+        outOffset = numBits ? byteOffsets[(numBytes - (numBits + 7) / 8) & 7] : position;
+        outBit = (8 - numBits % 8) % 8;
+    }
+
+    /** Whether bits made up after the end of the data have been read */
+    bool HasReadPastEnd() const { return numBits < 8 * numPaddingBytes; }
+
+private:
+    void Fill() {
+        while (numBits <= 56) {
+            uint8_t byte = 0;
+            const uint64_t byteOffset = position;
+            if (position + 1 < size && (data[position] != 0xFF || data[position + 1] == 0x00)) {
+                byte = data[position];
+                position += byte == 0xFF ? 2 : 1;
+            } else {
+                numPaddingBytes++;
+            }
+            byteOffsets[numBytes++ & 7] = byteOffset;
+            buffer |= uint64_t(byte) << (56 - numBits);
+            numBits += 8;
+        }
+    }
+
+    void Consume(int numConsumed) {
+        buffer <<= numConsumed;
+        numBits -= numConsumed;
+    }
+
+    const uint8_t* data;
+    uint64_t size;
+    uint64_t position;
+
+    /** Bits not read yet, from the top */
+    uint64_t buffer = 0;
+    int numBits = 0;
+
+    /** File offsets of the last 8 bytes put into the buffer, numBytes counts all of them */
+    uint64_t byteOffsets[8] = {};
+    uint64_t numBytes = 0;
+
+    /** Bytes past the end of the data at the end of the buffer */
+    int numPaddingBytes = 0;
+};
+
+/** Writes entropy-coded data, stuffing a zero byte after each 0xFF */
+class FJpegBitWriter {
+public:
+    explicit FJpegBitWriter(std::vector<uint8_t>& inOut) : out(inOut) {}
+
+    void Put(uint32_t bits, int numBits) {
+        buffer = (buffer << numBits) | (bits & ((1u << numBits) - 1));
+        count += numBits;
+        while (count >= 8) {
+            count -= 8;
+            const uint8_t byte = static_cast<uint8_t>(buffer >> count);
+            out.push_back(byte);
+            if (byte == 0xFF) {
+                out.push_back(0);
+            }
+        }
+    }
+
+    /** Pads the last byte with 1 bits like encoders do */
+    void Flush() {
+        if (count > 0) {
+            Put(0xFF, 8 - count);
+        }
+    }
+
+private:
+    std::vector<uint8_t>& out;
+    uint32_t buffer = 0;
+    int count = 0;
+};
+
+/** Reads the coefficients of a block without storing them, keeping track of the DC predictor like libjpeg does */
+static bool SkipBlock(FJpegBitReader& reader, const FJpegHuffmanTable& dcTable, const FJpegHuffmanTable& acTable, int32_t& dcPredictor) {
+    const int dcCategory = reader.Decode(dcTable);
+    if (dcCategory < 0 || dcCategory > 11) {
+        return false;
+    }
+    if (dcCategory) {
+        const int bits = reader.GetBits(dcCategory);
+        dcPredictor += bits < (1 << (dcCategory - 1)) ? bits - (1 << dcCategory) + 1 : bits;
+    }
+
+    for (int k = 1; k < 64; k++) {
+        const int runSize = reader.Decode(acTable);
+        if (runSize < 0) {
+            return false;
+        }
+        const int run = runSize >> 4;
+        const int acCategory = runSize & 15;
+        if (acCategory) {
+            k += run;
+            reader.GetBits(acCategory);
+        } else if (run == 15) {
+            k += 15;
+        } else {
+            break;  // End of block
+        }
+    }
+    return true;
+}
+
+static uint64_t HashHeaders(const uint8_t* data, uint64_t size) {
+    uint64_t hash = 14695981039346656037ull;  // FNV-1a
+    for (uint64_t i = 0; i < size; i++) {
+        hash = (hash ^ data[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+bool FJpegMcuIndex::Build(const uint8_t* data, uint64_t size) {
+    *this = FJpegMcuIndex();
+    FJpegScanLayout layout;
+    if (!ParseScanLayout(data, size, layout)) {
+        return false;
+    }
+
+    FJpegBitReader reader(data, size, layout.scanDataOffset);
+    int32_t dcPredictors[4] = {};
+    rowStarts.resize(uint64_t(layout.mcuRows) + 1);
+    for (int row = 0; row <= layout.mcuRows; row++) {
+        FRowStart& rowStart = rowStarts[row];
+        reader.Tell(rowStart.offset, rowStart.bit);
+        std::copy(dcPredictors, dcPredictors + 4, rowStart.dcPredictors);
+        if (row == layout.mcuRows) {
+            break;
+        }
+
+        for (int mcu = 0; mcu < layout.mcusPerRow; mcu++) {
+            for (int component = 0; component < layout.numComponents; component++) {
+                const FJpegScanLayout::FComponent& scanComponent = layout.components[component];
+                for (int block = 0; block < scanComponent.blocksPerMcu; block++) {
+                    if (!SkipBlock(reader, layout.dcTables[scanComponent.dcTable], layout.acTables[scanComponent.acTable], dcPredictors[component])) {
+                        rowStarts.clear();
+                        return false;
+                    }
+                }
+            }
+        }
+    }
+
+    // Truncated data decodes to zeros, which a band copied from it would not reproduce.
+    if (reader.HasReadPastEnd()) {
+        rowStarts.clear();
+        return false;
+    }
+
+    width = layout.width;
+    height = layout.height;
+    mcuHeight = layout.mcuHeight;
+    mcuRows = layout.mcuRows;
+    numComponents = layout.numComponents;
+    bVerticalUpsampling = layout.bVerticalUpsampling;
+    fileSize = size;
+    headerHash = HashHeaders(data, layout.scanDataOffset);
+    return true;
+}
+
+static const uint8_t MCU_INDEX_MAGIC[4] = {'J', 'M', 'C', 'U'};
+static const uint32_t MCU_INDEX_VERSION = 1;
+
+static void WriteLittleEndian(std::vector<uint8_t>& out, uint64_t value, int numBytes) {
+    for (int i = 0; i < numBytes; i++) {
+        out.push_back(static_cast<uint8_t>(value >> (8 * i)));
+    }
+}
+
+static uint64_t ReadLittleEndian(const uint8_t* data, int numBytes) {
+    uint64_t value = 0;
+    for (int i = 0; i < numBytes; i++) {
+        value |= uint64_t(data[i]) << (8 * i);
+    }
+    return value;
+}
+
+static const uint64_t MCU_INDEX_HEADER_SIZE = 32;
+
+static uint64_t GetRowStartSize(int numComponents) { return 9 + 4 * uint64_t(numComponents); }
+
+void FJpegMcuIndex::Serialize(std::vector<uint8_t>& outIndex) const {
+    // Magic, version, file size, header hash, number of row starts and of components, then the row starts.
+    outIndex.clear();
+    outIndex.reserve(MCU_INDEX_HEADER_SIZE + rowStarts.size() * GetRowStartSize(numComponents));
+    outIndex.insert(outIndex.end(), MCU_INDEX_MAGIC, MCU_INDEX_MAGIC + 4);
+    WriteLittleEndian(outIndex, MCU_INDEX_VERSION, 4);
+    WriteLittleEndian(outIndex, fileSize, 8);
+    WriteLittleEndian(outIndex, headerHash, 8);
+    WriteLittleEndian(outIndex, rowStarts.size(), 4);
+    WriteLittleEndian(outIndex, numComponents, 4);
+    for (const FRowStart& rowStart : rowStarts) {
+        WriteLittleEndian(outIndex, rowStart.offset, 8);
+        WriteLittleEndian(outIndex, rowStart.bit, 1);
+        for (int component = 0; component < numComponents; component++) {
+            WriteLittleEndian(outIndex, static_cast<uint32_t>(rowStart.dcPredictors[component]), 4);
+        }
+    }
+}
+
+uint64_t FJpegMcuIndex::GetSerializedSize(const uint8_t* data, uint64_t size) {
+    FJpegScanLayout layout;
+    if (!ParseScanLayout(data, size, layout)) {
+        return 0;
+    }
+    return MCU_INDEX_HEADER_SIZE + (uint64_t(layout.mcuRows) + 1) * GetRowStartSize(layout.numComponents);
+}
+
+bool FJpegMcuIndex::Deserialize(const uint8_t* index, uint64_t indexSize, const uint8_t* data, uint64_t size) {
+    *this = FJpegMcuIndex();
+    FJpegScanLayout layout;
+    if (!index || indexSize < MCU_INDEX_HEADER_SIZE || memcmp(index, MCU_INDEX_MAGIC, 4) != 0 || ReadLittleEndian(index + 4, 4) != MCU_INDEX_VERSION || !ParseScanLayout(data, size, layout)) {
+        return false;
+    }
+
+    const uint64_t numRowStarts = ReadLittleEndian(index + 24, 4);
+    const int indexComponents = static_cast<int>(ReadLittleEndian(index + 28, 4));
+    const uint64_t rowStartSize = GetRowStartSize(layout.numComponents);
+    if (ReadLittleEndian(index + 8, 8) != size || ReadLittleEndian(index + 16, 8) != HashHeaders(data, layout.scanDataOffset) || numRowStarts != uint64_t(layout.mcuRows) + 1 || indexComponents != layout.numComponents || indexSize < MCU_INDEX_HEADER_SIZE + numRowStarts * rowStartSize) {
+        return false;
+    }
+
+    rowStarts.resize(numRowStarts);
+    const uint8_t* entry = index + MCU_INDEX_HEADER_SIZE;
+    for (uint64_t row = 0; row < numRowStarts; row++, entry += rowStartSize) {
+        FRowStart& rowStart = rowStarts[row];
+        rowStart.offset = ReadLittleEndian(entry, 8);
+        rowStart.bit = entry[8];
+        for (int component = 0; component < layout.numComponents; component++) {
+            rowStart.dcPredictors[component] = static_cast<int32_t>(static_cast<uint32_t>(ReadLittleEndian(entry + 9 + 4 * component, 4)));
+        }
+
+        // Rows start in order within the scan's data, BuildBand copies between them.
+        const bool bOrdered = row == 0 || rowStart.offset > rowStarts[row - 1].offset || (rowStart.offset == rowStarts[row - 1].offset && rowStart.bit >= rowStarts[row - 1].bit);
+        if (rowStart.offset < layout.scanDataOffset || rowStart.offset >= size || rowStart.bit > 7 || !bOrdered) {
+            rowStarts.clear();
+            return false;
+        }
+    }
+
+    width = layout.width;
+    height = layout.height;
+    mcuHeight = layout.mcuHeight;
+    mcuRows = layout.mcuRows;
+    numComponents = layout.numComponents;
+    bVerticalUpsampling = layout.bVerticalUpsampling;
+    fileSize = size;
+    headerHash = ReadLittleEndian(index + 16, 8);
+    return true;
+}
+
+/**
+ * Picks the next DC difference of a priming row that walks the predictor towards remaining: the largest one the table
+ * has a code for without overshooting. 0 once remaining is reached, or if the table allows no step towards it.
+ */
+static int32_t GetPrimingStep(const FJpegHuffmanTable& dcTable, int32_t remaining) {
+    const int32_t magnitude = std::abs(remaining);
+    for (int category = 11; category > 0; category--) {
+        if (dcTable.codeLengths[category] && (1 << (category - 1)) <= magnitude) {
+            const int32_t step = std::min(magnitude, (1 << category) - 1);
+            return remaining < 0 ? -step : step;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Writes an MCU row whose blocks only have DC differences, which walk the predictor of each component from 0 to the
+ * value it has at the start of the band, and no AC coefficients.
+ */
+static bool WritePrimingRow(const FJpegScanLayout& layout, const int32_t* dcPredictors, FJpegBitWriter& writer) {
+    int32_t remaining[4] = {};
+    std::copy(dcPredictors, dcPredictors + layout.numComponents, remaining);
+
+    for (int mcu = 0; mcu < layout.mcusPerRow; mcu++) {
+        for (int component = 0; component < layout.numComponents; component++) {
+            const FJpegScanLayout::FComponent& scanComponent = layout.components[component];
+            const FJpegHuffmanTable& dcTable = layout.dcTables[scanComponent.dcTable];
+            const FJpegHuffmanTable& acTable = layout.acTables[scanComponent.acTable];
+            for (int block = 0; block < scanComponent.blocksPerMcu; block++) {
+                const int32_t step = GetPrimingStep(dcTable, remaining[component]);
+                const int32_t magnitude = std::abs(step);
+                int category = 0;
+                while ((1 << category) <= magnitude) {
+                    category++;
+                }
+                if (!dcTable.codeLengths[category] || !acTable.codeLengths[0]) {
+                    return false;
+                }
+                writer.Put(dcTable.codes[category], dcTable.codeLengths[category]);
+                if (category) {
+                    writer.Put(static_cast<uint32_t>(step < 0 ? step - 1 : step), category);
+                }
+                writer.Put(acTable.codes[0], acTable.codeLengths[0]);  // End of block
+                remaining[component] -= step;
+            }
+        }
+    }
+    return std::all_of(remaining, remaining + layout.numComponents, [](int32_t value) { return value == 0; });
+}
+
+bool FJpegMcuIndex::BuildBand(const uint8_t* data, int firstRow, int endRow, std::vector<uint8_t>& outJpeg, int& outPrimingRows) const {
+    outPrimingRows = 0;
+    FJpegScanLayout layout;
+    if (firstRow < 0 || endRow <= firstRow || endRow > mcuRows || !ParseScanLayout(data, fileSize, layout)) {
+        return false;
+    }
+
+    const FRowStart& start = rowStarts[firstRow];
+    const FRowStart& end = rowStarts[endRow];
+    const bool bPriming = std::any_of(start.dcPredictors, start.dcPredictors + numComponents, [](int32_t value) { return value != 0; });
+    const int primingRows = bPriming ? mcuHeight : 0;
+    const int bandHeight = primingRows + std::min(endRow * mcuHeight, height) - firstRow * mcuHeight;
+    if (bandHeight > 0xFFFF) {
+        return false;
+    }
+
+    outJpeg.assign(data, data + layout.scanDataOffset);
+    outJpeg.reserve(outJpeg.size() + (end.offset - start.offset) + 1024);
+    FJpegBitWriter writer(outJpeg);
+    if (bPriming && !WritePrimingRow(layout, start.dcPredictors, writer)) {
+        return false;
+    }
+
+    // The band's bits are unstuffed from the file and stuffed again, since they land on other byte boundaries.
+    uint64_t position = start.offset;
+    int bit = start.bit;
+    while (position < end.offset || (position == end.offset && bit < end.bit)) {
+        const int endBit = position == end.offset ? end.bit : 8;
+        const int numBits = endBit - bit;
+        writer.Put(data[position] >> (8 - endBit), numBits);
+        position += data[position] == 0xFF ? 2 : 1;
+        bit = 0;
+    }
+    writer.Flush();
+    outJpeg.push_back(0xFF);
+    outJpeg.push_back(JPEG_EOI);
+
+    outPrimingRows = primingRows;
+    outJpeg[layout.heightOffset] = static_cast<uint8_t>(bandHeight >> 8);
+    outJpeg[layout.heightOffset + 1] = static_cast<uint8_t>(bandHeight & 0xFF);
+    return true;
+}
+}  // namespace ImageDecoder
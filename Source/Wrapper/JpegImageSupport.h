@@ -0,0 +1,138 @@
+﻿#pragma once
+#include <cstdint>
+#include <vector>
+
+namespace ImageDecoder {
+
+/**
+ * Layout of a sequential Huffman-coded JPEG with a single scan, including where each of its restart intervals starts.
+ *
+ * Restart intervals are entropy-coded independently, so a band of MCU rows that starts and ends on interval boundaries
+ * can be cut out and decoded as a JPEG of its own.
+ */
+struct FJpegRestartIndex {
+    /** Size of the image in pixels */
+    int width = 0;
+    int height = 0;
+
+    /** Size of an MCU in pixels and of the MCU grid of the scan */
+    int mcuWidth = 0;
+    int mcuHeight = 0;
+    int mcusPerRow = 0;
+    int mcuRows = 0;
+
+    /** Number of MCUs per restart interval */
+    int restartInterval = 0;
+
+    /** Whether chroma is upsampled vertically, which makes decoding an MCU row read the rows above and below it */
+    bool bVerticalUpsampling = false;
+
+    /** Offset of the height field of the frame header */
+    uint64_t heightOffset = 0;
+
+    /** Offset of the first entropy-coded byte of the scan */
+    uint64_t scanDataOffset = 0;
+
+    /**
+     * Offset of the first byte of each restart interval, followed by the offset just past the marker that ends the scan.
+     * Interval i ends two bytes before segmentOffsets[i + 1], where its RST marker (or the end of the scan) is.
+     */
+    std::vector<uint64_t> segmentOffsets;
+
+    /**
+     * Reads the headers and finds the restart markers in the entropy-coded data.
+     *
+     * @return false if the data is not a complete single-scan sequential Huffman JPEG with restart intervals.
+     */
+    bool Parse(const uint8_t* data, uint64_t size);
+
+    /** Gets the number of restart intervals of the scan */
+    int GetNumSegments() const { return static_cast<int>(segmentOffsets.size()) - 1; }
+
+    /** Gets the restart interval the MCU row starts with, GetNumSegments() for the row past the end, or -1 if the row starts inside an interval */
+    int GetRowSegment(int row) const;
+
+    /**
+     * Builds a standalone JPEG of the MCU rows [firstRow, endRow), which must both start restart intervals.
+     * The restart markers are renumbered so they count up from RST0 like the decoder expects.
+     */
+    void BuildBand(const uint8_t* data, int firstRow, int endRow, std::vector<uint8_t>& outJpeg) const;
+};
+
+/**
+ * Finds the end of the entropy-coded data of the last scan that is complete within the first size bytes, for decoding a
+ * JPEG with several scans only up to that point.
+ *
+ * @param scanDataOffset Offset of the first entropy-coded byte of the first scan, where reading the header stops.
+ * @param maxScans Number of scans to stop after, 0 for all of them.
+ * @param outNumScans Will contain the number of complete scans up to the returned offset.
+ * @return The offset just past the data of the last complete scan, 0 if not even the first scan is complete.
+ */
+uint64_t FindJpegScansEnd(const uint8_t* data, uint64_t size, uint64_t scanDataOffset, int maxScans, int& outNumScans);
+
+/**
+ * Where each MCU row of a sequential Huffman-coded JPEG with a single scan starts in the entropy-coded data, together
+ * with the DC predictors at that point.
+ *
+ * Building the index entropy decodes the whole scan once. Afterwards a band of MCU rows can be decoded on its own:
+ * BuildBand copies the band's bits into a JPEG of their own, behind a synthetic MCU row that sets up the predictors.
+ */
+struct FJpegMcuIndex {
+    /** Position of the first bit of an MCU row and the DC predictor of each component, in scan order, before it */
+    struct FRowStart {
+        uint64_t offset = 0;
+        int bit = 0;
+        int32_t dcPredictors[4] = {};
+    };
+
+    /** Size of the image in pixels */
+    int width = 0;
+    int height = 0;
+
+    /** Height of an MCU row in pixels and the number of them */
+    int mcuHeight = 0;
+    int mcuRows = 0;
+
+    int numComponents = 0;
+
+    /** Whether chroma is upsampled vertically, which makes decoding an MCU row read the rows above and below it */
+    bool bVerticalUpsampling = false;
+
+    /** Size of the file and hash of its headers, to recognize an index of a different file */
+    uint64_t fileSize = 0;
+    uint64_t headerHash = 0;
+
+    /** Start of each MCU row, followed by the end of the scan's entropy-coded data */
+    std::vector<FRowStart> rowStarts;
+
+    /**
+     * Entropy decodes the scan and records where its MCU rows start.
+     *
+     * @return false if the data is not a complete single-scan sequential Huffman JPEG without restart intervals. Those
+     * with restart intervals are split at them by FJpegRestartIndex instead.
+     */
+    bool Build(const uint8_t* data, uint64_t size);
+
+    /** Writes the index in a portable form that can be stored next to the file */
+    void Serialize(std::vector<uint8_t>& outIndex) const;
+
+    /** Gets the size Serialize writes for the file from its headers alone, 0 if no index can be built for it */
+    static uint64_t GetSerializedSize(const uint8_t* data, uint64_t size);
+
+    /**
+     * Reads an index Serialize wrote.
+     *
+     * @return false if the index is malformed or was built from another file.
+     */
+    bool Deserialize(const uint8_t* index, uint64_t indexSize, const uint8_t* data, uint64_t size);
+
+    /**
+     * Builds a standalone JPEG of the MCU rows [firstRow, endRow).
+     *
+     * @param outPrimingRows Will contain the number of pixel rows above the band's first MCU row, which only set up the
+     * DC predictors and have to be thrown away.
+     * @return false if the DC or AC tables lack the codes the priming row needs. The rows then have to be decoded from the top.
+     */
+    bool BuildBand(const uint8_t* data, int firstRow, int endRow, std::vector<uint8_t>& outJpeg, int& outPrimingRows) const;
+};
+}  // namespace ImageDecoder
@@ -0,0 +1,303 @@
+#include "PngImageSupport.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include "zlib.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define PNG_FILTER_SSE2 1
+#else
+#define PNG_FILTER_SSE2 0
+#endif
+
+namespace ImageDecoder {
+enum EPngFilter : uint8_t { PNG_FILTER_NONE = 0, PNG_FILTER_SUB, PNG_FILTER_UP, PNG_FILTER_AVERAGE, PNG_FILTER_PAETH };
+
+static uint8_t PaethPredictor(int left, int above, int upperLeft) {
+    const int estimate = left + above - upperLeft;
+    const int distanceLeft = std::abs(estimate - left);
+    const int distanceAbove = std::abs(estimate - above);
+    const int distanceUpperLeft = std::abs(estimate - upperLeft);
+    if (distanceLeft <= distanceAbove && distanceLeft <= distanceUpperLeft) {
+        return static_cast<uint8_t>(left);
+    }
+    return static_cast<uint8_t>(distanceAbove <= distanceUpperLeft ? above : upperLeft);
+}
+
+/** Absolute value of a filtered byte taken as signed, the cost of a filter is the sum over the row */
+static int GetFilterCost(uint8_t filtered) { return filtered < 128 ? filtered : 256 - filtered; }
+
+/** Filters the bytes from begin to end one at a time, adding up the cost of no filter and of each candidate */
+static void FilterPngBytes(const uint8_t* row, const uint8_t* prevRow, uint64_t begin, uint64_t end, int bytesPerPixel, uint8_t* const candidates[4], uint64_t costs[5]) {
+    for (uint64_t i = begin; i < end; i++) {
+        const int left = i >= uint64_t(bytesPerPixel) ? row[i - bytesPerPixel] : 0;
+        const int above = prevRow[i];
+        const int upperLeft = i >= uint64_t(bytesPerPixel) ? prevRow[i - bytesPerPixel] : 0;
+        candidates[0][i] = static_cast<uint8_t>(row[i] - left);
+        candidates[1][i] = static_cast<uint8_t>(row[i] - above);
+        candidates[2][i] = static_cast<uint8_t>(row[i] - ((left + above) >> 1));
+        candidates[3][i] = static_cast<uint8_t>(row[i] - PaethPredictor(left, above, upperLeft));
+        costs[0] += GetFilterCost(row[i]);
+        for (int filter = 0; filter < 4; filter++) {
+            costs[filter + 1] += GetFilterCost(candidates[filter][i]);
+        }
+    }
+}
+
+#if PNG_FILTER_SSE2
+/** Sums the absolute values of 16 filtered bytes taken as signed into the two halves of the cost */
+static __m128i AddFilterCost(__m128i cost, __m128i filtered) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i absolute = _mm_min_epu8(filtered, _mm_sub_epi8(zero, filtered));
+    return _mm_add_epi64(cost, _mm_sad_epu8(absolute, zero));
+}
+
+/** Paeth predictor of eight pixels' bytes widened to 16 bits */
+static __m128i PaethPredictor16(__m128i left, __m128i above, __m128i upperLeft) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i towardsLeft = _mm_sub_epi16(above, upperLeft);
+    const __m128i towardsAbove = _mm_sub_epi16(left, upperLeft);
+    const __m128i towardsBoth = _mm_add_epi16(towardsLeft, towardsAbove);
+    const __m128i distanceLeft = _mm_max_epi16(towardsLeft, _mm_sub_epi16(zero, towardsLeft));
+    const __m128i distanceAbove = _mm_max_epi16(towardsAbove, _mm_sub_epi16(zero, towardsAbove));
+    const __m128i distanceUpperLeft = _mm_max_epi16(towardsBoth, _mm_sub_epi16(zero, towardsBoth));
+
+    // Same ties as the scalar predictor: left before above before upper left.
+    const __m128i useLeft = _mm_andnot_si128(_mm_or_si128(_mm_cmpgt_epi16(distanceLeft, distanceAbove), _mm_cmpgt_epi16(distanceLeft, distanceUpperLeft)), _mm_set1_epi16(-1));
+    const __m128i useAbove = _mm_andnot_si128(_mm_cmpgt_epi16(distanceAbove, distanceUpperLeft), _mm_set1_epi16(-1));
+    const __m128i aboveOrUpperLeft = _mm_or_si128(_mm_and_si128(useAbove, above), _mm_andnot_si128(useAbove, upperLeft));
+    return _mm_or_si128(_mm_and_si128(useLeft, left), _mm_andnot_si128(useLeft, aboveOrUpperLeft));
+}
+#endif
+
+uint64_t FilterPngRow(const uint8_t* row, const uint8_t* prevRow, uint64_t rowBytes, int bytesPerPixel, uint8_t* outFiltered, uint8_t* scratch) {
+    uint8_t* candidates[4];
+    for (int filter = 0; filter < 4; filter++) {
+        scratch[filter * (rowBytes + 1)] = static_cast<uint8_t>(PNG_FILTER_SUB + filter);
+        candidates[filter] = scratch + filter * (rowBytes + 1) + 1;
+    }
+
+    // The first pixel has nothing to its left, the rest of the row can be filtered 16 bytes at a time.
+    uint64_t costs[5] = {};
+    uint64_t i = std::min<uint64_t>(bytesPerPixel, rowBytes);
+    FilterPngBytes(row, prevRow, 0, i, bytesPerPixel, candidates, costs);
+#if PNG_FILTER_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    __m128i vectorCosts[5] = {zero, zero, zero, zero, zero};
+    for (; i + 16 <= rowBytes; i += 16) {
+        const __m128i current = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i));
+        const __m128i left = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i - bytesPerPixel));
+        const __m128i above = _mm_loadu_si128(reinterpret_cast<const __m128i*>(prevRow + i));
+        const __m128i upperLeft = _mm_loadu_si128(reinterpret_cast<const __m128i*>(prevRow + i - bytesPerPixel));
+
+        // The rounding average minus the bit it rounded up is the floor of the average.
+        const __m128i average = _mm_sub_epi8(_mm_avg_epu8(left, above), _mm_and_si128(_mm_xor_si128(left, above), _mm_set1_epi8(1)));
+        const __m128i paethLow = PaethPredictor16(_mm_unpacklo_epi8(left, zero), _mm_unpacklo_epi8(above, zero), _mm_unpacklo_epi8(upperLeft, zero));
+        const __m128i paethHigh = PaethPredictor16(_mm_unpackhi_epi8(left, zero), _mm_unpackhi_epi8(above, zero), _mm_unpackhi_epi8(upperLeft, zero));
+        const __m128i filtered[4] = {
+            _mm_sub_epi8(current, left),
+            _mm_sub_epi8(current, above),
+            _mm_sub_epi8(current, average),
+            _mm_sub_epi8(current, _mm_packus_epi16(paethLow, paethHigh)),
+        };
+
+        vectorCosts[0] = AddFilterCost(vectorCosts[0], current);
+        for (int filter = 0; filter < 4; filter++) {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(candidates[filter] + i), filtered[filter]);
+            vectorCosts[filter + 1] = AddFilterCost(vectorCosts[filter + 1], filtered[filter]);
+        }
+    }
+    for (int filter = 0; filter < 5; filter++) {
+        uint64_t halves[2];
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(halves), vectorCosts[filter]);
+        costs[filter] += halves[0] + halves[1];
+    }
+#endif
+    FilterPngBytes(row, prevRow, i, rowBytes, bytesPerPixel, candidates, costs);
+
+    // Ties keep the earlier filter, like libpng.
+    const uint8_t* best = row;
+    uint8_t bestFilter = PNG_FILTER_NONE;
+    uint64_t bestCost = costs[0];
+    for (int filter = 0; filter < 4; filter++) {
+        if (costs[filter + 1] < bestCost) {
+            best = candidates[filter];
+            bestFilter = static_cast<uint8_t>(PNG_FILTER_SUB + filter);
+            bestCost = costs[filter + 1];
+        }
+    }
+    outFiltered[0] = bestFilter;
+    memcpy(outFiltered + 1, best, rowBytes);
+    return bestCost;
+}
+
+#if PNG_FILTER_SSE2
+/** Loads a pixel into the low bytes of a register, through general purpose registers for the odd sizes */
+template <int BytesPerPixel>
+static __m128i LoadPixel(const uint8_t* pixel) {
+    if (BytesPerPixel == 8) {
+        return _mm_loadl_epi64(reinterpret_cast<const __m128i*>(pixel));
+    }
+    if (BytesPerPixel == 3) {
+        // Assembled from two loads, copying three bytes into an int goes through the stack.
+        uint16_t low;
+        memcpy(&low, pixel, 2);
+        return _mm_cvtsi32_si128(low | (pixel[2] << 16));
+    }
+    int32_t low;
+    memcpy(&low, pixel, 4);
+    if (BytesPerPixel == 4) {
+        return _mm_cvtsi32_si128(low);
+    }
+    uint16_t high;
+    memcpy(&high, pixel + 4, 2);
+    return _mm_unpacklo_epi32(_mm_cvtsi32_si128(low), _mm_cvtsi32_si128(high));
+}
+
+template <int BytesPerPixel>
+static void StorePixel(uint8_t* pixel, __m128i value) {
+    if (BytesPerPixel == 8) {
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(pixel), value);
+        return;
+    }
+    const int32_t low = _mm_cvtsi128_si32(value);
+    if (BytesPerPixel == 3) {
+        const uint16_t lowBytes = static_cast<uint16_t>(low);
+        memcpy(pixel, &lowBytes, 2);
+        pixel[2] = static_cast<uint8_t>(low >> 16);
+        return;
+    }
+    memcpy(pixel, &low, 4);
+    if (BytesPerPixel == 6) {
+        const int32_t high = _mm_cvtsi128_si32(_mm_srli_si128(value, 4));
+        memcpy(pixel + 4, &high, 2);
+    }
+}
+
+/**
+ * Reverses Sub, Average or Paeth a pixel at a time, each depending on the one to its left. The pixel to the left stays
+ * in a register, a constant pixel size lets the loads and stores compile to a move or two.
+ */
+template <int BytesPerPixel>
+static void UnfilterPngPixels(uint8_t* row, const uint8_t* prevRow, uint64_t rowBytes, uint8_t filter) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i left = zero;
+    __m128i upperLeft = zero;
+    for (uint64_t i = 0; i < rowBytes; i += BytesPerPixel) {
+        const __m128i current = LoadPixel<BytesPerPixel>(row + i);
+        const __m128i above = LoadPixel<BytesPerPixel>(prevRow + i);
+        if (filter == PNG_FILTER_SUB) {
+            left = _mm_add_epi8(current, left);
+        } else if (filter == PNG_FILTER_AVERAGE) {
+            left = _mm_add_epi8(current, _mm_sub_epi8(_mm_avg_epu8(left, above), _mm_and_si128(_mm_xor_si128(left, above), _mm_set1_epi8(1))));
+        } else {
+            const __m128i predictor = PaethPredictor16(_mm_unpacklo_epi8(left, zero), _mm_unpacklo_epi8(above, zero), _mm_unpacklo_epi8(upperLeft, zero));
+            left = _mm_add_epi8(current, _mm_packus_epi16(predictor, zero));
+            upperLeft = above;
+        }
+        StorePixel<BytesPerPixel>(row + i, left);
+    }
+}
+#endif
+
+bool UnfilterPngRow(uint8_t* row, const uint8_t* prevRow, uint64_t rowBytes, int bytesPerPixel, uint8_t filter) {
+#if PNG_FILTER_SSE2
+    // Pixels of 3 bytes and up fill enough of a register to be worth it, smaller ones are gray and rarely filtered serially.
+    if ((filter == PNG_FILTER_SUB || filter == PNG_FILTER_AVERAGE || filter == PNG_FILTER_PAETH) && rowBytes % bytesPerPixel == 0) {
+        switch (bytesPerPixel) {
+            case 3: UnfilterPngPixels<3>(row, prevRow, rowBytes, filter); return true;
+            case 4: UnfilterPngPixels<4>(row, prevRow, rowBytes, filter); return true;
+            case 6: UnfilterPngPixels<6>(row, prevRow, rowBytes, filter); return true;
+            case 8: UnfilterPngPixels<8>(row, prevRow, rowBytes, filter); return true;
+            default: break;
+        }
+    }
+#endif
+
+    // The first pixel has nothing to its left, which Average and Paeth treat as zeros.
+    const uint64_t firstPixelBytes = std::min<uint64_t>(bytesPerPixel, rowBytes);
+    switch (filter) {
+        case PNG_FILTER_NONE: break;
+        case PNG_FILTER_SUB:
+            for (uint64_t i = firstPixelBytes; i < rowBytes; i++) {
+                row[i] = static_cast<uint8_t>(row[i] + row[i - bytesPerPixel]);
+            }
+            break;
+        case PNG_FILTER_UP:
+            for (uint64_t i = 0; i < rowBytes; i++) {
+                row[i] = static_cast<uint8_t>(row[i] + prevRow[i]);
+            }
+            break;
+        case PNG_FILTER_AVERAGE:
+            for (uint64_t i = 0; i < firstPixelBytes; i++) {
+                row[i] = static_cast<uint8_t>(row[i] + (prevRow[i] >> 1));
+            }
+            for (uint64_t i = firstPixelBytes; i < rowBytes; i++) {
+                row[i] = static_cast<uint8_t>(row[i] + ((row[i - bytesPerPixel] + prevRow[i]) >> 1));
+            }
+            break;
+        case PNG_FILTER_PAETH:
+            for (uint64_t i = 0; i < firstPixelBytes; i++) {
+                row[i] = static_cast<uint8_t>(row[i] + prevRow[i]);
+            }
+            for (uint64_t i = firstPixelBytes; i < rowBytes; i++) {
+                row[i] = static_cast<uint8_t>(row[i] + PaethPredictor(row[i - bytesPerPixel], prevRow[i], prevRow[i - bytesPerPixel]));
+            }
+            break;
+        default: return false;
+    }
+    return true;
+}
+
+FPngDeflateSettings GetPngDeflateSettings(EPngProfile profile) {
+    // Measured on photos, screenshots and gradients: run-length matches deflate noisy rows nearly twice as fast as the
+    // fastest level while losing little, Huffman-only came out the same size and no faster. Z_FILTERED only won on some
+    // noisy rows and lost on photos, so only the smallest profile tries it.
+    switch (profile) {
+        case EPngProfile::Balanced: return {Z_DEFAULT_COMPRESSION, Z_DEFAULT_STRATEGY, Z_DEFAULT_STRATEGY, false};
+        case EPngProfile::Smallest: return {Z_BEST_COMPRESSION, Z_DEFAULT_STRATEGY, Z_FILTERED, true};
+        default: return {Z_BEST_SPEED, Z_DEFAULT_STRATEGY, Z_RLE, false};
+    }
+}
+
+uint64_t GetMaxDeflateSize(uint64_t size) {
+    // The sync flush adds an empty stored block after up to 7 bits of padding.
+    return size + ((size + 7) >> 3) + ((size + 63) >> 6) + 5 + 6;
+}
+
+uint16_t GetZlibHeader(int level) {
+    // Compression method 8 with a 32KB window, the level only goes into the header as a hint.
+    const int levelFlags = level == Z_DEFAULT_COMPRESSION ? 2 : level < 2 ? 0 : level < 6 ? 1 : level == 6 ? 2 : 3;
+    uint16_t header = static_cast<uint16_t>((0x78 << 8) | (levelFlags << 6));
+    header += 31 - header % 31;
+    return header;
+}
+
+static void WriteBigEndian32(uint8_t* dest, uint32_t value) {
+    dest[0] = static_cast<uint8_t>(value >> 24);
+    dest[1] = static_cast<uint8_t>(value >> 16);
+    dest[2] = static_cast<uint8_t>(value >> 8);
+    dest[3] = static_cast<uint8_t>(value);
+}
+
+uint64_t WritePngChunk(uint8_t* dest, const char type[4], const uint8_t* data0, uint64_t size0, const uint8_t* data1, uint64_t size1, const uint8_t* data2, uint64_t size2) {
+    const uint64_t size = size0 + size1 + size2;
+    WriteBigEndian32(dest, static_cast<uint32_t>(size));
+    memcpy(dest + 4, type, 4);
+
+    uint8_t* data = dest + 8;
+    const uint8_t* parts[3] = {data0, data1, data2};
+    const uint64_t partSizes[3] = {size0, size1, size2};
+    for (int part = 0; part < 3; part++) {
+        if (partSizes[part]) {
+            memcpy(data, parts[part], partSizes[part]);
+            data += partSizes[part];
+        }
+    }
+
+    // The CRC covers the type and the data. zlib takes its lengths as uInt, chunks stay far below that.
+    WriteBigEndian32(data, static_cast<uint32_t>(crc32(0, dest + 4, static_cast<uInt>(4 + size))));
+    return 12 + size;
+}
+}  // namespace ImageDecoder
@@ -0,0 +1,71 @@
+#pragma once
+#include <cstdint>
+#include "Decoder.h"
+
+namespace ImageDecoder {
+
+/** Size of the deflate window, and with that of the dictionary a block of a parallel encode is primed with */
+static const uint64_t PNG_DEFLATE_WINDOW_SIZE = 32 * 1024;
+
+/** Mean cost per byte of filtered rows above which they are noise to deflate, with few matches worth searching for */
+static const uint64_t PNG_NOISY_FILTER_COST = 3;
+
+/**
+ * How the rows of an encode profile are deflated.
+ */
+struct FPngDeflateSettings {
+    int level;
+
+    /** Strategy for rows whose filter cost stays below PNG_NOISY_FILTER_COST per byte */
+    int strategy;
+
+    /** Strategy for the noisy rows */
+    int noisyStrategy;
+
+    /** Whether to deflate every block with both strategies and keep the smaller output, regardless of the cost */
+    bool bTryBothStrategies;
+};
+
+/** Gets the zlib settings of an encode profile */
+FPngDeflateSettings GetPngDeflateSettings(EPngProfile profile);
+
+/**
+ * Filters a row for deflate with the filter whose output has the smallest sum of absolute values, taking the bytes as
+ * signed. This is the heuristic libpng uses by default. Works on 16 bytes at a time with SSE2.
+ *
+ * @param row The row in PNG byte order, rowBytes long.
+ * @param prevRow The row above in PNG byte order, all zeros for the first row.
+ * @param bytesPerPixel Distance to the byte of the same channel in the pixel to the left, at least 1.
+ * @param outFiltered Will contain the filter type followed by the filtered row, rowBytes + 1 bytes.
+ * @param scratch Room for four candidate rows of rowBytes + 1 bytes each.
+ * @return The cost of the filtered row, the sum of absolute values it was picked by.
+ */
+uint64_t FilterPngRow(const uint8_t* row, const uint8_t* prevRow, uint64_t rowBytes, int bytesPerPixel, uint8_t* outFiltered, uint8_t* scratch);
+
+/**
+ * Reverses the filter of an inflated row in place.
+ *
+ * @param row The row after its filter type byte, rowBytes long.
+ * @param prevRow The row above, already unfiltered, all zeros for the first row.
+ * @param filter The filter type byte of the row.
+ * @return false if the filter type is not one PNG defines.
+ */
+bool UnfilterPngRow(uint8_t* row, const uint8_t* prevRow, uint64_t rowBytes, int bytesPerPixel, uint8_t filter);
+
+/**
+ * Gets the largest size deflate can produce from size bytes with any level and strategy, including the sync flush that
+ * ends a block of a parallel encode. Same as zlib's conservative deflateBound.
+ */
+uint64_t GetMaxDeflateSize(uint64_t size);
+
+/** Gets the two byte zlib header deflate writes at this level */
+uint16_t GetZlibHeader(int level);
+
+/**
+ * Writes a PNG chunk with its length, type and CRC, the data being the concatenation of up to three parts so headers
+ * and trailers need not be copied next to the data first.
+ *
+ * @return The number of bytes written, 12 more than the data.
+ */
+uint64_t WritePngChunk(uint8_t* dest, const char type[4], const uint8_t* data0, uint64_t size0, const uint8_t* data1 = nullptr, uint64_t size1 = 0, const uint8_t* data2 = nullptr, uint64_t size2 = 0);
+}  // namespace ImageDecoder